@@ -0,0 +1,389 @@
+#pragma once
+
+#include "Vec3.h"
+#include "HDRImage.h"
+#include "Memory.h"
+
+#include <vector>
+#include <string>
+#include <format>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include <SFML/Graphics/Image.hpp>
+
+
+// Shader output modes, must match RaytracerShader.frag
+constexpr int
+    OUTPUT_BEAUTY = 0,
+    OUTPUT_FIRSTHIT = 1,
+    OUTPUT_ALBEDO = 2,
+    OUTPUT_PRIMITIVEID = 3,
+    OUTPUT_MATERIALID = 4,
+    OUTPUT_BOUNCES = 5,
+    OUTPUT_PRIMARYCOST = 6,
+    OUTPUT_PATHCOST = 7;
+
+// Selectable auxiliary outputs
+constexpr int
+    AOV_DEPTH = 1 << 0,
+    AOV_NORMAL = 1 << 1,
+    AOV_ALBEDO = 1 << 2,
+    AOV_PRIMITIVEID = 1 << 3,
+    AOV_MATERIALID = 1 << 4,
+    AOV_BOUNCES = 1 << 5,
+    AOV_PRIMARYCOST = 1 << 6,
+    AOV_PATHCOST = 1 << 7,
+    AOV_COUNT = 8,
+    AOV_ALL = (1 << AOV_COUNT) - 1;
+
+
+// Auxiliary buffers of the first hit along each pixel's primary ray.
+// The encodings must match the ones in RaytracerShader.frag.
+struct AOVBuffers
+{
+    static constexpr double DEPTHMAX = 10000.0;
+
+    unsigned int w, h;
+
+    std::vector<float> depth;  // Distance to the first hit, negative on miss
+    std::vector<float> normal; // xyz
+    std::vector<float> albedo; // rgb
+    std::vector<float> bounces; // Average surfaces hit per path
+    std::vector<float> primaryCost, pathCost; // Node visits and primitive tests, of the primary ray and per path
+    std::vector<uint32_t> primitiveID; // 0 on miss
+    std::vector<uint32_t> materialID;  // 0 on miss
+    MemoryCharge memory{ MEMORY_FRAMEBUFFERS };
+
+
+    AOVBuffers(unsigned int w, unsigned int h) :
+        w(w), h(h),
+        depth(w * h, -1.0f),
+        normal(w * h * 3, 0.0f),
+        albedo(w * h * 3, 1.0f),
+        bounces(w * h, 0.0f),
+        primaryCost(w * h * 2, 0.0f),
+        pathCost(w * h * 2, 0.0f),
+        primitiveID(w * h, 0),
+        materialID(w * h, 0)
+    {
+        memory.Set(MemoryCharge::Of(depth) + MemoryCharge::Of(normal) + MemoryCharge::Of(albedo) + MemoryCharge::Of(bounces) +
+            MemoryCharge::Of(primaryCost) + MemoryCharge::Of(pathCost) + MemoryCharge::Of(primitiveID) + MemoryCharge::Of(materialID));
+    }
+
+
+    static const char* Name(int aov)
+    {
+        switch (aov)
+        {
+        case AOV_DEPTH:       return "depth";
+        case AOV_NORMAL:      return "normal";
+        case AOV_ALBEDO:      return "albedo";
+        case AOV_PRIMITIVEID: return "primitive";
+        case AOV_MATERIALID:  return "material";
+        case AOV_BOUNCES:     return "bounces";
+        case AOV_PRIMARYCOST: return "primary cost";
+        case AOV_PATHCOST:    return "path cost";
+        }
+        return "beauty";
+    }
+
+    // Shader pass that produces the output, depth and normal share one
+    static int OutputMode(int aov)
+    {
+        switch (aov)
+        {
+        case AOV_DEPTH:
+        case AOV_NORMAL:      return OUTPUT_FIRSTHIT;
+        case AOV_ALBEDO:      return OUTPUT_ALBEDO;
+        case AOV_PRIMITIVEID: return OUTPUT_PRIMITIVEID;
+        case AOV_MATERIALID:  return OUTPUT_MATERIALID;
+        case AOV_BOUNCES:     return OUTPUT_BOUNCES;
+        case AOV_PRIMARYCOST: return OUTPUT_PRIMARYCOST;
+        case AOV_PATHCOST:    return OUTPUT_PATHCOST;
+        }
+        return OUTPUT_BEAUTY;
+    }
+
+
+    static float DecodeDepth(uint8_t hi, uint8_t lo)
+    {
+        unsigned int v = ((unsigned int)hi << 8) | (unsigned int)lo;
+        if (v == 0)
+            return -1.0f;
+        return (float)(exp2((double)v / 65535.0 * log2(1.0 + DEPTHMAX)) - 1.0);
+    }
+
+    static Vec3 DecodeNormal(uint8_t ex, uint8_t ey)
+    {
+        return Octahedral(((double)ex / 255.0) * 2.0 - 1.0, ((double)ey / 255.0) * 2.0 - 1.0);
+    }
+
+    // Normal from its octahedral coordinates, -1 to 1
+    static Vec3 Octahedral(double x, double y)
+    {
+        Vec3 n(x, y, 1.0 - std::abs(x) - std::abs(y));
+        if (n.z < 0.0)
+        {
+            n.x = (1.0 - std::abs(y)) * (x >= 0.0 ? 1.0 : -1.0);
+            n.y = (1.0 - std::abs(x)) * (y >= 0.0 ? 1.0 : -1.0);
+        }
+        return n.Normalize();
+    }
+
+
+    // Images read back from render textures, rows are stored top to bottom
+    void DecodeFirstHit(const sf::Image& img)
+    {
+        const uint8_t* px = img.getPixelsPtr();
+
+        for (unsigned int i = 0; i < w * h; i++)
+        {
+            const uint8_t* c = &px[i * 4];
+            depth[i] = DecodeDepth(c[0], c[1]);
+
+            Vec3 n = (depth[i] < 0.0f) ? Vec3() : DecodeNormal(c[2], c[3]);
+            normal[i*3 + 0] = (float)n.x;
+            normal[i*3 + 1] = (float)n.y;
+            normal[i*3 + 2] = (float)n.z;
+        }
+    }
+
+    void DecodeAlbedo(const sf::Image& img)
+    {
+        const uint8_t* px = img.getPixelsPtr();
+
+        for (unsigned int i = 0; i < w * h; i++)
+            for (int c = 0; c < 3; c++)
+                albedo[i*3 + c] = (float)px[i*4 + c] / 255.0f;
+    }
+
+    void DecodeIDs(const sf::Image& img, std::vector<uint32_t>& ids)
+    {
+        const uint8_t* px = img.getPixelsPtr();
+
+        for (unsigned int i = 0; i < w * h; i++)
+            ids[i] = ((uint32_t)px[i*4 + 0] << 16) | ((uint32_t)px[i*4 + 1] << 8) | (uint32_t)px[i*4 + 2];
+    }
+
+    void DecodeBounces(const sf::Image& img)
+    {
+        const uint8_t* px = img.getPixelsPtr();
+
+        for (unsigned int i = 0; i < w * h; i++)
+            bounces[i] = (float)(((unsigned int)px[i*4 + 0] << 8) | (unsigned int)px[i*4 + 1]) / 256.0f;
+    }
+
+    void DecodeCost(const sf::Image& img, std::vector<float>& cost)
+    {
+        const uint8_t* px = img.getPixelsPtr();
+
+        for (unsigned int i = 0; i < w * h; i++)
+        {
+            cost[i*2 + 0] = (float)(((unsigned int)px[i*4 + 0] << 8) | (unsigned int)px[i*4 + 1]);
+            cost[i*2 + 1] = (float)(((unsigned int)px[i*4 + 2] << 8) | (unsigned int)px[i*4 + 3]);
+        }
+    }
+
+    void Decode(int aov, const sf::Image& img)
+    {
+        switch (aov)
+        {
+        case AOV_DEPTH:
+        case AOV_NORMAL:      DecodeFirstHit(img); break;
+        case AOV_ALBEDO:      DecodeAlbedo(img); break;
+        case AOV_PRIMITIVEID: DecodeIDs(img, primitiveID); break;
+        case AOV_MATERIALID:  DecodeIDs(img, materialID); break;
+        case AOV_BOUNCES:     DecodeBounces(img); break;
+        case AOV_PRIMARYCOST: DecodeCost(img, primaryCost); break;
+        case AOV_PATHCOST:    DecodeCost(img, pathCost); break;
+        }
+    }
+
+
+    // False colour debug view of a single output
+    void Visualize(int aov, sf::Image& out) const
+    {
+        const std::vector<float>& cost = (aov == AOV_PRIMARYCOST) ? primaryCost : pathCost;
+
+        float maxValue = 0.0f;
+        if (aov == AOV_DEPTH)
+            maxValue = *std::max_element(depth.begin(), depth.end());
+        else if (aov == AOV_BOUNCES)
+            maxValue = *std::max_element(bounces.begin(), bounces.end());
+        else if (aov == AOV_PRIMARYCOST || aov == AOV_PATHCOST)
+            for (unsigned int i = 0; i < w * h; i++)
+                maxValue = std::max(maxValue, cost[i*2] + cost[i*2 + 1]);
+        maxValue = std::max(maxValue, 0.0001f);
+
+        for (unsigned int i = 0; i < w * h; i++)
+        {
+            float c[3] = { 0.0f, 0.0f, 0.0f };
+
+            switch (aov)
+            {
+            case AOV_DEPTH:
+                if (depth[i] >= 0.0f)
+                    c[0] = c[1] = c[2] = 1.0f - 0.9f * (depth[i] / maxValue);
+                break;
+
+            case AOV_NORMAL:
+                if (depth[i] >= 0.0f)
+                    for (int k = 0; k < 3; k++)
+                        c[k] = normal[i*3 + k] * 0.5f + 0.5f;
+                break;
+
+            case AOV_ALBEDO:
+                for (int k = 0; k < 3; k++)
+                    c[k] = albedo[i*3 + k];
+                break;
+
+            case AOV_PRIMITIVEID:
+            case AOV_MATERIALID:
+            {
+                uint32_t id = (aov == AOV_PRIMITIVEID) ? primitiveID[i] : materialID[i];
+                if (id != 0)
+                {
+                    uint32_t hash = id * 2654435761u;
+                    c[0] = (float)((hash >> 8) & 255) / 255.0f;
+                    c[1] = (float)((hash >> 16) & 255) / 255.0f;
+                    c[2] = (float)((hash >> 24) & 255) / 255.0f;
+                }
+                break;
+            }
+
+            case AOV_BOUNCES:
+            {
+                float t = bounces[i] / maxValue;
+                c[0] = std::clamp(t * 2.0f - 0.5f, 0.0f, 1.0f);
+                c[1] = std::clamp(1.0f - std::abs(t * 2.0f - 1.0f), 0.0f, 1.0f);
+                c[2] = std::clamp(1.0f - t * 2.0f, 0.0f, 1.0f);
+                break;
+            }
+
+            case AOV_PRIMARYCOST:
+            case AOV_PATHCOST:
+                Heat((cost[i*2] + cost[i*2 + 1]) / maxValue, c);
+                break;
+            }
+
+            out.setPixel(i%w, i/w, {
+                (uint8_t)(c[0] * 255.0f),
+                (uint8_t)(c[1] * 255.0f),
+                (uint8_t)(c[2] * 255.0f)
+            });
+        }
+
+        if (aov == AOV_PRIMARYCOST || aov == AOV_PATHCOST)
+            HeatLegend(out, maxValue);
+    }
+
+    // Black through blue, green and yellow to red and white, for t from 0 to 1
+    static void Heat(float t, float c[3])
+    {
+        static const float stops[6][3] = { { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 }, { 1, 1, 1 } };
+
+        float x = std::clamp(t, 0.0f, 1.0f) * 5.0f;
+        int s = std::min((int)x, 4);
+        float f = x - (float)s;
+        for (int k = 0; k < 3; k++)
+            c[k] = stops[s][k] + (stops[s + 1][k] - stops[s][k]) * f;
+    }
+
+    // Colour bar along the bottom of a heat map, labelled with the values at its ends and middle. The cost views
+    // colour node visits and primitive tests added together.
+    static void HeatLegend(sf::Image& out, float maxValue)
+    {
+        const unsigned int w = out.getSize().x, h = out.getSize().y;
+        const int scale = 2, band = 10 * scale; // Bar, gap, then digits 5 pixels high
+        if (w < 40 * scale || h < (unsigned int)band * 4)
+            return;
+
+        const unsigned int top = h - band, left = 2 * scale, right = w - 2 * scale;
+        for (unsigned int y = top; y < h; y++)
+            for (unsigned int x = 0; x < w; x++)
+            {
+                float c[3] = { 0.0f, 0.0f, 0.0f };
+                if (y < top + 3 * scale && x >= left && x < right)
+                    Heat((float)(x - left) / (float)(right - left - 1), c);
+
+                out.setPixel(x, y, { (uint8_t)(c[0] * 255.0f), (uint8_t)(c[1] * 255.0f), (uint8_t)(c[2] * 255.0f) });
+            }
+
+        // 3 by 5 digits, three bits per row from the top
+        static const uint16_t digits[10] = { 075557, 026227, 071747, 071717, 055711, 074717, 074757, 071111, 075757, 075717 };
+
+        auto Label = [&](float value, float anchor) {
+            const std::string text = std::format("{}", (long long)std::lround(value));
+            const int textW = (int)text.size() * 4 * scale - scale;
+            int x = std::clamp((int)(left + anchor * (right - left)) - (int)(anchor * textW), (int)left, (int)right - textW);
+
+            for (char ch : text)
+            {
+                const uint16_t glyph = digits[ch - '0'];
+                for (int row = 0; row < 5 * scale; row++)
+                    for (int col = 0; col < 3 * scale; col++)
+                        if (glyph & (1 << (14 - (row / scale) * 3 - col / scale)))
+                            out.setPixel(x + col, top + 5 * scale + row, sf::Color::White);
+                x += 4 * scale;
+            }
+        };
+
+        Label(0.0f, 0.0f);
+        Label(maxValue / 2.0f, 0.5f);
+        Label(maxValue, 1.0f);
+    }
+
+
+    static float Cost(const std::vector<float>& cost, unsigned int p, int channel)
+    {
+        return channel < 2 ? cost[p*2 + channel] : cost[p*2] + cost[p*2 + 1];
+    }
+
+    // Writes each selected output next to a snapshot as "<baseName> <aov><extension>", ".pfm" or ".exr"
+    bool Save(const std::string& baseName, int aovs, const std::string& extension = ".pfm") const
+    {
+        bool success = true;
+
+        for (int i = 0; i < AOV_COUNT; i++)
+        {
+            int aov = 1 << i;
+            if (!(aovs & aov))
+                continue;
+
+            int channels = (aov == AOV_NORMAL || aov == AOV_ALBEDO || aov == AOV_PRIMARYCOST || aov == AOV_PATHCOST) ? 3 : 1;
+            std::vector<float> row(w * channels);
+
+            HDRWriter writer;
+            bool saved = writer.Open(baseName + " " + Name(aov) + extension, w, h, channels);
+
+            for (unsigned int y = 0; saved && y < h; y++)
+            {
+                for (unsigned int x = 0; x < w; x++)
+                    for (int c = 0; c < channels; c++)
+                    {
+                        unsigned int p = y * w + x;
+                        float& v = row[x * channels + c];
+                        switch (aov)
+                        {
+                        case AOV_DEPTH:       v = depth[p]; break;
+                        case AOV_NORMAL:      v = normal[p*3 + c]; break;
+                        case AOV_ALBEDO:      v = albedo[p*3 + c]; break;
+                        case AOV_PRIMITIVEID: v = (float)primitiveID[p]; break; // 24 bit IDs are exact in a float
+                        case AOV_MATERIALID:  v = (float)materialID[p]; break;
+                        case AOV_BOUNCES:     v = bounces[p]; break;
+                        case AOV_PRIMARYCOST: v = Cost(primaryCost, p, c); break; // Node visits, primitive tests, both
+                        case AOV_PATHCOST:    v = Cost(pathCost, p, c); break;
+                        }
+                    }
+
+                saved &= writer.WriteRow(y, row.data());
+            }
+
+            success &= writer.Close() && saved;
+        }
+
+        return success;
+    }
+};
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cfloat>
+
+
+// Node and triangle indices of every mesh together have to stay below this, GLSL 1.30 can't reinterpret float bits
+constexpr uint32_t BVH_INDEX_LIMIT = 1u << 24;
+
+// Two texels of the shader's node texture, indices are stored as floats which are exact below 2^24
+struct BVHNode
+{
+    float min[3];
+    float leftFirst; // Left child (the right one follows it) for inner nodes, first triangle for leaves
+    float max[3];
+    float count;     // Triangles in a leaf, 0 for inner nodes
+};
+
+static_assert(sizeof(BVHNode) == 8 * sizeof(float));
+
+
+// Bounding volume hierarchy over the triangles of one mesh, split with binned surface area heuristic
+struct BVHBuilder
+{
+    static constexpr int
+        BINS = 12,
+        LEAF_SIZE = 4,   // Leaves smaller than this aren't split further
+        MAX_DEPTH = 32;  // Must not exceed MESH_STACK in RaytracerShader.frag
+
+    // Triangle costs relative to a node traversal
+    static constexpr float INTERSECT_COST = 1.0f, TRAVERSE_COST = 1.0f;
+
+
+    // Builds the hierarchy with local node and triangle indices, order receives the triangles in leaf order
+    static void Build(const float* positions, const uint32_t* indices, size_t triangles, std::vector<BVHNode>& nodes, std::vector<uint32_t>& order)
+    {
+        BVHBuilder builder(positions, indices, triangles);
+        builder.Subdivide();
+
+        nodes = std::move(builder.nodes);
+        order = std::move(builder.order);
+    }
+
+
+private:
+    struct Box
+    {
+        float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+        void Grow(const float* p)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                lo[a] = std::min(lo[a], p[a]);
+                hi[a] = std::max(hi[a], p[a]);
+            }
+        }
+
+        // Empty boxes are fine to grow by, they leave the box unchanged
+        void Grow(const Box& b)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                lo[a] = std::min(lo[a], b.lo[a]);
+                hi[a] = std::max(hi[a], b.hi[a]);
+            }
+        }
+
+        float Area() const
+        {
+            if (lo[0] > hi[0])
+                return 0.0f;
+            float e[3] = { hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2] };
+            return e[0]*e[1] + e[1]*e[2] + e[2]*e[0];
+        }
+    };
+
+    struct Bin
+    {
+        Box box;
+        uint32_t count = 0;
+    };
+
+    // Triangle bounds, partitioned in place so every pass reads memory in order
+    struct Prim
+    {
+        Box box;
+        float centroid[3];
+        uint32_t triangle;
+    };
+
+    struct Task
+    {
+        uint32_t node, first, count, depth;
+    };
+
+    std::vector<Prim> prims;
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> order;
+
+
+    BVHBuilder(const float* positions, const uint32_t* indices, size_t triangles) :
+        prims(triangles), order(triangles)
+    {
+        for (size_t t = 0; t < triangles; t++)
+        {
+            Prim& prim = prims[t];
+            for (int v = 0; v < 3; v++)
+                prim.box.Grow(&positions[indices[t*3 + v] * 3]);
+            for (int a = 0; a < 3; a++)
+                prim.centroid[a] = (prim.box.lo[a] + prim.box.hi[a]) * 0.5f;
+            prim.triangle = (uint32_t)t;
+        }
+
+        nodes.reserve(std::max<size_t>(1, triangles / LEAF_SIZE * 2));
+    }
+
+    void Subdivide()
+    {
+        nodes.push_back({});
+        std::vector<Task> stack = { { 0, 0, (uint32_t)prims.size(), 0 } };
+
+        while (!stack.empty())
+        {
+            Task task = stack.back();
+            stack.pop_back();
+
+            Box box, centroidBox;
+            for (uint32_t i = task.first; i < task.first + task.count; i++)
+            {
+                box.Grow(prims[i].box);
+                centroidBox.Grow(prims[i].centroid);
+            }
+
+            BVHNode& node = nodes[task.node];
+            for (int a = 0; a < 3; a++)
+            {
+                node.min[a] = box.lo[a];
+                node.max[a] = box.hi[a];
+            }
+
+            uint32_t split;
+            if (task.count <= LEAF_SIZE || task.depth + 1 >= MAX_DEPTH || !FindSplit(task, box, centroidBox, split))
+            {
+                node.leftFirst = (float)task.first;
+                node.count = (float)task.count;
+                continue;
+            }
+
+            uint32_t left = (uint32_t)nodes.size();
+            node.leftFirst = (float)left;
+            node.count = 0.0f;
+
+            nodes.push_back({});
+            nodes.push_back({});
+
+            stack.push_back({ left, task.first, split - task.first, task.depth + 1 });
+            stack.push_back({ left + 1, split, task.first + task.count - split, task.depth + 1 });
+        }
+
+        for (size_t i = 0; i < prims.size(); i++)
+            order[i] = prims[i].triangle;
+    }
+
+    // Partitions the task's triangles along the cheapest binned plane, fails when a leaf is cheaper
+    bool FindSplit(const Task& task, const Box& box, const Box& centroidBox, uint32_t& split)
+    {
+        float lo[3], scale[3];
+        for (int a = 0; a < 3; a++)
+        {
+            float extent = centroidBox.hi[a] - centroidBox.lo[a];
+            lo[a] = centroidBox.lo[a];
+            scale[a] = (extent > 0.0f) ? BINS / extent : 0.0f;
+        }
+
+        // Every axis is binned in the same pass
+        Bin bins[3][BINS];
+        for (uint32_t i = task.first; i < task.first + task.count; i++)
+        {
+            const Prim& prim = prims[i];
+            for (int a = 0; a < 3; a++)
+            {
+                Bin& bin = bins[a][BinOf(prim.centroid[a], lo[a], scale[a])];
+                bin.count++;
+                bin.box.Grow(prim.box);
+            }
+        }
+
+        float bestCost = FLT_MAX;
+        int bestAxis = -1, bestBin = 0;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (scale[axis] == 0.0f)
+                continue;
+
+            // Sweep from both sides for the cost of every plane between bins
+            float leftArea[BINS - 1], rightArea[BINS - 1];
+            uint32_t leftCount[BINS - 1], rightCount[BINS - 1];
+            Box leftBox, rightBox;
+            uint32_t leftSum = 0, rightSum = 0;
+            for (int i = 0; i < BINS - 1; i++)
+            {
+                const Bin& l = bins[axis][i];
+                const Bin& r = bins[axis][BINS - 1 - i];
+
+                leftSum += l.count;
+                leftCount[i] = leftSum;
+                leftBox.Grow(l.box);
+                leftArea[i] = leftBox.Area();
+
+                rightSum += r.count;
+                rightCount[BINS - 2 - i] = rightSum;
+                rightBox.Grow(r.box);
+                rightArea[BINS - 2 - i] = rightBox.Area();
+            }
+
+            for (int i = 0; i < BINS - 1; i++)
+            {
+                float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+                if (leftCount[i] > 0 && rightCount[i] > 0 && cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = i;
+                }
+            }
+        }
+
+        if (bestAxis < 0)
+            return false;
+
+        float leafCost = task.count * INTERSECT_COST;
+        float splitCost = TRAVERSE_COST + INTERSECT_COST * bestCost / std::max(box.Area(), FLT_MIN);
+        if (splitCost >= leafCost && task.count <= LEAF_SIZE * 4)
+            return false;
+
+        Prim* first = &prims[task.first];
+        Prim* middle = std::partition(first, first + task.count, [&](const Prim& prim) {
+            return BinOf(prim.centroid[bestAxis], lo[bestAxis], scale[bestAxis]) <= bestBin;
+        });
+
+        split = task.first + (uint32_t)(middle - first);
+        return split > task.first && split < task.first + task.count;
+    }
+
+    static int BinOf(float centroid, float lo, float scale)
+    {
+        return std::clamp((int)((centroid - lo) * scale), 0, BINS - 1);
+    }
+};
@@ -0,0 +1,676 @@
+#include "Renderer.h"
+#include "HDRImage.h"
+#include "Checkpoint.h"
+#include "RenderNodes.h"
+#include "Memory.h"
+#include "Trace.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <string_view>
+#include <format>
+#include <chrono>
+#include <charconv>
+#include <cmath>
+#include <filesystem>
+#include <functional>
+
+
+// Renders one scene to an image file without a window and exits, for running renders unattended.
+// Stops at whichever of the given criteria is met first, 256 samples per pixel if none are given.
+// Tiled renders apply them to every tile, with the time limit split between the tiles.
+// Tiles can also be rendered by workers, BatchRender processes on this or other machines connected over TCP.
+static const char* usage =
+    "Usage: BatchRender <scene> [options]\n"
+    "       BatchRender --worker <host[:port]>  Render tiles for a coordinator started with --serve\n"
+    "  --out <file>        Image to write, png, bmp, tga or jpg (render.png), or exr or pfm for linear floats\n"
+    "  --width <pixels>    Resolution, the scene's by default\n"
+    "  --height <pixels>\n"
+    "  --origin <x y z>    Camera, the scene's by default\n"
+    "  --fwd <x y z>\n"
+    "  --fov <degrees>\n"
+    "  --spp <samples>     Stop after this many samples per pixel\n"
+    "  --time <seconds>    Stop after this much time\n"
+    "  --noise <error>     Stop once the estimated standard error per pixel drops below this, 0 to 1\n"
+    "  --seed <n>          Renders with the same seed are identical (0)\n"
+    "  --deterministic     Trace a sample at a time, so the image is the same to the bit whatever the tiles, threads\n"
+    "                      or workers, and however the samples are split into passes. Slower, and can't stop on --time\n"
+    "  --tile <pixels>     Render in square tiles, each finished and written before the next, so memory use\n"
+    "                      depends on the tile size. For images beyond the GPU's texture limit, needs exr or pfm\n"
+    "  --checkpoint <file> Save progress here and continue from it when run again with the same scene and options\n"
+    "  --checkpoint-every <seconds>  (60)\n"
+    "  --serve <port>      Have workers render the tiles instead, needs --tile. They load the scene from the same path\n"
+    "  --worker-timeout <seconds>  Hand a worker's tile to another when it's silent for this long (60)\n"
+    "  --cpu <threads>     Trace on the CPU instead of the GPU, 0 threads uses every core\n"
+    "  --stats             Report ray statistics with the progress and in total, needs --cpu\n"
+    "  --denoise           Filter the finished render, guided by the depth, normal and albedo of each pixel's first hit\n"
+    "  --heatmap <primary|path>  Write a false colour image of the node visits and primitive tests of each pixel's\n"
+    "                      primary ray, or of its paths per sample, instead of rendering\n"
+    "  --trace <file>      Record where the time goes and save it as a Chrome trace to open in ui.perfetto.dev\n";
+
+
+static bool ParseNumber(std::string_view text, double& value)
+{
+    auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return ec == std::errc() && ptr == text.data() + text.size();
+}
+
+// Writes the renderer's current tile cut to the image, a row at a time unless the writer needs whole tiles
+static bool WriteTile(HDRWriter& writer, const Renderer& renderer)
+{
+    const unsigned int
+        width = std::min(renderer.tileW, renderer.w - renderer.tileX),
+        height = std::min(renderer.tileH, renderer.h - renderer.tileY),
+        rows = writer.WholeTiles() ? height : 1;
+
+    std::vector<float> buffer((size_t)width * rows * 3);
+    bool success = true;
+
+    for (unsigned int y = 0; y < height; y += rows)
+    {
+        for (unsigned int r = 0; r < rows; r++)
+            renderer.LinearRow(y + r, &buffer[(size_t)r * width * 3], width);
+
+        success &= writer.WriteTile(renderer.tileX, renderer.tileY + y, width, rows, buffer.data());
+    }
+    return success;
+}
+
+// Visualizes the traversal cost of one pass with its legend, and prints the mean and most per pixel
+static int WriteHeatmap(Renderer& renderer, int aov, unsigned int passSamples, const std::string& outFile)
+{
+    AOVBuffers buffers(renderer.w, renderer.h);
+    std::vector<float>& cost = (aov == AOV_PRIMARYCOST) ? buffers.primaryCost : buffers.pathCost;
+    renderer.Cost(AOVBuffers::OutputMode(aov), passSamples, cost.data());
+
+    double mean[2] = {}, most[2] = {};
+    for (size_t i = 0; i < cost.size(); i++)
+    {
+        mean[i % 2] += cost[i];
+        most[i % 2] = std::max(most[i % 2], (double)cost[i]);
+    }
+
+    const double pixels = (double)renderer.w * renderer.h;
+    std::cout << std::format("{}: {:.1f} node visits and {:.1f} primitive tests per pixel on average, at most {:.1f} and {:.1f}\n",
+        AOVBuffers::Name(aov), mean[0] / pixels, mean[1] / pixels, most[0], most[1]);
+
+    sf::Image image;
+    image.create(renderer.w, renderer.h);
+    buffers.Visualize(aov, image);
+
+    if (!image.saveToFile(outFile))
+    {
+        std::cout << "Saving " << outFile << " failed\n";
+        return 1;
+    }
+    std::cout << "Saved " << outFile << "\n";
+    return 0;
+}
+
+// Identifies a render across runs by everything its output depends on. The stop criteria are left out, so a resumed
+// render can be given more time or samples.
+static uint64_t JobHash(const SceneView& scene, const Cam& cam, unsigned int w, unsigned int h, unsigned int tileSize, uint32_t seed, unsigned int passSamples, const std::string& outFile,
+    bool cpu = false, bool deterministic = false)
+{
+    uint64_t hash = scene.Hash();
+    auto Add = [&hash](uint64_t v) {
+        hash = (hash ^ v) * 1099511628211ull;
+    };
+
+    const RenderSettings& settings = scene.settings;
+    for (uint64_t v : { (uint64_t)w, (uint64_t)h, (uint64_t)std::min(tileSize, w), (uint64_t)std::min(tileSize, h), (uint64_t)seed, (uint64_t)passSamples,
+        (uint64_t)settings.maxBounces, (uint64_t)settings.randomizeSampleDir, (uint64_t)settings.disableLighting, (uint64_t)settings.viewBounds, (uint64_t)cpu, (uint64_t)deterministic })
+        Add(v);
+
+    for (double v : { cam.origin.x, cam.origin.y, cam.origin.z, cam.fwd.x, cam.fwd.y, cam.fwd.z, (double)cam.fov })
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        Add(bits);
+    }
+
+    for (char c : outFile)
+        Add((uint8_t)c);
+    return hash;
+}
+
+// Accumulates passes on the renderer's current tile until one of the limits is reached, 0 for those not used, and
+// returns which. afterPass gets the seconds spent on the tile so far and the noise, only measured with a noise limit.
+// The limits are checked before the first pass too, a tile resumed from a checkpoint can have reached them already.
+static std::string RenderTile(Renderer& renderer, unsigned int passSamples, double spp, double timeLimit, double noiseLimit,
+    const std::function<void(double seconds, double noise)>& afterPass)
+{
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+
+    auto Reached = [&](double seconds, double noise) -> const char* {
+        if (spp > 0 && renderer.samples >= (unsigned int)spp)
+            return "sample count reached";
+        if (timeLimit > 0 && seconds >= timeLimit)
+            return "time limit reached";
+        if (noiseLimit > 0 && noise <= noiseLimit)
+            return "noise threshold reached";
+        return nullptr;
+    };
+
+    if (const char* reason = Reached(0.0, noiseLimit > 0 ? renderer.Noise() : std::numeric_limits<double>::infinity()))
+        return reason;
+
+    while (true)
+    {
+        // Never 0, the limit wasn't reached
+        unsigned int passCount = passSamples;
+        if (spp > 0)
+            passCount = std::min(passCount, (unsigned int)spp - renderer.samples);
+
+        renderer.Pass(passCount);
+
+        const double
+            seconds = std::chrono::duration<double>(Clock::now() - start).count(),
+            noise = noiseLimit > 0 ? renderer.Noise() : std::numeric_limits<double>::infinity();
+
+        if (const char* reason = Reached(seconds, noise))
+            return reason;
+
+        afterPass(seconds, noise);
+    }
+}
+
+// Renders the tiles a coordinator hands out until it has none left
+static int RunWorker(const std::string& address)
+{
+    TileWorker connection;
+    RenderJob job;
+    std::string error;
+
+    if (!connection.Connect(address, job, error))
+    {
+        std::cout << error << "\n";
+        return 1;
+    }
+
+    CachedScene scene;
+    if (!scene.Load(job.sceneFile, error))
+    {
+        std::cout << error << "\n";
+        connection.Reject(error);
+        return 1;
+    }
+
+    Cam cam = scene.view.cam;
+    cam.origin = job.origin;
+    cam.fwd = job.fwd;
+    cam.right = job.right;
+    cam.up = job.up;
+    cam.fov = job.fov;
+
+    const unsigned int passSamples = std::max(1u, scene.view.settings.samples);
+    if (JobHash(scene.view, cam, job.width, job.height, job.tileSize, job.seed, passSamples, job.outFile, false, job.deterministic) != job.hash)
+    {
+        error = job.sceneFile + " or something it loads differs from the coordinator's";
+        std::cout << error << "\n";
+        connection.Reject(error);
+        return 1;
+    }
+
+    Renderer renderer(job.width, job.height, job.seed, job.tileSize, job.deterministic);
+    if (!renderer.Init(scene.view, error))
+    {
+        std::cout << error << "\n";
+        connection.Reject(error);
+        return 1;
+    }
+    renderer.SetCam(cam);
+
+    if (!connection.Accept())
+        return 1;
+
+    std::cout << std::format("Rendering tiles of {} for {}\n", job.outFile, address);
+    const unsigned int tilesX = (job.width + renderer.tileW - 1) / renderer.tileW;
+
+    using Clock = std::chrono::steady_clock;
+    TileResult result;
+    double timeLimit;
+    bool connected = true;
+
+    while (connected && connection.NextTile(result.tile, timeLimit))
+    {
+        const Clock::time_point start = Clock::now();
+        renderer.SetTile((result.tile % tilesX) * renderer.tileW, (result.tile / tilesX) * renderer.tileH);
+
+        // Progress doubles as the sign of life the coordinator waits for
+        double lastReport = 0.0;
+        std::string reason = RenderTile(renderer, passSamples, job.spp, timeLimit, job.noiseLimit, [&](double seconds, double) {
+            if (seconds - lastReport >= 1.0)
+            {
+                lastReport = seconds;
+                connected &= connection.Progress(renderer.samples);
+            }
+        });
+
+        const unsigned int
+            width = std::min(renderer.tileW, renderer.w - renderer.tileX),
+            height = std::min(renderer.tileH, renderer.h - renderer.tileY);
+
+        result.pixels.resize((size_t)width * height * 3);
+        for (unsigned int y = 0; y < height; y++)
+            renderer.LinearRow(y, &result.pixels[(size_t)y * width * 3], width);
+
+        result.samples = renderer.samples;
+        result.noise = renderer.Noise();
+        result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::cout << std::format("Tile {}: {}, {} spp\n", result.tile + 1, reason, renderer.samples);
+        connected &= connection.Result(result);
+    }
+
+    std::cout << (connected ? "Done\n" : "Lost the coordinator\n");
+    return connected ? 0 : 1;
+}
+
+// Waits for workers and writes the tiles they return, the job is all tiles and workers need
+static int RunCoordinator(const RenderJob& job, double timeLimit, unsigned short port, double timeout)
+{
+    TileCoordinator coordinator;
+    coordinator.timeout = timeout;
+
+    std::string error;
+    if (!coordinator.Listen(port, error))
+    {
+        std::cout << error << "\n";
+        return 1;
+    }
+
+    HDRWriter writer;
+    const unsigned int tileW = std::min(job.tileSize, job.width), tileH = std::min(job.tileSize, job.height);
+    if (!writer.Open(job.outFile, job.width, job.height, 3, HDRWriter::COMPRESSION_RLE, tileW, tileH))
+    {
+        std::cout << "Can't write " << job.outFile << "\n";
+        return 1;
+    }
+
+    const unsigned int
+        tilesX = (job.width + tileW - 1) / tileW,
+        tileCount = tilesX * ((job.height + tileH - 1) / tileH);
+
+    std::cout << std::format("Waiting for workers on port {} to render {} tiles\n", port, tileCount);
+
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+    unsigned int finished = 0;
+
+    bool saved = coordinator.Run(job, timeLimit, [&](const TileResult& result) {
+        const unsigned int
+            x = (result.tile % tilesX) * tileW,
+            y = (result.tile / tilesX) * tileH;
+
+        std::cout << std::format("Tile {}/{} from {} ({}/{} done): {} spp in {:.2f} s, noise {:.5f}\n",
+            result.tile + 1, tileCount, result.worker, ++finished, tileCount, result.samples, result.seconds, result.noise);
+
+        TraceScope scope("Write tile");
+        return writer.WriteTile(x, y, std::min(tileW, job.width - x), std::min(tileH, job.height - y), result.pixels.data());
+    });
+
+    saved &= writer.Close();
+    if (!saved)
+    {
+        std::cout << "Saving " << job.outFile << " failed\n";
+        return 1;
+    }
+
+    std::cout << std::format("Rendered {} tiles in {:.2f} s\nSaved {}\n", tileCount, std::chrono::duration<double>(Clock::now() - start).count(), job.outFile);
+    return 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cout << usage;
+        return 1;
+    }
+
+    if (std::string_view(argv[1]) == "--worker")
+        return RunWorker(argc > 2 ? argv[2] : "localhost");
+
+    const std::string sceneFile = argv[1];
+    std::string outFile = "render.png", checkpointFile, heatmap, traceFile;
+
+    double
+        width = 0, height = 0,
+        fov = 0,
+        spp = 0, timeLimit = 0, noiseLimit = 0,
+        seed = 0,
+        tileSize = 0,
+        checkpointInterval = 60,
+        port = 0, workerTimeout = 60,
+        cpuThreads = 0;
+    double origin[3], fwd[3];
+    bool hasOrigin = false, hasFwd = false, cpu = false, showStats = false, deterministic = false, denoise = false;
+
+    for (int i = 2; i < argc; i++)
+    {
+        std::string_view option = argv[i];
+
+        // Number of values each option takes, and where they go
+        int count = 1;
+        double* values = nullptr;
+
+        if (option == "--out" && i + 1 < argc)
+        {
+            outFile = argv[++i];
+            continue;
+        }
+        else if (option == "--checkpoint" && i + 1 < argc)
+        {
+            checkpointFile = argv[++i];
+            continue;
+        }
+        else if (option == "--trace" && i + 1 < argc)
+        {
+            traceFile = argv[++i];
+            continue;
+        }
+        else if (option == "--heatmap" && i + 1 < argc)
+        {
+            heatmap = argv[++i];
+            if (heatmap != "primary" && heatmap != "path")
+            {
+                std::cout << "Bad value '" << heatmap << "' for --heatmap\n";
+                return 1;
+            }
+            continue;
+        }
+        else if (option == "--stats")
+        {
+            showStats = true;
+            continue;
+        }
+        else if (option == "--deterministic")
+        {
+            deterministic = true;
+            continue;
+        }
+        else if (option == "--denoise")
+        {
+            denoise = true;
+            continue;
+        }
+        else if (option == "--checkpoint-every") values = &checkpointInterval;
+        else if (option == "--width")  values = &width;
+        else if (option == "--height") values = &height;
+        else if (option == "--fov")    values = &fov;
+        else if (option == "--spp")    values = &spp;
+        else if (option == "--time")   values = &timeLimit;
+        else if (option == "--noise")  values = &noiseLimit;
+        else if (option == "--seed")   values = &seed;
+        else if (option == "--tile")   values = &tileSize;
+        else if (option == "--serve")  values = &port;
+        else if (option == "--worker-timeout") values = &workerTimeout;
+        else if (option == "--cpu")    { values = &cpuThreads; cpu = true; }
+        else if (option == "--origin") { values = origin; count = 3; hasOrigin = true; }
+        else if (option == "--fwd")    { values = fwd; count = 3; hasFwd = true; }
+
+        if (values == nullptr || i + count >= argc)
+        {
+            std::cout << "Unknown or incomplete option '" << option << "'\n" << usage;
+            return 1;
+        }
+
+        for (int v = 0; v < count; v++)
+            if (!ParseNumber(argv[++i], values[v]) || (values[v] < 0.0 && count == 1))
+            {
+                std::cout << "Bad value '" << argv[i] << "' for " << option << "\n";
+                return 1;
+            }
+    }
+
+    if (spp == 0 && timeLimit == 0 && noiseLimit == 0)
+        spp = 256;
+
+    if (showStats && !cpu)
+    {
+        std::cout << "--stats needs --cpu, the shader can't count\n";
+        return 1;
+    }
+    if (deterministic && timeLimit > 0)
+    {
+        std::cout << "--deterministic can't stop on --time, how many samples fit in it differs between runs\n";
+        return 1;
+    }
+
+    // Saved on the way out, from any return below
+    const TraceSession session(traceFile, "Main", std::cout);
+
+    CachedScene scene;
+    std::string error;
+    bool loaded;
+    {
+        TraceScope scope("Load scene");
+        loaded = scene.Load(sceneFile, error);
+    }
+    if (!loaded)
+    {
+        std::cout << error << "\n";
+        return 1;
+    }
+
+    Cam cam = scene.view.cam;
+    if (fov > 0)
+        cam.fov = (float)std::min(fov, 179.99);
+    if (hasOrigin)
+        cam.origin = Vec3(origin[0], origin[1], origin[2]);
+    if (hasFwd)
+    {
+        cam.fwd = Vec3(fwd[0], fwd[1], fwd[2]);
+        if (cam.fwd.MagSqr() < utils::MINVAL)
+        {
+            std::cout << "--fwd can't be zero\n";
+            return 1;
+        }
+    }
+    cam.UpdateRotation();
+
+    const unsigned int
+        w = width > 0 ? (unsigned int)width : scene.view.settings.width,
+        h = height > 0 ? (unsigned int)height : scene.view.settings.height,
+        passSamples = std::max(1u, scene.view.settings.samples);
+
+    const bool hdr = HDRWriter::IsHDR(outFile), tiled = tileSize > 0;
+    if (!heatmap.empty() && (hdr || tiled || port > 0 || !checkpointFile.empty()))
+    {
+        std::cout << "--heatmap writes a whole png, bmp, tga or jpg image at once\n";
+        return 1;
+    }
+    if (denoise && (tiled || port > 0 || !heatmap.empty()))
+    {
+        std::cout << "--denoise filters a whole image at once, it can't take --tile, --serve or --heatmap\n";
+        return 1;
+    }
+    if (tiled && !hdr)
+    {
+        std::cout << "--tile needs an exr or pfm output, which tiles are written to as they finish\n";
+        return 1;
+    }
+
+    if (port > 0)
+    {
+        if (!tiled || !checkpointFile.empty())
+        {
+            std::cout << "--serve needs --tile and doesn't checkpoint, a lost worker's tile is rendered again instead\n";
+            return 1;
+        }
+        if (cpu)
+        {
+            std::cout << "--serve doesn't take --cpu, workers render on their own GPU\n";
+            return 1;
+        }
+
+        RenderJob job;
+        job.sceneFile = sceneFile;
+        job.outFile = outFile;
+        job.width = w;
+        job.height = h;
+        job.tileSize = (uint32_t)tileSize;
+        job.seed = (uint32_t)seed;
+        job.origin = cam.origin;
+        job.fwd = cam.fwd;
+        job.right = cam.right;
+        job.up = cam.up;
+        job.fov = cam.fov;
+        job.spp = spp;
+        job.noiseLimit = noiseLimit;
+        job.deterministic = deterministic;
+        job.hash = JobHash(scene.view, cam, w, h, job.tileSize, job.seed, passSamples, outFile, false, deterministic);
+
+        return RunCoordinator(job, timeLimit, (unsigned short)port, workerTimeout);
+    }
+
+    Renderer renderer(w, h, (uint32_t)seed, (unsigned int)tileSize, deterministic);
+    if (cpu)
+        renderer.InitCpu(scene.view, (unsigned int)cpuThreads);
+    else if (!renderer.Init(scene.view, error))
+    {
+        std::cout << error << "\n";
+        return 1;
+    }
+    renderer.SetCam(cam);
+
+    if (!heatmap.empty())
+        return WriteHeatmap(renderer, heatmap == "primary" ? AOV_PRIMARYCOST : AOV_PATHCOST, passSamples, outFile);
+
+    // The CPU traces the same paths, but not to the bit, so checkpoints don't carry over between the two
+    const uint64_t job = JobHash(scene.view, cam, w, h, (unsigned int)tileSize, (uint32_t)seed, passSamples, outFile, cpu, deterministic);
+    Checkpoint checkpoint;
+    bool resume = false;
+
+    if (!checkpointFile.empty() && std::filesystem::exists(checkpointFile))
+    {
+        resume = checkpoint.Load(checkpointFile, job, renderer.StateSize(), error);
+        if (!resume)
+            std::cout << "Not resuming, " << error << "\n";
+    }
+
+    HDRWriter writer;
+    const unsigned int fileTileW = tiled ? renderer.tileW : 0, fileTileH = tiled ? renderer.tileH : 0;
+
+    // Tiles finished before the checkpoint are already in the output
+    if (hdr && resume && !writer.Resume(outFile, w, h, 3, HDRWriter::COMPRESSION_RLE, fileTileW, fileTileH, checkpoint.output))
+    {
+        std::cout << "Not resuming, can't continue " << outFile << "\n";
+        checkpoint.Close(); // Saving renames over it, which fails on Windows while it's mapped
+        resume = false;
+    }
+    if (hdr && !resume && !writer.Open(outFile, w, h, 3, HDRWriter::COMPRESSION_RLE, fileTileW, fileTileH))
+    {
+        std::cout << "Can't write " << outFile << "\n";
+        return 1;
+    }
+
+    const unsigned int
+        tilesX = (w + renderer.tileW - 1) / renderer.tileW,
+        tilesY = (h + renderer.tileH - 1) / renderer.tileH,
+        tileCount = tilesX * tilesY;
+
+
+    using Clock = std::chrono::steady_clock;
+    double elapsed = resume ? checkpoint.header.elapsed : 0.0, lastCheckpoint = elapsed;
+    const Clock::time_point start = Clock::now() - std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(elapsed));
+    bool saved = true;
+
+    // The output's progress is taken at the same time, so both always agree on which tiles are done
+    auto SaveCheckpoint = [&](unsigned int tile) {
+        TraceScope scope("Checkpoint");
+        HDRWriter::Progress progress;
+        if ((hdr && !writer.GetProgress(progress)) || !Checkpoint::Save(checkpointFile, job, tile, elapsed, renderer, hdr ? &progress : nullptr))
+            std::cout << "Saving checkpoint " << checkpointFile << " failed\n";
+        lastCheckpoint = elapsed;
+    };
+
+    const unsigned int firstTile = resume ? checkpoint.header.tile : 0;
+    for (unsigned int t = firstTile; t < tileCount; t++)
+    {
+        if (tiled)
+            renderer.SetTile((t % tilesX) * renderer.tileW, (t / tilesX) * renderer.tileH);
+
+        if (resume && t == firstTile)
+        {
+            checkpoint.Restore(renderer);
+            std::cout << std::format("Resuming {}at {} spp, {:.1f} s\n", tiled ? std::format("tile {}/{} ", t + 1, tileCount) : "", renderer.samples, elapsed);
+        }
+
+        // The time left is shared evenly between the remaining tiles
+        const double tileStart = elapsed, tileTime = (timeLimit - tileStart) / (tileCount - t);
+        const std::string tileName = tiled ? std::format("Tile {}/{}: ", t + 1, tileCount) : "";
+
+        double lastReport = elapsed;
+        std::string reason = RenderTile(renderer, passSamples, spp, timeLimit > 0 ? std::max(0.001, tileTime) : 0.0, noiseLimit, [&](double, double noise) {
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+            if (!checkpointFile.empty() && elapsed - lastCheckpoint >= checkpointInterval)
+                SaveCheckpoint(t);
+
+            // Every pass with statistics, they're per pass
+            if (elapsed - lastReport >= 1.0 || showStats)
+            {
+                lastReport = elapsed;
+                std::cout << std::format("{}{} spp, {:.1f} s", tileName, renderer.samples, elapsed);
+                if (noiseLimit > 0)
+                    std::cout << std::format(", noise {:.5f}", noise);
+                if (showStats)
+                    std::cout << ", " << renderer.Stats()->Line();
+                std::cout << "\n";
+            }
+        });
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::cout << std::format("{}Done, {}: {} spp in {:.2f} s, noise {:.5f}\n", tileName, reason, renderer.samples, elapsed - tileStart, renderer.Noise());
+
+        // Only untiled, so this is the whole image
+        if (denoise)
+            renderer.Denoise();
+
+        if (hdr)
+        {
+            TraceScope scope("Write tile");
+            saved &= WriteTile(writer, renderer);
+        }
+
+        if (!checkpointFile.empty() && t + 1 < tileCount)
+        {
+            renderer.Reset();
+            SaveCheckpoint(t + 1);
+        }
+    }
+
+    if (tiled)
+        std::cout << std::format("Rendered {} tiles in {:.2f} s\n", tileCount, elapsed);
+
+    if (showStats)
+        std::cout << (resume ? "Ray statistics since resuming:\n" : "Ray statistics:\n") << renderer.TotalStats()->Summary();
+
+    {
+        TraceScope scope("Save image");
+        if (hdr)
+            saved &= writer.Close();
+        else
+            saved = renderer.Result().saveToFile(outFile);
+    }
+
+    if (!saved)
+    {
+        std::cout << "Saving " << outFile << " failed\n";
+        return 1;
+    }
+
+    if (!checkpointFile.empty())
+    {
+        std::error_code ec;
+        std::filesystem::remove(checkpointFile, ec);
+    }
+
+    std::cout << "Saved " << outFile << "\nMemory: " << memoryUsage.Summary() << "\n";
+    return 0;
+}
@@ -0,0 +1,953 @@
+#include "Renderer.h"
+#include "HDRImage.h"
+#include "KernelBenchmark.h"
+#include "ScalingBenchmark.h"
+#include "Memory.h"
+#include "Trace.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <string_view>
+#include <format>
+#include <chrono>
+#include <charconv>
+#include <cmath>
+#include <memory>
+#include <algorithm>
+#include <filesystem>
+#include <new>
+#include <cstdlib>
+
+#include <SFML/OpenGL.hpp>
+
+
+// Measures rendering speed on a fixed set of scenes, to compare versions and machines. Every scene is rendered with its
+// own camera, resolution and settings and a fixed seed, and the results are written as JSON.
+// Convergence is timed against references, high sample count renders of the same scenes made with --make-references.
+// Those use another seed, so their noise doesn't line up with the benchmark's.
+// --kernels times the CPU intersection kernels instead, which needs no GPU.
+// --scaling times the CPU tracer on more and more threads at every resolution from 80x45 to 1920x1080 instead.
+// --regress checks that renders still converge to the same image: every scene is rendered to a fixed sample count by
+// the shader and by the CPU tracer and compared with a reference, within tolerances measured when the reference was
+// made.
+// Run it with a software GL, such as Mesa's with LIBGL_ALWAYS_SOFTWARE=1, where there's no GPU.
+static const char* usage =
+    "Usage: Benchmark [scenes] [options]\n"
+    "  Renders Scenes/Default.scene, Scenes/Box.scene and Scenes/Mesh.scene unless scenes are given\n"
+    "  --out <file>        Write the results here, printed otherwise\n"
+    "  --frames <n>        Passes timed per scene (64)\n"
+    "  --rmse <error>      Time how long it takes to get this close to the reference, 0 to 1 in display units (0.01)\n"
+    "  --max-time <seconds>  Give up on reaching it after this long (120)\n"
+    "  --references <dir>  Where the references are kept (Scenes/References)\n"
+    "  --make-references <spp>  Render the references instead of benchmarking\n"
+    "  --kernels           Time the intersection kernels in ns per ray instead, scalar and four wide\n"
+    "  --cpu <threads>     Benchmark and make references on the CPU, 0 threads uses every core\n"
+    "  --regress           Compare fixed sample count renders of the shader and the CPU with the references in\n"
+    "                      <references>/Regression instead, fails when either is off by more than the tolerances\n"
+    "                      or a reference is missing.\n"
+    "                      With --make-references, makes those references and tolerances\n"
+    "  --spp <samples>     Per pixel for the regression renders, when making their tolerances (64)\n"
+    "  --deterministic     Render a sample at a time as BatchRender --deterministic, to time what it costs\n"
+    "  --scaling <threads> Time the CPU tracer on 1 up to this many threads, 0 for every core, at resolutions from\n"
+    "                      80x45 to 1920x1080 instead, with the speedup, efficiency, bandwidth and what limits it\n"
+    "  --trace <file>      Record where the time goes and save it as a Chrome trace to open in ui.perfetto.dev\n";
+
+constexpr uint32_t
+    BENCHMARK_SEED = 1,
+    REFERENCE_SEED = 0x9E3779B9;
+
+constexpr int BENCHMARK_VERSION = 3; // Of the JSON, bump when fields change meaning
+
+// Regression renders are small so the CPU and software GL get through them quickly
+constexpr unsigned int
+    REGRESSION_W = 320,
+    REGRESSION_H = 180,
+    REGRESSION_SPP = 64;
+
+// Tolerances are the mean of the metrics over this many seeds plus this many standard deviations of them, so another
+// noise pattern passes and anything that moves the image further than the noise does fails
+constexpr unsigned int REGRESSION_SEEDS = 8;
+constexpr double REGRESSION_DEVIATIONS = 4.0;
+
+// Every scene has to fail against its reference scaled by this, or its tolerances are too loose to notice lost energy
+constexpr float REGRESSION_DIMMED = 0.8f;
+
+
+struct SceneResult
+{
+    std::string scene;
+    unsigned int w = 0, h = 0, passSamples = 0;
+
+    std::vector<double> frameMs;  // Every timed pass, including the readback and accumulation
+    double samplesPerSecond = 0.0;
+    double raysPerSample = 0.0;   // Surfaces hit per path plus the ray leaving the scene
+
+    // Negative when there's no reference or the target wasn't reached
+    double timeToRMSE = -1.0, finalRMSE = -1.0;
+    unsigned int sppToRMSE = 0;
+
+    // Bytes per MemoryCategory at the end of the scene, and the most held at once while it ran
+    uint64_t memory[MEMORY_CATEGORIES] = {}, memoryPeak[MEMORY_CATEGORIES] = {};
+    uint64_t memoryTotal = 0, memoryTotalPeak = 0;
+};
+
+// How far an image is from its reference
+struct ImageMetrics
+{
+    double
+        rmse = -1.0,      // Tonemapped, 0 to 1 as displayed
+        relMSE = -1.0,    // Linear, each squared difference relative to the reference's value squared
+        fireflies = -1.0, // Fraction of pixels several times brighter than the reference
+        blurRMSE = -1.0,  // Tonemapped after averaging squares of pixels, where the noise mostly cancels and bias doesn't
+        bias = -1.0;      // Largest difference of a channel's linear mean over the image, relative to the reference's
+
+    bool Within(const ImageMetrics& limit) const
+    {
+        return rmse <= limit.rmse && relMSE <= limit.relMSE && fireflies <= limit.fireflies && blurRMSE <= limit.blurRMSE && bias <= limit.bias;
+    }
+};
+
+struct RegressionResult
+{
+    std::string scene;
+    unsigned int spp = 0;
+    ImageMetrics tolerance, shader, cpu;
+    ImageMetrics shaderDenoised, cpuDenoised; // The same renders after Renderer::Denoise
+    ImageMetrics dimmed; // The shader's render against the reference scaled by REGRESSION_DIMMED, which has to fail
+    double backendRMSE = -1.0; // Between the shader and the CPU, tonemapped
+    bool pass = false;
+    std::string error; // Why it couldn't be checked or the check is too loose, which fails it
+};
+
+
+// Every allocation is counted, so the scaling benchmark can tell whether the allocator holds threads back
+void* operator new(size_t size)
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size > 0 ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+// Over-aligned types, like the tracer's alignas(64) statistics, come here instead. MSVC's aligned blocks have to be
+// freed with _aligned_free, and aligned_alloc wants the size in whole alignments.
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    const size_t align = (size_t)alignment;
+#ifdef _MSC_VER
+    void* p = _aligned_malloc(size > 0 ? size : 1, align);
+#else
+    void* p = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align);
+#endif
+    if (p != nullptr)
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+#ifdef _MSC_VER
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept
+{
+    operator delete(p, alignment);
+}
+
+
+static bool ParseNumber(std::string_view text, double& value)
+{
+    auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return ec == std::errc() && ptr == text.data() + text.size();
+}
+
+static std::string ReferenceFile(const std::string& directory, const std::string& scene)
+{
+    return directory + "/" + std::filesystem::path(scene).stem().string() + ".pfm";
+}
+
+// Root mean square difference of the tonemapped images, as they'd be displayed
+static double DisplayRMSE(const Renderer& renderer, const std::vector<float>& reference)
+{
+    std::vector<float> row((size_t)renderer.w * 3);
+    double total = 0.0;
+
+    for (unsigned int y = 0; y < renderer.h; y++)
+    {
+        renderer.LinearRow(y, row.data(), renderer.w);
+        const float* ref = &reference[(size_t)y * renderer.w * 3];
+
+        for (unsigned int x = 0; x < renderer.w; x++)
+        {
+            Color
+                a = Color(row[x*3], row[x*3 + 1], row[x*3 + 2]).ACESFilm(),
+                b = Color(ref[x*3], ref[x*3 + 1], ref[x*3 + 2]).ACESFilm(),
+                d = a - b;
+            total += d.r * d.r + d.g * d.g + d.b * d.b;
+        }
+    }
+    return std::sqrt(total / ((double)renderer.w * renderer.h * 3));
+}
+
+// Linear rgb images w wide of the same size, rows top down
+static ImageMetrics Compare(const std::vector<float>& image, const std::vector<float>& reference, unsigned int w)
+{
+    constexpr double
+        RELMSE_EPSILON = 0.01, // Keeps dark pixels from dominating the relative error
+        FIREFLY_RATIO = 4.0,
+        FIREFLY_FLOOR = 0.5;
+    constexpr unsigned int BLOCK = 10; // Side of the pixel squares averaged for blurRMSE, partial ones are left out
+
+    double squared = 0.0, relative = 0.0;
+    double sumA[3] = {}, sumB[3] = {};
+    size_t fireflies = 0;
+    const size_t pixels = image.size() / 3;
+
+    const unsigned int blocksX = w / BLOCK, blocksY = (unsigned int)(pixels / w) / BLOCK;
+    std::vector<double> blocks((size_t)blocksX * blocksY * 6, 0.0); // Linear sums of the image's rgb, then the reference's
+
+    for (size_t i = 0; i < pixels; i++)
+    {
+        const float* a = &image[i*3];
+        const float* b = &reference[i*3];
+
+        Color
+            ta = Color(a[0], a[1], a[2]).ACESFilm(),
+            tb = Color(b[0], b[1], b[2]).ACESFilm(),
+            d = ta - tb;
+        squared += d.r * d.r + d.g * d.g + d.b * d.b;
+
+        const unsigned int bx = (unsigned int)(i % w) / BLOCK, by = (unsigned int)(i / w) / BLOCK;
+        double* block = bx < blocksX && by < blocksY ? &blocks[((size_t)by * blocksX + bx) * 6] : nullptr;
+
+        for (int c = 0; c < 3; c++)
+        {
+            const double e = (double)a[c] - b[c];
+            relative += e * e / ((double)b[c] * b[c] + RELMSE_EPSILON);
+            sumA[c] += a[c];
+            sumB[c] += b[c];
+
+            if (block != nullptr)
+            {
+                block[c] += a[c];
+                block[3 + c] += b[c];
+            }
+        }
+
+        const double
+            lumA = 0.2126 * a[0] + 0.7152 * a[1] + 0.0722 * a[2],
+            lumB = 0.2126 * b[0] + 0.7152 * b[1] + 0.0722 * b[2];
+        if (lumA > lumB * FIREFLY_RATIO + FIREFLY_FLOOR)
+            fireflies++;
+    }
+
+    ImageMetrics metrics;
+    metrics.rmse = std::sqrt(squared / ((double)pixels * 3));
+    metrics.relMSE = relative / ((double)pixels * 3);
+    metrics.fireflies = (double)fireflies / pixels;
+
+    double blurred = 0.0;
+    const double area = BLOCK * BLOCK;
+    for (size_t i = 0; i < blocks.size(); i += 6)
+    {
+        const double* block = &blocks[i];
+        const Color d =
+            Color(block[0] / area, block[1] / area, block[2] / area).ACESFilm() -
+            Color(block[3] / area, block[4] / area, block[5] / area).ACESFilm();
+        blurred += d.r * d.r + d.g * d.g + d.b * d.b;
+    }
+    metrics.blurRMSE = blocks.empty() ? 0.0 : std::sqrt(blurred / ((double)blocks.size() / 2));
+
+    // Noise averages out of a mean over the whole image, light that's lost or gained doesn't
+    metrics.bias = 0.0;
+    for (int c = 0; c < 3; c++)
+        metrics.bias = std::max(metrics.bias, std::abs(sumA[c] - sumB[c]) / std::max(sumB[c], 1e-6));
+    return metrics;
+}
+
+static std::string JsonString(const std::string& text)
+{
+    std::string out = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+// Numbers that weren't measured are null
+static std::string JsonNumber(double value)
+{
+    return value < 0.0 ? "null" : std::format("{:.6g}", value);
+}
+
+
+// How the benchmark renders, on the GPU and in the fast mode by default
+struct Backend
+{
+    bool cpu = false;
+    unsigned int threads = 0;
+    bool deterministic = false; // A sample at a time, see Renderer
+};
+
+// Renderer for the loaded scene at w by h, its own resolution for 0, null if the shader fails to load
+static std::unique_ptr<Renderer> MakeRenderer(const std::string& file, const CachedScene& scene, uint32_t seed, const Backend& backend, unsigned int w = 0, unsigned int h = 0)
+{
+    auto renderer = std::make_unique<Renderer>(w > 0 ? w : scene.view.settings.width, h > 0 ? h : scene.view.settings.height, seed, 0, backend.deterministic);
+    if (backend.cpu)
+    {
+        renderer->InitCpu(scene.view, backend.threads);
+        return renderer;
+    }
+
+    std::string error;
+    if (!renderer->Init(scene.view, error))
+    {
+        std::cerr << file << ": " << error << "\n";
+        return nullptr;
+    }
+    return renderer;
+}
+
+// Renderer for the scene at its own resolution, null if either fails to load
+static std::unique_ptr<Renderer> LoadScene(const std::string& file, CachedScene& scene, uint32_t seed, const Backend& backend)
+{
+    std::string error;
+    if (!scene.Load(file, error))
+    {
+        std::cerr << file << ": " << error << "\n";
+        return nullptr;
+    }
+    return MakeRenderer(file, scene, seed, backend);
+}
+
+// Passes of the scene's sample count until spp, then the accumulated image
+static std::vector<float> RenderLinear(Renderer& renderer, unsigned int passSamples, unsigned int spp, const std::string& progress = "")
+{
+    while (renderer.samples < spp)
+    {
+        renderer.Pass(std::min(passSamples, spp - renderer.samples));
+        if (!progress.empty())
+            std::cerr << std::format("\r{}: {}/{} spp", progress, renderer.samples, spp);
+    }
+    if (!progress.empty())
+        std::cerr << "\n";
+
+    std::vector<float> image((size_t)renderer.w * renderer.h * 3);
+    for (unsigned int y = 0; y < renderer.h; y++)
+        renderer.LinearRow(y, &image[(size_t)y * renderer.w * 3], renderer.w);
+    return image;
+}
+
+static bool SavePFM(const std::string& outFile, const std::vector<float>& image, unsigned int w, unsigned int h)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(outFile).parent_path(), ec);
+
+    HDRWriter writer;
+    bool saved = writer.Open(outFile, w, h, 3);
+    for (unsigned int y = 0; saved && y < h; y++)
+        saved &= writer.WriteRow(y, &image[(size_t)y * w * 3]);
+    saved &= writer.Close();
+
+    std::cerr << (saved ? "Saved " : "Saving failed, ") << outFile << "\n";
+    return saved;
+}
+
+static bool MakeReference(const std::string& file, const std::string& directory, unsigned int spp, const Backend& backend)
+{
+    CachedScene scene;
+    std::unique_ptr<Renderer> renderer = LoadScene(file, scene, REFERENCE_SEED, backend);
+    if (!renderer)
+        return false;
+
+    const std::vector<float> image = RenderLinear(*renderer, std::max(1u, scene.view.settings.samples), spp, file);
+    return SavePFM(ReferenceFile(directory, file), image, renderer->w, renderer->h);
+}
+
+static std::string ToleranceFile(const std::string& directory, const std::string& scene)
+{
+    return directory + "/" + std::filesystem::path(scene).stem().string() + ".tolerance";
+}
+
+// "key value" lines, the sample count the tolerances hold for and the largest metrics that pass, # starts a comment
+static bool ReadTolerance(const std::string& filename, unsigned int& spp, ImageMetrics& limit)
+{
+    std::ifstream file(filename);
+    std::string line, key;
+    double value;
+    int found = 0;
+
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        if (line.starts_with("#") || !(fields >> key >> value))
+            continue;
+
+        if (key == "spp")            { spp = (unsigned int)value; found |= 1; }
+        else if (key == "rmse")      { limit.rmse = value; found |= 2; }
+        else if (key == "relMSE")    { limit.relMSE = value; found |= 4; }
+        else if (key == "fireflies") { limit.fireflies = value; found |= 8; }
+        else if (key == "blurRMSE")  { limit.blurRMSE = value; found |= 16; }
+        else if (key == "bias")      { limit.bias = value; found |= 32; }
+    }
+    return found == 63 && spp > 0;
+}
+
+// Reference for the regression test, then the fixed sample count render it's checked against with REGRESSION_SEEDS
+// seeds, from the benchmark's on. The spread of their metrics becomes the tolerances.
+static bool MakeRegressionReference(const std::string& file, const std::string& directory, unsigned int referenceSpp, unsigned int spp, const Backend& backend)
+{
+    CachedScene scene;
+    std::string error;
+    if (!scene.Load(file, error))
+    {
+        std::cerr << file << ": " << error << "\n";
+        return false;
+    }
+
+    const unsigned int passSamples = std::max(1u, scene.view.settings.samples);
+    std::unique_ptr<Renderer> renderer = MakeRenderer(file, scene, REFERENCE_SEED, backend, REGRESSION_W, REGRESSION_H);
+    if (!renderer)
+        return false;
+
+    const std::vector<float> reference = RenderLinear(*renderer, passSamples, referenceSpp, file);
+    if (!SavePFM(ReferenceFile(directory, file), reference, REGRESSION_W, REGRESSION_H))
+        return false;
+
+    std::vector<ImageMetrics> measured;
+    for (uint32_t s = 0; s < REGRESSION_SEEDS; s++)
+    {
+        renderer = MakeRenderer(file, scene, BENCHMARK_SEED + s, backend, REGRESSION_W, REGRESSION_H);
+        measured.push_back(Compare(RenderLinear(*renderer, passSamples, spp, std::format("{} seed {}", file, s + 1)), reference, REGRESSION_W));
+    }
+
+    // Mean plus REGRESSION_DEVIATIONS standard deviations over the seeds, and at least a little room for metrics that
+    // came out the same on every seed
+    auto Limit = [&](double ImageMetrics::* metric, double room) {
+        double mean = 0.0, variance = 0.0;
+        for (const ImageMetrics& m : measured)
+            mean += m.*metric / measured.size();
+        for (const ImageMetrics& m : measured)
+            variance += (m.*metric - mean) * (m.*metric - mean) / (measured.size() - 1);
+        return std::max(mean + REGRESSION_DEVIATIONS * std::sqrt(variance), mean + room);
+    };
+
+    const std::string toleranceFile = ToleranceFile(directory, file);
+    std::ofstream out(toleranceFile);
+    out << std::format("# Measured on {} at {} spp, the mean over {} seeds plus {} standard deviations\n",
+        backend.cpu ? "the CPU" : "the shader", spp, REGRESSION_SEEDS, REGRESSION_DEVIATIONS);
+    out << std::format("spp {}\n", spp);
+    out << std::format("rmse {:.6g}\n", Limit(&ImageMetrics::rmse, 0.002));
+    out << std::format("relMSE {:.6g}\n", Limit(&ImageMetrics::relMSE, 0.005));
+    out << std::format("fireflies {:.6g}\n", Limit(&ImageMetrics::fireflies, 0.0005));
+    out << std::format("blurRMSE {:.6g}\n", Limit(&ImageMetrics::blurRMSE, 0.001));
+    out << std::format("bias {:.6g}\n", Limit(&ImageMetrics::bias, 0.001));
+
+    if (!out.flush())
+    {
+        std::cerr << "Can't write " << toleranceFile << "\n";
+        return false;
+    }
+    std::cerr << "Saved " << toleranceFile << "\n";
+    return true;
+}
+
+// Renders the scene to the tolerances' sample count with the shader and on the CPU, both with the benchmark's seed, and
+// checks each against the reference. The two trace the same paths, so they also have to be closer to each other than
+// the shader is to the reference, and denoising has to bring both closer to it. The shader's render also has to fail
+// against the reference dimmed by REGRESSION_DIMMED, or the tolerances couldn't catch a loss of energy. The references
+// are kept with the scenes, so one that's missing or unreadable fails the scene rather than being made from the build
+// under test.
+static bool RegressScene(const std::string& file, const std::string& directory, const Backend& backend, RegressionResult& result)
+{
+    result.scene = file;
+
+    CachedScene scene;
+    std::string error;
+    if (!scene.Load(file, error))
+    {
+        std::cerr << file << ": " << error << "\n";
+        return false;
+    }
+
+    unsigned int refW, refH;
+    int refChannels;
+    std::vector<float> reference;
+    const std::string referenceFile = ReferenceFile(directory, file), toleranceFile = ToleranceFile(directory, file);
+
+    if (!ReadPFM(referenceFile, refW, refH, refChannels, reference) || refW != REGRESSION_W || refH != REGRESSION_H || refChannels != 3)
+        result.error = std::format("no {}x{} reference at {}", REGRESSION_W, REGRESSION_H, referenceFile);
+    else if (!ReadTolerance(toleranceFile, result.spp, result.tolerance))
+        result.error = "no tolerances at " + toleranceFile;
+
+    if (!result.error.empty())
+    {
+        std::cerr << std::format("{}: FAIL, {}\n", file, result.error);
+        return true;
+    }
+
+    const unsigned int passSamples = std::max(1u, scene.view.settings.samples);
+    std::unique_ptr<Renderer> shader = MakeRenderer(file, scene, BENCHMARK_SEED, Backend{ false, 0, backend.deterministic }, REGRESSION_W, REGRESSION_H);
+    std::unique_ptr<Renderer> cpu = MakeRenderer(file, scene, BENCHMARK_SEED, Backend{ true, backend.threads, backend.deterministic }, REGRESSION_W, REGRESSION_H);
+    if (!shader)
+        return false;
+
+    const std::vector<float>
+        shaderImage = RenderLinear(*shader, passSamples, result.spp, file + " shader"),
+        cpuImage = RenderLinear(*cpu, passSamples, result.spp, file + " CPU");
+
+    result.shader = Compare(shaderImage, reference, REGRESSION_W);
+    result.cpu = Compare(cpuImage, reference, REGRESSION_W);
+    result.backendRMSE = Compare(cpuImage, shaderImage, REGRESSION_W).rmse;
+
+    std::vector<float> dimmed = reference;
+    for (float& v : dimmed)
+        v *= REGRESSION_DIMMED;
+    result.dimmed = Compare(shaderImage, dimmed, REGRESSION_W);
+    if (result.dimmed.Within(result.tolerance))
+        result.error = std::format("tolerances too loose, the reference scaled by {} passes them", REGRESSION_DIMMED);
+
+    shader->Denoise();
+    cpu->Denoise();
+    result.shaderDenoised = Compare(RenderLinear(*shader, passSamples, result.spp), reference, REGRESSION_W);
+    result.cpuDenoised = Compare(RenderLinear(*cpu, passSamples, result.spp), reference, REGRESSION_W);
+
+    result.pass = result.shader.Within(result.tolerance) && result.cpu.Within(result.tolerance) && result.backendRMSE <= result.shader.rmse &&
+        result.shaderDenoised.rmse < result.shader.rmse && result.cpuDenoised.rmse < result.cpu.rmse && !result.dimmed.Within(result.tolerance);
+
+    std::cerr << std::format("{}: {}, RMSE {:.5f} shader, {:.5f} CPU, {:.5f} between them (at most {:.5f}), bias {:.5f} shader, {:.5f} CPU, "
+        "{:.5f} dimmed (at most {:.5f}), denoised {:.5f} shader, {:.5f} CPU\n",
+        file, result.pass ? "pass" : "FAIL", result.shader.rmse, result.cpu.rmse, result.backendRMSE, result.tolerance.rmse,
+        result.shader.bias, result.cpu.bias, result.dimmed.bias, result.tolerance.bias, result.shaderDenoised.rmse, result.cpuDenoised.rmse);
+    return true;
+}
+
+static bool RunScene(const std::string& file, const std::string& references, unsigned int frames, double targetRMSE, double maxTime, const Backend& backend, SceneResult& result)
+{
+    using Clock = std::chrono::steady_clock;
+
+    memoryUsage.ResetPeaks();
+
+    CachedScene scene;
+    std::unique_ptr<Renderer> renderer = LoadScene(file, scene, BENCHMARK_SEED, backend);
+    if (!renderer)
+        return false;
+
+    result.scene = file;
+    result.w = renderer->w;
+    result.h = renderer->h;
+    result.passSamples = std::max(1u, scene.view.settings.samples);
+
+    // The first pass pays for compiling the shader and uploading the scene
+    renderer->Pass(result.passSamples);
+    renderer->Reset();
+
+    result.raysPerSample = renderer->MeanBounces(result.passSamples) + 1.0;
+
+    std::cerr << std::format("{}: timing {} passes\n", file, frames);
+    for (unsigned int f = 0; f < frames; f++)
+    {
+        const Clock::time_point start = Clock::now();
+        renderer->Pass(result.passSamples);
+        result.frameMs.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+
+    double total = 0.0;
+    for (double ms : result.frameMs)
+        total += ms;
+    result.samplesPerSecond = (double)result.w * result.h * result.passSamples * frames / (total / 1000.0);
+
+    // Only the passes are timed, not the comparisons
+    unsigned int refW, refH;
+    int refChannels;
+    std::vector<float> reference;
+    const std::string referenceFile = ReferenceFile(references, file);
+
+    if (!ReadPFM(referenceFile, refW, refH, refChannels, reference) || refW != result.w || refH != result.h || refChannels != 3)
+        std::cerr << std::format("{}: no reference at {}, make one with --make-references\n", file, referenceFile);
+    else
+    {
+        const MemoryCharge referenceMemory(MEMORY_SCRATCH, MemoryCharge::Of(reference));
+        renderer->Reset();
+        double elapsed = 0.0;
+
+        while (elapsed < maxTime)
+        {
+            const Clock::time_point start = Clock::now();
+            renderer->Pass(result.passSamples);
+            elapsed += std::chrono::duration<double>(Clock::now() - start).count();
+
+            result.finalRMSE = DisplayRMSE(*renderer, reference);
+            if (result.finalRMSE <= targetRMSE)
+            {
+                result.timeToRMSE = elapsed;
+                result.sppToRMSE = renderer->samples;
+                break;
+            }
+        }
+        std::cerr << std::format("{}: RMSE {:.5f} after {} spp, {:.2f} s\n", file, result.finalRMSE, renderer->samples, elapsed);
+    }
+
+    for (int c = 0; c < MEMORY_CATEGORIES; c++)
+    {
+        result.memory[c] = memoryUsage.Current((MemoryCategory)c);
+        result.memoryPeak[c] = memoryUsage.Peak((MemoryCategory)c);
+    }
+    result.memoryTotal = memoryUsage.Total();
+    result.memoryTotalPeak = memoryUsage.TotalPeak();
+    std::cerr << std::format("{}: memory {}\n", file, memoryUsage.Summary());
+
+    return true;
+}
+
+static std::string ToJson(const std::vector<SceneResult>& results, double targetRMSE, const std::string& device, bool deterministic)
+{
+    std::ostringstream out;
+    out << "{\n";
+    out << std::format("  \"benchmarkVersion\": {},\n", BENCHMARK_VERSION);
+    out << std::format("  \"device\": {},\n", JsonString(device));
+    out << std::format("  \"deterministic\": {},\n", deterministic ? "true" : "false");
+    out << std::format("  \"targetRMSE\": {},\n", JsonNumber(targetRMSE));
+    out << "  \"scenes\": [";
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const SceneResult& r = results[i];
+
+        std::vector<double> sorted = r.frameMs;
+        std::sort(sorted.begin(), sorted.end());
+        double mean = 0.0;
+        for (double ms : sorted)
+            mean += ms / sorted.size();
+
+        out << (i > 0 ? ",\n" : "\n") << "    {\n";
+        out << std::format("      \"scene\": {},\n", JsonString(r.scene));
+        out << std::format("      \"width\": {}, \"height\": {}, \"samplesPerPass\": {}, \"frames\": {},\n", r.w, r.h, r.passSamples, r.frameMs.size());
+        out << std::format("      \"frameMs\": {{ \"mean\": {}, \"median\": {}, \"min\": {}, \"max\": {} }},\n",
+            JsonNumber(mean), JsonNumber(sorted[sorted.size() / 2]), JsonNumber(sorted.front()), JsonNumber(sorted.back()));
+        out << std::format("      \"samplesPerSecond\": {},\n", JsonNumber(r.samplesPerSecond));
+        out << std::format("      \"raysPerSample\": {},\n", JsonNumber(r.raysPerSample));
+        out << std::format("      \"mraysPerSecond\": {},\n", JsonNumber(r.samplesPerSecond * r.raysPerSample / 1e6));
+        out << std::format("      \"timeToRMSE\": {},\n", JsonNumber(r.timeToRMSE));
+        out << std::format("      \"sppToRMSE\": {},\n", r.timeToRMSE < 0.0 ? "null" : std::to_string(r.sppToRMSE));
+        out << std::format("      \"finalRMSE\": {},\n", JsonNumber(r.finalRMSE));
+
+        out << "      \"memory\": {";
+        for (int c = 0; c < MEMORY_CATEGORIES; c++)
+            out << std::format(" \"{}\": {{ \"current\": {}, \"peak\": {} }},", memoryCategoryNames[c], r.memory[c], r.memoryPeak[c]);
+        out << std::format(" \"total\": {{ \"current\": {}, \"peak\": {} }} }}\n", r.memoryTotal, r.memoryTotalPeak);
+        out << "    }";
+    }
+
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+static std::string MetricsToJson(const ImageMetrics& m)
+{
+    return std::format("{{ \"rmse\": {}, \"relMSE\": {}, \"fireflies\": {}, \"blurRMSE\": {}, \"bias\": {} }}",
+        JsonNumber(m.rmse), JsonNumber(m.relMSE), JsonNumber(m.fireflies), JsonNumber(m.blurRMSE), JsonNumber(m.bias));
+}
+
+static std::string RegressionToJson(const std::vector<RegressionResult>& results, const std::string& device)
+{
+    bool pass = true;
+    for (const RegressionResult& r : results)
+        pass &= r.pass;
+
+    std::ostringstream out;
+    out << "{\n";
+    out << std::format("  \"benchmarkVersion\": {},\n", BENCHMARK_VERSION);
+    out << std::format("  \"device\": {},\n", JsonString(device));
+    out << std::format("  \"width\": {}, \"height\": {},\n", REGRESSION_W, REGRESSION_H);
+    out << std::format("  \"pass\": {},\n", pass ? "true" : "false");
+    out << "  \"scenes\": [";
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const RegressionResult& r = results[i];
+
+        out << (i > 0 ? ",\n" : "\n") << "    {\n";
+        out << std::format("      \"scene\": {}, \"spp\": {}, \"pass\": {},\n", JsonString(r.scene), r.spp, r.pass ? "true" : "false");
+        out << std::format("      \"tolerance\": {},\n", MetricsToJson(r.tolerance));
+        out << std::format("      \"shader\": {},\n", MetricsToJson(r.shader));
+        out << std::format("      \"cpu\": {},\n", MetricsToJson(r.cpu));
+        out << std::format("      \"shaderDenoised\": {},\n", MetricsToJson(r.shaderDenoised));
+        out << std::format("      \"cpuDenoised\": {},\n", MetricsToJson(r.cpuDenoised));
+        out << std::format("      \"dimmed\": {},\n", MetricsToJson(r.dimmed));
+        out << std::format("      \"backendRMSE\": {},\n", JsonNumber(r.backendRMSE));
+        out << std::format("      \"error\": {}\n", r.error.empty() ? "null" : JsonString(r.error));
+        out << "    }";
+    }
+
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+static std::string KernelsToJson(const std::vector<KernelResult>& results)
+{
+    std::ostringstream out;
+    out << "{\n";
+    out << std::format("  \"benchmarkVersion\": {},\n", BENCHMARK_VERSION);
+    out << std::format("  \"simd\": {},\n", JsonString(INTERSECT_SSE ? "SSE2" : "none"));
+    out << std::format("  \"raysPerRun\": {},\n", KernelBenchmark::RAYS);
+    out << "  \"kernels\": [";
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const KernelResult& r = results[i];
+
+        out << (i > 0 ? ",\n" : "\n");
+        out << std::format("    {{ \"kernel\": {}, \"rays\": {}, \"hitRate\": {}, \"scalarNs\": {}, \"simdNs\": {}, \"speedup\": {}, \"surfaceNs\": {}, \"mismatches\": {} }}",
+            JsonString(r.kernel), JsonString(rayDistributionNames[r.rays]), JsonNumber(r.hitRate),
+            JsonNumber(r.scalarNs), JsonNumber(r.simdNs), JsonNumber(r.scalarNs / r.simdNs), JsonNumber(r.surfaceNs), r.mismatches);
+    }
+
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+static std::string ScalingToJson(const ScalingBenchmark& benchmark, const std::vector<std::pair<std::string, std::vector<ScalingPoint>>>& scenes)
+{
+    std::ostringstream out;
+    out << "{\n";
+    out << std::format("  \"benchmarkVersion\": {},\n", BENCHMARK_VERSION);
+    out << std::format("  \"hardwareThreads\": {},\n", benchmark.cores);
+    out << "  \"peakGBs\": [";
+    for (size_t t = 0; t < benchmark.threadCounts.size(); t++)
+        out << std::format("{}{{ \"threads\": {}, \"GBs\": {} }}", t > 0 ? ", " : "", benchmark.threadCounts[t], JsonNumber(benchmark.peakGBs[t]));
+    out << "],\n";
+    out << "  \"scenes\": [";
+
+    for (size_t i = 0; i < scenes.size(); i++)
+    {
+        out << (i > 0 ? ",\n" : "\n") << "    {\n";
+        out << std::format("      \"scene\": {},\n", JsonString(scenes[i].first));
+        out << "      \"points\": [";
+
+        const std::vector<ScalingPoint>& points = scenes[i].second;
+        for (size_t j = 0; j < points.size(); j++)
+        {
+            const ScalingPoint& p = points[j];
+            out << (j > 0 ? ",\n" : "\n");
+            out << std::format("        {{ \"width\": {}, \"height\": {}, \"threads\": {}, \"passMs\": {}, \"traceMs\": {}, \"spawnMs\": {}, "
+                "\"samplesPerSecond\": {}, \"speedup\": {}, \"efficiency\": {}, \"bandwidthGBs\": {}, \"allocationsPerPass\": {}, \"limit\": {} }}",
+                p.w, p.h, p.threads, JsonNumber(p.passMs), JsonNumber(p.traceMs), JsonNumber(p.spawnMs),
+                JsonNumber(p.samplesPerSecond), JsonNumber(p.speedup), JsonNumber(p.efficiency), JsonNumber(p.bandwidthGBs),
+                JsonNumber(p.allocationsPerPass), JsonString(p.limit));
+        }
+        out << "\n      ]\n    }";
+    }
+
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+static bool WriteJson(const std::string& json, const std::string& outFile)
+{
+    if (outFile.empty())
+    {
+        std::cout << json;
+        return true;
+    }
+
+    std::ofstream file(outFile);
+    if (!(file << json))
+    {
+        std::cerr << "Can't write " << outFile << "\n";
+        return false;
+    }
+    std::cerr << "Saved " << outFile << "\n";
+    return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> scenes;
+    std::string outFile, references = "Scenes/References", traceFile;
+    double frames = 64, targetRMSE = 0.01, maxTime = 120, referenceSpp = 0, regressionSpp = REGRESSION_SPP, cpuThreads = 0, scalingThreads = 0;
+    bool kernels = false, regress = false, scaling = false;
+    Backend backend;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view option = argv[i];
+        double* value = nullptr;
+
+        if (!option.starts_with("--"))
+        {
+            scenes.push_back(argv[i]);
+            continue;
+        }
+        else if (option == "--out" && i + 1 < argc)
+        {
+            outFile = argv[++i];
+            continue;
+        }
+        else if (option == "--kernels")
+        {
+            kernels = true;
+            continue;
+        }
+        else if (option == "--regress")
+        {
+            regress = true;
+            continue;
+        }
+        else if (option == "--deterministic")
+        {
+            backend.deterministic = true;
+            continue;
+        }
+        else if (option == "--trace" && i + 1 < argc)
+        {
+            traceFile = argv[++i];
+            continue;
+        }
+        else if (option == "--references" && i + 1 < argc)
+        {
+            references = argv[++i];
+            continue;
+        }
+        else if (option == "--frames")   value = &frames;
+        else if (option == "--rmse")     value = &targetRMSE;
+        else if (option == "--max-time") value = &maxTime;
+        else if (option == "--make-references") value = &referenceSpp;
+        else if (option == "--spp")      value = &regressionSpp;
+        else if (option == "--cpu")    { value = &cpuThreads; backend.cpu = true; }
+        else if (option == "--scaling") { value = &scalingThreads; scaling = true; }
+
+        if (value == nullptr || i + 1 >= argc)
+        {
+            std::cerr << "Unknown or incomplete option '" << option << "'\n" << usage;
+            return 1;
+        }
+        if (!ParseNumber(argv[++i], *value) || *value < 0.0)
+        {
+            std::cerr << "Bad value '" << argv[i] << "' for " << option << "\n";
+            return 1;
+        }
+    }
+
+    if (kernels && !traceFile.empty())
+    {
+        std::cerr << "--kernels times single calls, far too short to trace\n";
+        return 1;
+    }
+
+    // Saved on the way out, from any return below
+    const TraceSession session(traceFile, "Main", std::cerr);
+
+    if (kernels)
+    {
+        KernelBenchmark benchmark;
+        const std::vector<KernelResult> results = benchmark.Run();
+
+        size_t mismatches = 0;
+        for (const KernelResult& r : results)
+            mismatches += r.mismatches;
+        if (mismatches > 0)
+            std::cerr << std::format("The four wide kernels disagree with the scalar ones on {} rays\n", mismatches);
+
+        return WriteJson(KernelsToJson(results), outFile) ? 0 : 1;
+    }
+
+    if (scenes.empty())
+        scenes = { "Scenes/Default.scene", "Scenes/Box.scene", "Scenes/Mesh.scene" };
+
+    backend.threads = (unsigned int)cpuThreads;
+
+    if (scaling)
+    {
+        ScalingBenchmark benchmark((unsigned int)scalingThreads);
+        std::vector<std::pair<std::string, std::vector<ScalingPoint>>> results;
+
+        for (const std::string& file : scenes)
+        {
+            CachedScene scene;
+            std::string error;
+            if (!scene.Load(file, error))
+            {
+                std::cerr << file << ": " << error << "\n";
+                return 1;
+            }
+            results.emplace_back(file, benchmark.Run(file, scene.view, std::max(1u, scene.view.settings.samples), BENCHMARK_SEED));
+        }
+        return WriteJson(ScalingToJson(benchmark, results), outFile) ? 0 : 1;
+    }
+    const std::string regressionReferences = references + "/Regression";
+
+    if (referenceSpp > 0)
+    {
+        bool success = true;
+        for (const std::string& scene : scenes)
+            success &= regress ?
+                MakeRegressionReference(scene, regressionReferences, (unsigned int)referenceSpp, std::max(1u, (unsigned int)regressionSpp), backend) :
+                MakeReference(scene, references, (unsigned int)referenceSpp, backend);
+        return success ? 0 : 1;
+    }
+
+    if (regress)
+    {
+        std::vector<RegressionResult> results;
+        bool pass = true;
+        for (const std::string& scene : scenes)
+        {
+            RegressionResult result;
+            if (!RegressScene(scene, regressionReferences, backend, result))
+                return 1;
+            pass &= result.pass;
+            results.push_back(std::move(result));
+        }
+
+        sf::Context context;
+        const char* device = (const char*)glGetString(GL_RENDERER);
+        if (!WriteJson(RegressionToJson(results, device != nullptr ? device : ""), outFile))
+            return 1;
+        return pass ? 0 : 1;
+    }
+
+    if (frames < 1)
+    {
+        std::cerr << "--frames needs at least one\n";
+        return 1;
+    }
+
+    std::vector<SceneResult> results;
+    for (const std::string& scene : scenes)
+    {
+        SceneResult result;
+        if (!RunScene(scene, references, (unsigned int)frames, targetRMSE, maxTime, backend, result))
+            return 1;
+        results.push_back(std::move(result));
+    }
+
+    if (backend.cpu)
+        return WriteJson(ToJson(results, targetRMSE, std::format("CPU, {} threads", cpu::Tracer(backend.threads).Threads()), backend.deterministic), outFile) ? 0 : 1;
+
+    sf::Context context;
+    const char* device = (const char*)glGetString(GL_RENDERER);
+    return WriteJson(ToJson(results, targetRMSE, device != nullptr ? device : "", backend.deterministic), outFile) ? 0 : 1;
+}
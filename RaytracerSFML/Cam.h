@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Vec3.h"
+
+
+struct Cam
+{
+    float fov;
+    bool perspective;
+    float speed;
+
+    Vec3
+        origin,
+        fwd, right, up;
+
+
+    Cam(float fov, bool perspective, float speed, const Vec3& origin, const Vec3& fwd) :
+        fov(fov), perspective(perspective), speed(speed), origin(origin), fwd(fwd)
+    {
+        UpdateRotation();
+    }
+
+    void UpdateRotation()
+    {
+        fwd.Normalize();
+
+        right = fwd.Cross({ 0, -1, 0 });
+        right.Normalize();
+
+        up = fwd.Cross(right);
+        up.Normalize();
+    }
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "Renderer.h"
+#include "HDRImage.h"
+#include "MappedFile.h"
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <type_traits>
+
+
+// Accumulation state of an unfinished batch render, so a job that was stopped can continue where it left off.
+// Written into a mapped temporary file that's flushed and renamed over the last checkpoint, so a checkpoint on disk is
+// always complete. Bump the version whenever the layout changes.
+constexpr uint32_t
+    CHECKPOINT_MAGIC = 0x4B435452, // "RTCK"
+    CHECKPOINT_VERSION = 1;
+
+struct CheckpointHeader
+{
+    uint32_t magic, version, headerSize, reserved;
+
+    uint64_t job; // Hash of everything the render's output depends on, a checkpoint only resumes the same job
+
+    uint32_t tile, passes, samples, reserved2; // Tile being rendered and its accumulation so far
+    uint64_t draws;                            // Seeds taken from the renderer's generator
+    double elapsed;                            // Seconds rendered before the checkpoint
+
+    uint64_t stateValues;                      // Doubles of renderer state following the header
+    uint64_t outputEnd, outputPixels, outputChunks; // Progress of the output file, the chunk offsets follow the state
+};
+
+static_assert(std::is_trivially_copyable_v<CheckpointHeader>);
+
+
+struct Checkpoint
+{
+    CheckpointHeader header = {};
+    HDRWriter::Progress output;
+
+
+    // Replaces the checkpoint, fails without touching it if anything can't be written
+    static bool Save(const std::string& filename, uint64_t job, uint32_t tile, double elapsed, const Renderer& renderer, const HDRWriter::Progress* output)
+    {
+        CheckpointHeader header;
+        std::memset((void*)&header, 0, sizeof(header));
+
+        header.magic = CHECKPOINT_MAGIC;
+        header.version = CHECKPOINT_VERSION;
+        header.headerSize = sizeof(CheckpointHeader);
+        header.job = job;
+        header.tile = tile;
+        header.passes = renderer.passes;
+        header.samples = renderer.samples;
+        header.draws = renderer.Draws();
+        header.elapsed = elapsed;
+        header.stateValues = renderer.StateSize();
+
+        if (output != nullptr)
+        {
+            header.outputEnd = output->end;
+            header.outputPixels = output->pixelsWritten;
+            header.outputChunks = output->offsets.size();
+        }
+
+        const std::string tempFile = filename + ".tmp";
+        MappedOutputFile file;
+        if (!file.Create(tempFile, sizeof(header) + (header.stateValues + header.outputChunks) * 8))
+            return false;
+
+        // Filled straight into the mapping, the state can be as large as the image
+        uint8_t* at = file.data;
+        std::memcpy(at, &header, sizeof(header));
+        at += sizeof(header);
+
+        renderer.SaveState((double*)at);
+        at += header.stateValues * sizeof(double);
+
+        if (header.outputChunks > 0)
+            std::memcpy(at, output->offsets.data(), header.outputChunks * sizeof(uint64_t));
+
+        bool success = file.Flush();
+        file.Close();
+
+        std::error_code ec;
+        if (success)
+            std::filesystem::rename(tempFile, filename, ec);
+        if (!success || ec)
+        {
+            std::filesystem::remove(tempFile, ec);
+            return false;
+        }
+        return true;
+    }
+
+    // Reads the checkpoint if it belongs to job and holds stateSize values of renderer state, error says why not otherwise.
+    // The state stays mapped until Restore or Close, and isn't when this fails.
+    bool Load(const std::string& filename, uint64_t job, size_t stateSize, std::string& error)
+    {
+        auto Fail = [&](const char* message) {
+            error = message;
+            file.Close();
+            return false;
+        };
+
+        if (!file.Open(filename))
+            return Fail("no checkpoint");
+
+        if (file.size < sizeof(CheckpointHeader))
+            return Fail("damaged checkpoint");
+
+        std::memcpy((void*)&header, file.data, sizeof(header));
+
+        if (header.magic != CHECKPOINT_MAGIC || header.version != CHECKPOINT_VERSION || header.headerSize != sizeof(CheckpointHeader))
+            return Fail("checkpoint from another version");
+        if (header.job != job)
+            return Fail("checkpoint is for a different scene or settings");
+        if (header.stateValues != stateSize || header.stateValues > file.size || header.outputChunks > file.size ||
+            file.size != sizeof(header) + (header.stateValues + header.outputChunks) * 8)
+            return Fail("damaged checkpoint");
+
+        const uint64_t* chunks = (const uint64_t*)(file.data + sizeof(header) + header.stateValues * sizeof(double));
+
+        output.end = header.outputEnd;
+        output.pixelsWritten = header.outputPixels;
+        output.offsets.assign(chunks, chunks + header.outputChunks);
+        return true;
+    }
+
+    // Continues the accumulation in renderer, which has to be on header.tile already
+    void Restore(Renderer& renderer)
+    {
+        renderer.RestoreState((const double*)(file.data + sizeof(header)), header.passes, header.samples, header.draws);
+        file.Close();
+    }
+
+    // Unmaps a loaded checkpoint that won't be restored
+    void Close()
+    {
+        file.Close();
+    }
+
+
+private:
+    MappedFile file;
+};
@@ -0,0 +1,947 @@
+#pragma once
+
+#include "Intersect.h"
+#include "Scene.h"
+#include "Cam.h"
+#include "AOV.h"
+#include "Trace.h"
+
+#include <vector>
+#include <string>
+#include <format>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+// Ray statistics are plain increments of per thread counters, lost in run to run noise on the bundled scenes.
+// Build with RAY_STATS 0 to leave them out entirely.
+#ifndef RAY_STATS
+    #define RAY_STATS 1
+#endif
+
+#if RAY_STATS
+    #define RAY_STAT(statement) statement
+#else
+    #define RAY_STAT(statement)
+#endif
+
+
+// The path tracer of RaytracerShader.frag on the CPU, for machines without a usable GPU and for measuring what the
+// shader can't: how many tests each ray takes, where paths end, how the work scales over threads.
+// Everything is ported in single precision and in the same order, with the same random number streams, so both trace
+// the same paths up to floating point differences between the GPU and CPU.
+namespace cpu
+{
+    using Float4v = sf::Glsl::Vec4;
+
+    // Same as RaytracerShader.frag
+    constexpr float
+        PI = 3.1415926536f,
+        riAir = 1.000293f;
+
+
+    // Counted by each thread on its own while tracing and summed after
+    struct alignas(64) RayStats
+    {
+        static constexpr int
+            GROUPS = SHAPE_TYPES + 1, // Every shape type, then meshes
+            BOUNCE_BINS = 32;         // The last also counts paths with more bounces
+
+        uint64_t
+            boundsPassed[GROUPS] = {}, // Bounding sphere checks, planes have none
+            boundsFailed[GROUPS] = {},
+            tests[GROUPS] = {},        // Primitive tests, triangles for meshes
+            hits[GROUPS] = {},         // Tests that found a hit, whether it was the closest or not
+            nodeVisits = 0,            // Mesh BVH nodes
+            rays = 0,                  // Scene traversals, one per bounce
+            paths = 0,
+            escaped = 0,               // Paths that ended in the sky
+            rouletteKills = 0,         // Paths ended by Russian roulette
+            internalReflections = 0,   // Refractions turned into total internal reflection
+            bounces[BOUNCE_BINS] = {}; // Paths by the number of surfaces they hit
+
+
+        void Add(const RayStats& s)
+        {
+            for (int g = 0; g < GROUPS; g++)
+            {
+                boundsPassed[g] += s.boundsPassed[g];
+                boundsFailed[g] += s.boundsFailed[g];
+                tests[g] += s.tests[g];
+                hits[g] += s.hits[g];
+            }
+            for (int b = 0; b < BOUNCE_BINS; b++)
+                bounces[b] += s.bounces[b];
+
+            nodeVisits += s.nodeVisits;
+            rays += s.rays;
+            paths += s.paths;
+            escaped += s.escaped;
+            rouletteKills += s.rouletteKills;
+            internalReflections += s.internalReflections;
+        }
+
+        static const char* GroupName(int g)
+        {
+            return g < SHAPE_TYPES ? shapeInfo[g].keyword : "Mesh";
+        }
+
+        uint64_t Tests() const
+        {
+            uint64_t total = 0;
+            for (int g = 0; g < GROUPS; g++)
+                total += tests[g];
+            return total;
+        }
+
+        double MeanBounces() const
+        {
+            uint64_t total = 0;
+            for (int b = 0; b < BOUNCE_BINS; b++)
+                total += bounces[b] * b;
+            return paths > 0 ? (double)total / paths : 0.0;
+        }
+
+        // One line for following a render pass by pass
+        std::string Line() const
+        {
+            const double perRay = rays > 0 ? 1.0 / rays : 0.0;
+            return std::format("{:.2f} rays per path, {:.2f} tests and {:.2f} BVH nodes per ray, {:.2f} bounces, {:.1f}% roulette, {:.1f}% sky",
+                paths > 0 ? (double)rays / paths : 0.0, Tests() * perRay, nodeVisits * perRay, MeanBounces(),
+                paths > 0 ? 100.0 * rouletteKills / paths : 0.0, paths > 0 ? 100.0 * escaped / paths : 0.0);
+        }
+
+        // Everything, one line per statistic
+        std::string Summary() const
+        {
+            std::string out = std::format("{} paths, {} rays, {} BVH nodes, {} roulette kills, {} total internal reflections, {} escaped\n",
+                paths, rays, nodeVisits, rouletteKills, internalReflections, escaped);
+
+            for (int g = 0; g < GROUPS; g++)
+            {
+                const uint64_t checks = boundsPassed[g] + boundsFailed[g];
+                if (checks == 0 && tests[g] == 0)
+                    continue;
+
+                out += std::format("  {:<7}", GroupName(g));
+                if (checks > 0)
+                    out += std::format(" bounds {} passed / {} failed, {:.1f}% pass,", boundsPassed[g], boundsFailed[g], 100.0 * boundsPassed[g] / checks);
+                out += std::format(" {} tests, {} hits", tests[g], hits[g]);
+                if (tests[g] > 0)
+                    out += std::format(", {:.1f}% hit", 100.0 * hits[g] / tests[g]);
+                out += "\n";
+            }
+
+            int last = BOUNCE_BINS - 1;
+            while (last > 0 && bounces[last] == 0)
+                last--;
+
+            out += "  Bounces:";
+            for (int b = 0; b <= last; b++)
+                out += std::format(" {}{}:{}", b, b == BOUNCE_BINS - 1 ? "+" : "", bounces[b]);
+            return out + "\n";
+        }
+    };
+
+
+    inline float Clamp(float x, float a, float b)
+    {
+        return std::min(std::max(x, a), b);
+    }
+
+    inline float Smoothstep(float e0, float e1, float x)
+    {
+        float t = Clamp((x - e0) / (e1 - e0), 0.0f, 1.0f);
+        return t * t * (3.0f - 2.0f * t);
+    }
+
+    inline Float3 Lerp(const Float3& p0, const Float3& p1, float t)
+    {
+        return p0 * (1.0f - t) + p1 * t;
+    }
+
+    inline Float3 XYZ(const Float4v& v)
+    {
+        return { v.x, v.y, v.z };
+    }
+
+    inline Float3 Reflect(const Float3& i, const Float3& n)
+    {
+        return i - n * (2.0f * Dot(n, i));
+    }
+
+    // Zero when there's no refraction, as GLSL's refract
+    inline Float3 Refract(const Float3& i, const Float3& n, float eta)
+    {
+        float d = Dot(n, i), k = 1.0f - eta * eta * (1.0f - d * d);
+        if (k < 0.0f)
+            return Float3();
+        return i * eta - n * (eta * d + std::sqrt(k));
+    }
+
+    inline bool operator==(const Float4v& a, const Float4v& b)
+    {
+        return a.x == b.x && a.y == b.y && a.z == b.z && a.w == b.w;
+    }
+
+
+    inline uint32_t NextRandom(uint32_t& state)
+    {
+        state = state * 747796405u + 2891336453u;
+        uint32_t result = ((state >> ((state >> 28) + 4u)) ^ state) * 277803737u;
+        result = (result >> 22) ^ result;
+        return result;
+    }
+
+    inline float RandomValue(uint32_t& state)
+    {
+        return (float)NextRandom(state) / 4294967295.0f;
+    }
+
+    // Random value in normal distribution (with mean=0 and sd=1)
+    inline float RandomValueNormalDistribution(uint32_t& state)
+    {
+        float theta = 2.0f * PI * RandomValue(state);
+        float rho = std::sqrt(-2.0f * std::log(RandomValue(state)));
+        return rho * std::cos(theta);
+    }
+
+    inline Float3 RandomDirection(uint32_t& state)
+    {
+        float x = RandomValueNormalDistribution(state);
+        float y = RandomValueNormalDistribution(state);
+        float z = RandomValueNormalDistribution(state);
+        return Normalize(Float3(x, y, z));
+    }
+
+
+    // What the shader gets as uniforms, besides the scene's arrays which are read in place
+    struct TraceSettings
+    {
+        int maxBounces = 8;
+        bool randomizeDir = true, disableLighting = false, viewBounds = false;
+
+        Float3 peakCol, horizonCol, voidCol, sunCol, sunDir;
+        float sunFlare = 256.0f;
+
+        Float3 camPos, camFwd, camUp, camRight;
+        float viewHeight = 1.0f, viewWidth = 1.0f;
+    };
+
+
+    // RaytracerShader.frag's main() and everything it calls, for one thread. The shader's globals are members.
+    struct PathTracer
+    {
+        const SceneView& scene;
+        const TraceSettings& settings;
+        RayStats& stats;
+
+        int pathBounces = 0; // Surfaces hit by the last path
+
+        // Traversal work since the pixel started, as the shader counts it for the cost heatmaps. Unlike the
+        // statistics these are always counted, bounding sphere checks and BVH nodes count as node visits.
+        int costNodes = 0, costTests = 0;
+
+        // First hit of the camera ray, shared by every sample of a pixel when the sample direction doesn't change
+        bool usePrimaryHit = false, primaryHasHit = false;
+        float primaryL = 0.0f;
+        Float3 primaryP, primaryN;
+        int primaryS = 0;
+        Material primaryMat = {};
+
+
+        PathTracer(const SceneView& scene, const TraceSettings& settings, RayStats& stats) :
+            scene(scene), settings(settings), stats(stats)
+        {}
+
+        Float3 SampleSkybox(const Float3& rD) const
+        {
+            float skyGradientT = std::pow(Smoothstep(0.0f, 0.7f, rD.y), 0.8f);
+            float groundToSkyT = Smoothstep(-0.06f, 0.0f, rD.y);
+            Float3 skyGradient = Lerp(settings.horizonCol, settings.peakCol, skyGradientT);
+            float sun = std::pow(std::max(0.0f, Dot(rD, settings.sunDir)), settings.sunFlare);
+            // Combine ground, sky, and sun
+            return Lerp(settings.voidCol, skyGradient, groundToSkyT) + settings.sunCol * (sun * (float)(groundToSkyT >= 1.0f));
+        }
+
+        static void FresnelReflectAmount(const Float3& dir, const Float3& normal, float reflectivityX, float reflectivityY, float n1, float n2, float& x, float& y)
+        {
+            // Schlick aproximation
+            float r0 = (n1 - n2) / (n1 + n2);
+            r0 *= r0;
+            float cosX = -Dot(normal, dir);
+            if (n1 > n2)
+            {
+                float n = n1 / n2;
+                float sinT2 = (n * n) * (1.0f - cosX * cosX);
+                // Total internal reflection
+                if (sinT2 > 1.0f)
+                {
+                    x = y = 1.0f;
+                    return;
+                }
+                cosX = std::sqrt(1.0f - sinT2);
+            }
+            float c = 1.0f - cosX;
+            float ret = r0 + (1.0f - r0) * (c*c*c*c*c);
+
+            // adjust reflect multiplier for object reflectivity
+            x = reflectivityX + (1.0f - reflectivityX) * ret;
+            y = reflectivityY + (1.0f - reflectivityY) * ret;
+        }
+
+        static Float4v PlaneTile(const Float3& p, Float4v albedo)
+        {
+            int tile = ((int)((std::abs(p.x) + std::floor(p.x)) * 2.0f) % 2 + (int)((std::abs(p.z) + std::floor(p.z)) * 2.0f) % 2);
+            float shade = (tile % 2 == 0) ? 1.0f : 0.666f;
+            albedo.x *= shade;
+            albedo.y *= shade;
+            albedo.z *= shade;
+            return albedo;
+        }
+
+        static bool Intersect(int type, const Float3& rO, const Float3& rD, const float* shape, float& l, Float3& p, Float3& n, int& s)
+        {
+            switch (type)
+            {
+            case SHAPE_AABB:   return RayAABBIntersect(rO, rD, shape, l, p, n, s);
+            case SHAPE_OBB:    return RayOBBIntersect(rO, rD, shape, l, p, n, s);
+            case SHAPE_SPHERE: return RaySphereIntersect(rO, rD, shape, l, p, n, s);
+            case SHAPE_TRI:    return RayTriIntersect(rO, rD, shape, l, p, n, s);
+            default:           return RayPlaneIntersect(rO, rD, shape, l, p, n, s);
+            }
+        }
+
+        bool RayMeshTriIntersect(const Float3& rO, const Float3& rD, int t, float& l, Float3& p, Float3& n, int& side) const
+        {
+            const MeshView& meshes = scene.meshes;
+            const uint32_t* tri = meshes.triangles + (size_t)t * 3;
+            const Float3 v0 = Load3(meshes.vertices + (size_t)tri[0] * 3);
+            Float3 edge1 = Load3(meshes.vertices + (size_t)tri[1] * 3) - v0;
+            Float3 edge2 = Load3(meshes.vertices + (size_t)tri[2] * 3) - v0;
+
+            // No backface-culling, meshes can be closed refractive volumes
+            Float3 h = Cross(rD, edge2);
+            float a = Dot(edge1, h);
+
+            if (a == 0.0f)
+                return false;
+
+            Float3 s = rO - v0;
+            float f = 1.0f / a;
+            float u = f * Dot(s, h);
+
+            if (u < 0.0f || u > 1.0f)
+                return false;
+
+            Float3 q = Cross(s, edge1);
+            float v = f * Dot(rD, q);
+
+            if (v < 0.0f || u + v > 1.0f)
+                return false;
+
+            float d = f * Dot(edge2, q);
+
+            if (d <= 0.0f)
+                return false;
+
+            l = d;
+            p = rO + rD * d;
+            n = Normalize(Cross(edge1, edge2));
+
+            if (meshes.normalCount > 0)
+            {
+                Float3 sn =
+                    Load3(meshes.normals + (size_t)tri[0] * 3) * (1.0f - u - v) +
+                    Load3(meshes.normals + (size_t)tri[1] * 3) * u +
+                    Load3(meshes.normals + (size_t)tri[2] * 3) * v;
+
+                if (Dot(sn, sn) > MINVAL)
+                {
+                    float sign = Dot(sn, n) + MINVAL;
+                    n = Normalize(sn) * (float)((sign > 0.0f) - (sign < 0.0f));
+                }
+            }
+
+            side = 1;
+            if (Dot(Cross(edge1, edge2), rD) > 0.0f)
+            {
+                n *= -1.0f;
+                side = -1;
+            }
+            return true;
+        }
+
+        // Distance to where the ray enters a box, MAXVAL on a miss
+        static float NodeDistance(const Float3& rO, const Float3& irD, const BVHNode& node)
+        {
+            const Float3
+                t1 = Mul(Float3(node.min[0], node.min[1], node.min[2]) - rO, irD),
+                t2 = Mul(Float3(node.max[0], node.max[1], node.max[2]) - rO, irD);
+
+            float near = std::max(std::max(std::min(t1.x, t2.x), std::min(t1.y, t2.y)), std::max(std::min(t1.z, t2.z), 0.0f));
+            float far = std::min(std::min(std::max(t1.x, t2.x), std::max(t1.y, t2.y)), std::max(t1.z, t2.z));
+
+            return (far >= near) ? near : MAXVAL;
+        }
+
+        // Closest triangle of mesh m nearer than l, walks the mesh's BVH front to back
+        bool RayMeshIntersect(const Float3& rO, const Float3& rD, int m, float& l, Float3& p, Float3& n, int& side)
+        {
+            constexpr int MESH_STACK = 32;
+            const BVHNode* nodes = scene.meshes.nodes;
+
+            Float3 irD = Inverse(rD);
+            bool hasHit = false;
+
+            int stack[MESH_STACK];
+            float stackDist[MESH_STACK];
+            int top = 0;
+
+            int node = scene.meshes.roots[m];
+            if (NodeDistance(rO, irD, nodes[node]) >= l)
+                return false;
+
+            while (true)
+            {
+                const BVHNode& current = nodes[node];
+                const int count = (int)current.count;
+                costNodes++;
+                RAY_STAT(stats.nodeVisits++);
+
+                if (count > 0)
+                {
+                    int first = (int)current.leftFirst;
+                    for (int t = first; t < first + count; t++)
+                    {
+                        float nl;
+                        Float3 np, nn;
+                        int ss;
+
+                        costTests++;
+                        RAY_STAT(stats.tests[SHAPE_TYPES]++);
+                        if (RayMeshTriIntersect(rO, rD, t, nl, np, nn, ss))
+                        {
+                            RAY_STAT(stats.hits[SHAPE_TYPES]++);
+                            if (nl < l)
+                            {
+                                l = nl;
+                                p = np;
+                                n = nn;
+                                side = ss;
+                                hasHit = true;
+                            }
+                        }
+                    }
+                }
+                else
+                {
+                    int near = (int)current.leftFirst;
+                    int far = near + 1;
+
+                    float nearDist = NodeDistance(rO, irD, nodes[near]);
+                    float farDist = NodeDistance(rO, irD, nodes[far]);
+
+                    if (farDist < nearDist)
+                    {
+                        std::swap(near, far);
+                        std::swap(nearDist, farDist);
+                    }
+
+                    if (nearDist < l)
+                    {
+                        if (farDist < l && top < MESH_STACK)
+                        {
+                            stack[top] = far;
+                            stackDist[top++] = farDist;
+                        }
+                        node = near;
+                        continue;
+                    }
+                }
+
+                // Skip anything a closer hit has covered since it was pushed
+                while (top > 0 && stackDist[top - 1] >= l)
+                    top--;
+                if (top == 0)
+                    break;
+                node = stack[--top];
+            }
+
+            return hasHit;
+        }
+
+        bool GetFirstHit(Float3 rO, const Float3& rD, bool showBounds, float& l, Float3& p, Float3& n, int& s, Material& mat)
+        {
+            RAY_STAT(stats.rays++);
+
+            if (Dot(rD, n) > 0.0f)
+                rO += n * MINVAL;
+            else
+                rO -= n * MINVAL;
+
+            bool hasHit = false;
+            float nl;
+            Float3 np, nn;
+            int ss;
+
+            if (showBounds)
+                mat = {};
+
+            // Bounds tints of each shape type, then meshes
+            static const Float4v
+                boundsAlbedo[RayStats::GROUPS] = { { 1.0f, 0.85f, 0.85f, 1.0f }, { 0.85f, 1.0f, 0.85f, 1.0f }, { 0.85f, 0.85f, 1.0f, 1.0f }, { 1.0f, 1.0f, 1.0f, 1.0f }, {}, { 1.0f, 0.85f, 1.0f, 1.0f } },
+                boundsEmission[RayStats::GROUPS] = { { 0.35f, 0.0f, 0.0f, 0.35f }, { 0.0f, 0.35f, 0.0f, 0.35f }, { 0.0f, 0.0f, 0.35f, 0.35f }, { 0.25f, 0.25f, 0.25f, 0.25f }, {}, { 0.35f, 0.0f, 0.35f, 0.35f } };
+
+            auto ShowBounds = [&](int group) {
+                l = 1.0f;
+                p = rD * l;
+                n = rD * -1.0f;
+                s = 1;
+                mat.albedo = { mat.albedo.x * boundsAlbedo[group].x, mat.albedo.y * boundsAlbedo[group].y, mat.albedo.z * boundsAlbedo[group].z, mat.albedo.w * boundsAlbedo[group].w };
+                mat.emission = { mat.emission.x + boundsEmission[group].x, mat.emission.y + boundsEmission[group].y, mat.emission.z + boundsEmission[group].z, mat.emission.w + boundsEmission[group].w };
+                hasHit = true;
+            };
+
+            for (int type : { SHAPE_AABB, SHAPE_OBB, SHAPE_SPHERE, SHAPE_TRI })
+            {
+                const ShapeView& list = scene.shapes[type];
+                const int stride = shapeInfo[type].vectors * shapeInfo[type].components;
+
+                int boundsID = 0;
+                int boundOffset = 0;
+                while (boundOffset < list.count)
+                {
+                    costNodes++;
+                    if (CheckBoundingSphere(rO, rD, list.bounds[boundsID]))
+                    {
+                        RAY_STAT(stats.boundsPassed[type]++);
+
+                        if (showBounds)
+                            ShowBounds(type);
+                        else
+                        {
+                            for (int i = boundOffset; i < std::min(boundOffset + list.boundCoverage[boundsID], list.count); i++)
+                            {
+                                costTests++;
+                                RAY_STAT(stats.tests[type]++);
+                                if (Intersect(type, rO, rD, list.data + (size_t)i * stride, nl, np, nn, ss))
+                                {
+                                    RAY_STAT(stats.hits[type]++);
+                                    if (nl < l)
+                                    {
+                                        l = nl;
+                                        p = np;
+                                        n = nn;
+                                        s = ss;
+                                        mat = list.mats[i];
+                                        hasHit = true;
+                                    }
+                                }
+                            }
+                        }
+                    }
+                    else
+                        RAY_STAT(stats.boundsFailed[type]++);
+
+                    boundOffset += list.boundCoverage[boundsID++];
+                }
+            }
+
+            for (int m = 0; m < scene.meshes.count; m++)
+            {
+                costNodes++;
+                if (CheckBoundingSphere(rO, rD, scene.meshes.bounds[m]))
+                {
+                    RAY_STAT(stats.boundsPassed[SHAPE_TYPES]++);
+
+                    if (showBounds)
+                        ShowBounds(SHAPE_TYPES);
+                    else
+                    {
+                        nl = l;
+                        if (RayMeshIntersect(rO, rD, m, nl, np, nn, ss))
+                        {
+                            l = nl;
+                            p = np;
+                            n = nn;
+                            s = ss;
+                            mat = scene.meshes.mats[m];
+                            hasHit = true;
+                        }
+                    }
+                }
+                else
+                    RAY_STAT(stats.boundsFailed[SHAPE_TYPES]++);
+            }
+
+            const ShapeView& planes = scene.shapes[SHAPE_PLANE];
+            for (int i = 0; i < planes.count && !showBounds; i++)
+            {
+                costTests++;
+                RAY_STAT(stats.tests[SHAPE_PLANE]++);
+                if (RayPlaneIntersect(rO, rD, planes.data + (size_t)i * 6, nl, np, nn, ss))
+                {
+                    RAY_STAT(stats.hits[SHAPE_PLANE]++);
+                    if (nl < l)
+                    {
+                        l = nl;
+                        p = np;
+                        n = nn;
+                        s = ss;
+                        mat = planes.mats[i];
+                        mat.albedo = PlaneTile(p, mat.albedo);
+                        hasHit = true;
+                    }
+                }
+            }
+
+            return hasHit;
+        }
+
+        Float3 Raytrace(Float3 rO, Float3 rD, float ri, uint32_t& seed)
+        {
+            Float3 incomingLight;
+            Float3 rayColour(1.0f, 1.0f, 1.0f);
+
+            Float4v queuedAbsorption;
+            pathBounces = 0;
+            RAY_STAT(stats.paths++);
+
+            // The shader leaves n undeclared between bounces, so the offset away from the last surface depends on the
+            // driver keeping its value. It's kept here, which is what the offset is for.
+            Float3 p, n;
+
+            for (int i = 0; i <= settings.maxBounces; i++)
+            {
+                float l = MAXVAL;
+                int s = 0;
+                Material mat = {};
+
+                bool hasHit;
+                if (i == 0 && usePrimaryHit)
+                {
+                    hasHit = primaryHasHit;
+                    l = primaryL;
+                    p = primaryP;
+                    n = primaryN;
+                    s = primaryS;
+                    mat = primaryMat;
+                }
+                else
+                    hasHit = GetFirstHit(rO, rD, false, l, p, n, s, mat);
+
+                if (hasHit)
+                {
+                    if (settings.disableLighting)
+                        return XYZ(mat.albedo) * mat.albedo.w + XYZ(mat.emission) * mat.emission.w;
+
+                    pathBounces++;
+                    rayColour = Mul(rayColour, Float3(
+                        std::exp(-queuedAbsorption.x * (l + queuedAbsorption.w)),
+                        std::exp(-queuedAbsorption.y * (l + queuedAbsorption.w)),
+                        std::exp(-queuedAbsorption.z * (l + queuedAbsorption.w))));
+
+                    float
+                        ri1 = ri,
+                        ri2 = mat.surface.z;
+
+                    if (s < 0)
+                    {
+                        ri1 = ri2;
+                        ri2 = ri;
+                    }
+
+                    float fresnelX, fresnelY;
+                    FresnelReflectAmount(rD, n, mat.surface.x, mat.surface.y, ri1, ri2, fresnelX, fresnelY);
+
+                    if (RandomValue(seed) > mat.albedo.w)
+                    {
+                        bool TIR = false;
+                        Float3 nrD = Refract(rD, n, ri1 / ri2);
+
+                        if (std::abs(Length(nrD) - 1.0f) > 0.1f)
+                        {
+                            nrD = Reflect(rD, n);
+                            TIR = true;
+                            RAY_STAT(stats.internalReflections++);
+                        }
+                        rD = nrD;
+
+                        if (s > 0)
+                        {
+                            if (!TIR)
+                                queuedAbsorption = mat.absorption;
+                        }
+                        else
+                        {
+                            if (!(queuedAbsorption == mat.absorption))
+                                rayColour = Mul(rayColour, Float3(
+                                    std::exp(-mat.absorption.x * (l + mat.absorption.w)),
+                                    std::exp(-mat.absorption.y * (l + mat.absorption.w)),
+                                    std::exp(-mat.absorption.z * (l + mat.absorption.w))));
+
+                            queuedAbsorption = Float4v();
+                        }
+                    }
+                    else
+                    {
+                        queuedAbsorption = Float4v();
+
+                        Float3 diffuseDir = Normalize(n + RandomDirection(seed));
+                        Float3 specularDir = Reflect(rD, n);
+                        bool isSpecularBounce = mat.specular.w >= RandomValue(seed);
+                        rD = Normalize(Lerp(diffuseDir, specularDir, isSpecularBounce ? mat.surface.y * fresnelY : mat.surface.x * fresnelX));
+
+                        if (isSpecularBounce)
+                        {
+                            mat.albedo.x = mat.specular.x;
+                            mat.albedo.y = mat.specular.y;
+                            mat.albedo.z = mat.specular.z;
+                        }
+                    }
+                    rO = p;
+
+                    // Update light calculations
+                    Float3 emittedLight = XYZ(mat.emission) * mat.emission.w;
+                    incomingLight += Mul(emittedLight, rayColour);
+                    rayColour = Mul(rayColour, XYZ(mat.albedo));
+
+                    float k = std::max(rayColour.x, std::max(rayColour.y, rayColour.z));
+                    if (RandomValue(seed) >= k)
+                    {
+                        RAY_STAT(stats.rouletteKills++);
+                        break;
+                    }
+                    rayColour *= 1.0f / k;
+                }
+                else
+                { // Ambient
+                    if (settings.disableLighting)
+                        return Float3();
+
+                    RAY_STAT(stats.escaped++);
+                    Float3 skyLight = SampleSkybox(rD);
+                    incomingLight += Mul(skyLight, rayColour);
+                    break;
+                }
+            }
+
+            RAY_STAT(stats.bounces[std::min(pathBounces, RayStats::BOUNCE_BINS - 1)]++);
+            return incomingLight;
+        }
+
+        Float3 PixelDirection(float u, float v) const
+        {
+            Float3 dirLocal(-settings.viewWidth / 2.0f + settings.viewWidth * u, -settings.viewHeight / 2.0f + settings.viewHeight * v, 1.0f);
+            Float3 pixDir = settings.camRight * dirLocal.x + settings.camUp * dirLocal.y + settings.camFwd * dirLocal.z;
+            return Normalize(pixDir);
+        }
+
+        // The beauty pass's radiance, the mean bounce count in every channel, or node visits and primitive tests in red
+        // and green, of the pixel counted from the image's bottom left as gl_FragCoord. The first hit modes give what
+        // the shader encodes, unquantized: the distance, -1 on a miss, and the normal's octahedral coordinates, or the
+        // albedo, white for the sky.
+        Float3 Pixel(int outputMode, int x, int y, int imgW, int imgH, int samples, uint32_t rndS)
+        {
+            float u = ((float)x + 0.5f) / (float)imgW, v = ((float)y + 0.5f) / (float)imgH;
+            costNodes = costTests = 0;
+
+            if (outputMode == OUTPUT_PRIMARYCOST)
+            {
+                float l = MAXVAL;
+                int s = 0;
+                Float3 p, n;
+                Material mat;
+
+                GetFirstHit(settings.camPos, PixelDirection(u, v), false, l, p, n, s, mat);
+                return { (float)costNodes, (float)costTests, 0.0f };
+            }
+
+            if (outputMode == OUTPUT_FIRSTHIT || outputMode == OUTPUT_ALBEDO)
+            {
+                float l = MAXVAL;
+                int s = 0;
+                Float3 p, n;
+                Material mat;
+
+                const bool hit = GetFirstHit(settings.camPos, PixelDirection(u, v), false, l, p, n, s, mat);
+                if (outputMode == OUTPUT_ALBEDO)
+                    return hit ? XYZ(mat.albedo) : Float3(1.0f, 1.0f, 1.0f);
+                if (!hit)
+                    return { -1.0f, 0.0f, 0.0f };
+
+                // As EncodeNormal
+                n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+                if (n.z < 0.0f)
+                    return { l, (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f) };
+                return { l, n.x, n.y };
+            }
+
+            uint32_t seed = rndS + (uint32_t)x + (uint32_t)(y * imgW);
+
+            if (settings.randomizeDir)
+            {
+                v += ((RandomValue(seed) - 0.5f) / 1.25f) / (float)imgH;
+                u += ((RandomValue(seed) - 0.5f) / 1.25f) / (float)imgW;
+            }
+
+            Float3 pixDir = PixelDirection(u, v);
+
+            usePrimaryHit = false;
+            if (!settings.randomizeDir)
+            { // Every sample starts along the same ray, so find its first hit once
+                primaryL = MAXVAL;
+                primaryN = Float3();
+                primaryS = 0;
+                primaryHasHit = GetFirstHit(settings.camPos, pixDir, false, primaryL, primaryP, primaryN, primaryS, primaryMat);
+                usePrimaryHit = true;
+            }
+
+            if (outputMode == OUTPUT_PATHCOST)
+            { // Per sample, the primary hit shared by the samples included
+                for (int i = 0; i < samples; i++)
+                    Raytrace(settings.camPos, pixDir, riAir, seed);
+                return { (float)costNodes / (float)samples, (float)costTests / (float)samples, 0.0f };
+            }
+
+            if (outputMode == OUTPUT_BOUNCES)
+            {
+                float bounces = 0.0f;
+                for (int i = 0; i < samples; i++)
+                {
+                    Raytrace(settings.camPos, pixDir, riAir, seed);
+                    bounces += (float)pathBounces;
+                }
+                bounces /= (float)samples;
+                return { bounces, bounces, bounces };
+            }
+
+            Float3 outCol;
+            for (int i = 0; i < samples; i++)
+                outCol += Raytrace(settings.camPos, pixDir, riAir, seed);
+            outCol /= (float)samples;
+
+            if (settings.viewBounds)
+            {
+                float l = 0.0f;
+                int s = 0;
+                Float3 p, n;
+                Material mat = {};
+
+                if (GetFirstHit(settings.camPos, pixDir, true, l, p, n, s, mat))
+                    outCol += XYZ(mat.albedo) * mat.albedo.w + XYZ(mat.emission) * mat.emission.w;
+            }
+            return outCol;
+        }
+    };
+
+
+    // Traces passes over a block of rows on several threads, each taking the next unclaimed row. The scene's arrays are
+    // read in place, so the scene has to outlive the tracer.
+    struct Tracer
+    {
+        TraceSettings settings;
+        RayStats
+            stats, // Of the last pass
+            total; // Of every pass
+
+
+        // 0 threads uses every core
+        explicit Tracer(unsigned int threads = 0) :
+            threads(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency()))
+        {}
+
+        unsigned int Threads() const
+        {
+            return threads;
+        }
+
+        void SetScene(const SceneView& view)
+        {
+            scene = &view;
+
+            const RenderSettings& s = view.settings;
+            settings.maxBounces = (int)s.maxBounces;
+            settings.randomizeDir = s.randomizeSampleDir;
+            settings.disableLighting = s.disableLighting;
+            settings.viewBounds = s.viewBounds;
+
+            const SkySettings& sky = view.sky;
+            settings.peakCol = ToFloat(sky.peakCol);
+            settings.horizonCol = ToFloat(sky.horizonCol);
+            settings.voidCol = ToFloat(sky.voidCol);
+            settings.sunCol = ToFloat(sky.sunCol);
+            settings.sunDir = ToFloat(Vec3(sky.sunDir).Normalize());
+            settings.sunFlare = sky.sunFlare;
+        }
+
+        // As SetCamUniforms
+        void SetCam(const Cam& cam, unsigned int w, unsigned int h)
+        {
+            settings.viewHeight = std::tan((cam.fov / 2.0f) * (float)utils::PI / 180.0f) * 2.0f;
+            settings.viewWidth = settings.viewHeight / ((float)h / (float)w);
+
+            settings.camPos = ToFloat(cam.origin);
+            settings.camFwd = ToFloat(cam.fwd);
+            settings.camUp = ToFloat(cam.up);
+            settings.camRight = ToFloat(cam.right);
+        }
+
+        // Fills rgb, rows top down, for the width by height pixels with their top left at x, y of the w by h image.
+        // rndS is the shader's seed for the pass.
+        void Pass(int outputMode, unsigned int w, unsigned int h, unsigned int x, unsigned int y, unsigned int width, unsigned int height,
+            unsigned int samples, uint32_t rndS, float* rgb)
+        {
+            threadStats.assign(threads, RayStats());
+            std::atomic<unsigned int> nextRow = 0;
+
+            auto Work = [&](unsigned int thread) {
+                TraceScope scope("CPU rows");
+                PathTracer tracer(*scene, settings, threadStats[thread]);
+
+                for (unsigned int row = nextRow++; row < height; row = nextRow++)
+                {
+                    // The shader counts rows from the bottom
+                    const int pixelY = (int)h - 1 - (int)(y + row);
+                    float* out = rgb + (size_t)row * width * 3;
+
+                    for (unsigned int col = 0; col < width; col++)
+                    {
+                        Float3 c = tracer.Pixel(outputMode, (int)(x + col), pixelY, (int)w, (int)h, (int)samples, rndS);
+                        out[col*3 + 0] = c.x;
+                        out[col*3 + 1] = c.y;
+                        out[col*3 + 2] = c.z;
+                    }
+                }
+            };
+
+            std::vector<std::thread> workers;
+            for (unsigned int t = 1; t < threads; t++)
+                workers.emplace_back(Work, t);
+            Work(0);
+
+            for (std::thread& worker : workers)
+                worker.join();
+
+            // Integer counters, so the totals are the same whichever thread traced which rows
+            stats = RayStats();
+            for (const RayStats& s : threadStats)
+                stats.Add(s);
+            total.Add(stats);
+        }
+
+
+    private:
+        unsigned int threads;
+        const SceneView* scene = nullptr;
+        std::vector<RayStats> threadStats; // Apart from each other, so threads never write to the same cache line
+
+        static Float3 ToFloat(const Vec3& v)
+        {
+            return { (float)v.x, (float)v.y, (float)v.z };
+        }
+    };
+}
@@ -0,0 +1,292 @@
+#pragma once
+
+#include "AOV.h"
+#include "Memory.h"
+
+#include <vector>
+#include <thread>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+
+// Edge-avoiding a-trous wavelet filter (SVGF style) guided by first-hit albedo, normal and depth.
+// Lighting is demodulated by albedo before filtering so texture detail isn't blurred away.
+struct Denoiser
+{
+    unsigned int w, h;
+
+    int iterations;
+    float
+        sigmaLuminance, // Scales the luminance edge-stopping by the estimated noise
+        sigmaNormal,    // Exponent on the normal similarity, rounded to a power of two
+        sigmaDepth,     // Allowed depth difference relative to the local depth gradient
+        sigmaAlbedo;
+
+
+    Denoiser(unsigned int w, unsigned int h) :
+        w(w), h(h),
+        iterations(5),
+        sigmaLuminance(4.0f), sigmaNormal(128.0f), sigmaDepth(1.0f), sigmaAlbedo(0.05f),
+        guide(w * h), ping(w * h), pong(w * h)
+    {
+        memory.Set(MemoryCharge::Of(guide) + MemoryCharge::Of(ping) + MemoryCharge::Of(pong));
+    }
+
+
+    // color and out are rgb triplets, may point to the same buffer
+    void Denoise(const float* color, const AOVBuffers& aov, float* out)
+    {
+        ParallelRows([&](unsigned int y) {
+            for (unsigned int x = 0; x < w; x++)
+            {
+                unsigned int i = y * w + x;
+                Guide& g = guide[i];
+
+                g.nx = aov.normal[i*3 + 0];
+                g.ny = aov.normal[i*3 + 1];
+                g.nz = aov.normal[i*3 + 2];
+                g.depth = aov.depth[i];
+                g.depthGradient = DepthGradient(aov, x, y);
+
+                for (int c = 0; c < 3; c++)
+                {
+                    g.albedo[c] = std::max(aov.albedo[i*3 + c], 0.01f);
+                    ping[i].rgb[c] = color[i*3 + c] / g.albedo[c];
+                }
+            }
+        });
+
+        EstimateVariance();
+
+        int normalSquarings = (int)std::round(std::log2(std::max(1.0f, sigmaNormal)));
+
+        for (int it = 0; it < iterations; it++)
+        {
+            int step = 1 << it;
+
+            ParallelRows([&](unsigned int y) {
+                for (unsigned int x = 0; x < w; x++)
+                    guide[y * w + x].phiLuminance = sigmaLuminance * std::sqrt(BlurredVariance(x, y)) + 0.0001f;
+            });
+
+            ParallelRows([&](unsigned int y) { FilterRow(y, step, normalSquarings); });
+
+            ping.swap(pong);
+        }
+
+        ParallelRows([&](unsigned int y) {
+            for (unsigned int i = y * w; i < (y + 1) * w; i++)
+                for (int c = 0; c < 3; c++)
+                    out[i*3 + c] = ping[i].rgb[c] * guide[i].albedo[c];
+        });
+    }
+
+
+private:
+    // Per-pixel data kept together so each filter tap touches as few cache lines as possible
+    struct Guide
+    {
+        float nx, ny, nz, depth;
+        float albedo[3];
+        float depthGradient;
+        float phiLuminance;
+    };
+
+    struct Sample
+    {
+        float rgb[3];
+        float variance; // Of luminance
+    };
+
+    std::vector<Guide> guide;
+    std::vector<Sample> ping, pong;
+    MemoryCharge memory{ MEMORY_SCRATCH };
+
+
+    static inline float Luminance(const float* c)
+    {
+        return 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2];
+    }
+
+    // exp(-x) for x in [0, 126], within ~0.02% which is plenty for filter weights
+    static inline float NegExp(float x)
+    {
+        float t = -x * 1.44269504f;
+        float i = std::floor(t), f = t - i;
+        float p = 1.0f + f * (0.6960656f + f * (0.2244486f + f * 0.0794187f));
+
+        int32_t bits;
+        std::memcpy(&bits, &p, sizeof(bits));
+        bits += (int32_t)i << 23;
+        std::memcpy(&p, &bits, sizeof(bits));
+        return p;
+    }
+
+    template<typename F>
+    void ParallelRows(F&& rowFunc)
+    {
+        unsigned int threadCount = std::max(1u, std::min(std::thread::hardware_concurrency(), h));
+        std::vector<std::thread> threads;
+
+        for (unsigned int t = 0; t < threadCount; t++)
+            threads.emplace_back([&, t]() {
+                for (unsigned int y = t; y < h; y += threadCount)
+                    rowFunc(y);
+            });
+
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    float DepthGradient(const AOVBuffers& aov, unsigned int x, unsigned int y) const
+    {
+        float z = aov.depth[y * w + x];
+        if (z < 0.0f)
+            return 0.0f;
+
+        auto diff = [&](unsigned int qx, unsigned int qy) {
+            float zq = aov.depth[qy * w + qx];
+            return (zq < 0.0f) ? 0.0f : std::abs(zq - z);
+        };
+
+        float
+            dx = std::max(x > 0 ? diff(x - 1, y) : 0.0f, x < w - 1 ? diff(x + 1, y) : 0.0f),
+            dy = std::max(y > 0 ? diff(x, y - 1) : 0.0f, y < h - 1 ? diff(x, y + 1) : 0.0f);
+
+        return dx + dy;
+    }
+
+    // Initial luminance variance from each pixel's 3x3 neighbourhood
+    void EstimateVariance()
+    {
+        ParallelRows([&](unsigned int y) {
+            for (unsigned int x = 0; x < w; x++)
+            {
+                float sum = 0.0f, sumSqr = 0.0f;
+                int n = 0;
+
+                for (int dy = -1; dy <= 1; dy++)
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        int qx = (int)x + dx, qy = (int)y + dy;
+                        if (qx < 0 || qy < 0 || qx >= (int)w || qy >= (int)h)
+                            continue;
+
+                        float l = Luminance(ping[qy * w + qx].rgb);
+                        sum += l;
+                        sumSqr += l * l;
+                        n++;
+                    }
+
+                float mean = sum / n;
+                ping[y * w + x].variance = std::max(0.0f, sumSqr / n - mean * mean);
+            }
+        });
+    }
+
+    float BlurredVariance(unsigned int x, unsigned int y) const
+    {
+        static constexpr float kernel[2] = { 0.25f, 0.125f };
+
+        float sum = 0.0f, sumW = 0.0f;
+        for (int dy = -1; dy <= 1; dy++)
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                int qx = (int)x + dx, qy = (int)y + dy;
+                if (qx < 0 || qy < 0 || qx >= (int)w || qy >= (int)h)
+                    continue;
+
+                float k = kernel[std::abs(dx)] * kernel[std::abs(dy)];
+                sum += ping[qy * w + qx].variance * k;
+                sumW += k;
+            }
+        return sum / sumW;
+    }
+
+    void FilterRow(unsigned int y, int step, int normalSquarings)
+    {
+        static constexpr float kernel[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+        static const float offsetLength[3][3] = {
+            { 1.0f, 1.0f, 2.0f },
+            { 1.0f, std::sqrt(2.0f), std::sqrt(5.0f) },
+            { 2.0f, std::sqrt(5.0f), std::sqrt(8.0f) }
+        };
+
+        float invSigmaA = 1.0f / sigmaAlbedo;
+
+        for (unsigned int x = 0; x < w; x++)
+        {
+            unsigned int p = y * w + x;
+
+            const Guide& gP = guide[p];
+            const Sample& sP = ping[p];
+            float
+                lP = Luminance(sP.rgb),
+                invPhiL = 1.0f / gP.phiLuminance,
+                phiZ = sigmaDepth * gP.depthGradient * (float)step + 0.0001f;
+
+            float
+                sumW = kernel[0] * kernel[0],
+                sumVar = sP.variance * sumW * sumW,
+                sum[3] = { sP.rgb[0] * sumW, sP.rgb[1] * sumW, sP.rgb[2] * sumW };
+
+            for (int dy = -2; dy <= 2; dy++)
+            {
+                int qy = (int)y + dy * step;
+                if (qy < 0 || qy >= (int)h)
+                    continue;
+
+                for (int dx = -2; dx <= 2; dx++)
+                {
+                    int qx = (int)x + dx * step;
+                    if ((dx == 0 && dy == 0) || qx < 0 || qx >= (int)w)
+                        continue;
+
+                    unsigned int q = qy * w + qx;
+                    const Guide& gQ = guide[q];
+
+                    if ((gP.depth < 0.0f) != (gQ.depth < 0.0f))
+                        continue; // Sky and geometry never mix
+
+                    const Sample& sQ = ping[q];
+                    float
+                        wNormal = 1.0f,
+                        exponent = std::abs(lP - Luminance(sQ.rgb)) * invPhiL;
+
+                    if (gP.depth >= 0.0f)
+                    {
+                        wNormal = std::max(0.0f, gP.nx*gQ.nx + gP.ny*gQ.ny + gP.nz*gQ.nz);
+                        for (int n = 0; n < normalSquarings; n++)
+                            wNormal *= wNormal;
+
+                        float
+                            aR = gP.albedo[0] - gQ.albedo[0],
+                            aG = gP.albedo[1] - gQ.albedo[1],
+                            aB = gP.albedo[2] - gQ.albedo[2];
+
+                        exponent += std::abs(gP.depth - gQ.depth) / (phiZ * offsetLength[std::abs(dy)][std::abs(dx)]);
+                        exponent += (aR*aR + aG*aG + aB*aB) * invSigmaA;
+                    }
+
+                    if (exponent > 16.0f || wNormal < 0.0001f)
+                        continue;
+
+                    float weight = kernel[std::abs(dx)] * kernel[std::abs(dy)] * wNormal * NegExp(exponent);
+
+                    sum[0] += sQ.rgb[0] * weight;
+                    sum[1] += sQ.rgb[1] * weight;
+                    sum[2] += sQ.rgb[2] * weight;
+                    sumVar += sQ.variance * weight * weight;
+                    sumW += weight;
+                }
+            }
+
+            Sample& out = pong[p];
+            for (int c = 0; c < 3; c++)
+                out.rgb[c] = sum[c] / sumW;
+            out.variance = sumVar / (sumW * sumW);
+        }
+    }
+};
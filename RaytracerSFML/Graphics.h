@@ -218,4 +218,14 @@ struct Color
             std::max(0.0, std::min((b*(2.51*b + 0.03)) / (b*(2.43*b + 0.59) + 0.14), 1.0))
         };
     }
+
+    // Linear color from the shader's EncodeRGBE, the exponent is stored in alpha
+    static Color FromRGBE(const sf::Color& c)
+    {
+        if (c.a == 0)
+            return Color();
+
+        double scale = std::ldexp(1.0 / 255.0, (int)c.a - 128);
+        return { c.r * scale, c.g * scale, c.b * scale };
+    }
 };
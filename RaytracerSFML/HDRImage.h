@@ -0,0 +1,433 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+
+
+// Writes a float image a scanline or tile at a time, so large frames never have to be held in memory whole.
+// The format comes from the extension, ".pfm" for a portable float map, ".exr" for an OpenEXR scanline image,
+// or a tiled one when a tile size is given. Channels are 1 (written as Y) or 3 (interleaved rgb).
+// Rows or tiles may arrive in any order, but every pixel exactly once.
+struct HDRWriter
+{
+    enum Compression
+    {
+        COMPRESSION_NONE = 0, // Values as in the OpenEXR compression attribute
+        COMPRESSION_RLE = 1
+    };
+
+
+    HDRWriter() = default;
+    HDRWriter(const HDRWriter&) = delete;
+    HDRWriter& operator=(const HDRWriter&) = delete;
+
+    ~HDRWriter()
+    {
+        Close();
+    }
+
+
+    static bool IsHDR(const std::string& filename)
+    {
+        return HasExtension(filename, ".pfm") || HasExtension(filename, ".exr");
+    }
+
+    // How much of the file has been written, to continue it with Resume after a restart
+    struct Progress
+    {
+        uint64_t end = 0, pixelsWritten = 0;
+        std::vector<uint64_t> offsets; // Per EXR chunk, 0 for those not written yet
+    };
+
+
+    // Tiled EXR files only take tiles of exactly the given size, cut off at the right and bottom edges
+    bool Open(const std::string& filename, unsigned int width, unsigned int height, int channelCount,
+        Compression compression = COMPRESSION_RLE, unsigned int tileWidth = 0, unsigned int tileHeight = 0)
+    {
+        return Begin(filename, "wb", width, height, channelCount, compression, tileWidth, tileHeight);
+    }
+
+    // Continues a file left unfinished, opened with the same arguments. Anything written after the progress was taken is
+    // overwritten.
+    bool Resume(const std::string& filename, unsigned int width, unsigned int height, int channelCount,
+        Compression compression, unsigned int tileWidth, unsigned int tileHeight, const Progress& progress)
+    {
+        if (!Begin(filename, "r+b", width, height, channelCount, compression, tileWidth, tileHeight))
+            return false;
+
+        if (exr)
+        {
+            if (progress.offsets.size() != offsets.size() || progress.end < dataStart + offsets.size() * sizeof(uint64_t))
+                return success = false;
+
+            offsets = progress.offsets;
+            success &= _fseeki64(file, (int64_t)progress.end, SEEK_SET) == 0;
+        }
+
+        pixelsWritten = progress.pixelsWritten;
+        return success;
+    }
+
+    // Flushes the file, so everything in the progress has reached it
+    bool GetProgress(Progress& progress)
+    {
+        if (file == nullptr || !success || fflush(file) != 0)
+            return false;
+
+        progress.end = (uint64_t)_ftelli64(file); // EXR chunks are only ever appended
+        progress.pixelsWritten = pixelsWritten;
+        progress.offsets = offsets;
+        return true;
+    }
+
+    // Tiled EXR files only take whole tiles through WriteTile
+    bool WholeTiles() const
+    {
+        return exr && tileW > 0;
+    }
+
+    // Row y counted from the top
+    bool WriteRow(unsigned int y, const float* row)
+    {
+        return WriteTile(0, y, w, 1, row);
+    }
+
+    // The rectangle at x, y from the top left, data holds its rows one after another
+    bool WriteTile(unsigned int x, unsigned int y, unsigned int width, unsigned int height, const float* data)
+    {
+        if (file == nullptr || width == 0 || height == 0 || x + width > w || y + height > h)
+            return false;
+
+        const size_t rowValues = (size_t)width * channels;
+
+        if (!exr)
+        { // Portable float maps store their rows bottom to top
+            for (unsigned int r = 0; r < height; r++)
+            {
+                uint64_t offset = dataStart + ((uint64_t)(h - 1 - y - r) * w + x) * channels * sizeof(float);
+                success &= _fseeki64(file, (int64_t)offset, SEEK_SET) == 0;
+                success &= fwrite(&data[r * rowValues], sizeof(float), rowValues, file) == rowValues;
+            }
+        }
+        else if (tileW == 0)
+        { // Scanline files only take whole rows
+            if (x != 0 || width != w)
+                return false;
+
+            for (unsigned int r = 0; r < height; r++)
+            {
+                line.clear();
+                PutPlanarRow(&data[r * rowValues], width);
+
+                int32_t chunk[1] = { (int32_t)(y + r) };
+                success &= WriteEXRChunk(y + r, chunk, 1);
+            }
+        }
+        else
+        {
+            if (x % tileW != 0 || y % tileH != 0 || width != std::min(tileW, w - x) || height != std::min(tileH, h - y))
+                return false;
+
+            line.clear();
+            for (unsigned int r = 0; r < height; r++)
+                PutPlanarRow(&data[r * rowValues], width);
+
+            // Tile coordinates and the mipmap level, there's only level 0
+            int32_t chunk[4] = { (int32_t)(x / tileW), (int32_t)(y / tileH), 0, 0 };
+            success &= WriteEXRChunk((size_t)chunk[1] * TilesX() + chunk[0], chunk, 4);
+        }
+
+        pixelsWritten += (uint64_t)width * height;
+        return success;
+    }
+
+    // Fails if a pixel is missing or anything failed to write
+    bool Close()
+    {
+        if (file == nullptr)
+            return false;
+
+        if (exr)
+        { // Chunk sizes are only known once they're compressed, so the offset table is filled in last
+            success &= _fseeki64(file, (int64_t)dataStart, SEEK_SET) == 0;
+            success &= fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), file) == offsets.size();
+        }
+
+        success &= fclose(file) == 0;
+        file = nullptr;
+
+        return success && pixelsWritten == (uint64_t)w * h;
+    }
+
+
+private:
+    FILE* file = nullptr;
+    unsigned int w = 0, h = 0, tileW = 0, tileH = 0;
+    int channels = 0;
+    bool exr = false, rle = false, success = false;
+    uint64_t pixelsWritten = 0;
+
+    uint64_t dataStart = 0;         // First row for PFM, the offset table for EXR
+    std::vector<uint64_t> offsets;  // Per EXR row or tile
+    std::vector<uint8_t> line, packed;
+
+
+    unsigned int TilesX() const
+    {
+        return (w + tileW - 1) / tileW;
+    }
+
+    unsigned int TilesY() const
+    {
+        return (h + tileH - 1) / tileH;
+    }
+
+
+    bool Begin(const std::string& filename, const char* mode, unsigned int width, unsigned int height, int channelCount,
+        Compression compression, unsigned int tileWidth, unsigned int tileHeight)
+    {
+        Close();
+
+        w = width;
+        h = height;
+        channels = channelCount;
+        exr = HasExtension(filename, ".exr");
+        rle = compression == COMPRESSION_RLE;
+        tileW = (tileWidth > 0 && tileHeight > 0) ? tileWidth : 0;
+        tileH = (tileW > 0) ? tileHeight : 0;
+        pixelsWritten = 0;
+
+        if ((channels != 1 && channels != 3) || (!exr && !HasExtension(filename, ".pfm")))
+            return false;
+        if (fopen_s(&file, filename.c_str(), mode) != 0)
+        {
+            file = nullptr;
+            return false;
+        }
+
+        success = exr ? WriteEXRHeader(compression) : WritePFMHeader();
+        return success;
+    }
+
+    static bool HasExtension(const std::string& filename, const char* extension)
+    {
+        size_t n = strlen(extension);
+        if (filename.size() < n)
+            return false;
+
+        for (size_t i = 0; i < n; i++)
+            if (tolower((unsigned char)filename[filename.size() - n + i]) != extension[i])
+                return false;
+        return true;
+    }
+
+    bool WritePFMHeader()
+    {
+        int n = fprintf(file, "%s\n%u %u\n-1.0\n", (channels == 3) ? "PF" : "Pf", w, h); // Negative scale means little endian
+        dataStart = (n > 0) ? (uint64_t)n : 0;
+        return n > 0;
+    }
+
+
+    // OpenEXR, single part scanline file with one row per chunk or tiled file with a single level, 32 bit float channels
+
+    void Put(const void* data, size_t bytes)
+    {
+        const uint8_t* p = (const uint8_t*)data;
+        line.insert(line.end(), p, p + bytes);
+    }
+
+    void PutInt(int32_t v)
+    {
+        Put(&v, 4);
+    }
+
+    void PutAttribute(const char* name, const char* type, int32_t size)
+    {
+        Put(name, strlen(name) + 1);
+        Put(type, strlen(type) + 1);
+        PutInt(size);
+    }
+
+    bool WriteEXRHeader(Compression compression)
+    {
+        const char* names[3] = { "B", "G", "R" }; // Channels are listed alphabetically
+
+        line.clear();
+        PutInt(20000630); // Magic
+        PutInt(tileW > 0 ? 0x202 : 2); // Version 2, with the single part tiled flag
+
+        PutAttribute("channels", "chlist", channels * (2 + 16) + 1);
+        for (int c = 0; c < channels; c++)
+        {
+            Put(channels == 1 ? "Y" : names[c], 2);
+            PutInt(2); // FLOAT
+            PutInt(0); // pLinear and reserved
+            PutInt(1); // x sampling
+            PutInt(1); // y sampling
+        }
+        Put("", 1);
+
+        uint8_t compressionValue = (uint8_t)compression, lineOrder = 0; // Increasing y
+        PutAttribute("compression", "compression", 1);
+        Put(&compressionValue, 1);
+
+        const int32_t window[4] = { 0, 0, (int32_t)w - 1, (int32_t)h - 1 };
+        PutAttribute("dataWindow", "box2i", 16);
+        Put(window, 16);
+        PutAttribute("displayWindow", "box2i", 16);
+        Put(window, 16);
+
+        PutAttribute("lineOrder", "lineOrder", 1);
+        Put(&lineOrder, 1);
+
+        const float aspect = 1.0f, center[2] = { 0.0f, 0.0f }, width = 1.0f;
+        PutAttribute("pixelAspectRatio", "float", 4);
+        Put(&aspect, 4);
+        PutAttribute("screenWindowCenter", "v2f", 8);
+        Put(center, 8);
+        PutAttribute("screenWindowWidth", "float", 4);
+        Put(&width, 4);
+
+        if (tileW > 0)
+        {
+            uint8_t mode = 0; // One level, rounding down
+            PutAttribute("tiles", "tiledesc", 9);
+            PutInt((int32_t)tileW);
+            PutInt((int32_t)tileH);
+            Put(&mode, 1);
+        }
+
+        Put("", 1); // End of header
+
+        dataStart = line.size();
+        offsets.assign(tileW > 0 ? (size_t)TilesX() * TilesY() : h, 0);
+
+        bool ok = fwrite(line.data(), 1, line.size(), file) == line.size();
+        return ok && fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), file) == offsets.size();
+    }
+
+    // Each channel's values are stored together, in the header's channel order
+    void PutPlanarRow(const float* row, unsigned int width)
+    {
+        size_t start = line.size();
+        line.resize(start + (size_t)width * channels * sizeof(float));
+
+        float* out = (float*)&line[start];
+        for (int c = 0; c < channels; c++)
+        {
+            int source = channels - 1 - c; // B, G, R from interleaved rgb
+            for (unsigned int x = 0; x < width; x++)
+                out[c * width + x] = row[x * channels + source];
+        }
+    }
+
+    // Writes the chunk in line after its header, which leads with the chunk's coordinates
+    bool WriteEXRChunk(size_t index, const int32_t* coordinates, int count)
+    {
+        if (offsets[index] != 0)
+            return false;
+
+        const uint8_t* data = line.data();
+        int32_t size = (int32_t)line.size();
+        if (rle && PackRLE())
+        { // Only stored compressed when that's smaller
+            data = packed.data();
+            size = (int32_t)packed.size();
+        }
+
+        offsets[index] = (uint64_t)_ftelli64(file);
+
+        bool ok = fwrite(coordinates, sizeof(int32_t), count, file) == (size_t)count;
+        ok &= fwrite(&size, sizeof(size), 1, file) == 1;
+        return ok && fwrite(data, 1, size, file) == (size_t)size;
+    }
+
+    // OpenEXR's RLE: bytes are split into even and odd halves, delta encoded, then run length encoded.
+    // Fails when the result isn't smaller than the input.
+    bool PackRLE()
+    {
+        const size_t n = line.size();
+        std::vector<uint8_t> split(n);
+
+        size_t half = (n + 1) / 2;
+        for (size_t i = 0; i < n; i++)
+            split[(i % 2) ? half + i / 2 : i / 2] = line[i];
+
+        for (size_t i = n; i-- > 1;)
+            split[i] = (uint8_t)(split[i] - split[i - 1] + 128);
+
+        constexpr size_t MIN_RUN = 3, MAX_RUN = 127;
+        packed.clear();
+
+        size_t start = 0;
+        while (start < n && packed.size() < n)
+        {
+            size_t end = start + 1;
+            while (end < n && split[end] == split[start] && end - start - 1 < MAX_RUN)
+                end++;
+
+            if (end - start >= MIN_RUN)
+            { // Run of one repeated byte
+                packed.push_back((uint8_t)(end - start - 1));
+                packed.push_back(split[start]);
+                start = end;
+            }
+            else
+            { // Literal bytes until the next run of three
+                end = start;
+                while (end < n && end - start < MAX_RUN && !(end + 2 < n && split[end] == split[end + 1] && split[end] == split[end + 2]))
+                    end++;
+
+                packed.push_back((uint8_t)(-(int)(end - start)));
+                packed.insert(packed.end(), split.begin() + start, split.begin() + end);
+                start = end;
+            }
+        }
+
+        return start >= n && packed.size() < n;
+    }
+};
+
+
+// Reads a portable float map whole, like the references and AOVs written above. Rows are returned top to bottom,
+// with channelCount values per pixel.
+inline bool ReadPFM(const std::string& filename, unsigned int& width, unsigned int& height, int& channelCount, std::vector<float>& pixels)
+{
+    FILE* file;
+    if (fopen_s(&file, filename.c_str(), "rb") != 0)
+        return false;
+
+    char type[3] = {};
+    double scale = 0.0;
+    bool success = fscanf_s(file, "%2s %u %u %lf", type, (unsigned int)sizeof(type), &width, &height, &scale) == 4 && fgetc(file) != EOF &&
+        type[0] == 'P' && (type[1] == 'F' || type[1] == 'f') && width > 0 && height > 0 && scale != 0.0;
+
+    if (success)
+    {
+        channelCount = type[1] == 'F' ? 3 : 1;
+        const size_t rowSize = (size_t)width * channelCount;
+        pixels.resize(rowSize * height);
+
+        // Stored bottom to top
+        for (unsigned int y = height; success && y-- > 0;)
+            success = fread(&pixels[y * rowSize], sizeof(float), rowSize, file) == rowSize;
+
+        // A positive scale means big endian
+        if (success && scale > 0.0)
+            for (float& v : pixels)
+            {
+                uint8_t* b = (uint8_t*)&v;
+                std::swap(b[0], b[3]);
+                std::swap(b[1], b[2]);
+            }
+    }
+
+    fclose(file);
+    return success;
+}
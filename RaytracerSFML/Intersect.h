@@ -0,0 +1,662 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include <SFML/Graphics/Glsl.hpp>
+
+// Four wide kernels use SSE2 where it's there, which every x64 target has, and plain arrays elsewhere
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define INTERSECT_SSE 1
+    #include <emmintrin.h>
+#else
+    #define INTERSECT_SSE 0
+#endif
+
+
+// C++ versions of the ray-shape kernels in RaytracerShader.frag, in single precision like the shader so both find the
+// same hits. Shapes are read from the layout the shader gets them in (see shapeInfo in Scene.h), a pointer to one
+// shape's floats stands in for the shader's index. The four wide versions trace a packet of rays against one shape and
+// return a bit per ray that hit, along with the distances the scalar ones would give. The scalar ones also find the hit
+// point, normal and side the tracer needs, unless SURFACE is false, which leaves them with the four wide ones' work.
+namespace cpu
+{
+    using Float3 = sf::Glsl::Vec3;
+
+    // Same as RaytracerShader.frag
+    constexpr float
+        MINVAL = 0.000025f,
+        MAXVAL = 10000000.0f;
+
+
+    inline float Dot(const Float3& a, const Float3& b)
+    {
+        return a.x*b.x + a.y*b.y + a.z*b.z;
+    }
+
+    inline Float3 Cross(const Float3& a, const Float3& b)
+    {
+        return { a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x };
+    }
+
+    inline float Length(const Float3& a)
+    {
+        return std::sqrt(Dot(a, a));
+    }
+
+    inline Float3 Normalize(const Float3& a)
+    {
+        return a / Length(a);
+    }
+
+    inline Float3 Mul(const Float3& a, const Float3& b)
+    {
+        return { a.x*b.x, a.y*b.y, a.z*b.z };
+    }
+
+    inline Float3 Inverse(const Float3& a)
+    {
+        return { 1.0f / a.x, 1.0f / a.y, 1.0f / a.z };
+    }
+
+    inline Float3 Load3(const float* v)
+    {
+        return { v[0], v[1], v[2] };
+    }
+
+
+    // Make sure to invert irD beforehand
+    inline bool CheckBoundingBox(const Float3& rO, const Float3& irD, const Float3& bMin, const Float3& bMax)
+    {
+        float tx1 = (bMin.x - rO.x) * irD.x;
+        float tx2 = (bMax.x - rO.x) * irD.x;
+
+        float tmin = std::min(tx1, tx2);
+        float tmax = std::max(tx1, tx2);
+
+        float ty1 = (bMin.y - rO.y) * irD.y;
+        float ty2 = (bMax.y - rO.y) * irD.y;
+
+        tmin = std::max(tmin, std::min(ty1, ty2));
+        tmax = std::min(tmax, std::max(ty1, ty2));
+
+        float tz1 = (bMin.z - rO.z) * irD.z;
+        float tz2 = (bMax.z - rO.z) * irD.z;
+
+        tmin = std::max(tmin, std::min(tz1, tz2));
+        tmax = std::min(tmax, std::max(tz1, tz2));
+
+        return (tmax >= std::max(0.0f, tmin)) && (tmin < MAXVAL);
+    }
+
+    inline bool CheckBoundingSphere(const Float3& rO, const Float3& rD, const sf::Glsl::Vec4& s)
+    {
+        Float3 oc = rO - Float3(s.x, s.y, s.z);
+        float b = Dot(oc, rD);
+
+        Float3 qc = oc - rD * b;
+        float h = (s.w*s.w) - Dot(qc, qc);
+
+        if (h < -MINVAL)
+            return false;
+
+        return b * std::abs(b) < h;
+    }
+
+    // vec3(min), vec3(max)
+    template <bool SURFACE = true>
+    inline bool RayAABBIntersect(const Float3& rO, const Float3& rD, const float* shape, float& l, Float3& p, Float3& n, int& side)
+    {
+        const Float3 bMin = Load3(shape), bMax = Load3(shape + 3), invDir = Inverse(rD);
+
+        float tx1 = (bMin.x - rO.x) * invDir.x;
+        float tx2 = (bMax.x - rO.x) * invDir.x;
+
+        float tmin = std::min(tx1, tx2);
+        float tmax = std::max(tx1, tx2);
+
+        float ty1 = (bMin.y - rO.y) * invDir.y;
+        float ty2 = (bMax.y - rO.y) * invDir.y;
+
+        tmin = std::max(tmin, std::min(ty1, ty2));
+        tmax = std::min(tmax, std::max(ty1, ty2));
+
+        float tz1 = (bMin.z - rO.z) * invDir.z;
+        float tz2 = (bMax.z - rO.z) * invDir.z;
+
+        tmin = std::max(tmin, std::min(tz1, tz2));
+        tmax = std::min(tmax, std::max(tz1, tz2));
+
+        if (!((tmax >= std::max(0.0f, tmin)) && (tmin < MAXVAL)))
+            return false;
+
+        l = (tmin > 0.0f) ? tmin : tmax;
+        if constexpr (!SURFACE)
+            return true; // Without the fallback below, which only NaNs reach
+
+        p = rO + (rD * l);
+        side = (tmin > 0.0f) ? 1 : -1;
+        n = Float3();
+
+        if (l == tx1)
+        {
+            p.x = bMin.x;
+            n = Float3((float)-side, 0, 0);
+        }
+        else if (l == tx2)
+        {
+            p.x = bMax.x;
+            n = Float3((float)side, 0, 0);
+        }
+        else if (l == ty1)
+        {
+            p.y = bMin.y;
+            n = Float3(0, (float)-side, 0);
+        }
+        else if (l == ty2)
+        {
+            p.y = bMax.y;
+            n = Float3(0, (float)side, 0);
+        }
+        else if (l == tz1)
+        {
+            p.z = bMin.z;
+            n = Float3(0, 0, (float)-side);
+        }
+        else if (l == tz2)
+        {
+            p.z = bMax.z;
+            n = Float3(0, 0, (float)side);
+        }
+
+        if (Length(n) < 0.5f)
+        {
+            p = rO + rD * 0.1f;
+            l = 0.1f;
+            n = Float3(1, 1, 1);
+        }
+
+        return true;
+    }
+
+    // vec3(center), vec3(halfLength), vec3(x-axis), vec3(y-axis), vec3(z-axis)
+    template <bool SURFACE = true>
+    inline bool RayOBBIntersect(const Float3& rO, const Float3& rD, const float* shape, float& l, Float3& p, Float3& n, int& side)
+    {
+        float // Distances to entry & exit.
+            minV = -MAXVAL,
+            maxV = MAXVAL;
+
+        Float3
+            rayToCenter = Load3(shape) - rO,
+            nMin,
+            nMax;
+
+        for (int a = 0; a < 3; a++)
+        { // Check each axis individually.
+            Float3 axis = Load3(shape + 6 + a*3);
+            float halfLength = shape[3 + a];
+
+            float
+                distAlongAxis = Dot(axis, rayToCenter), // Distance from ray to OBB center along axis.
+                f = Dot(axis, rD); // Length of direction.
+
+            if (std::abs(f) > MINVAL)
+            { // Ray is not orthogonal to axis.
+                Float3
+                    tnMin = axis,
+                    tnMax = axis * -1.0f;
+
+                float
+                    t0 = (distAlongAxis + halfLength) / f,
+                    t1 = (distAlongAxis - halfLength) / f;
+
+                if (t0 > t1)
+                { // Flip intersection order.
+                    std::swap(t0, t1);
+                    tnMin = tnMax;
+                    tnMax = axis;
+                }
+
+                if (t0 > minV)
+                { // Keep the longer entry-point.
+                    minV = t0;
+                    nMin = tnMin;
+                }
+                if (t1 < maxV)
+                { // Keep the shorter exit-point.
+                    maxV = t1;
+                    nMax = tnMax;
+                }
+
+                if (minV > maxV)   return false; // Ray misses OBB.
+                if (maxV < 0.0f)   return false; // OBB is behind ray.
+            }
+            else if (-distAlongAxis - halfLength > 0.0f
+                  || -distAlongAxis + halfLength < 0.0f)
+            { // Ray is orthogonal to axis but not located between the axis-planes.
+                return false;
+            }
+        }
+
+        // Find the closest positive intersection.
+        if constexpr (!SURFACE)
+        {
+            l = (minV > 0.0f) ? minV : maxV;
+            return true;
+        }
+
+        if (minV > 0.0f)
+        {
+            l = minV;
+            n = nMin;
+            side = 1;
+        }
+        else
+        {
+            l = maxV;
+            n = -nMax;
+            side = -1;
+        }
+
+        p = rO + rD * l;
+        n = Normalize(n);
+        return true;
+    }
+
+    // vec4(pos, rad)
+    template <bool SURFACE = true>
+    inline bool RaySphereIntersect(const Float3& rO, const Float3& rD, const float* shape, float& l, Float3& p, Float3& n, int& side)
+    {
+        const Float3 center = Load3(shape);
+        const float radius = shape[3];
+
+        Float3 oc = rO - center;
+        float b = Dot(oc, rD);
+
+        Float3 qc = oc - rD * b;
+        float h = (radius * radius) - Dot(qc, qc);
+
+        if (h < -MINVAL)
+            return false;
+
+        h = std::sqrt(std::max(0.0f, h));
+
+        float t0 = -b - h;
+        float t1 = -b + h;
+
+        if (t0 > t1)
+            std::swap(t0, t1);
+
+        if (t0 < 0.0f)
+        {
+            if (t1 < 0.0f)
+                return false;
+            t0 = t1;
+        }
+
+        l = t0;
+        if constexpr (!SURFACE)
+            return true;
+
+        p = rO + rD * l;
+        n = (p - center) / radius;
+        side = 1;
+
+        if (Dot(n, rD) > 0.0f)
+        {
+            n *= -1.0f;
+            side = -1;
+        }
+        return true;
+    }
+
+    // vec3(v1), vec3(v2), vec3(v3), back faces are culled
+    template <bool SURFACE = true>
+    inline bool RayTriIntersect(const Float3& rO, const Float3& rD, const float* shape, float& l, Float3& p, Float3& n, int& side)
+    {
+        const Float3 v0 = Load3(shape);
+        Float3 edge1 = Load3(shape + 3) - v0;
+        Float3 edge2 = Load3(shape + 6) - v0;
+
+        // Backface-culling
+        Float3 iN = Cross(edge1, edge2);
+        if (Dot(iN, rD) >= 0.0f)
+            return false;
+
+        Float3 h = Cross(rD, edge2);
+        float a = Dot(edge1, h);
+
+        if (a > -MINVAL && a < MINVAL)
+            return false;
+
+        Float3 s = rO - v0;
+        float f = 1.0f / a;
+        float u = f * Dot(s, h);
+
+        if (u < 0.0f || u > 1.0f)
+            return false;
+
+        Float3 q = Cross(s, edge1);
+        float v = f * Dot(rD, q);
+
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+
+        float t = f * Dot(edge2, q);
+
+        if (t <= 0.0f)
+            return false;
+
+        l = t;
+        if constexpr (!SURFACE)
+            return true;
+
+        p = rO + rD * t;
+        n = Normalize(iN);
+        side = (Dot(n, rD) < 0.0f) ? 1 : -1;
+
+        return true;
+    }
+
+    // vec3(center), vec3(normal)
+    template <bool SURFACE = true>
+    inline bool RayPlaneIntersect(const Float3& rO, const Float3& rD, const float* shape, float& l, Float3& p, Float3& n, int& side)
+    {
+        const Float3 center = Load3(shape), normal = Load3(shape + 3);
+
+        float a = Dot(normal, rD);
+        float b = Dot(normal, center - rO);
+
+        if ((a >= 0.0f) != (b >= 0.0f))
+            return false;
+        if (std::abs(b) < MINVAL)
+            return false;
+
+        l = (Dot(normal, center) - Dot(normal, rO)) / a;
+        if constexpr (!SURFACE)
+            return true;
+
+        p = rO + rD * l;
+        n = normal;
+        side = (Dot(n, rD) < 0.0f) ? 1 : -1;
+
+        return true;
+    }
+
+
+    // Four floats, or four masks from comparing them with every bit of a lane set where it holds
+    struct Float4
+    {
+#if INTERSECT_SSE
+        __m128 v;
+
+        Float4() : v(_mm_setzero_ps()) {}
+        Float4(__m128 v) : v(v) {}
+        Float4(float a) : v(_mm_set1_ps(a)) {}
+
+        static Float4 Load(const float* p) { return _mm_loadu_ps(p); }
+        void Store(float* p) const { _mm_storeu_ps(p, v); }
+
+        Float4 operator+(const Float4& b) const { return _mm_add_ps(v, b.v); }
+        Float4 operator-(const Float4& b) const { return _mm_sub_ps(v, b.v); }
+        Float4 operator*(const Float4& b) const { return _mm_mul_ps(v, b.v); }
+        Float4 operator/(const Float4& b) const { return _mm_div_ps(v, b.v); }
+
+        Float4 operator<(const Float4& b) const { return _mm_cmplt_ps(v, b.v); }
+        Float4 operator<=(const Float4& b) const { return _mm_cmple_ps(v, b.v); }
+        Float4 operator>(const Float4& b) const { return _mm_cmpgt_ps(v, b.v); }
+        Float4 operator>=(const Float4& b) const { return _mm_cmpge_ps(v, b.v); }
+
+        Float4 operator&(const Float4& b) const { return _mm_and_ps(v, b.v); }
+        Float4 operator|(const Float4& b) const { return _mm_or_ps(v, b.v); }
+        Float4 operator^(const Float4& b) const { return _mm_xor_ps(v, b.v); }
+        Float4 operator~() const { return _mm_xor_ps(v, _mm_castsi128_ps(_mm_set1_epi32(-1))); }
+
+        friend Float4 Min(const Float4& a, const Float4& b) { return _mm_min_ps(a.v, b.v); }
+        friend Float4 Max(const Float4& a, const Float4& b) { return _mm_max_ps(a.v, b.v); }
+        friend Float4 Sqrt(const Float4& a) { return _mm_sqrt_ps(a.v); }
+        friend Float4 Abs(const Float4& a) { return _mm_and_ps(a.v, _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF))); }
+
+        // a where mask is set, b elsewhere
+        friend Float4 Select(const Float4& mask, const Float4& a, const Float4& b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+        // Bit i for lane i
+        friend int Mask(const Float4& mask) { return _mm_movemask_ps(mask.v); }
+#else
+        float v[4];
+
+        Float4() : v{ 0.0f, 0.0f, 0.0f, 0.0f } {}
+        Float4(float a) : v{ a, a, a, a } {}
+
+        static Float4 Load(const float* p) { Float4 r; std::memcpy(r.v, p, sizeof(r.v)); return r; }
+        void Store(float* p) const { std::memcpy(p, v, sizeof(v)); }
+
+        template <typename F>
+        static Float4 Each(F f) { Float4 r; for (int i = 0; i < 4; i++) r.v[i] = f(i); return r; }
+
+        static float Bits(bool b) { uint32_t u = b ? 0xFFFFFFFFu : 0u; float f; std::memcpy(&f, &u, 4); return f; }
+        static uint32_t Int(float f) { uint32_t u; std::memcpy(&u, &f, 4); return u; }
+        static float Float(uint32_t u) { float f; std::memcpy(&f, &u, 4); return f; }
+
+        Float4 operator+(const Float4& b) const { return Each([&](int i) { return v[i] + b.v[i]; }); }
+        Float4 operator-(const Float4& b) const { return Each([&](int i) { return v[i] - b.v[i]; }); }
+        Float4 operator*(const Float4& b) const { return Each([&](int i) { return v[i] * b.v[i]; }); }
+        Float4 operator/(const Float4& b) const { return Each([&](int i) { return v[i] / b.v[i]; }); }
+
+        Float4 operator<(const Float4& b) const { return Each([&](int i) { return Bits(v[i] < b.v[i]); }); }
+        Float4 operator<=(const Float4& b) const { return Each([&](int i) { return Bits(v[i] <= b.v[i]); }); }
+        Float4 operator>(const Float4& b) const { return Each([&](int i) { return Bits(v[i] > b.v[i]); }); }
+        Float4 operator>=(const Float4& b) const { return Each([&](int i) { return Bits(v[i] >= b.v[i]); }); }
+
+        Float4 operator&(const Float4& b) const { return Each([&](int i) { return Float(Int(v[i]) & Int(b.v[i])); }); }
+        Float4 operator|(const Float4& b) const { return Each([&](int i) { return Float(Int(v[i]) | Int(b.v[i])); }); }
+        Float4 operator^(const Float4& b) const { return Each([&](int i) { return Float(Int(v[i]) ^ Int(b.v[i])); }); }
+        Float4 operator~() const { return Each([&](int i) { return Float(~Int(v[i])); }); }
+
+        // Same operand order as the SSE instructions, which return the second operand when either is NaN
+        friend Float4 Min(const Float4& a, const Float4& b) { return Each([&](int i) { return a.v[i] < b.v[i] ? a.v[i] : b.v[i]; }); }
+        friend Float4 Max(const Float4& a, const Float4& b) { return Each([&](int i) { return a.v[i] > b.v[i] ? a.v[i] : b.v[i]; }); }
+        friend Float4 Sqrt(const Float4& a) { return Each([&](int i) { return std::sqrt(a.v[i]); }); }
+        friend Float4 Abs(const Float4& a) { return Each([&](int i) { return std::abs(a.v[i]); }); }
+
+        friend Float4 Select(const Float4& mask, const Float4& a, const Float4& b) { return (mask & a) | (~mask & b); }
+        friend int Mask(const Float4& mask) { int m = 0; for (int i = 0; i < 4; i++) m |= (int)(Int(mask.v[i]) >> 31) << i; return m; }
+#endif
+    };
+
+    struct Float3x4
+    {
+        Float4 x, y, z;
+
+        Float3x4() = default;
+        Float3x4(const Float4& x, const Float4& y, const Float4& z) : x(x), y(y), z(z) {}
+        Float3x4(const Float3& a) : x(a.x), y(a.y), z(a.z) {}
+
+        Float3x4 operator+(const Float3x4& b) const { return { x + b.x, y + b.y, z + b.z }; }
+        Float3x4 operator-(const Float3x4& b) const { return { x - b.x, y - b.y, z - b.z }; }
+        Float3x4 operator*(const Float4& a) const { return { x * a, y * a, z * a }; }
+    };
+
+    inline Float4 Dot(const Float3x4& a, const Float3x4& b)
+    {
+        return a.x*b.x + a.y*b.y + a.z*b.z;
+    }
+
+    inline Float3x4 Cross(const Float3x4& a, const Float3x4& b)
+    {
+        return { a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x };
+    }
+
+    // Four rays side by side, lanes of rays that don't exist can hold anything
+    struct RayPacket
+    {
+        Float3x4 o, d;
+    };
+
+
+    // The four wide kernels below make the same decisions as the scalar ones, lane by lane. The branches become masks,
+    // and early outs are left to the end since the entry only grows and the exit only shrinks.
+
+    inline int CheckBoundingBox4(const RayPacket& r, const Float3x4& irD, const Float3& bMin, const Float3& bMax)
+    {
+        Float4 tx1 = (Float4(bMin.x) - r.o.x) * irD.x;
+        Float4 tx2 = (Float4(bMax.x) - r.o.x) * irD.x;
+
+        Float4 tmin = Min(tx1, tx2);
+        Float4 tmax = Max(tx1, tx2);
+
+        Float4 ty1 = (Float4(bMin.y) - r.o.y) * irD.y;
+        Float4 ty2 = (Float4(bMax.y) - r.o.y) * irD.y;
+
+        tmin = Max(tmin, Min(ty1, ty2));
+        tmax = Min(tmax, Max(ty1, ty2));
+
+        Float4 tz1 = (Float4(bMin.z) - r.o.z) * irD.z;
+        Float4 tz2 = (Float4(bMax.z) - r.o.z) * irD.z;
+
+        tmin = Max(tmin, Min(tz1, tz2));
+        tmax = Min(tmax, Max(tz1, tz2));
+
+        return Mask((tmax >= Max(0.0f, tmin)) & (tmin < MAXVAL));
+    }
+
+    inline int CheckBoundingSphere4(const RayPacket& r, const sf::Glsl::Vec4& s)
+    {
+        Float3x4 oc = r.o - Float3x4(Float3(s.x, s.y, s.z));
+        Float4 b = Dot(oc, r.d);
+
+        Float3x4 qc = oc - r.d * b;
+        Float4 h = Float4(s.w*s.w) - Dot(qc, qc);
+
+        return Mask(~(h < -MINVAL) & (b * Abs(b) < h));
+    }
+
+    // Leaves out the scalar version's fallback for a distance matching no slab, which only NaNs reach
+    inline int RayAABBIntersect4(const RayPacket& r, const float* shape, Float4& l)
+    {
+        const Float4 one = 1.0f;
+        const Float3x4 invDir(one / r.d.x, one / r.d.y, one / r.d.z);
+
+        Float4 tx1 = (Float4(shape[0]) - r.o.x) * invDir.x;
+        Float4 tx2 = (Float4(shape[3]) - r.o.x) * invDir.x;
+
+        Float4 tmin = Min(tx1, tx2);
+        Float4 tmax = Max(tx1, tx2);
+
+        Float4 ty1 = (Float4(shape[1]) - r.o.y) * invDir.y;
+        Float4 ty2 = (Float4(shape[4]) - r.o.y) * invDir.y;
+
+        tmin = Max(tmin, Min(ty1, ty2));
+        tmax = Min(tmax, Max(ty1, ty2));
+
+        Float4 tz1 = (Float4(shape[2]) - r.o.z) * invDir.z;
+        Float4 tz2 = (Float4(shape[5]) - r.o.z) * invDir.z;
+
+        tmin = Max(tmin, Min(tz1, tz2));
+        tmax = Min(tmax, Max(tz1, tz2));
+
+        l = Select(tmin > 0.0f, tmin, tmax);
+        return Mask((tmax >= Max(0.0f, tmin)) & (tmin < MAXVAL));
+    }
+
+    inline int RayOBBIntersect4(const RayPacket& r, const float* shape, Float4& l)
+    {
+        Float4
+            minV = -MAXVAL,
+            maxV = MAXVAL,
+            miss;
+
+        const Float3x4 rayToCenter = Float3x4(Load3(shape)) - r.o;
+
+        for (int a = 0; a < 3; a++)
+        {
+            const Float3x4 axis(Load3(shape + 6 + a*3));
+            const Float4 halfLength = shape[3 + a];
+
+            Float4
+                distAlongAxis = Dot(axis, rayToCenter),
+                f = Dot(axis, r.d),
+                slanted = Abs(f) > MINVAL;
+
+            Float4
+                t0 = (distAlongAxis + halfLength) / f,
+                t1 = (distAlongAxis - halfLength) / f;
+
+            // Lanes orthogonal to the axis keep their interval, and miss unless they're between the planes
+            minV = Select(slanted, Max(minV, Min(t0, t1)), minV);
+            maxV = Select(slanted, Min(maxV, Max(t0, t1)), maxV);
+
+            Float4 outside = (Float4(0.0f) - distAlongAxis - halfLength > 0.0f) | (Float4(0.0f) - distAlongAxis + halfLength < 0.0f);
+            miss = miss | (~slanted & outside);
+        }
+
+        miss = miss | (minV > maxV) | (maxV < 0.0f);
+
+        l = Select(minV > 0.0f, minV, maxV);
+        return Mask(~miss);
+    }
+
+    inline int RaySphereIntersect4(const RayPacket& r, const float* shape, Float4& l)
+    {
+        Float3x4 oc = r.o - Float3x4(Load3(shape));
+        Float4 b = Dot(oc, r.d);
+
+        Float3x4 qc = oc - r.d * b;
+        Float4 h = Float4(shape[3] * shape[3]) - Dot(qc, qc);
+
+        Float4 miss = h < -MINVAL;
+
+        h = Sqrt(Max(h, 0.0f));
+
+        Float4 t0 = Float4(0.0f) - b - h;
+        Float4 t1 = h - b;
+
+        l = Select(t0 < 0.0f, t1, t0);
+        return Mask(~(miss | ((t0 < 0.0f) & (t1 < 0.0f))));
+    }
+
+    inline int RayTriIntersect4(const RayPacket& r, const float* shape, Float4& l)
+    {
+        const Float3 v0 = Load3(shape);
+        const Float3x4
+            edge1(Load3(shape + 3) - v0),
+            edge2(Load3(shape + 6) - v0),
+            iN(Cross(Load3(shape + 3) - v0, Load3(shape + 6) - v0));
+
+        Float4 miss = Dot(iN, r.d) >= 0.0f;
+
+        Float3x4 h = Cross(r.d, edge2);
+        Float4 a = Dot(edge1, h);
+
+        miss = miss | ((a > -MINVAL) & (a < MINVAL));
+
+        Float3x4 s = r.o - Float3x4(v0);
+        Float4 f = Float4(1.0f) / a;
+        Float4 u = f * Dot(s, h);
+
+        miss = miss | (u < 0.0f) | (u > 1.0f);
+
+        Float3x4 q = Cross(s, edge1);
+        Float4 v = f * Dot(r.d, q);
+
+        miss = miss | (v < 0.0f) | (u + v > 1.0f);
+
+        l = f * Dot(edge2, q);
+        return Mask(~(miss | (l <= 0.0f)));
+    }
+
+    inline int RayPlaneIntersect4(const RayPacket& r, const float* shape, Float4& l)
+    {
+        const Float3 center = Load3(shape), normal = Load3(shape + 3);
+
+        Float4 a = Dot(Float3x4(normal), r.d);
+        Float4 b = Dot(Float3x4(normal), Float3x4(center) - r.o);
+
+        Float4 miss = ((a >= 0.0f) ^ (b >= 0.0f)) | (Abs(b) < MINVAL);
+
+        l = (Float4(Dot(normal, center)) - Dot(Float3x4(normal), r.o)) / a;
+        return Mask(~miss);
+    }
+}
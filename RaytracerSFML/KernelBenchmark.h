@@ -0,0 +1,382 @@
+#pragma once
+
+#include "Intersect.h"
+
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+
+
+// Times the intersection kernels of Intersect.h one shape at a time, scalar and four wide, on rays that mostly hit it,
+// mostly miss it or skim along its surface. How often a kernel returns early decides most of its cost, so each kind of
+// ray is timed on its own.
+enum RayDistribution
+{
+    RAYS_HIT,     // From outside towards a point on the front of the shape
+    RAYS_MISS,    // Past the shape's bounding sphere
+    RAYS_GRAZING, // Nearly parallel to the surface, just above or below it
+    RAY_DISTRIBUTIONS
+};
+
+constexpr const char* rayDistributionNames[RAY_DISTRIBUTIONS] = { "hit", "miss", "grazing" };
+
+struct KernelResult
+{
+    std::string kernel;
+    RayDistribution rays = RAYS_HIT;
+
+    double // Per ray and shape
+        scalarNs = 0.0,  // Finding only the hits and distances, like the four wide kernels
+        simdNs = 0.0,
+        surfaceNs = 0.0, // Scalar as the tracer calls them, also finding the hit point, normal and side
+        hitRate = 0.0;   // Of the scalar kernel
+
+    size_t mismatches = 0; // Rays the four wide kernel decided differently, or found more than 0.01% further or nearer
+};
+
+
+struct KernelBenchmark
+{
+    static constexpr size_t RAYS = 4096; // Small enough to stay in cache, so the kernels are timed rather than memory
+    static constexpr uint32_t SEED = 1;
+
+    double secondsPerRun = 0.25; // For each kernel, distribution and variant
+    double sink = 0.0;           // Every kernel result is added in, so none of the timed work can be left out
+
+
+    std::vector<KernelResult> Run()
+    {
+        using namespace cpu;
+
+        // Test shapes in the shader's layout, none centered on the origin or lined up with the axes where they can help it
+        const float sphere[4] = { 0.5f, -0.25f, 0.125f, 1.0f };
+        const float aabb[6] = { -0.5f, -0.75f, -0.25f, 1.5f, 0.25f, 1.0f };
+        const float tri[9] = { -1.0f, -1.0f, 0.25f, 1.0f, -0.75f, 0.0f, 0.0f, 1.0f, -0.25f };
+        const float plane[6] = { 0.25f, -0.5f, 0.0f, 0.0f, 1.0f, 0.0f };
+        float obb[15] = { 0.5f, 0.25f, -0.5f, 1.0f, 0.5f, 0.75f };
+        {
+            const Float3
+                x = Normalize(Float3(1.0f, 0.5f, -0.25f)),
+                y = Normalize(Cross(Float3(0.25f, 0.0f, 1.0f), x)),
+                z = Cross(x, y);
+            const Float3 axes[3] = { x, y, z };
+            for (int a = 0; a < 3; a++)
+                std::copy(&axes[a].x, &axes[a].x + 3, obb + 6 + a*3);
+        }
+
+        const sf::Glsl::Vec4 bounds(sphere[0], sphere[1], sphere[2], sphere[3]);
+        const Float3 boxMin = Load3(aabb), boxMax = Load3(aabb + 3);
+
+        std::vector<KernelResult> results;
+        for (int d = 0; d < RAY_DISTRIBUTIONS; d++)
+        {
+            const RayDistribution rays = (RayDistribution)d;
+
+            Generate(rays, [&](Float3& p, Float3& n) { SphereSurface(sphere, p, n); }, Load3(sphere), sphere[3]);
+            // Bounds have no surface to find, their scalar check is timed once
+            results.push_back(Time("CheckBoundingSphere", rays,
+                [&](size_t i, float& l) { l = 0.0f; return CheckBoundingSphere(o[i], dir[i], bounds); },
+                nullptr,
+                [&](const RayPacket& r, const Float3x4&, Float4& l) { l = 0.0f; return CheckBoundingSphere4(r, bounds); }));
+            results.push_back(Time("RaySphereIntersect", rays,
+                [&](size_t i, float& l) { Float3 p, n; int s; return RaySphereIntersect<false>(o[i], dir[i], sphere, l, p, n, s); },
+                [&](size_t i, float& l) { Float3 p, n; int s; const bool hit = RaySphereIntersect(o[i], dir[i], sphere, l, p, n, s); return KeepSurface(hit, p, n, s); },
+                [&](const RayPacket& r, const Float3x4&, Float4& l) { return RaySphereIntersect4(r, sphere, l); }));
+
+            Generate(rays, [&](Float3& p, Float3& n) { BoxSurface(aabb, nullptr, p, n); }, (boxMin + boxMax) * 0.5f, Length(boxMax - boxMin) * 0.5f);
+            results.push_back(Time("CheckBoundingBox", rays,
+                [&](size_t i, float& l) { l = 0.0f; return CheckBoundingBox(o[i], inv[i], boxMin, boxMax); },
+                nullptr,
+                [&](const RayPacket& r, const Float3x4& irD, Float4& l) { l = 0.0f; return CheckBoundingBox4(r, irD, boxMin, boxMax); }));
+            results.push_back(Time("RayAABBIntersect", rays,
+                [&](size_t i, float& l) { Float3 p, n; int s; return RayAABBIntersect<false>(o[i], dir[i], aabb, l, p, n, s); },
+                [&](size_t i, float& l) { Float3 p, n; int s; const bool hit = RayAABBIntersect(o[i], dir[i], aabb, l, p, n, s); return KeepSurface(hit, p, n, s); },
+                [&](const RayPacket& r, const Float3x4&, Float4& l) { return RayAABBIntersect4(r, aabb, l); }));
+
+            Generate(rays, [&](Float3& p, Float3& n) { BoxSurface(obb + 3, obb, p, n); }, Load3(obb), Length(Load3(obb + 3)));
+            results.push_back(Time("RayOBBIntersect", rays,
+                [&](size_t i, float& l) { Float3 p, n; int s; return RayOBBIntersect<false>(o[i], dir[i], obb, l, p, n, s); },
+                [&](size_t i, float& l) { Float3 p, n; int s; const bool hit = RayOBBIntersect(o[i], dir[i], obb, l, p, n, s); return KeepSurface(hit, p, n, s); },
+                [&](const RayPacket& r, const Float3x4&, Float4& l) { return RayOBBIntersect4(r, obb, l); }));
+
+            const Float3 triCenter = (Load3(tri) + Load3(tri + 3) + Load3(tri + 6)) / 3.0f;
+            Generate(rays, [&](Float3& p, Float3& n) { TriSurface(tri, p, n); }, triCenter,
+                std::max({ Length(Load3(tri) - triCenter), Length(Load3(tri + 3) - triCenter), Length(Load3(tri + 6) - triCenter) }));
+            results.push_back(Time("RayTriIntersect", rays,
+                [&](size_t i, float& l) { Float3 p, n; int s; return RayTriIntersect<false>(o[i], dir[i], tri, l, p, n, s); },
+                [&](size_t i, float& l) { Float3 p, n; int s; const bool hit = RayTriIntersect(o[i], dir[i], tri, l, p, n, s); return KeepSurface(hit, p, n, s); },
+                [&](const RayPacket& r, const Float3x4&, Float4& l) { return RayTriIntersect4(r, tri, l); }));
+
+            // Planes have no bounds to miss, so missing rays leave above it pointing up
+            Generate(rays, [&](Float3& p, Float3& n) { PlaneSurface(plane, p, n); }, Load3(plane), 2.0f, Load3(plane + 3));
+            results.push_back(Time("RayPlaneIntersect", rays,
+                [&](size_t i, float& l) { Float3 p, n; int s; return RayPlaneIntersect<false>(o[i], dir[i], plane, l, p, n, s); },
+                [&](size_t i, float& l) { Float3 p, n; int s; const bool hit = RayPlaneIntersect(o[i], dir[i], plane, l, p, n, s); return KeepSurface(hit, p, n, s); },
+                [&](const RayPacket& r, const Float3x4&, Float4& l) { return RayPlaneIntersect4(r, plane, l); }));
+        }
+        return results;
+    }
+
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::mt19937 rng{ SEED };
+    float surfaceSum = 0.0f;
+
+    // The current rays, as they'd be traced one at a time and as packets of four
+    std::vector<cpu::Float3> o, dir, inv;
+    std::vector<float> packets; // o xyz, d xyz and 1/d xyz, four of each per packet
+
+    float Random(float from = 0.0f, float to = 1.0f)
+    {
+        return std::uniform_real_distribution<float>(from, to)(rng);
+    }
+
+    cpu::Float3 RandomDirection()
+    {
+        std::normal_distribution<float> normal;
+        cpu::Float3 v;
+        do
+            v = cpu::Float3(normal(rng), normal(rng), normal(rng));
+        while (cpu::Dot(v, v) < 1e-6f);
+        return cpu::Normalize(v);
+    }
+
+    // Surface points and their outward normals, roughly uniform over the surface
+    void SphereSurface(const float* s, cpu::Float3& p, cpu::Float3& n)
+    {
+        n = RandomDirection();
+        p = cpu::Load3(s) + n * s[3];
+    }
+
+    // With axes, halfLengths and center belong to an OBB, without them extents holds an AABB's min and max
+    void BoxSurface(const float* extents, const float* center, cpu::Float3& p, cpu::Float3& n)
+    {
+        using namespace cpu;
+
+        Float3 local(Random(-1.0f, 1.0f), Random(-1.0f, 1.0f), Random(-1.0f, 1.0f)), normal;
+        const int face = (int)(Random() * 5.999f);
+        const float sign = (face & 1) ? 1.0f : -1.0f;
+        (&local.x)[face / 2] = sign;
+        (&normal.x)[face / 2] = sign;
+
+        if (center == nullptr)
+        {
+            const Float3 bMin = Load3(extents), bMax = Load3(extents + 3);
+            p = bMin + Mul(bMax - bMin, (local + Float3(1.0f, 1.0f, 1.0f)) * 0.5f);
+            n = normal;
+            return;
+        }
+
+        const Float3 halfLength = Load3(extents), axes[3] = { Load3(extents + 3), Load3(extents + 6), Load3(extents + 9) };
+        local = Mul(local, halfLength);
+
+        p = Load3(center) + axes[0] * local.x + axes[1] * local.y + axes[2] * local.z;
+        n = axes[0] * normal.x + axes[1] * normal.y + axes[2] * normal.z;
+    }
+
+    void TriSurface(const float* t, cpu::Float3& p, cpu::Float3& n)
+    {
+        using namespace cpu;
+
+        float u = Random(), v = Random();
+        if (u + v > 1.0f)
+        {
+            u = 1.0f - u;
+            v = 1.0f - v;
+        }
+
+        const Float3 v0 = Load3(t), edge1 = Load3(t + 3) - v0, edge2 = Load3(t + 6) - v0;
+        p = v0 + edge1 * u + edge2 * v;
+        n = Normalize(Cross(edge1, edge2)); // The side that isn't culled
+    }
+
+    void PlaneSurface(const float* plane, cpu::Float3& p, cpu::Float3& n)
+    {
+        using namespace cpu;
+
+        n = Load3(plane + 3);
+        const Float3 u = Normalize(Cross(n, std::abs(n.x) < 0.9f ? Float3(1, 0, 0) : Float3(0, 1, 0))), v = Cross(n, u);
+        p = Load3(plane) + u * Random(-2.0f, 2.0f) + v * Random(-2.0f, 2.0f);
+    }
+
+    // Fills the rays from surface points of a shape bounded by the sphere at center, with up set for planes
+    template <typename Surface>
+    void Generate(RayDistribution rays, Surface surface, const cpu::Float3& center, float radius, const cpu::Float3& up = cpu::Float3())
+    {
+        using namespace cpu;
+
+        rng.seed(SEED);
+        o.resize(RAYS);
+        dir.resize(RAYS);
+        inv.resize(RAYS);
+
+        for (size_t i = 0; i < RAYS; i++)
+        {
+            Float3 p, n;
+            surface(p, n);
+
+            if (rays == RAYS_HIT)
+            { // Seen from somewhere in front of the point
+                Float3 away = n + RandomDirection() * 0.75f;
+                if (Dot(away, n) < 0.1f)
+                    away = n;
+
+                o[i] = p + Normalize(away) * (radius * 3.0f);
+                dir[i] = Normalize(p - o[i]);
+            }
+            else if (rays == RAYS_MISS && Dot(up, up) > 0.0f)
+            {
+                Float3 towards = RandomDirection();
+                if (Dot(towards, up) < 0.0f)
+                    towards -= up * (2.0f * Dot(towards, up));
+
+                o[i] = p + up * Random(0.1f, radius);
+                dir[i] = Normalize(towards + up * 0.05f);
+            }
+            else if (rays == RAYS_MISS)
+            { // Aimed beside the bounding sphere
+                const Float3 from = RandomDirection();
+                const Float3 side = Normalize(Cross(from, RandomDirection()));
+
+                o[i] = center + from * (radius * 3.0f);
+                dir[i] = Normalize(center + side * (radius * Random(1.1f, 3.0f)) - o[i]);
+            }
+            else
+            { // Along a tangent, tilted a little either way and passing just inside or outside the surface
+                const Float3 tangent = Normalize(Cross(n, RandomDirection()));
+                dir[i] = Normalize(tangent + n * Random(-0.02f, 0.02f));
+                o[i] = p + n * (radius * Random(-0.01f, 0.01f)) - dir[i] * (radius * 3.0f);
+            }
+            inv[i] = Inverse(dir[i]);
+        }
+
+        packets.assign(RAYS * 9, 0.0f);
+        for (size_t i = 0; i < RAYS; i++)
+        {
+            const Float3* rayValues[3] = { &o[i], &dir[i], &inv[i] };
+            for (int v = 0; v < 3; v++)
+                for (int c = 0; c < 3; c++)
+                    packets[(i / 4) * 36 + (v*3 + c) * 4 + i % 4] = (&rayValues[v]->x)[c];
+        }
+    }
+
+    // Uses the hit point, normal and side a scalar kernel found, so none of their work can be left out
+    bool KeepSurface(bool hit, const cpu::Float3& p, const cpu::Float3& n, int side)
+    {
+        if (hit)
+            surfaceSum += p.x + p.y + p.z + n.x + n.y + n.z + (float)side;
+        return hit;
+    }
+
+    cpu::RayPacket Packet(size_t p, cpu::Float3x4& irD) const
+    {
+        const float* at = &packets[p * 36];
+        cpu::RayPacket r;
+        r.o = { cpu::Float4::Load(at), cpu::Float4::Load(at + 4), cpu::Float4::Load(at + 8) };
+        r.d = { cpu::Float4::Load(at + 12), cpu::Float4::Load(at + 16), cpu::Float4::Load(at + 20) };
+        irD = { cpu::Float4::Load(at + 24), cpu::Float4::Load(at + 28), cpu::Float4::Load(at + 32) };
+        return r;
+    }
+
+    // Runs each variant over every ray for secondsPerRun, then checks the packets found what the scalar kernel did.
+    // surface is the scalar kernel as the tracer calls it, nullptr where that's scalar itself.
+    template <typename Scalar, typename Surface, typename Wide>
+    KernelResult Time(const char* kernel, RayDistribution rays, Scalar scalar, Surface surface, Wide wide)
+    {
+        KernelResult result;
+        result.kernel = kernel;
+        result.rays = rays;
+
+        std::vector<float> scalarL(RAYS), wideL(RAYS);
+        std::vector<uint8_t> scalarHit(RAYS), wideHit(RAYS);
+
+        double sum = 0.0;
+        size_t hits = 0;
+
+        result.scalarNs = Repeat([&]() {
+            for (size_t i = 0; i < RAYS; i++)
+            {
+                float l = 0.0f;
+                const bool hit = scalar(i, l);
+                hits += hit;
+                sum += hit ? l : 0.0f;
+            }
+        });
+
+        if constexpr (std::is_null_pointer_v<Surface>)
+            result.surfaceNs = result.scalarNs;
+        else
+            result.surfaceNs = Repeat([&]() {
+                for (size_t i = 0; i < RAYS; i++)
+                {
+                    float l = 0.0f;
+                    const bool hit = surface(i, l);
+                    hits += hit;
+                    sum += hit ? l : 0.0f;
+                }
+            });
+
+        result.simdNs = Repeat([&]() {
+            for (size_t p = 0; p < RAYS / 4; p++)
+            {
+                cpu::Float3x4 irD;
+                cpu::Float4 l;
+                const int mask = wide(Packet(p, irD), irD, l);
+                hits += mask != 0;
+                sum += (double)Mask(l > 0.0f);
+            }
+        });
+
+        for (size_t i = 0; i < RAYS; i++)
+            scalarHit[i] = scalar(i, scalarL[i]);
+        for (size_t p = 0; p < RAYS / 4; p++)
+        {
+            cpu::Float3x4 irD;
+            cpu::Float4 l;
+            const int mask = wide(Packet(p, irD), irD, l);
+            l.Store(&wideL[p * 4]);
+            for (int k = 0; k < 4; k++)
+                wideHit[p * 4 + k] = (mask >> k) & 1;
+        }
+
+        size_t scalarHits = 0;
+        for (size_t i = 0; i < RAYS; i++)
+        {
+            scalarHits += scalarHit[i];
+            if (scalarHit[i] != wideHit[i] ||
+                (scalarHit[i] && std::abs(scalarL[i] - wideL[i]) > 1e-4f * std::max(1.0f, std::abs(scalarL[i]))))
+                result.mismatches++;
+        }
+        result.hitRate = (double)scalarHits / RAYS;
+
+        sink += sum + (double)hits + surfaceSum;
+        return result;
+    }
+
+    // Nanoseconds per ray of one call of run over every ray, taking the fastest of several
+    template <typename F>
+    double Repeat(F run)
+    {
+        run(); // Warm up
+
+        double best = 1e30, total = 0.0;
+        while (total < secondsPerRun)
+        {
+            const Clock::time_point start = Clock::now();
+            for (int r = 0; r < 16; r++)
+                run();
+            const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+            best = std::min(best, seconds / 16.0);
+            total += seconds;
+        }
+        return best * 1e9 / RAYS;
+    }
+};
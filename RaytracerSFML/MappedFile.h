@@ -0,0 +1,221 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+
+// Read-only memory mapping of a whole file, pages are only read from disk when touched
+struct MappedFile
+{
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept
+    {
+        *this = std::move(other);
+    }
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Close();
+            data = other.data;
+            size = other.size;
+            other.data = nullptr;
+            other.size = 0;
+        }
+        return *this;
+    }
+
+    ~MappedFile()
+    {
+        Close();
+    }
+
+
+    bool Open(const std::string& filename)
+    {
+        Close();
+
+#ifdef _WIN32
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file); // The mapping keeps the file open
+
+        if (mapping == nullptr)
+            return false;
+
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+
+        if (view == nullptr)
+            return false;
+
+        data = (const uint8_t*)view;
+        size = (size_t)fileSize.QuadPart;
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        void* view = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+            view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd); // The mapping keeps the file open
+
+        if (view == MAP_FAILED)
+            return false;
+
+        data = (const uint8_t*)view;
+        size = (size_t)st.st_size;
+#endif
+        return true;
+    }
+
+    void Close()
+    {
+        if (data == nullptr)
+            return;
+
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap((void*)data, size);
+#endif
+        data = nullptr;
+        size = 0;
+    }
+};
+
+
+// Read-write mapping of a new file of a fixed size, the file is filled in place instead of through a staging buffer
+struct MappedOutputFile
+{
+    uint8_t* data = nullptr;
+    size_t size = 0;
+
+
+    MappedOutputFile() = default;
+    MappedOutputFile(const MappedOutputFile&) = delete;
+    MappedOutputFile& operator=(const MappedOutputFile&) = delete;
+
+    ~MappedOutputFile()
+    {
+        Close();
+    }
+
+
+    // Replaces any existing file
+    bool Create(const std::string& filename, size_t bytes)
+    {
+        Close();
+        if (bytes == 0)
+            return false;
+
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+        fileSize.QuadPart = (LONGLONG)bytes;
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, (DWORD)(fileSize.QuadPart >> 32), (DWORD)fileSize.QuadPart, nullptr);
+        void* view = (mapping != nullptr) ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, bytes) : nullptr;
+        if (mapping != nullptr)
+            CloseHandle(mapping);
+
+        if (view == nullptr)
+        {
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+            return false;
+        }
+#else
+        fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+
+        void* view = MAP_FAILED;
+        if (ftruncate(fd, (off_t)bytes) == 0)
+            view = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (view == MAP_FAILED)
+        {
+            close(fd);
+            fd = -1;
+            return false;
+        }
+#endif
+        data = (uint8_t*)view;
+        size = bytes;
+        return true;
+    }
+
+    // Waits until everything written is on disk
+    bool Flush()
+    {
+        if (data == nullptr)
+            return false;
+
+#ifdef _WIN32
+        return FlushViewOfFile(data, size) && FlushFileBuffers(file);
+#else
+        return msync(data, size, MS_SYNC) == 0 && fsync(fd) == 0;
+#endif
+    }
+
+    void Close()
+    {
+        if (data == nullptr)
+            return;
+
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+#else
+        munmap(data, size);
+        close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+};
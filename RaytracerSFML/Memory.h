@@ -0,0 +1,180 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <format>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+
+// Bytes held by each subsystem, current and peak. Owners of large buffers charge them with a MemoryCharge, sized
+// from what they allocated: CPU buffers by their capacity and GPU textures by their texel count. Small and short lived
+// allocations aren't charged, so this is the memory that grows with the image and scene rather than the process total.
+enum MemoryCategory
+{
+    MEMORY_FRAMEBUFFERS, // Images and render targets of the frame, on the CPU and GPU
+    MEMORY_ACCUMULATION, // Running sums of samples
+    MEMORY_GEOMETRY,     // Shape values, mesh vertices, normals and triangles
+    MEMORY_BVH,          // Bounding spheres and mesh BVH nodes
+    MEMORY_MATERIALS,
+    MEMORY_TEXTURES,     // The scene's data textures on the GPU
+    MEMORY_SCRATCH,      // Per pass buffers: readbacks, the CPU tracer's output, denoising
+
+    MEMORY_CATEGORIES
+};
+
+constexpr const char* memoryCategoryNames[MEMORY_CATEGORIES] = {
+    "framebuffers", "accumulation", "geometry", "bvh", "materials", "textures", "scratch"
+};
+
+
+struct MemoryUsage
+{
+    uint64_t Current(MemoryCategory category) const
+    {
+        return current[category].load(std::memory_order_relaxed);
+    }
+
+    uint64_t Peak(MemoryCategory category) const
+    {
+        return peak[category].load(std::memory_order_relaxed);
+    }
+
+    // Of every category at once, which is less than the sum of their peaks when they peak at different times
+    uint64_t Total() const
+    {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    uint64_t TotalPeak() const
+    {
+        return totalPeak.load(std::memory_order_relaxed);
+    }
+
+    // Starts the peaks over from what's held now, to measure one phase on its own
+    void ResetPeaks()
+    {
+        for (int c = 0; c < MEMORY_CATEGORIES; c++)
+            peak[c].store(current[c].load());
+        totalPeak.store(total.load());
+    }
+
+    void Add(MemoryCategory category, int64_t bytes)
+    {
+        Raise(peak[category], current[category].fetch_add((uint64_t)bytes) + (uint64_t)bytes);
+        Raise(totalPeak, total.fetch_add((uint64_t)bytes) + (uint64_t)bytes);
+    }
+
+    // One line of every category, current over peak
+    std::string Summary() const
+    {
+        std::string line;
+        for (int c = 0; c < MEMORY_CATEGORIES; c++)
+            line += std::format("{} {} / {}, ", memoryCategoryNames[c], Format(Current((MemoryCategory)c)), Format(Peak((MemoryCategory)c)));
+        return line + std::format("total {} / {}", Format(Total()), Format(TotalPeak()));
+    }
+
+    static std::string Format(uint64_t bytes)
+    {
+        if (bytes < 1024 * 1024)
+            return std::format("{:.1f} KB", bytes / 1024.0);
+        if (bytes < 1024ull * 1024 * 1024)
+            return std::format("{:.1f} MB", bytes / (1024.0 * 1024.0));
+        return std::format("{:.2f} GB", bytes / (1024.0 * 1024.0 * 1024.0));
+    }
+
+
+private:
+    std::atomic<uint64_t> current[MEMORY_CATEGORIES] = {}, peak[MEMORY_CATEGORIES] = {};
+    std::atomic<uint64_t> total = 0, totalPeak = 0;
+
+    static void Raise(std::atomic<uint64_t>& max, uint64_t value)
+    {
+        uint64_t was = max.load(std::memory_order_relaxed);
+        while (value > was && !max.compare_exchange_weak(was, value, std::memory_order_relaxed))
+            ;
+    }
+};
+
+inline MemoryUsage memoryUsage;
+
+
+// Bytes one owner holds in a category, given back when it's destroyed. Copies charge the same again, moves hand the
+// charge over.
+struct MemoryCharge
+{
+    explicit MemoryCharge(MemoryCategory category, size_t bytes = 0) :
+        category(category)
+    {
+        Set(bytes);
+    }
+
+    MemoryCharge(const MemoryCharge& other) :
+        MemoryCharge(other.category, other.bytes)
+    {}
+
+    MemoryCharge(MemoryCharge&& other) noexcept :
+        category(other.category), bytes(other.bytes)
+    {
+        other.bytes = 0;
+    }
+
+    MemoryCharge& operator=(const MemoryCharge& other)
+    {
+        if (this != &other)
+        {
+            Set(0);
+            category = other.category;
+            Set(other.bytes);
+        }
+        return *this;
+    }
+
+    MemoryCharge& operator=(MemoryCharge&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Set(0);
+            category = other.category;
+            bytes = other.bytes;
+            other.bytes = 0;
+        }
+        return *this;
+    }
+
+    ~MemoryCharge()
+    {
+        Set(0);
+    }
+
+    // Replaces the charge, after the owner's buffers were resized
+    void Set(size_t newBytes)
+    {
+        if (newBytes != bytes)
+            memoryUsage.Add(category, (int64_t)newBytes - (int64_t)bytes);
+        bytes = newBytes;
+    }
+
+    size_t Bytes() const
+    {
+        return bytes;
+    }
+
+    template<typename T>
+    static size_t Of(const std::vector<T>& v)
+    {
+        return v.capacity() * sizeof(T);
+    }
+
+    // Of an SFML image, texture or render target, 8 bit rgba at its current size
+    template<typename T>
+    static size_t OfTexels(const T& image)
+    {
+        return (size_t)image.getSize().x * image.getSize().y * 4;
+    }
+
+private:
+    MemoryCategory category;
+    size_t bytes = 0;
+};
@@ -0,0 +1,778 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <format>
+#include <charconv>
+#include <thread>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <cstdint>
+
+
+// Triangle mesh with indexed vertices, each vertex is stored once no matter how many triangles share it
+struct Mesh
+{
+    std::vector<float> positions;  // xyz per vertex
+    std::vector<float> normals;    // xyz per vertex, empty when the file has none
+    std::vector<uint32_t> indices; // Three vertices per triangle, counter-clockwise seen from the front
+
+
+    size_t VertexCount() const
+    {
+        return positions.size() / 3;
+    }
+
+    size_t TriangleCount() const
+    {
+        return indices.size() / 3;
+    }
+
+    // Loads a .obj or binary .ply file, on failure returns false and describes the first problem
+    bool Load(const std::string& filename, std::string& error);
+};
+
+
+// Mesh files are mapped and split into one chunk per thread, chunks are parsed independently and merged afterwards
+struct MeshLoader
+{
+    static constexpr size_t MIN_CHUNK_BYTES = 1 << 20;
+
+
+    static unsigned int ChunkCount(size_t bytes)
+    {
+        size_t chunks = std::max<size_t>(1, bytes / MIN_CHUNK_BYTES);
+        return (unsigned int)std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), chunks));
+    }
+
+    template<typename F>
+    static void ParallelChunks(unsigned int chunks, F&& chunkFunc)
+    {
+        if (chunks == 1)
+        {
+            chunkFunc(0u);
+            return;
+        }
+
+        std::vector<std::thread> threads;
+        for (unsigned int c = 0; c < chunks; c++)
+            threads.emplace_back([&, c]() { chunkFunc(c); });
+
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+
+    /*===================================================================================================*/
+    /*                                                OBJ                                                */
+    /*===================================================================================================*/
+
+    // Negative OBJ indices count back from the last vertex, they're stored relative to the chunk until its base is known
+    static constexpr int64_t OBJ_RELATIVE = (int64_t)1 << 40;
+    static constexpr int64_t OBJ_NONE = -1;
+
+    struct ObjChunk
+    {
+        const char *begin, *end;
+
+        std::vector<float> positions, normals;
+        std::vector<int64_t> corners; // Position and normal index per face corner
+        std::vector<uint32_t> faceSizes;
+        std::vector<uint32_t> triangles; // Resolved position and normal index per triangle corner
+
+        size_t lines = 0, firstTriangle = 0;
+        size_t errorLine = 0;
+        std::string error;
+        bool usesNormals = false;
+    };
+
+    static const char* SkipSpaces(const char* p, const char* end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        return p;
+    }
+
+    static bool ParseFloat(const char*& p, const char* end, float& value)
+    {
+        p = SkipSpaces(p, end);
+        if (p < end && *p == '+')
+            p++;
+
+        auto [ptr, ec] = std::from_chars(p, end, value);
+        if (ec != std::errc())
+            return false;
+        p = ptr;
+        return true;
+    }
+
+    // One index of a face corner, count is the number of elements read so far in this chunk
+    static bool ParseObjIndex(const char*& p, const char* end, size_t count, int64_t& index)
+    {
+        int64_t value;
+        auto [ptr, ec] = std::from_chars(p, end, value);
+        if (ec != std::errc() || value == 0)
+            return false;
+        p = ptr;
+
+        index = (value > 0) ? value - 1 : OBJ_RELATIVE + (int64_t)count + value;
+        return true;
+    }
+
+    static void ParseObjChunk(ObjChunk& chunk)
+    {
+        const char* p = chunk.begin;
+
+        while (p < chunk.end && chunk.error.empty())
+        {
+            const char* lineEnd = (const char*)memchr(p, '\n', chunk.end - p);
+            if (lineEnd == nullptr)
+                lineEnd = chunk.end;
+            chunk.lines++;
+
+            const char* q = SkipSpaces(p, lineEnd);
+            size_t keyLength = 0;
+            while (q + keyLength < lineEnd && q[keyLength] != ' ' && q[keyLength] != '\t' && q[keyLength] != '\r')
+                keyLength++;
+            std::string_view key(q, keyLength);
+            q += keyLength;
+
+            if (key == "v" || key == "vn")
+            {
+                std::vector<float>& out = (key == "v") ? chunk.positions : chunk.normals;
+                float xyz[3];
+                for (int c = 0; c < 3; c++)
+                    if (!ParseFloat(q, lineEnd, xyz[c]))
+                    {
+                        chunk.error = std::format("expected three numbers after '{}'", key);
+                        break;
+                    }
+                out.insert(out.end(), xyz, xyz + 3);
+            }
+            else if (key == "f")
+            {
+                uint32_t corners = 0;
+                while (true)
+                {
+                    q = SkipSpaces(q, lineEnd);
+                    if (q >= lineEnd || *q == '\r' || *q == '#')
+                        break;
+
+                    // v, v/vt, v//vn or v/vt/vn, texture coordinates aren't used
+                    int64_t position, normal = OBJ_NONE, unused;
+                    bool valid = ParseObjIndex(q, lineEnd, chunk.positions.size() / 3, position);
+                    if (valid && q < lineEnd && *q == '/')
+                    {
+                        q++;
+                        if (q < lineEnd && *q != '/')
+                            valid = ParseObjIndex(q, lineEnd, 0, unused);
+                        if (valid && q < lineEnd && *q == '/')
+                        {
+                            q++;
+                            valid = ParseObjIndex(q, lineEnd, chunk.normals.size() / 3, normal);
+                            chunk.usesNormals = true;
+                        }
+                    }
+
+                    if (!valid || (q < lineEnd && *q != ' ' && *q != '\t' && *q != '\r'))
+                    {
+                        chunk.error = "malformed face index";
+                        break;
+                    }
+
+                    chunk.corners.push_back(position);
+                    chunk.corners.push_back(normal);
+                    corners++;
+                }
+
+                if (chunk.error.empty() && corners < 3)
+                    chunk.error = "faces need at least three vertices";
+                chunk.faceSizes.push_back(corners);
+            }
+            // Everything else (vt, o, g, s, usemtl, mtllib...) doesn't affect the geometry
+
+            if (!chunk.error.empty())
+                chunk.errorLine = chunk.lines;
+
+            p = lineEnd + 1;
+        }
+    }
+
+    static bool ResolveObjIndex(int64_t index, size_t base, size_t count, uint32_t& out)
+    {
+        if (index >= OBJ_RELATIVE / 2)
+            index = index - OBJ_RELATIVE + (int64_t)base;
+        else if (index == OBJ_NONE)
+        {
+            out = UINT32_MAX;
+            return true;
+        }
+
+        if (index < 0 || (size_t)index >= count)
+            return false;
+        out = (uint32_t)index;
+        return true;
+    }
+
+    static bool LoadOBJ(const MappedFile& file, const std::string& filename, Mesh& mesh, std::string& error)
+    {
+        const char* text = (const char*)file.data;
+        unsigned int chunkCount = ChunkCount(file.size);
+
+        // Chunks end on line breaks
+        std::vector<ObjChunk> chunks(chunkCount);
+        const char* at = text;
+        for (unsigned int c = 0; c < chunkCount; c++)
+        {
+            const char* end = (c == chunkCount - 1) ? text + file.size : text + file.size * (c + 1) / chunkCount;
+            if (end < at)
+                end = at;
+            const char* lineEnd = (const char*)memchr(end, '\n', text + file.size - end);
+            end = (lineEnd == nullptr) ? text + file.size : lineEnd + 1;
+
+            chunks[c].begin = at;
+            chunks[c].end = end;
+            at = end;
+        }
+
+        ParallelChunks(chunkCount, [&](unsigned int c) { ParseObjChunk(chunks[c]); });
+
+        size_t line = 0, positionCount = 0, normalCount = 0, triangleCount = 0;
+        bool usesNormals = false;
+        for (ObjChunk& chunk : chunks)
+        {
+            if (!chunk.error.empty())
+            {
+                error = std::format("{}:{}: {}", filename, line + chunk.errorLine, chunk.error);
+                return false;
+            }
+            line += chunk.lines;
+
+            positionCount += chunk.positions.size() / 3;
+            normalCount += chunk.normals.size() / 3;
+            chunk.firstTriangle = triangleCount;
+            for (uint32_t corners : chunk.faceSizes)
+                triangleCount += corners - 2;
+            usesNormals |= chunk.usesNormals;
+        }
+
+        if (positionCount >= UINT32_MAX)
+        {
+            error = filename + ": too many vertices";
+            return false;
+        }
+
+        // Resolve indices against the whole file and fan triangulate polygons
+        std::vector<std::string> errors(chunkCount);
+        ParallelChunks(chunkCount, [&](unsigned int c) {
+            ObjChunk& chunk = chunks[c];
+
+            size_t positionBase = 0, normalBase = 0;
+            for (unsigned int prev = 0; prev < c; prev++)
+            {
+                positionBase += chunks[prev].positions.size() / 3;
+                normalBase += chunks[prev].normals.size() / 3;
+            }
+
+            std::vector<uint32_t> face;
+            chunk.triangles.reserve((chunk.corners.size() / 2) * 3 * 2);
+
+            const int64_t* corner = chunk.corners.data();
+            for (uint32_t corners : chunk.faceSizes)
+            {
+                face.resize(corners * 2);
+                for (uint32_t k = 0; k < corners; k++, corner += 2)
+                {
+                    if (!ResolveObjIndex(corner[0], positionBase, positionCount, face[k*2 + 0]) ||
+                        !ResolveObjIndex(corner[1], normalBase, normalCount, face[k*2 + 1]))
+                    {
+                        errors[c] = "a face refers to a vertex that doesn't exist";
+                        return;
+                    }
+                }
+
+                for (uint32_t k = 1; k + 1 < corners; k++)
+                {
+                    const uint32_t tri[3] = { 0, k, k + 1 };
+                    for (uint32_t v : tri)
+                    {
+                        chunk.triangles.push_back(face[v*2 + 0]);
+                        chunk.triangles.push_back(face[v*2 + 1]);
+                    }
+                }
+            }
+
+            std::vector<int64_t>().swap(chunk.corners);
+        });
+
+        for (const std::string& e : errors)
+            if (!e.empty())
+            {
+                error = filename + ": " + e;
+                return false;
+            }
+
+        mesh = Mesh();
+        mesh.positions.reserve(positionCount * 3);
+        for (const ObjChunk& chunk : chunks)
+            mesh.positions.insert(mesh.positions.end(), chunk.positions.begin(), chunk.positions.end());
+
+        std::vector<float> normals;
+        if (usesNormals)
+        {
+            normals.reserve(normalCount * 3);
+            for (const ObjChunk& chunk : chunks)
+                normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+        }
+
+        // Position and normal indices usually match, otherwise every distinct pair becomes its own vertex
+        bool sharedIndices = true;
+        for (const ObjChunk& chunk : chunks)
+            for (size_t i = 0; usesNormals && sharedIndices && i < chunk.triangles.size(); i += 2)
+                sharedIndices = chunk.triangles[i] == chunk.triangles[i + 1];
+
+        mesh.indices.resize(triangleCount * 3);
+        if (!usesNormals || (sharedIndices && normalCount == positionCount))
+        {
+            ParallelChunks(chunkCount, [&](unsigned int c) {
+                const ObjChunk& chunk = chunks[c];
+                for (size_t i = 0; i < chunk.triangles.size() / 2; i++)
+                    mesh.indices[chunk.firstTriangle * 3 + i] = chunk.triangles[i * 2];
+            });
+
+            if (usesNormals)
+                mesh.normals = std::move(normals);
+            return true;
+        }
+
+        std::vector<float> positions;
+        std::unordered_map<uint64_t, uint32_t> vertices;
+        vertices.reserve(positionCount);
+
+        size_t index = 0;
+        for (const ObjChunk& chunk : chunks)
+            for (size_t i = 0; i < chunk.triangles.size(); i += 2)
+            {
+                uint32_t position = chunk.triangles[i], normal = chunk.triangles[i + 1];
+                auto [it, inserted] = vertices.try_emplace(((uint64_t)position << 32) | normal, (uint32_t)(positions.size() / 3));
+
+                if (inserted)
+                {
+                    positions.insert(positions.end(), &mesh.positions[position * 3], &mesh.positions[position * 3] + 3);
+                    if (normal == UINT32_MAX)
+                        mesh.normals.insert(mesh.normals.end(), { 0.0f, 0.0f, 0.0f }); // Falls back to the face normal
+                    else
+                        mesh.normals.insert(mesh.normals.end(), &normals[normal * 3], &normals[normal * 3] + 3);
+                }
+                mesh.indices[index++] = it->second;
+            }
+
+        mesh.positions = std::move(positions);
+        return true;
+    }
+
+
+    /*===================================================================================================*/
+    /*                                                PLY                                                */
+    /*===================================================================================================*/
+
+    enum PlyType { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64, PLY_INVALID };
+
+    struct PlyProperty
+    {
+        std::string name;
+        PlyType type, countType; // countType is only used by lists
+        bool list;
+    };
+
+    struct PlyElement
+    {
+        std::string name;
+        size_t count;
+        std::vector<PlyProperty> properties;
+
+        // Bytes per element, 0 if it has lists
+        size_t Stride() const
+        {
+            size_t stride = 0;
+            for (const PlyProperty& p : properties)
+            {
+                if (p.list)
+                    return 0;
+                stride += TypeSize(p.type);
+            }
+            return stride;
+        }
+    };
+
+    static PlyType ParseType(std::string_view name)
+    {
+        static const std::pair<std::string_view, PlyType> names[] = {
+            { "char", PLY_INT8 },    { "int8", PLY_INT8 },     { "uchar", PLY_UINT8 },    { "uint8", PLY_UINT8 },
+            { "short", PLY_INT16 },  { "int16", PLY_INT16 },   { "ushort", PLY_UINT16 },  { "uint16", PLY_UINT16 },
+            { "int", PLY_INT32 },    { "int32", PLY_INT32 },   { "uint", PLY_UINT32 },    { "uint32", PLY_UINT32 },
+            { "float", PLY_FLOAT32 }, { "float32", PLY_FLOAT32 }, { "double", PLY_FLOAT64 }, { "float64", PLY_FLOAT64 }
+        };
+        for (const auto& [n, type] : names)
+            if (n == name)
+                return type;
+        return PLY_INVALID;
+    }
+
+    static size_t TypeSize(PlyType type)
+    {
+        switch (type)
+        {
+        case PLY_INT8: case PLY_UINT8:   return 1;
+        case PLY_INT16: case PLY_UINT16: return 2;
+        case PLY_INT32: case PLY_UINT32: case PLY_FLOAT32: return 4;
+        case PLY_FLOAT64: return 8;
+        default: return 0;
+        }
+    }
+
+    static double ReadValue(const uint8_t* p, PlyType type, bool bigEndian)
+    {
+        uint8_t b[8];
+        size_t size = TypeSize(type);
+        for (size_t i = 0; i < size; i++)
+            b[i] = bigEndian ? p[size - 1 - i] : p[i];
+
+        switch (type)
+        {
+        case PLY_INT8:    return (double)(int8_t)b[0];
+        case PLY_UINT8:   return (double)b[0];
+        case PLY_INT16:   { int16_t v;  memcpy(&v, b, 2); return (double)v; }
+        case PLY_UINT16:  { uint16_t v; memcpy(&v, b, 2); return (double)v; }
+        case PLY_INT32:   { int32_t v;  memcpy(&v, b, 4); return (double)v; }
+        case PLY_UINT32:  { uint32_t v; memcpy(&v, b, 4); return (double)v; }
+        case PLY_FLOAT32: { float v;    memcpy(&v, b, 4); return (double)v; }
+        case PLY_FLOAT64: { double v;   memcpy(&v, b, 8); return v; }
+        default: return 0.0;
+        }
+    }
+
+    // Walks one element with lists, returns its end or nullptr if it runs past the file
+    static const uint8_t* SkipElement(const uint8_t* p, const uint8_t* end, const PlyElement& element, bool bigEndian)
+    {
+        for (const PlyProperty& prop : element.properties)
+        {
+            size_t bytes = TypeSize(prop.type);
+            if (prop.list)
+            {
+                if (p + TypeSize(prop.countType) > end)
+                    return nullptr;
+                double count = ReadValue(p, prop.countType, bigEndian);
+                p += TypeSize(prop.countType);
+                bytes *= (size_t)std::max(0.0, count);
+            }
+            if (p + bytes > end)
+                return nullptr;
+            p += bytes;
+        }
+        return p;
+    }
+
+    static bool LoadPLY(const MappedFile& file, const std::string& filename, Mesh& mesh, std::string& error)
+    {
+        const char* text = (const char*)file.data;
+        const char* textEnd = text + file.size;
+
+        auto Fail = [&](const std::string& message) {
+            error = filename + ": " + message;
+            return false;
+        };
+
+        // ASCII header
+        std::vector<PlyElement> elements;
+        bool bigEndian = false, hasFormat = false;
+        const char* p = text;
+        const uint8_t* data = nullptr;
+
+        while (p < textEnd)
+        {
+            const char* lineEnd = (const char*)memchr(p, '\n', textEnd - p);
+            if (lineEnd == nullptr)
+                break;
+
+            std::vector<std::string_view> tokens;
+            for (const char* q = p; q < lineEnd;)
+            {
+                q = SkipSpaces(q, lineEnd);
+                const char* start = q;
+                while (q < lineEnd && *q != ' ' && *q != '\t' && *q != '\r')
+                    q++;
+                if (q > start)
+                    tokens.emplace_back(start, q - start);
+                else
+                    q++;
+            }
+            p = lineEnd + 1;
+
+            if (tokens.empty() || tokens[0] == "ply" || tokens[0] == "comment" || tokens[0] == "obj_info")
+                continue;
+
+            if (tokens[0] == "end_header")
+            {
+                data = (const uint8_t*)p;
+                break;
+            }
+            else if (tokens[0] == "format" && tokens.size() >= 2)
+            {
+                if (tokens[1] == "ascii")
+                    return Fail("ASCII PLY files aren't supported, export it as binary");
+                bigEndian = tokens[1] == "binary_big_endian";
+                hasFormat = true;
+            }
+            else if (tokens[0] == "element" && tokens.size() == 3)
+            {
+                PlyElement element{ std::string(tokens[1]), 0, {} };
+                auto [ptr, ec] = std::from_chars(tokens[2].data(), tokens[2].data() + tokens[2].size(), element.count);
+                if (ec != std::errc())
+                    return Fail(std::format("bad element count '{}'", tokens[2]));
+                elements.push_back(element);
+            }
+            else if (tokens[0] == "property" && !elements.empty())
+            {
+                PlyProperty prop{};
+                if (tokens.size() == 5 && tokens[1] == "list")
+                {
+                    prop = { std::string(tokens[4]), ParseType(tokens[3]), ParseType(tokens[2]), true };
+                    if (prop.countType == PLY_INVALID)
+                        return Fail(std::format("unknown property type '{}'", tokens[2]));
+                }
+                else if (tokens.size() == 3)
+                    prop = { std::string(tokens[2]), ParseType(tokens[1]), PLY_INVALID, false };
+                else
+                    return Fail("malformed property");
+
+                if (prop.type == PLY_INVALID)
+                    return Fail(std::format("unknown property type in '{}'", prop.name));
+                elements.back().properties.push_back(prop);
+            }
+            else
+                return Fail(std::format("unexpected header line '{}'", tokens[0]));
+        }
+
+        if (data == nullptr || !hasFormat)
+            return Fail("missing PLY header");
+
+        const uint8_t* end = file.data + file.size;
+        mesh = Mesh();
+
+        for (const PlyElement& element : elements)
+        {
+            if (element.name == "vertex")
+            {
+                size_t stride = element.Stride();
+                if (stride == 0)
+                    return Fail("vertex lists aren't supported");
+                if (element.count > (size_t)(end - data) / stride)
+                    return Fail("file ends inside the vertex data");
+                if (element.count >= UINT32_MAX)
+                    return Fail("too many vertices");
+
+                // Offset of each wanted property, -1 when missing
+                const char* names[6] = { "x", "y", "z", "nx", "ny", "nz" };
+                int offsets[6];
+                PlyType types[6];
+                for (int k = 0; k < 6; k++)
+                {
+                    offsets[k] = -1;
+                    size_t offset = 0;
+                    for (const PlyProperty& prop : element.properties)
+                    {
+                        if (prop.name == names[k])
+                        {
+                            offsets[k] = (int)offset;
+                            types[k] = prop.type;
+                        }
+                        offset += TypeSize(prop.type);
+                    }
+                }
+
+                if (offsets[0] < 0 || offsets[1] < 0 || offsets[2] < 0)
+                    return Fail("vertices need x, y and z");
+                bool hasNormals = offsets[3] >= 0 && offsets[4] >= 0 && offsets[5] >= 0;
+
+                mesh.positions.resize(element.count * 3);
+                if (hasNormals)
+                    mesh.normals.resize(element.count * 3);
+
+                unsigned int chunkCount = ChunkCount(element.count * stride);
+                ParallelChunks(chunkCount, [&](unsigned int c) {
+                    for (size_t v = element.count * c / chunkCount; v < element.count * (c + 1) / chunkCount; v++)
+                    {
+                        const uint8_t* vertex = data + v * stride;
+                        for (int k = 0; k < 3; k++)
+                            mesh.positions[v*3 + k] = (float)ReadValue(vertex + offsets[k], types[k], bigEndian);
+                        if (hasNormals)
+                            for (int k = 0; k < 3; k++)
+                                mesh.normals[v*3 + k] = (float)ReadValue(vertex + offsets[k + 3], types[k + 3], bigEndian);
+                    }
+                });
+
+                data += element.count * stride;
+            }
+            else if (element.name == "face")
+            {
+                if (!LoadPLYFaces(data, end, element, bigEndian, mesh.indices, error))
+                    return Fail(error);
+            }
+            else
+            { // Skipped
+                size_t stride = element.Stride();
+                if (stride > 0)
+                {
+                    if (element.count > (size_t)(end - data) / stride)
+                        return Fail(std::format("file ends inside the '{}' data", element.name));
+                    data += element.count * stride;
+                }
+                else
+                    for (size_t i = 0; i < element.count && data != nullptr; i++)
+                        data = SkipElement(data, end, element, bigEndian);
+
+                if (data == nullptr)
+                    return Fail(std::format("file ends inside the '{}' data", element.name));
+            }
+        }
+
+        if (mesh.positions.empty() || mesh.indices.empty())
+            return Fail("no vertices or faces");
+
+        for (uint32_t index : mesh.indices)
+            if (index >= mesh.VertexCount())
+                return Fail("a face refers to a vertex that doesn't exist");
+        return true;
+    }
+
+    // Faces are usually all triangles stored back to back, those are decoded in parallel and anything else is walked in order
+    static bool LoadPLYFaces(const uint8_t*& data, const uint8_t* end, const PlyElement& element, bool bigEndian, std::vector<uint32_t>& indices, std::string& error)
+    {
+        int listIndex = -1;
+        for (size_t i = 0; i < element.properties.size(); i++)
+            if (element.properties[i].list && (element.properties[i].name == "vertex_indices" || element.properties[i].name == "vertex_index"))
+                listIndex = (int)i;
+
+        if (listIndex < 0)
+        {
+            error = "faces need a vertex_indices list";
+            return false;
+        }
+
+        const PlyProperty& list = element.properties[listIndex];
+        size_t countSize = TypeSize(list.countType), indexSize = TypeSize(list.type);
+
+        if (element.properties.size() == 1 && element.count > 0 && data + countSize <= end && ReadValue(data, list.countType, bigEndian) == 3.0)
+        {
+            size_t stride = countSize + indexSize * 3;
+            bool allTriangles = element.count <= (size_t)(end - data) / stride;
+
+            if (allTriangles)
+            {
+                indices.resize(element.count * 3);
+
+                unsigned int chunkCount = ChunkCount(element.count * stride);
+                std::vector<char> valid(chunkCount, 1);
+                ParallelChunks(chunkCount, [&](unsigned int c) {
+                    for (size_t f = element.count * c / chunkCount; f < element.count * (c + 1) / chunkCount; f++)
+                    {
+                        const uint8_t* face = data + f * stride;
+                        if (ReadValue(face, list.countType, bigEndian) != 3.0)
+                        {
+                            valid[c] = 0;
+                            return;
+                        }
+                        for (int k = 0; k < 3; k++)
+                            indices[f*3 + k] = (uint32_t)ReadValue(face + countSize + k * indexSize, list.type, bigEndian);
+                    }
+                });
+
+                allTriangles = std::find(valid.begin(), valid.end(), 0) == valid.end();
+            }
+
+            if (allTriangles)
+            {
+                data += element.count * stride;
+                return true;
+            }
+            indices.clear();
+        }
+
+        std::vector<uint32_t> face;
+        for (size_t f = 0; f < element.count; f++)
+        {
+            for (size_t i = 0; i < element.properties.size(); i++)
+            {
+                const PlyProperty& prop = element.properties[i];
+                size_t count = 1;
+                if (prop.list)
+                {
+                    if (data + TypeSize(prop.countType) > end)
+                    {
+                        error = "file ends inside the face data";
+                        return false;
+                    }
+                    count = (size_t)std::max(0.0, ReadValue(data, prop.countType, bigEndian));
+                    data += TypeSize(prop.countType);
+                }
+
+                size_t bytes = count * TypeSize(prop.type);
+                if (bytes > (size_t)(end - data))
+                {
+                    error = "file ends inside the face data";
+                    return false;
+                }
+
+                if ((int)i == listIndex)
+                {
+                    face.resize(count);
+                    for (size_t k = 0; k < count; k++)
+                        face[k] = (uint32_t)ReadValue(data + k * indexSize, prop.type, bigEndian);
+
+                    for (size_t k = 1; k + 1 < count; k++)
+                        indices.insert(indices.end(), { face[0], face[k], face[k + 1] });
+                }
+                data += bytes;
+            }
+        }
+        return true;
+    }
+};
+
+
+inline bool Mesh::Load(const std::string& filename, std::string& error)
+{
+    MappedFile file;
+    if (!file.Open(filename))
+    {
+        error = filename + ": can't open file";
+        return false;
+    }
+
+    std::string extension = filename.substr(std::min(filename.size(), filename.find_last_of('.')));
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)std::tolower((unsigned char)c); });
+
+    bool loaded;
+    if (extension == ".obj")
+        loaded = MeshLoader::LoadOBJ(file, filename, *this, error);
+    else if (extension == ".ply")
+        loaded = MeshLoader::LoadPLY(file, filename, *this, error);
+    else
+    {
+        error = filename + ": unknown mesh format, expected .obj or .ply";
+        return false;
+    }
+
+    if (loaded && indices.empty())
+    {
+        error = filename + ": mesh has no faces";
+        return false;
+    }
+    return loaded;
+}
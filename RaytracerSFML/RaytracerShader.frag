@@ -22,6 +22,10 @@ const float riDiamond = 2.417;
 uniform int imgW;
 uniform int imgH;
 
+// Offset of the rendered pixels within the image from its bottom left, for rendering large images in tiles.
+// imgW and imgH stay the whole image's size
+uniform ivec2 tileOffset = ivec2(0, 0);
+
 
 uint NextRandom(inout uint state)
 {
@@ -136,6 +140,56 @@ vec3 ACESFilm(vec3 x)
     return clamp((x*(2.51*x + 0.03)) / (x*(2.43*x + 0.59) + 0.14), 0.0, 1.0);
 }
 
+// 8 bit mantissas sharing an exponent stored in alpha, so linear colors above 1 survive an 8 bit render target.
+// Alpha 0 is reserved for black, decoded by Color::FromRGBE
+vec4 EncodeRGBE(vec3 c)
+{
+    c = max(c, vec3(0.0));
+    float m = max(c.r, max(c.g, c.b));
+    if (!(m > 1e-30))
+        return vec4(0.0);
+
+    float e = clamp(floor(log2(m)) + 1.0, -127.0, 127.0);
+    return vec4(min(floor(c * exp2(-e) * 255.0 + 0.5), 255.0), e + 128.0) / 255.0;
+}
+
+// Log-encoded 16 bit distance stored across two 8 bit channels, 0 is reserved for misses
+const float DEPTHMAX = 10000.0;
+
+vec2 EncodeDepth(float d)
+{
+    float v = floor(log2(1.0 + clamp(d, 0.0, DEPTHMAX)) / log2(1.0 + DEPTHMAX) * 65535.0 + 0.5);
+    v = max(v, 1.0);
+    return vec2(floor(v / 256.0), mod(v, 256.0)) / 255.0;
+}
+
+float DecodeDepth(vec2 e)
+{
+    float v = floor(e.x * 255.0 + 0.5) * 256.0 + floor(e.y * 255.0 + 0.5);
+    if (v < 0.5)
+        return -1.0;
+    return exp2(v / 65535.0 * log2(1.0 + DEPTHMAX)) - 1.0;
+}
+
+// Octahedral normal encoding
+vec2 EncodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0.0)
+        e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return e * 0.5 + 0.5;
+}
+
+vec3 DecodeNormal(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
 /*=======================================================================================================*/
 /*                                                 UTILS                                                 */
 /*=======================================================================================================*/
@@ -158,6 +212,26 @@ vec3 ACESFilm(vec3 x)
 
 const int MATVALS = 5;
 
+// Primitive IDs hold the shape type in the top 4 of 24 bits and the shape index below it, 0 is reserved for misses
+const int PRIM_AABB = 1;
+const int PRIM_OBB = 2;
+const int PRIM_SPHERE = 3;
+const int PRIM_TRI = 4;
+const int PRIM_PLANE = 5;
+const int PRIM_MESH = 6; // Mesh triangles take the types from here to 15, their index counts across every mesh
+
+int PrimitiveID(int type, int i)
+{
+    return type * 1048576 + i;
+}
+
+// Set by GetFirstHit to the closest primitive hit
+int hitPrimitive = 0;
+
+// Traversal work since the pixel started, bounding sphere checks and BVH nodes count as node visits
+int costNodes = 0;
+int costTests = 0;
+
 
 // Make sure to invert irD beforehand
 bool CheckBoundingBox(in vec3 rO, in vec3 irD, in vec3 bMin, in vec3 bMax)
@@ -519,8 +593,207 @@ bool RayPlaneIntersect(in vec3 rO, in vec3 rD, in int i, out float l, out vec3 p
 
     return true;
 }
+
+// Checkered tiling of plane albedo
+vec4 PlaneTile(in vec3 p, in vec4 albedo)
+{
+    int tile = (int((abs(p.x) + floor(p.x)) * 2.0) % 2 + int((abs(p.z) + floor(p.z)) * 2.0) % 2);
+    albedo.xyz *= (tile % 2 == 0) ? 1.0 : 0.666;
+    return albedo;
+}
 // PLANE
 
+
+// MESH
+const int MESHMAX = 8;
+const int MESH_TEXTURE_WIDTH = 4096;
+const int MESH_STACK = 32;
+uniform int meshCount;
+
+uniform vec4 meshBounds[MESHMAX];
+uniform int meshRoots[MESHMAX];
+uniform int meshFirstTriangle[MESHMAX];
+uniform vec4 meshMats[MESHMAX*MATVALS];
+
+// Data textures shared by every mesh, rows of MESH_TEXTURE_WIDTH texels
+uniform bool meshSmooth;
+uniform sampler2D meshVertices;   // xyz
+uniform sampler2D meshNormals;    // xyz, zero for meshes without normals
+uniform usampler2D meshTriangles; // Three vertex indices
+uniform sampler2D meshNodes;      // Two texels per BVH node, (min x3, left child or first triangle), (max x3, triangle count)
+
+ivec2 MeshTexel(in int i)
+{
+    return ivec2(i % MESH_TEXTURE_WIDTH, i / MESH_TEXTURE_WIDTH);
+}
+
+int MeshOfTriangle(in int t)
+{
+    int m = 0;
+    for (int i = 1; i < meshCount; i++)
+        if (t >= meshFirstTriangle[i])
+            m = i;
+    return m;
+}
+
+bool RayMeshTriIntersect(in vec3 rO, in vec3 rD, in int t, out float l, out vec3 p, out vec3 n, out int side)
+{
+    uvec3 tri = texelFetch(meshTriangles, MeshTexel(t), 0).xyz;
+    vec3 v0 = texelFetch(meshVertices, MeshTexel(int(tri.x)), 0).xyz;
+    vec3 edge1 = texelFetch(meshVertices, MeshTexel(int(tri.y)), 0).xyz - v0;
+    vec3 edge2 = texelFetch(meshVertices, MeshTexel(int(tri.z)), 0).xyz - v0;
+
+    // No backface-culling, meshes can be closed refractive volumes
+    vec3 h = cross(rD, edge2);
+    float a = dot(edge1, h);
+
+    if (a == 0.0)
+        return false;
+
+    vec3 s = rO - v0;
+    float f = 1.0 / a;
+    float u = f * dot(s, h);
+
+    if (u < 0.0 || u > 1.0)
+        return false;
+
+    vec3 q = cross(s, edge1);
+    float v = f * dot(rD, q);
+
+    if (v < 0.0 || u + v > 1.0)
+        return false;
+
+    float d = f * dot(edge2, q);
+
+    if (d <= 0.0)
+        return false;
+
+    l = d;
+    p = rO + rD * d;
+    n = normalize(cross(edge1, edge2));
+
+    if (meshSmooth)
+    {
+        vec3 sn = 
+            texelFetch(meshNormals, MeshTexel(int(tri.x)), 0).xyz * (1.0 - u - v) +
+            texelFetch(meshNormals, MeshTexel(int(tri.y)), 0).xyz * u +
+            texelFetch(meshNormals, MeshTexel(int(tri.z)), 0).xyz * v;
+
+        if (dot(sn, sn) > MINVAL)
+            n = normalize(sn) * sign(dot(sn, n) + MINVAL);
+    }
+
+    side = 1;
+    if (dot(cross(edge1, edge2), rD) > 0.0)
+    {
+        n *= -1.0;
+        side = -1;
+    }
+    return true;
+}
+
+// Distance to where the ray enters a box, MAXVAL on a miss
+float NodeDistance(in vec3 rO, in vec3 irD, in vec3 bMin, in vec3 bMax)
+{
+    vec3 t1 = (bMin - rO) * irD;
+    vec3 t2 = (bMax - rO) * irD;
+
+    vec3 tMin = min(t1, t2);
+    vec3 tMax = max(t1, t2);
+
+    float near = max(max(tMin.x, tMin.y), max(tMin.z, 0.0));
+    float far = min(min(tMax.x, tMax.y), tMax.z);
+
+    return (far >= near) ? near : MAXVAL;
+}
+
+// Closest triangle of mesh m nearer than l, walks the mesh's BVH front to back
+bool RayMeshIntersect(in vec3 rO, in vec3 rD, in int m, inout float l, out vec3 p, out vec3 n, out int side, out int triangle)
+{
+    vec3 irD = 1.0 / rD;
+    bool hasHit = false;
+
+    int stack[MESH_STACK];
+    float stackDist[MESH_STACK];
+    int top = 0;
+
+    int node = meshRoots[m];
+    vec4 rootMin = texelFetch(meshNodes, MeshTexel(node * 2), 0);
+    vec4 rootMax = texelFetch(meshNodes, MeshTexel(node * 2 + 1), 0);
+    if (NodeDistance(rO, irD, rootMin.xyz, rootMax.xyz) >= l)
+        return false;
+
+    while (true)
+    {
+        costNodes++;
+        vec4 nodeMin = texelFetch(meshNodes, MeshTexel(node * 2), 0);
+        vec4 nodeMax = texelFetch(meshNodes, MeshTexel(node * 2 + 1), 0);
+        int count = int(nodeMax.w);
+
+        if (count > 0)
+        {
+            int first = int(nodeMin.w);
+            for (int t = first; t < first + count; t++)
+            {
+                float nl;
+                vec3 np, nn;
+                int ss;
+
+                costTests++;
+                if (RayMeshTriIntersect(rO, rD, t, nl, np, nn, ss) && nl < l)
+                {
+                    l = nl;
+                    p = np;
+                    n = nn;
+                    side = ss;
+                    triangle = t;
+                    hasHit = true;
+                }
+            }
+        }
+        else
+        {
+            int near = int(nodeMin.w);
+            int far = near + 1;
+
+            float nearDist = NodeDistance(rO, irD, texelFetch(meshNodes, MeshTexel(near * 2), 0).xyz, texelFetch(meshNodes, MeshTexel(near * 2 + 1), 0).xyz);
+            float farDist = NodeDistance(rO, irD, texelFetch(meshNodes, MeshTexel(far * 2), 0).xyz, texelFetch(meshNodes, MeshTexel(far * 2 + 1), 0).xyz);
+
+            if (farDist < nearDist)
+            {
+                int tempNode = near;
+                near = far;
+                far = tempNode;
+
+                float tempDist = nearDist;
+                nearDist = farDist;
+                farDist = tempDist;
+            }
+
+            if (nearDist < l)
+            {
+                if (farDist < l && top < MESH_STACK)
+                {
+                    stack[top] = far;
+                    stackDist[top++] = farDist;
+                }
+                node = near;
+                continue;
+            }
+        }
+
+        // Skip anything a closer hit has covered since it was pushed
+        while (top > 0 && stackDist[top - 1] >= l)
+            top--;
+        if (top == 0)
+            break;
+        node = stack[--top];
+    }
+
+    return hasHit;
+}
+// MESH
+
 /*=======================================================================================================*/
 /*                                                SHAPES                                                 */
 /*=======================================================================================================*/
@@ -624,6 +897,7 @@ bool GetFirstHit(in vec3 rO, in vec3 rD, in bool showBounds, inout float l, inou
     int boundOffset = 0;
     while (boundOffset < aabbCount)
     {
+        costNodes++;
         if (CheckBoundingSphere(rO, rD, aabbBounds[boundsID]))
         {
             if (showBounds)
@@ -640,6 +914,7 @@ bool GetFirstHit(in vec3 rO, in vec3 rD, in bool showBounds, inout float l, inou
             {
                 for (int i = boundOffset; i < min(boundOffset + aabbBoundCoverage[boundsID], aabbCount); i++)
                 {
+                    costTests++;
                     if (RayAABBIntersect(rO, rD, i, nl, np, nn, ss))
                     {
                         if (nl < l)
@@ -655,6 +930,7 @@ bool GetFirstHit(in vec3 rO, in vec3 rD, in bool showBounds, inout float l, inou
                             emission = aabbMats[i*MATVALS+3];
                             absorption = aabbMats[i*MATVALS+4];
                             hasHit = true;
+                            hitPrimitive = PrimitiveID(PRIM_AABB, i);
                         }
                     }
                 }
@@ -670,6 +946,7 @@ bool GetFirstHit(in vec3 rO, in vec3 rD, in bool showBounds, inout float l, inou
     boundOffset = 0;
     while (boundOffset < obbCount)
     {
+        costNodes++;
         if (CheckBoundingSphere(rO, rD, obbBounds[boundsID]))
         {
             if (showBounds)
@@ -686,6 +963,7 @@ bool GetFirstHit(in vec3 rO, in vec3 rD, in bool showBounds, inout float l, inou
             {
                 for (int i = boundOffset; i < min(boundOffset + obbBoundCoverage[boundsID], obbCount); i++)
                 {
+                    costTests++;
                     if (RayOBBIntersect(rO, rD, i, nl, np, nn, ss))
                     {
                         if (nl < l)
@@ -701,6 +979,7 @@ bool GetFirstHit(in vec3 rO, in vec3 rD, in bool showBounds, inout float l, inou
                             emission = obbMats[i*MATVALS+3];
                             absorption = obbMats[i*MATVALS+4];
                             hasHit = true;
+                            hitPrimitive = PrimitiveID(PRIM_OBB, i);
                         }
                     }
                 }
@@ -713,6 +992,7 @@ bool GetFirstHit(in vec3 rO, in vec3 rD, in bool showBounds, inout float l, inou
     boundOffset = 0;
     while (boundOffset < sphereCount)
     {
+        costNodes++;
         if (CheckBoundingSphere(rO, rD, sphereBounds[boundsID]))
         {    
             if (showBounds)
@@ -729,6 +1009,7 @@ bool GetFirstHit(in vec3 rO, in vec3 rD, in bool showBounds, inout float l, inou
             {
                 for (int i = boundOffset; i < min(boundOffset + sphereBoundCoverage[boundsID], sphereCount); i++)
                 {
+                    costTests++;
                     if (RaySphereIntersect(rO, rD, i, nl, np, nn, ss))
                     {
                         if (nl < l)
@@ -744,6 +1025,7 @@ bool GetFirstHit(in vec3 rO, in vec3 rD, in bool showBounds, inout float l, inou
                             emission = sphereMats[i*MATVALS+3];
                             absorption = sphereMats[i*MATVALS+4];
                             hasHit = true;
+                            hitPrimitive = PrimitiveID(PRIM_SPHERE, i);
                         }
                     }
                 }
@@ -756,6 +1038,7 @@ bool GetFirstHit(in vec3 rO, in vec3 rD, in bool showBounds, inout float l, inou
     boundOffset = 0;
     while (boundOffset < triCount)
     {
+        costNodes++;
         if (CheckBoundingSphere(rO, rD, triBounds[boundsID]))
         {    
             if (showBounds)
@@ -772,6 +1055,7 @@ bool GetFirstHit(in vec3 rO, in vec3 rD, in bool showBounds, inout float l, inou
             {
                 for (int i = boundOffset; i < min(boundOffset + triBoundCoverage[boundsID], triCount); i++)
                 {
+                    costTests++;
                     if (RayTriIntersect(rO, rD, i, nl, np, nn, ss))
                     {
                         if (nl < l)
@@ -787,6 +1071,7 @@ bool GetFirstHit(in vec3 rO, in vec3 rD, in bool showBounds, inout float l, inou
                             emission = triMats[i*MATVALS+3];
                             absorption = triMats[i*MATVALS+4];
                             hasHit = true;
+                            hitPrimitive = PrimitiveID(PRIM_TRI, i);
                         }
                     }
                 }
@@ -794,12 +1079,51 @@ bool GetFirstHit(in vec3 rO, in vec3 rD, in bool showBounds, inout float l, inou
         }
         boundOffset += triBoundCoverage[boundsID++];
     }
+
+    for (int m = 0; m < meshCount; m++)
+    {
+        costNodes++;
+        if (CheckBoundingSphere(rO, rD, meshBounds[m]))
+        {
+            if (showBounds)
+            {
+                l = 1.0;
+                p = rD * l; 
+                n = -rD;
+                s = 1;
+                albedo *= vec4(1.0,0.85,1.0,1.0);
+                emission += vec4(0.35,0.0,0.35,0.35);
+                hasHit = true;
+            }
+            else
+            {
+                int tri;
+                nl = l;
+                if (RayMeshIntersect(rO, rD, m, nl, np, nn, ss, tri))
+                {
+                    l = nl; 
+                    p = np; 
+                    n = nn;
+                    s = ss;
+
+                    surface = meshMats[m*MATVALS+0];
+                    albedo = meshMats[m*MATVALS+1];
+                    specular = meshMats[m*MATVALS+2];
+                    emission = meshMats[m*MATVALS+3];
+                    absorption = meshMats[m*MATVALS+4];
+                    hasHit = true;
+                    hitPrimitive = PrimitiveID(PRIM_MESH, tri);
+                }
+            }
+        }
+    }
     
     for (int i = 0; i < planeCount; i++)
     {
         if (showBounds)
             break;
 
+        costTests++;
         if (RayPlaneIntersect(rO, rD, i, nl, np, nn, ss))
         {
             if (nl < l)
@@ -815,9 +1139,9 @@ bool GetFirstHit(in vec3 rO, in vec3 rD, in bool showBounds, inout float l, inou
                 emission = planeMats[i*MATVALS+3];
                 absorption = planeMats[i*MATVALS+4];
 
-                int tile = (int((abs(p.x) + floor(p.x)) * 2.0) % 2 + int((abs(p.z) + floor(p.z)) * 2.0) % 2);
-                albedo.xyz *= (tile % 2 == 0) ? 1.0 : 0.666;
+                albedo = PlaneTile(p, albedo);
                 hasHit = true;
+                hitPrimitive = PrimitiveID(PRIM_PLANE, i);
             }
         }
     }
@@ -826,6 +1150,62 @@ bool GetFirstHit(in vec3 rO, in vec3 rD, in bool showBounds, inout float l, inou
 }
 
 
+vec4 MaterialValue(in int primitive, in int k)
+{
+    int type = primitive / 1048576;
+    int i = primitive - type * 1048576;
+
+    if (type >= PRIM_MESH)
+        return meshMats[MeshOfTriangle(primitive - PRIM_MESH * 1048576)*MATVALS+k];
+    else if (type == PRIM_AABB)
+        return aabbMats[i*MATVALS+k];
+    else if (type == PRIM_OBB)
+        return obbMats[i*MATVALS+k];
+    else if (type == PRIM_SPHERE)
+        return sphereMats[i*MATVALS+k];
+    else if (type == PRIM_TRI)
+        return triMats[i*MATVALS+k];
+    return planeMats[i*MATVALS+k];
+}
+
+// Intersects a single primitive by ID, used to resume from a cached first hit without traversing the scene
+bool IntersectPrimitive(in int primitive, in vec3 rO, in vec3 rD, out float l, out vec3 p, out vec3 n, out int s, out vec4 surface, out vec4 albedo, out vec4 specular, out vec4 emission, out vec4 absorption)
+{
+    int type = primitive / 1048576;
+    int i = primitive - type * 1048576;
+
+    bool hit = false;
+    costTests++;
+    if (type == PRIM_AABB)
+        hit = RayAABBIntersect(rO, rD, i, l, p, n, s);
+    else if (type == PRIM_OBB)
+        hit = RayOBBIntersect(rO, rD, i, l, p, n, s);
+    else if (type == PRIM_SPHERE)
+        hit = RaySphereIntersect(rO, rD, i, l, p, n, s);
+    else if (type == PRIM_TRI)
+        hit = RayTriIntersect(rO, rD, i, l, p, n, s);
+    else if (type == PRIM_PLANE)
+        hit = RayPlaneIntersect(rO, rD, i, l, p, n, s);
+    else if (type >= PRIM_MESH)
+        hit = RayMeshTriIntersect(rO, rD, primitive - PRIM_MESH * 1048576, l, p, n, s);
+
+    if (!hit)
+        return false;
+
+    surface = MaterialValue(primitive, 0);
+    albedo = MaterialValue(primitive, 1);
+    specular = MaterialValue(primitive, 2);
+    emission = MaterialValue(primitive, 3);
+    absorption = MaterialValue(primitive, 4);
+
+    if (type == PRIM_PLANE)
+        albedo = PlaneTile(p, albedo);
+
+    hitPrimitive = primitive;
+    return true;
+}
+
+
 // Testing: Got fresnel reflectance working.
 /*vec3 Raytrace(in vec3 rO, in vec3 rD, in float ri, inout uint seed)
 {
@@ -931,12 +1311,24 @@ bool GetFirstHit(in vec3 rO, in vec3 rD, in bool showBounds, inout float l, inou
     return incomingLight;
 }*/
 
+// First hit of the camera ray, shared by every sample of a pixel when the sample direction doesn't change
+bool usePrimaryHit = false;
+bool primaryHasHit;
+float primaryL;
+vec3 primaryP, primaryN;
+int primaryS;
+vec4 primarySurface, primaryAlbedo, primarySpecular, primaryEmission, primaryAbsorption;
+
+// Set by Raytrace to the number of surfaces the last path hit
+int pathBounces = 0;
+
 vec3 Raytrace(in vec3 rO, in vec3 rD, in float ri, inout uint seed)
 {
 	vec3 incomingLight = vec3(0);
 	vec3 rayColour = vec3(1);
 
 	vec4 queuedAbsorption = vec4(0);
+    pathBounces = 0;
 
     for (int i = 0; i <= maxBounces; i++)
     {
@@ -950,11 +1342,29 @@ vec3 Raytrace(in vec3 rO, in vec3 rD, in float ri, inout uint seed)
         vec4 emission = vec4(0);
         vec4 absorption = vec4(0);
 
-        if (GetFirstHit(rO, rD, false, l, p, n, s, surface, albedo, specular, emission, absorption))
+        bool hasHit;
+        if (i == 0 && usePrimaryHit)
+        {
+            hasHit = primaryHasHit;
+            l = primaryL;
+            p = primaryP;
+            n = primaryN;
+            s = primaryS;
+            surface = primarySurface;
+            albedo = primaryAlbedo;
+            specular = primarySpecular;
+            emission = primaryEmission;
+            absorption = primaryAbsorption;
+        }
+        else
+            hasHit = GetFirstHit(rO, rD, false, l, p, n, s, surface, albedo, specular, emission, absorption);
+
+        if (hasHit)
         {
             if (disableLighting) // && i == 1
                 return albedo.xyz * albedo.w + emission.xyz * emission.w;
 
+            pathBounces++;
             rayColour *= exp(-queuedAbsorption.xyz * (l + queuedAbsorption.w));
 
             float 
@@ -1066,56 +1476,302 @@ uniform bool randomizeDir;
 
 uniform int rndSeed;
 
+const int OUTPUT_BEAUTY = 0;
+const int OUTPUT_FIRSTHIT = 1;
+const int OUTPUT_ALBEDO = 2;
+const int OUTPUT_PRIMITIVEID = 3;
+const int OUTPUT_MATERIALID = 4;
+const int OUTPUT_BOUNCES = 5;
+const int OUTPUT_PRIMARYCOST = 6;
+const int OUTPUT_PATHCOST = 7;
+uniform int outputMode;
+
+uniform bool trackHistory;
+uniform bool reproject;
+uniform int maxHistory;
+uniform sampler2D lastHit;
+
+uniform vec3 prevCamPos;
+uniform vec3 prevCamFwd;
+uniform vec3 prevCamUp;
+uniform vec3 prevCamRight;
+
+uniform float prevViewHeight;
+uniform float prevViewWidth;
+
+uniform bool primaryCache;
+uniform sampler2D lastPrimary;
+
+
+vec3 PixelDirection(in vec2 uv)
+{
+    vec3 botLeftLocal = vec3(-viewWidth / 2.0, -viewHeight / 2.0, 1.0);
+    vec3 dirLocal = botLeftLocal + vec3(viewWidth * uv.x, viewHeight * uv.y, 0.0);
+    vec3 pixDir = camRight * dirLocal.x + camUp * dirLocal.y + camFwd * dirLocal.z;
+    return normalize(pixDir);
+}
+
+bool PrimaryHit(in vec3 rD, out float l, out vec3 n)
+{
+    l = MAXVAL;
+    n = vec3(0);
+    vec3 p;
+    int s = 0;
+    vec4 surface, albedo, specular, emission, absorption;
+
+    return GetFirstHit(camPos, rD, false, l, p, n, s, surface, albedo, specular, emission, absorption);
+}
+
+// Depth in rg, normal in ba
+vec4 EncodeFirstHit(in vec3 rD)
+{
+    float l;
+    vec3 n;
+
+    if (!PrimaryHit(rD, l, n))
+        return vec4(0);
+
+    return vec4(EncodeDepth(l), EncodeNormal(n));
+}
+
+// Albedo of the first surface hit, white for the sky so its lighting passes through untouched
+vec4 FirstHitAlbedo(in vec3 rD)
+{
+    float l = MAXVAL;
+    vec3 p, n = vec3(0);
+    int s = 0;
+    vec4 surface, albedo, specular, emission, absorption;
+
+    if (!GetFirstHit(camPos, rD, false, l, p, n, s, surface, albedo, specular, emission, absorption))
+        return vec4(1.0);
+
+    return vec4(albedo.xyz, 1.0);
+}
+
+// Materials live per primitive, so identical materials are given the same ID by hashing their values
+int MaterialID(in int primitive)
+{
+    uint hash = 2166136261u;
+    for (int k = 0; k < MATVALS; k++)
+    {
+        vec4 v = MaterialValue(primitive, k);
+        for (int c = 0; c < 4; c++)
+            hash = (hash ^ uint(int(floor(v[c] * 4096.0 + 0.5)))) * 16777619u;
+    }
+
+    int id = int(hash % 16777215u);
+    return id + 1;
+}
+
+// 24 bit ID in rgb
+vec4 EncodeFirstHitID(in vec3 rD, in bool material)
+{
+    float l;
+    vec3 n;
+
+    if (!PrimaryHit(rD, l, n))
+        return vec4(0);
+
+    int id = material ? MaterialID(hitPrimitive) : hitPrimitive;
+    int hi = id / 65536, mid = (id / 256) % 256, lo = id % 256;
+    return vec4(float(hi), float(mid), float(lo), 255.0) / 255.0;
+}
+
+// Average bounce count in 8.8 fixed point across rg
+vec4 EncodeBounces(in float bounces)
+{
+    float v = floor(clamp(bounces, 0.0, 255.0) * 256.0 + 0.5);
+    v = min(v, 65535.0);
+    return vec4(floor(v / 256.0), mod(v, 256.0), 0.0, 255.0) / 255.0;
+}
+
+// Node visits in rg and primitive tests in ba, 16 bit integers each
+vec4 EncodeCost(in float nodes, in float tests)
+{
+    vec2 v = min(floor(vec2(nodes, tests) + 0.5), 65535.0);
+    return vec4(floor(v.x / 256.0), mod(v.x, 256.0), floor(v.y / 256.0), mod(v.y, 256.0)) / 255.0;
+}
+
+// Finds the previous accumulation of the surface seen along rD, fails if it was occluded or off-screen
+bool ReprojectHistory(in vec3 rD, out vec4 history)
+{
+    float l;
+    vec3 n;
+    bool hit = PrimaryHit(rD, l, n);
+
+    vec3 prevDir = hit ? (camPos + rD * l) - prevCamPos : rD;
+    vec3 prevLocal = vec3(dot(prevDir, prevCamRight), dot(prevDir, prevCamUp), dot(prevDir, prevCamFwd));
+
+    if (prevLocal.z <= MINVAL)
+        return false;
+
+    vec2 prevUV = (prevLocal.xy / prevLocal.z) / vec2(prevViewWidth, prevViewHeight) + 0.5;
+
+    if (prevUV.x < 0.0 || prevUV.x > 1.0 || prevUV.y < 0.0 || prevUV.y > 1.0)
+        return false;
+
+    ivec2 prevPix = min(ivec2(prevUV * vec2(imgW, imgH)), ivec2(imgW - 1, imgH - 1));
+    vec4 prevHit = texelFetch(lastHit, prevPix, 0);
+    float prevDepth = DecodeDepth(prevHit.xy);
+
+    if (hit)
+    {
+        if (prevDepth < 0.0)
+            return false;
+
+        float expectedDepth = length(prevDir);
+        if (abs(prevDepth - expectedDepth) > expectedDepth * 0.02 + 0.01)
+            return false;
+
+        if (dot(DecodeNormal(prevHit.zw), n) < 0.9)
+            return false;
+    }
+    else if (prevDepth >= 0.0)
+        return false;
+
+    history = texture2D(lastFrame, prevUV);
+    return true;
+}
+
 
 void main(void)
 {
-    vec2 uv = vec2(gl_TexCoord[0].x, 1.0 - gl_TexCoord[0].y);
-    vec3 lFrame = texture2D(lastFrame, uv).xyz;
+    vec2 texUV = vec2(gl_TexCoord[0].x, 1.0 - gl_TexCoord[0].y);
+
+    // Seeds and directions come from integer pixel coordinates, so tiles trace exactly what a whole render would
+    ivec2 pixel = ivec2(gl_FragCoord.xy) + tileOffset;
+    vec2 uv = (vec2(pixel) + 0.5) / vec2(imgW, imgH);
+
+    if (outputMode == OUTPUT_FIRSTHIT)
+    {
+        gl_FragColor = EncodeFirstHit(PixelDirection(uv));
+        return;
+    }
+    else if (outputMode == OUTPUT_ALBEDO)
+    {
+        gl_FragColor = FirstHitAlbedo(PixelDirection(uv));
+        return;
+    }
+    else if (outputMode == OUTPUT_PRIMITIVEID || outputMode == OUTPUT_MATERIALID)
+    {
+        gl_FragColor = EncodeFirstHitID(PixelDirection(uv), outputMode == OUTPUT_MATERIALID);
+        return;
+    }
+    else if (outputMode == OUTPUT_PRIMARYCOST)
+    {
+        float l;
+        vec3 n;
+        PrimaryHit(PixelDirection(uv), l, n);
+        gl_FragColor = EncodeCost(float(costNodes), float(costTests));
+        return;
+    }
+
+    vec4 lFrame = texture2D(lastFrame, texUV);
     vec3 outCol = vec3(0);
     
     uint rndS = uint(rndSeed + 2147483647);
-    uint seed = rndS + uint(uv.x * imgW) + uint(uv.y * imgW * imgH);
+    uint seed = rndS + uint(pixel.x) + uint(pixel.y * imgW);
 
+    vec2 sampleUV = uv;
     if (randomizeDir)
     {
-        uv.y += ((RandomValue(seed) - 0.5) / 1.25) / float(imgH);
-        uv.x += ((RandomValue(seed) - 0.5) / 1.25) / float(imgW);
+        sampleUV.y += ((RandomValue(seed) - 0.5) / 1.25) / float(imgH);
+        sampleUV.x += ((RandomValue(seed) - 0.5) / 1.25) / float(imgW);
     }
     
-    vec3 botLeftLocal = vec3(-viewWidth / 2.0, -viewHeight / 2.0, 1.0);
-    vec3 dirLocal = botLeftLocal + vec3(viewWidth * uv.x, viewHeight * uv.y, 0.0);
-    vec3 pixDir = camRight * dirLocal.x + camUp * dirLocal.y + camFwd * dirLocal.z;
-    pixDir = normalize(pixDir);
+    vec3 pixDir = PixelDirection(sampleUV);
 
-    for (int i = 0; i < samples; i++)
-        outCol += Raytrace(camPos, pixDir, riAir, seed);
-    outCol /= samples;
+    if (!randomizeDir)
+    { // Every sample starts along the same ray, so find its first hit once
+        // Cached primitive IDs skip the traversal too, 0 is a cached miss
+        int cached = -1;
+        if (primaryCache)
+            cached = int(dot(floor(texelFetch(lastPrimary, ivec2(gl_FragCoord.xy), 0).xyz * 255.0 + 0.5), vec3(65536.0, 256.0, 1.0)));
 
-    outCol = ACESFilm(outCol);
+        primaryHasHit = false;
+        if (cached > 0)
+            primaryHasHit = IntersectPrimitive(cached, camPos, pixDir, primaryL, primaryP, primaryN, primaryS, primarySurface, primaryAlbedo, primarySpecular, primaryEmission, primaryAbsorption);
 
-    if (realRender)
-    {
-        gl_FragColor = vec4(outCol, 1.0);
+        if (cached < 0 || (cached > 0 && !primaryHasHit))
+        {
+            primaryL = MAXVAL;
+            primaryN = vec3(0);
+            primaryS = 0;
+            primaryHasHit = GetFirstHit(camPos, pixDir, false, primaryL, primaryP, primaryN, primaryS, primarySurface, primaryAlbedo, primarySpecular, primaryEmission, primaryAbsorption);
+        }
+
+        usePrimaryHit = true;
+    }
+
+    if (outputMode == OUTPUT_PATHCOST)
+    { // Per sample, the primary hit shared by the samples included
+        for (int i = 0; i < samples; i++)
+            Raytrace(camPos, pixDir, riAir, seed);
+        gl_FragColor = EncodeCost(float(costNodes) / float(samples), float(costTests) / float(samples));
+        return;
     }
-    else
-    {
-        float avgWeight = 1.0 / (float(frameCount + 1));
-        outCol = (lFrame * (1.0 - avgWeight)) + (outCol * avgWeight);
-        gl_FragColor = vec4(outCol, 1.0);
 
+    if (outputMode == OUTPUT_BOUNCES)
+    {
+        float bounces = 0.0;
+        for (int i = 0; i < samples; i++)
+        {
+            Raytrace(camPos, pixDir, riAir, seed);
+            bounces += float(pathBounces);
+        }
+        gl_FragColor = EncodeBounces(bounces / float(samples));
+        return;
     }
 
+    for (int i = 0; i < samples; i++)
+        outCol += Raytrace(camPos, pixDir, riAir, seed);
+    outCol /= samples;
+
+    vec3 bounds = vec3(0);
     if (viewBounds)
     {
         float l = 0;
         int s = 0;
-        vec3 p, n;
+        vec3 p, n = vec3(0);
         vec4 albedo, emission, surface, specular, absorption;
 
         if (GetFirstHit(camPos, pixDir, true, l, p, n, s, surface, albedo, specular, emission, absorption))
-            gl_FragColor.xyz += albedo.xyz * albedo.w + emission.xyz * emission.w;
+            bounds = albedo.xyz * albedo.w + emission.xyz * emission.w;
+    }
+
+    if (realRender)
+    { // Unclamped radiance, accumulated and tonemapped on the CPU
+        gl_FragColor = EncodeRGBE(outCol + bounds);
+        return;
+    }
+
+    outCol = ACESFilm(outCol);
+
+    if (trackHistory)
+    { // Alpha holds how many frames have been accumulated into the pixel
+        bool validHistory = true;
+        if (reproject)
+            validHistory = ReprojectHistory(PixelDirection(uv), lFrame);
+
+        float historyLength = validHistory ? floor(lFrame.a * 255.0 + 0.5) : 0.0;
+        if (reproject)
+            historyLength = min(historyLength, float(maxHistory));
+        else if (historyLength >= 255.0)
+            historyLength = max(255.0, float(frameCount));
+
+        float avgWeight = 1.0 / (historyLength + 1.0);
+        outCol = (lFrame.xyz * (1.0 - avgWeight)) + (outCol * avgWeight);
+        gl_FragColor = vec4(outCol, min(historyLength + 1.0, 255.0) / 255.0);
+    }
+    else
+    {
+        float avgWeight = 1.0 / (float(frameCount + 1));
+        outCol = (lFrame.xyz * (1.0 - avgWeight)) + (outCol * avgWeight);
+        gl_FragColor = vec4(outCol, 1.0);
+
     }
 
+    gl_FragColor.xyz += bounds;
 }
 
 /*=======================================================================================================*/
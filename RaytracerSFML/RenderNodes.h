@@ -0,0 +1,403 @@
+#pragma once
+
+#include "Vec3.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <format>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include <cstdlib>
+
+#include <SFML/Network.hpp>
+
+
+// Renders the tiles of one image on several processes, on this machine or others. A coordinator listens for workers,
+// sends each one the job, then hands out tiles one at a time and collects their linear radiance. A tile goes back to
+// the queue when its worker disconnects or hasn't been heard from for too long, so workers can come and go freely.
+// Workers load the scene from their own disk, and only take part if everything hashes the same as the coordinator's.
+constexpr uint32_t
+    RENDER_NODES_MAGIC = 0x4E525452, // "RTRN"
+    RENDER_NODES_VERSION = 2;
+
+constexpr unsigned short RENDER_NODES_PORT = 50515;
+
+// Every packet starts with one of these
+enum RenderNodesMessage : uint8_t
+{
+    MESSAGE_HELLO,    // Worker: magic, version
+    MESSAGE_JOB,      // Coordinator: RenderJob
+    MESSAGE_ACCEPT,   // Worker: ready for tiles
+    MESSAGE_REJECT,   // Worker: reason, can't render the job
+    MESSAGE_TILE,     // Coordinator: tile index, time limit in seconds or 0
+    MESSAGE_PROGRESS, // Worker: samples so far, sent at least every second while rendering
+    MESSAGE_RESULT,   // Worker: tile index, samples, seconds, noise, the tile's rgb floats row by row
+    MESSAGE_DONE      // Coordinator: no tiles left
+};
+
+
+// What workers are asked to render, the stop criteria apply to every tile
+struct RenderJob
+{
+    std::string sceneFile, outFile;
+    uint64_t hash = 0; // Of the scene and settings, see BatchRender
+
+    uint32_t width = 0, height = 0, tileSize = 0, seed = 0;
+    Vec3 origin, fwd, right, up; // Sent as they are, so the camera's rays match to the bit
+    float fov = 0.0f;
+
+    double spp = 0.0, noiseLimit = 0.0;
+    bool deterministic = false;
+};
+
+inline sf::Packet& operator<<(sf::Packet& packet, const Vec3& v)
+{
+    return packet << v.x << v.y << v.z;
+}
+
+inline sf::Packet& operator>>(sf::Packet& packet, Vec3& v)
+{
+    return packet >> v.x >> v.y >> v.z;
+}
+
+inline sf::Packet& operator<<(sf::Packet& packet, const RenderJob& job)
+{
+    return packet << job.sceneFile << job.outFile << (sf::Uint64)job.hash
+        << job.width << job.height << job.tileSize << job.seed
+        << job.origin << job.fwd << job.right << job.up << job.fov
+        << job.spp << job.noiseLimit << job.deterministic;
+}
+
+inline sf::Packet& operator>>(sf::Packet& packet, RenderJob& job)
+{
+    sf::Uint64 hash = 0;
+    packet >> job.sceneFile >> job.outFile >> hash
+        >> job.width >> job.height >> job.tileSize >> job.seed
+        >> job.origin >> job.fwd >> job.right >> job.up >> job.fov
+        >> job.spp >> job.noiseLimit >> job.deterministic;
+    job.hash = hash;
+    return packet;
+}
+
+
+// A finished tile
+struct TileResult
+{
+    uint32_t tile = 0, samples = 0;
+    double seconds = 0.0, noise = 0.0;
+    std::vector<float> pixels; // rgb, rows of the tile cut off at the image's edges
+    std::string worker;
+};
+
+
+// Hands out the tiles of one job to every worker that connects
+struct TileCoordinator
+{
+    double timeout = 60.0; // Seconds of silence before a worker counts as lost, has to be longer than a pass
+
+
+    bool Listen(unsigned short port, std::string& error)
+    {
+        if (listener.listen(port) != sf::Socket::Done)
+        {
+            error = std::format("can't listen on port {}", port);
+            return false;
+        }
+        selector.add(listener);
+        return true;
+    }
+
+    // Renders every tile of job and passes each to store as it arrives, in any order. The time limit is shared between
+    // the tiles and workers still left, 0 for none. Only returns once every tile is done, or store fails.
+    bool Run(const RenderJob& job, double timeLimit, const std::function<bool(const TileResult&)>& store)
+    {
+        const uint32_t
+            tileW = job.tileSize > 0 ? std::min(job.tileSize, job.width) : job.width,
+            tileH = job.tileSize > 0 ? std::min(job.tileSize, job.height) : job.height,
+            tilesX = (job.width + tileW - 1) / tileW,
+            tileCount = tilesX * ((job.height + tileH - 1) / tileH);
+
+        pending.clear();
+        for (uint32_t t = 0; t < tileCount; t++)
+            pending.push_back(t);
+
+        sf::Packet jobPacket;
+        jobPacket << (sf::Uint8)MESSAGE_JOB << job;
+
+        const Clock::time_point start = Clock::now();
+        uint32_t done = 0;
+
+        while (done < tileCount)
+        {
+            selector.wait(sf::seconds(0.25f));
+            const Clock::time_point now = Clock::now();
+
+            if (selector.isReady(listener))
+            {
+                auto worker = std::make_unique<Worker>();
+                if (listener.accept(worker->socket) == sf::Socket::Done)
+                {
+                    worker->socket.setBlocking(false);
+                    worker->name = std::format("{}:{}", worker->socket.getRemoteAddress().toString(), worker->socket.getRemotePort());
+                    worker->lastHeard = now;
+                    selector.add(worker->socket);
+                    workers.push_back(std::move(worker));
+                }
+            }
+
+            for (auto& worker : workers)
+            {
+                if (!worker->lost && selector.isReady(worker->socket))
+                    Receive(*worker, jobPacket, tileW, tileH, tilesX, job, now, done, store);
+
+                if (!worker->lost && std::chrono::duration<double>(now - worker->lastHeard).count() > timeout)
+                    Drop(*worker, "stopped responding");
+            }
+
+            if (!failed.empty())
+                return false;
+
+            std::erase_if(workers, [](const std::unique_ptr<Worker>& worker) { return worker->lost; });
+
+            // Hand out tiles to every idle worker. The time left is shared out as if each of them rendered an equal
+            // part of the tiles not handed out yet.
+            const size_t ready = std::count_if(workers.begin(), workers.end(), [](const auto& worker) { return worker->accepted; });
+            for (auto& worker : workers)
+            {
+                if (pending.empty())
+                    break;
+                if (!worker->accepted || worker->tile >= 0)
+                    continue;
+
+                double tileTime = 0.0;
+                if (timeLimit > 0)
+                {
+                    const double left = timeLimit - std::chrono::duration<double>(now - start).count();
+                    tileTime = std::max(0.001, left * std::min(ready, pending.size()) / pending.size());
+                }
+
+                worker->tile = (int64_t)pending.front();
+                pending.pop_front();
+
+                sf::Packet packet;
+                packet << (sf::Uint8)MESSAGE_TILE << (sf::Uint32)worker->tile << tileTime;
+                Send(*worker, packet);
+            }
+        }
+
+        // Workers exit on their own once told, or when the connection closes
+        sf::Packet packet;
+        packet << (sf::Uint8)MESSAGE_DONE;
+        for (auto& worker : workers)
+            if (worker->accepted)
+                Send(*worker, packet);
+        return true;
+    }
+
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Worker
+    {
+        sf::TcpSocket socket;
+        std::string name;
+        Clock::time_point lastHeard;
+        bool accepted = false, lost = false;
+        int64_t tile = -1; // Being rendered, -1 when idle
+    };
+
+    sf::TcpListener listener;
+    sf::SocketSelector selector;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::deque<uint32_t> pending; // Tiles not handed out, lost ones are put back in front
+    std::string failed;           // Set when a result couldn't be stored
+
+
+    // Non-blocking sockets send large packets in parts, repeated until everything is out
+    void Send(Worker& worker, sf::Packet& packet)
+    {
+        sf::Socket::Status status;
+        do
+            status = worker.socket.send(packet);
+        while (status == sf::Socket::Partial);
+
+        if (status != sf::Socket::Done)
+            Drop(worker, "disconnected");
+    }
+
+    void Drop(Worker& worker, const std::string& reason)
+    {
+        if (worker.tile >= 0)
+        {
+            pending.push_front((uint32_t)worker.tile);
+            std::cout << std::format("Worker {} {}, tile {} is handed out again\n", worker.name, reason, worker.tile + 1);
+        }
+        else
+            std::cout << std::format("Worker {} {}\n", worker.name, reason);
+
+        // Before the socket closes, the selector only finds it by its handle
+        selector.remove(worker.socket);
+        worker.socket.disconnect();
+        worker.tile = -1;
+        worker.lost = true;
+    }
+
+    void Receive(Worker& worker, sf::Packet& jobPacket, uint32_t tileW, uint32_t tileH, uint32_t tilesX, const RenderJob& job,
+        Clock::time_point now, uint32_t& done, const std::function<bool(const TileResult&)>& store)
+    {
+        sf::Packet packet;
+        sf::Socket::Status status;
+
+        // Everything that has fully arrived, a partly received packet is kept by the socket
+        while (!worker.lost && (status = worker.socket.receive(packet)) == sf::Socket::Done)
+        {
+            worker.lastHeard = now;
+
+            sf::Uint8 type = 0;
+            packet >> type;
+
+            if (type == MESSAGE_HELLO)
+            {
+                sf::Uint32 magic = 0, version = 0;
+                packet >> magic >> version;
+                if (!packet || magic != RENDER_NODES_MAGIC || version != RENDER_NODES_VERSION)
+                    Drop(worker, "is from another version");
+                else
+                    Send(worker, jobPacket);
+            }
+            else if (type == MESSAGE_ACCEPT)
+            {
+                worker.accepted = true;
+                std::cout << std::format("Worker {} joined\n", worker.name);
+            }
+            else if (type == MESSAGE_REJECT)
+            {
+                std::string reason;
+                packet >> reason;
+                Drop(worker, "can't render the job: " + reason);
+            }
+            else if (type == MESSAGE_RESULT)
+            {
+                TileResult result;
+                packet >> result.tile >> result.samples >> result.seconds >> result.noise;
+
+                const uint32_t
+                    x = (result.tile % tilesX) * tileW,
+                    y = (result.tile / tilesX) * tileH,
+                    count = std::min(tileW, job.width - x) * std::min(tileH, job.height - y) * 3;
+
+                if (!packet || worker.tile != (int64_t)result.tile)
+                {
+                    Drop(worker, "sent a result for the wrong tile");
+                    continue;
+                }
+
+                result.pixels.resize(count);
+                for (float& v : result.pixels)
+                    packet >> v;
+
+                if (!packet || !packet.endOfPacket())
+                {
+                    Drop(worker, "sent a damaged result");
+                    continue;
+                }
+
+                result.worker = worker.name;
+                worker.tile = -1;
+                done++;
+
+                if (!store(result))
+                    failed = std::format("tile {}", result.tile + 1);
+            }
+            else if (type != MESSAGE_PROGRESS)
+                Drop(worker, "sent an unknown message");
+        }
+
+        if (!worker.lost && (status == sf::Socket::Disconnected || status == sf::Socket::Error))
+            Drop(worker, "disconnected");
+    }
+};
+
+
+// The worker's end of the connection, blocking
+struct TileWorker
+{
+    // Connects to "host" or "host:port" and waits for the job
+    bool Connect(const std::string& address, RenderJob& job, std::string& error)
+    {
+        std::string host = address;
+        unsigned short port = RENDER_NODES_PORT;
+
+        size_t colon = address.rfind(':');
+        if (colon != std::string::npos)
+        {
+            host = address.substr(0, colon);
+            port = (unsigned short)std::atoi(address.c_str() + colon + 1);
+        }
+
+        if (socket.connect(sf::IpAddress(host), port, sf::seconds(10.0f)) != sf::Socket::Done)
+        {
+            error = "can't connect to " + address;
+            return false;
+        }
+
+        sf::Packet packet;
+        packet << (sf::Uint8)MESSAGE_HELLO << RENDER_NODES_MAGIC << RENDER_NODES_VERSION;
+
+        sf::Uint8 type = 0;
+        if (socket.send(packet) != sf::Socket::Done || socket.receive(packet) != sf::Socket::Done || !(packet >> type >> job) || type != MESSAGE_JOB)
+        {
+            error = "the coordinator didn't send a job, is it another version?";
+            return false;
+        }
+        return true;
+    }
+
+    bool Accept()
+    {
+        sf::Packet packet;
+        packet << (sf::Uint8)MESSAGE_ACCEPT;
+        return socket.send(packet) == sf::Socket::Done;
+    }
+
+    void Reject(const std::string& reason)
+    {
+        sf::Packet packet;
+        packet << (sf::Uint8)MESSAGE_REJECT << reason;
+        socket.send(packet);
+    }
+
+    // Waits for the next tile, false once there are none left or the coordinator is gone
+    bool NextTile(uint32_t& tile, double& timeLimit)
+    {
+        sf::Packet packet;
+        sf::Uint8 type = 0;
+        return socket.receive(packet) == sf::Socket::Done && (packet >> type) && type == MESSAGE_TILE && (packet >> tile >> timeLimit);
+    }
+
+    bool Progress(uint32_t samples)
+    {
+        sf::Packet packet;
+        packet << (sf::Uint8)MESSAGE_PROGRESS << samples;
+        return socket.send(packet) == sf::Socket::Done;
+    }
+
+    bool Result(const TileResult& result)
+    {
+        sf::Packet packet;
+        packet << (sf::Uint8)MESSAGE_RESULT << result.tile << result.samples << result.seconds << result.noise;
+        for (float v : result.pixels)
+            packet << v;
+        return socket.send(packet) == sf::Socket::Done;
+    }
+
+
+private:
+    sf::TcpSocket socket;
+};
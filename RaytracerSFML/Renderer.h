@@ -0,0 +1,507 @@
+#pragma once
+
+#include "Utils.h"
+#include "Graphics.h"
+#include "Cam.h"
+#include "SceneCache.h"
+#include "AOV.h"
+#include "Denoiser.h"
+#include "CpuTracer.h"
+#include "Memory.h"
+#include "Trace.h"
+
+#include <vector>
+#include <string>
+#include <random>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+
+#include <SFML/Graphics.hpp>
+
+
+// Camera uniforms for looking through cam at a w by h image
+inline void SetCamUniforms(sf::Shader& shader, const Cam& cam, unsigned int w, unsigned int h)
+{
+    float
+        viewHeight = tanf((cam.fov / 2.0f) * (float)utils::PI / 180.0f) * 2.0f,
+        viewWidth = viewHeight / ((float)h / (float)w);
+
+    shader.setUniform("viewHeight", viewHeight);
+    shader.setUniform("viewWidth", viewWidth);
+
+    shader.setUniform("camPos", Vec3(cam.origin).ToShader());
+    shader.setUniform("camFwd", Vec3(cam.fwd).ToShader());
+    shader.setUniform("camUp", Vec3(cam.up).ToShader());
+    shader.setUniform("camRight", Vec3(cam.right).ToShader());
+}
+
+
+// Progressive rendering without a window. Every pass traces some samples per pixel in the shader's realRender mode,
+// which outputs linear radiance. The passes are accumulated on the CPU in full precision, and tonemapped along with
+// their squares for the noise estimate.
+// Images too large for one render target or for memory are rendered a tile at a time, with everything sized to the tile.
+// InitCpu traces the same passes with the shader's path tracer ported to the CPU instead, for machines without a GPU
+// and for the ray statistics only it can count.
+// Deterministic renderers trace and accumulate one sample at a time, each seeded from its index in the tile. Every
+// pixel then sums the same values in the same order however the samples are split into passes, and with tiles each
+// pixel is the same whichever tiles, threads or processes render it. The image is the same to the bit on a backend
+// and device. It costs a draw and readback per sample on the GPU, and a trip through the worker threads per sample on
+// the CPU.
+struct Renderer
+{
+    const unsigned int
+        w, h,          // Of the whole image
+        tileW, tileH;  // Rendered at once, the whole image unless rendering in tiles
+
+    const bool deterministic;
+
+    unsigned int
+        tileX = 0,
+        tileY = 0,   // Top left pixel of the current tile
+        passes = 0,  // Accumulated into every pixel, each sample is one when deterministic
+        samples = 0; // Per pixel, over every pass
+
+
+    Renderer(unsigned int w, unsigned int h, uint32_t seed = 0, unsigned int tileSize = 0, bool deterministic = false) :
+        w(w), h(h),
+        tileW(tileSize > 0 ? std::min(tileSize, w) : w),
+        tileH(tileSize > 0 ? std::min(tileSize, h) : h),
+        deterministic(deterministic),
+        sum(tileW * tileH * 3, 0.0), toneSum(tileW * tileH * 3, 0.0), toneSqr(tileW * tileH * 3, 0.0), seed(seed), rng(seed)
+    {
+        accumulationMemory.Set(MemoryCharge::Of(sum) + MemoryCharge::Of(toneSum) + MemoryCharge::Of(toneSqr));
+    }
+
+    // Seed of a sample of a deterministic render, from its index alone so samples can be traced in any grouping.
+    // SplitMix64's finalizer, so consecutive indices get unrelated seeds.
+    static uint32_t SampleSeed(uint32_t seed, uint64_t sample)
+    {
+        uint64_t z = ((uint64_t)seed << 32) + sample + 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return (uint32_t)(z ^ (z >> 31));
+    }
+
+
+    // Loads the shader and uploads the scene, the scene's camera is used until SetCam
+    bool Init(const SceneView& scene, std::string& error, const std::string& shaderFile = "RaytracerShader.frag")
+    {
+        if (!sf::Shader::isAvailable())
+        {
+            error = "shaders aren't supported";
+            return false;
+        }
+        if (!shader.loadFromFile(shaderFile, sf::Shader::Type::Fragment))
+        {
+            error = shaderFile + ": can't load shader";
+            return false;
+        }
+        if (std::max(tileW, tileH) > sf::Texture::getMaximumSize())
+        {
+            error = std::format("{}x{} is larger than the GPU's texture limit of {}, render in tiles", tileW, tileH, sf::Texture::getMaximumSize());
+            return false;
+        }
+        if (!target.create(tileW, tileH) || !canvas.create(tileW, tileH))
+        {
+            error = std::format("can't create a {}x{} render target", tileW, tileH);
+            return false;
+        }
+
+        framebufferMemory.Set(MemoryCharge::OfTexels(target) + MemoryCharge::OfTexels(canvas));
+        sprite.setTexture(canvas, true);
+        scene.Upload(shader, textures);
+
+        const RenderSettings& settings = scene.settings;
+        shader.setUniform("imgW", (int)w);
+        shader.setUniform("imgH", (int)h);
+        shader.setUniform("maxBounces", (int)settings.maxBounces);
+        shader.setUniform("randomizeDir", settings.randomizeSampleDir);
+        shader.setUniform("disableLighting", settings.disableLighting);
+        shader.setUniform("viewBounds", settings.viewBounds);
+
+        // Each pass stands alone, history is kept here instead of in the shader
+        shader.setUniform("outputMode", OUTPUT_BEAUTY);
+        shader.setUniform("realRender", true);
+        shader.setUniform("frameCount", 0);
+        shader.setUniform("trackHistory", false);
+        shader.setUniform("reproject", false);
+        shader.setUniform("primaryCache", false);
+        shader.setUniform("maxHistory", 1);
+
+        // Unused, but every sampler has to be bound
+        shader.setUniform("lastFrame", canvas);
+        shader.setUniform("lastHit", canvas);
+        shader.setUniform("lastPrimary", canvas);
+
+        SetCam(scene.cam);
+        SetTile(0, 0);
+        return true;
+    }
+
+    // Traces on threads of the CPU, 0 uses every core. The scene is read in place and has to outlive the renderer.
+    void InitCpu(const SceneView& scene, unsigned int threads)
+    {
+        tracer = std::make_unique<cpu::Tracer>(threads);
+        tracer->SetScene(scene);
+        linear.assign((size_t)tileW * tileH * 3, 0.0f);
+        scratchMemory.Set(MemoryCharge::Of(linear));
+
+        SetCam(scene.cam);
+        SetTile(0, 0);
+    }
+
+    bool Cpu() const
+    {
+        return tracer != nullptr;
+    }
+
+    // Only counted on the CPU, null otherwise
+    const cpu::RayStats* Stats() const // Of the last pass
+    {
+        return tracer != nullptr ? &tracer->stats : nullptr;
+    }
+
+    const cpu::RayStats* TotalStats() const // Since InitCpu
+    {
+        return tracer != nullptr ? &tracer->total : nullptr;
+    }
+
+    // Changing the camera restarts accumulation
+    void SetCam(const Cam& cam)
+    {
+        if (tracer != nullptr)
+            tracer->SetCam(cam, w, h);
+        else
+            SetCamUniforms(shader, cam, w, h);
+        Reset();
+    }
+
+    // Moves to the tile with its top left pixel at x, y and restarts accumulation. Every pixel is traced exactly as in
+    // an untiled render, tiles reaching past the image's edges trace the outside for nothing.
+    void SetTile(unsigned int x, unsigned int y)
+    {
+        tileX = x;
+        tileY = y;
+
+        // The shader counts pixels from the bottom left
+        if (tracer == nullptr)
+            shader.setUniform("tileOffset", sf::Glsl::Ivec2((int)x, (int)h - (int)y - (int)tileH));
+
+        Reset();
+    }
+
+    // Also restarts the seeds, so every tile is traced with the same ones as an untiled render no matter which tiles
+    // came before it, or which process renders it
+    void Reset()
+    {
+        std::fill(sum.begin(), sum.end(), 0.0);
+        std::fill(toneSum.begin(), toneSum.end(), 0.0);
+        std::fill(toneSqr.begin(), toneSqr.end(), 0.0);
+        passes = samples = 0;
+
+        rng.seed(seed);
+        draws = 0;
+    }
+
+    void Pass(unsigned int passSamples)
+    {
+        trace.frame.store(passes, std::memory_order_relaxed);
+        TraceScope scope("Pass");
+
+        if (deterministic)
+        {
+            for (unsigned int s = 0; s < passSamples; s++)
+            {
+                Trace(1, SampleSeed(seed, samples));
+                passes++;
+                samples++;
+            }
+            return;
+        }
+
+        draws++;
+        Trace(passSamples, rng());
+
+        passes++;
+        samples += passSamples;
+    }
+
+    // Surfaces hit per path averaged over the tile, from one pass in the bounces output mode. Uses the seed the next
+    // Pass starts with, without taking it, so it describes the paths that pass traces. Leaves the accumulation alone.
+    double MeanBounces(unsigned int passSamples)
+    {
+        double total = 0.0;
+
+        if (tracer != nullptr)
+        {
+            TraceAside(OUTPUT_BOUNCES, passSamples);
+            for (size_t i = 0; i < (size_t)tileW * tileH; i++)
+                total += linear[i*3];
+        }
+        else
+        {
+            sf::Image frame = DrawAside(OUTPUT_BOUNCES, passSamples);
+            const uint8_t* px = frame.getPixelsPtr();
+
+            for (size_t i = 0; i < (size_t)tileW * tileH; i++)
+                total += (double)(((unsigned int)px[i*4] << 8) | (unsigned int)px[i*4 + 1]) / 256.0; // As AOVBuffers::DecodeBounces
+        }
+        return total / ((double)tileW * tileH);
+    }
+
+    // Node visits and primitive tests of every pixel in the tile, interleaved, for OUTPUT_PRIMARYCOST or the
+    // per sample average of a pass for OUTPUT_PATHCOST. Seeded and left alone as MeanBounces.
+    void Cost(int outputMode, unsigned int passSamples, float* cost)
+    {
+        if (tracer != nullptr)
+        {
+            TraceAside(outputMode, passSamples);
+            for (size_t i = 0; i < (size_t)tileW * tileH; i++)
+            {
+                cost[i*2 + 0] = linear[i*3 + 0];
+                cost[i*2 + 1] = linear[i*3 + 1];
+            }
+            return;
+        }
+
+        sf::Image frame = DrawAside(outputMode, passSamples);
+        const uint8_t* px = frame.getPixelsPtr();
+
+        for (size_t i = 0; i < (size_t)tileW * tileH; i++)
+        { // As AOVBuffers::DecodeCost
+            cost[i*2 + 0] = (float)(((unsigned int)px[i*4 + 0] << 8) | (unsigned int)px[i*4 + 1]);
+            cost[i*2 + 1] = (float)(((unsigned int)px[i*4 + 2] << 8) | (unsigned int)px[i*4 + 3]);
+        }
+    }
+
+    // Depth, normal and albedo of the first hit along every pixel's primary ray in the tile, the Denoiser's guides
+    void FirstHits(AOVBuffers& aov)
+    {
+        if (tracer != nullptr)
+        {
+            TraceAside(OUTPUT_FIRSTHIT, 1);
+            for (size_t i = 0; i < (size_t)tileW * tileH; i++)
+            {
+                const Vec3 n = linear[i*3] < 0.0f ? Vec3() : AOVBuffers::Octahedral(linear[i*3 + 1], linear[i*3 + 2]);
+                aov.depth[i] = linear[i*3];
+                aov.normal[i*3 + 0] = (float)n.x;
+                aov.normal[i*3 + 1] = (float)n.y;
+                aov.normal[i*3 + 2] = (float)n.z;
+            }
+
+            TraceAside(OUTPUT_ALBEDO, 1);
+            std::copy(linear.begin(), linear.end(), aov.albedo.begin());
+            return;
+        }
+
+        aov.DecodeFirstHit(DrawAside(OUTPUT_FIRSTHIT, 1));
+        aov.DecodeAlbedo(DrawAside(OUTPUT_ALBEDO, 1));
+    }
+
+    // Filters the accumulated tile's linear radiance with the Denoiser and keeps the result in its place, so it comes
+    // after the last pass. The noise estimate still describes the unfiltered samples.
+    void Denoise()
+    {
+        TraceScope scope("Denoise");
+
+        AOVBuffers aov(tileW, tileH);
+        FirstHits(aov);
+
+        std::vector<float> image((size_t)tileW * tileH * 3);
+        for (unsigned int y = 0; y < tileH; y++)
+            LinearRow(y, &image[(size_t)y * tileW * 3], tileW);
+
+        Denoiser(tileW, tileH).Denoise(image.data(), aov, image.data());
+
+        const double n = std::max(1u, samples);
+        for (size_t i = 0; i < image.size(); i++)
+            sum[i] = image[i] * n;
+    }
+
+    // Standard error of the accumulated pixel values averaged over the image, in display units from 0 to 1.
+    // Needs two passes, before that it's infinite.
+    double Noise() const
+    {
+        if (passes < 2)
+            return std::numeric_limits<double>::infinity();
+
+        const double n = samples;
+        double total = 0.0;
+        for (size_t i = 0; i < toneSum.size(); i++)
+        {
+            double mean = toneSum[i] / n;
+            double variance = std::max(0.0, (toneSqr[i] - n * mean * mean) / (passes - 1)); // Per sample
+            total += std::sqrt(variance / n);
+        }
+        return total / (double)toneSum.size();
+    }
+
+    // Everything the current tile's accumulation depends on, so a render can be continued in another process.
+    // The values are the linear and tonemapped sums back to back.
+    size_t StateSize() const
+    {
+        return sum.size() * 3;
+    }
+
+    uint64_t Draws() const
+    {
+        return draws;
+    }
+
+    void SaveState(double* values) const
+    {
+        std::copy(sum.begin(), sum.end(), values);
+        std::copy(toneSum.begin(), toneSum.end(), values + sum.size());
+        std::copy(toneSqr.begin(), toneSqr.end(), values + sum.size() * 2);
+    }
+
+    // Draws counts the seeds taken for the tile, the generator is replayed up to it. Deterministic renders take none,
+    // their seeds come from the sample count.
+    void RestoreState(const double* values, unsigned int passCount, unsigned int sampleCount, uint64_t drawCount)
+    {
+        std::copy(values, values + sum.size(), sum.begin());
+        std::copy(values + sum.size(), values + sum.size() * 2, toneSum.begin());
+        std::copy(values + sum.size() * 2, values + sum.size() * 3, toneSqr.begin());
+
+        passes = passCount;
+        samples = sampleCount;
+
+        rng.seed(seed);
+        rng.discard(drawCount);
+        draws = drawCount;
+    }
+
+    // The accumulated tile, tonemapped
+    sf::Image Result() const
+    {
+        sf::Image image;
+        image.create(tileW, tileH, sf::Color::Black);
+
+        const double n = std::max(1u, samples);
+        for (unsigned int i = 0; i < tileW * tileH; i++)
+        {
+            Color c = Color(sum[i*3 + 0], sum[i*3 + 1], sum[i*3 + 2]) / n;
+            c = c.ACESFilm();
+
+            image.setPixel(i % tileW, i / tileW, {
+                (uint8_t)(c.r * 255.0 + 0.5),
+                (uint8_t)(c.g * 255.0 + 0.5),
+                (uint8_t)(c.b * 255.0 + 0.5)
+            });
+        }
+        return image;
+    }
+
+    // Row y of the tile's accumulated linear radiance, the first width interleaved rgb values
+    void LinearRow(unsigned int y, float* row, unsigned int width) const
+    {
+        const double n = std::max(1u, samples);
+        for (size_t i = 0; i < (size_t)width * 3; i++)
+            row[i] = (float)(sum[(size_t)y * tileW * 3 + i] / n);
+    }
+
+
+private:
+    std::unique_ptr<cpu::Tracer> tracer; // Only when tracing on the CPU
+    std::vector<float> linear;           // The CPU's last pass
+
+    sf::Shader shader;
+    SceneTextures textures;
+    sf::RenderTexture target;
+    sf::Texture canvas; // Only gives the sprite its size and texture coordinates
+    sf::Sprite sprite;
+
+    std::vector<double> sum, toneSum, toneSqr; // rgb per pixel, linear and tonemapped
+
+    MemoryCharge
+        accumulationMemory{ MEMORY_ACCUMULATION },
+        framebufferMemory{ MEMORY_FRAMEBUFFERS }, // The render target and canvas, 8 bit rgba
+        scratchMemory{ MEMORY_SCRATCH };
+
+    uint32_t seed;
+    std::mt19937 rng;
+    uint64_t draws = 0; // Taken from rng since the last Reset
+
+    // The seed the next pass starts with, without taking it
+    uint32_t NextSeed() const
+    {
+        if (deterministic)
+            return SampleSeed(seed, samples);
+
+        std::mt19937 next = rng;
+        return next();
+    }
+
+    // Traces passSamples per pixel from one seed and accumulates their average
+    void Trace(unsigned int passSamples, uint32_t rndS)
+    {
+        TracePhases phases;
+        if (tracer != nullptr)
+        {
+            phases.Next("CPU trace");
+            tracer->Pass(OUTPUT_BEAUTY, w, h, tileX, tileY, tileW, tileH, passSamples, rndS, linear.data());
+
+            phases.Next("Accumulation");
+            for (size_t i = 0; i < (size_t)tileW * tileH; i++)
+                Accumulate(i, Color(linear[i*3], linear[i*3 + 1], linear[i*3 + 2]), passSamples);
+            return;
+        }
+
+        phases.Next("Draw");
+        shader.setUniform("samples", (int)passSamples);
+        shader.setUniform("rndSeed", (int)((int64_t)rndS - 2147483647));
+
+        target.draw(sprite, sf::RenderStates(sf::BlendNone, sf::Transform::Identity, nullptr, &shader));
+        target.display();
+
+        // Waits for the draw, which returns before the GPU is done
+        phases.Next("Readback");
+        const MemoryCharge readback(MEMORY_SCRATCH, (size_t)tileW * tileH * 4);
+        sf::Image frame = target.getTexture().copyToImage();
+        const uint8_t* px = frame.getPixelsPtr();
+
+        phases.Next("Accumulation");
+        for (size_t i = 0; i < (size_t)tileW * tileH; i++)
+            Accumulate(i, Color::FromRGBE({ px[i*4], px[i*4 + 1], px[i*4 + 2], px[i*4 + 3] }), passSamples);
+    }
+
+    // Draws another output mode with the seed the next pass starts with, without taking it
+    sf::Image DrawAside(int outputMode, unsigned int passSamples)
+    {
+        shader.setUniform("outputMode", outputMode);
+        shader.setUniform("samples", (int)passSamples);
+        shader.setUniform("rndSeed", (int)((int64_t)NextSeed() - 2147483647));
+
+        target.draw(sprite, sf::RenderStates(sf::BlendNone, sf::Transform::Identity, nullptr, &shader));
+        target.display();
+        shader.setUniform("outputMode", OUTPUT_BEAUTY);
+
+        return target.getTexture().copyToImage();
+    }
+
+    // The same on the CPU into linear. Not a pass of the render, so it isn't counted in the statistics.
+    void TraceAside(int outputMode, unsigned int passSamples)
+    {
+        const cpu::RayStats lastStats = tracer->stats, totalStats = tracer->total;
+        tracer->Pass(outputMode, w, h, tileX, tileY, tileW, tileH, passSamples, NextSeed(), linear.data());
+        tracer->stats = lastStats;
+        tracer->total = totalStats;
+    }
+
+    // Weighted by sample count so a shorter last pass counts for less
+    void Accumulate(size_t i, const Color& value, unsigned int passSamples)
+    {
+        const Color toned = value.ACESFilm();
+        const double v[3] = { value.r, value.g, value.b }, t[3] = { toned.r, toned.g, toned.b };
+
+        for (int c = 0; c < 3; c++)
+        {
+            sum[i*3 + c] += v[c] * passSamples;
+            toneSum[i*3 + c] += t[c] * passSamples;
+            toneSqr[i*3 + c] += t[c] * t[c] * passSamples;
+        }
+    }
+};
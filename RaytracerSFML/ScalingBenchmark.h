@@ -0,0 +1,230 @@
+#pragma once
+
+#include "Renderer.h"
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+
+
+// Times the CPU tracer at thread counts from 1 up to a limit and at the resolutions listed in Scenes/Default.scene, to
+// find where more threads stop paying off and why. Each point is taken apart into the causes this tracer can have:
+// starting and joining the threads, the accumulation that runs on one thread after them, heap allocations, and memory
+// traffic against what the machine can stream on as many threads. Random numbers can't be one, every pixel keeps its
+// own generator state. Whatever is left is contention between the cores: false sharing, shared caches and SMT siblings.
+
+// Heap allocations of the whole process, counted by Benchmark's operator new
+inline std::atomic<uint64_t> heapAllocations = 0;
+
+constexpr unsigned int scalingResolutions[][2] = {
+    { 80, 45 }, { 160, 90 }, { 320, 180 }, { 640, 360 }, { 960, 540 }, { 1280, 720 }, { 1920, 1080 }
+};
+
+struct ScalingPoint
+{
+    unsigned int w = 0, h = 0, threads = 0;
+
+    double
+        passMs = 0.0,           // Median of whole passes of the renderer
+        traceMs = 0.0,          // Median of the tracing alone, the part on every thread
+        spawnMs = 0.0,          // Median of starting and joining the threads with no rows to trace
+        samplesPerSecond = 0.0,
+        speedup = 0.0,          // Over one thread at the same resolution
+        efficiency = 0.0,       // Speedup per thread
+        bandwidthGBs = 0.0,     // Bytes a pass reads and writes over its time, an upper bound as geometry is mostly cached
+        peakGBs = 0.0,          // Streamed on as many threads
+        allocationsPerPass = 0.0;
+
+    const char* limit = "";
+};
+
+
+struct ScalingBenchmark
+{
+    static constexpr unsigned int PASSES = 3; // Timed at each point, after an untimed one
+
+    static constexpr double
+        GOOD_EFFICIENCY = 0.8,   // Points at least this efficient aren't held back by anything
+        BANDWIDTH_SHARE = 0.6,   // Of the streamed peak, past which memory is the limit
+        THREAD_ALLOCATIONS = 64, // Per thread and pass, past which the allocator is
+
+        // Moved per pixel and pass besides the tracing: the tracer writes the linear rgb floats, then accumulation reads
+        // them and reads and writes three rgb doubles
+        FRAMEBUFFER_BYTES = 3 * 4 * 2 + 9 * 8 * 2,
+        NODE_BYTES = sizeof(BVHNode),
+        TRIANGLE_BYTES = 3 * 4 + 3 * 3 * 4; // Three indices and the vertices they point to
+
+    const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned int> threadCounts; // Doubling from 1, then the limit
+    std::vector<double> peakGBs;            // For each of threadCounts
+
+
+    // 0 goes up to every core
+    explicit ScalingBenchmark(unsigned int maxThreads)
+    {
+        if (maxThreads == 0)
+            maxThreads = cores;
+
+        for (unsigned int t = 1; t < maxThreads; t *= 2)
+            threadCounts.push_back(t);
+        threadCounts.push_back(maxThreads);
+    }
+
+    // A triad through arrays much larger than any cache, on every thread count, best of a few runs
+    void MeasureBandwidth()
+    {
+        constexpr size_t COUNT = (size_t)1 << 24;
+        constexpr int RUNS = 4;
+        std::vector<float> a(COUNT, 0.0f), b(COUNT, 1.0f), c(COUNT, 2.0f);
+
+        peakGBs.clear();
+        for (unsigned int threads : threadCounts)
+        {
+            double best = 0.0;
+            for (int run = 0; run < RUNS; run++)
+            {
+                auto Work = [&](unsigned int t) {
+                    const size_t first = COUNT * t / threads, last = COUNT * (t + 1) / threads;
+                    for (size_t i = first; i < last; i++)
+                        a[i] = b[i] + 0.5f * c[i];
+                };
+
+                const auto start = std::chrono::steady_clock::now();
+                std::vector<std::thread> workers;
+                for (unsigned int t = 1; t < threads; t++)
+                    workers.emplace_back(Work, t);
+                Work(0);
+                for (std::thread& worker : workers)
+                    worker.join();
+
+                const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                best = std::max(best, 3.0 * COUNT * sizeof(float) / seconds / 1e9);
+            }
+            peakGBs.push_back(best);
+            std::cerr << std::format("Streaming on {} threads: {:.2f} GB/s\n", threads, best);
+        }
+    }
+
+    // Every resolution at every thread count for the scene, the scene's camera looking at w by h images
+    std::vector<ScalingPoint> Run(const std::string& name, const SceneView& scene, unsigned int passSamples, uint32_t seed)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        if (peakGBs.size() != threadCounts.size())
+            MeasureBandwidth();
+
+        std::vector<ScalingPoint> points;
+        for (const auto& resolution : scalingResolutions)
+        {
+            const unsigned int w = resolution[0], h = resolution[1];
+            double oneThreadMs = 0.0;
+
+            for (size_t t = 0; t < threadCounts.size(); t++)
+            {
+                ScalingPoint p;
+                p.w = w;
+                p.h = h;
+                p.threads = threadCounts[t];
+                p.peakGBs = peakGBs[t];
+
+                std::vector<double> passMs, traceMs, spawnMs;
+
+                // Whole passes as renders take them
+                Renderer renderer(w, h, seed);
+                renderer.InitCpu(scene, p.threads);
+                renderer.Pass(passSamples);
+
+                const uint64_t allocations = heapAllocations.load();
+                for (unsigned int i = 0; i < PASSES; i++)
+                {
+                    const Clock::time_point start = Clock::now();
+                    renderer.Pass(passSamples);
+                    passMs.push_back(Milliseconds(start));
+                }
+                p.allocationsPerPass = (double)(heapAllocations.load() - allocations) / PASSES;
+
+                // The tracing alone, and the threads alone
+                cpu::Tracer tracer(p.threads);
+                tracer.SetScene(scene);
+                tracer.SetCam(scene.cam, w, h);
+                std::vector<float> rgb((size_t)w * h * 3);
+
+                for (unsigned int i = 0; i < PASSES; i++)
+                {
+                    Clock::time_point start = Clock::now();
+                    tracer.Pass(OUTPUT_BEAUTY, w, h, 0, 0, w, h, passSamples, seed + i, rgb.data());
+                    traceMs.push_back(Milliseconds(start));
+
+                    start = Clock::now();
+                    tracer.Pass(OUTPUT_BEAUTY, w, h, 0, 0, w, 0, passSamples, seed + i, rgb.data());
+                    spawnMs.push_back(Milliseconds(start));
+                }
+
+                p.passMs = Median(passMs);
+                p.traceMs = Median(traceMs);
+                p.spawnMs = Median(spawnMs);
+                p.samplesPerSecond = (double)w * h * passSamples / (p.passMs / 1000.0);
+
+                if (p.threads == 1)
+                    oneThreadMs = p.passMs;
+                p.speedup = oneThreadMs > 0.0 ? oneThreadMs / p.passMs : 0.0;
+                p.efficiency = p.speedup / p.threads;
+
+                // Over the timed tracing passes, the empty ones count nothing
+                const cpu::RayStats& s = tracer.total;
+                const double
+                    geometryBytes = ((double)s.nodeVisits * NODE_BYTES + (double)s.tests[cpu::RayStats::GROUPS - 1] * TRIANGLE_BYTES) / PASSES,
+                    bytes = (double)w * h * FRAMEBUFFER_BYTES + geometryBytes;
+                p.bandwidthGBs = bytes / (p.passMs / 1000.0) / 1e9;
+
+                p.limit = Limit(p, oneThreadMs);
+                points.push_back(p);
+
+                std::cerr << std::format("{} {}x{}, {} threads: {:.2f} ms per pass, {:.2f}x, {:.0f}% efficient, {:.2f} GB/s, limit: {}\n",
+                    name, w, h, p.threads, p.passMs, p.speedup, p.efficiency * 100.0, p.bandwidthGBs, p.limit);
+            }
+        }
+        return points;
+    }
+
+
+private:
+    // What holds the point back the most, if anything does
+    const char* Limit(const ScalingPoint& p, double oneThreadMs) const
+    {
+        if (p.threads == 1 || p.efficiency >= GOOD_EFFICIENCY)
+            return "none";
+        if (p.threads > cores)
+            return "oversubscribed";
+        if (p.bandwidthGBs >= p.peakGBs * BANDWIDTH_SHARE)
+            return "memory bandwidth";
+        if (p.allocationsPerPass >= THREAD_ALLOCATIONS * p.threads)
+            return "allocator";
+
+        // The serial parts, when they make up most of the time lost against perfect scaling
+        const double
+            lost = p.passMs - oneThreadMs / p.threads,
+            serial = p.passMs - p.traceMs;
+        if (std::max(p.spawnMs, serial) >= lost / 2.0)
+            return p.spawnMs > serial ? "thread startup" : "serial accumulation";
+
+        return "contention";
+    }
+
+    static double Milliseconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static double Median(std::vector<double> values)
+    {
+        std::sort(values.begin(), values.end());
+        return values[values.size() / 2];
+    }
+};
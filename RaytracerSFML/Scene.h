@@ -0,0 +1,1406 @@
+#pragma once
+
+#include "Vec3.h"
+#include "Cam.h"
+#include "Graphics.h"
+#include "MeshLoader.h"
+#include "BVH.h"
+#include "SceneGenerator.h"
+#include "Memory.h"
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <sstream>
+#include <format>
+#include <charconv>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include <SFML/Graphics/Shader.hpp>
+#include <SFML/Graphics/Texture.hpp>
+#include <SFML/OpenGL.hpp>
+
+// Data texture formats missing from older OpenGL headers
+#ifndef GL_RGBA32F
+    #define GL_RGBA32F 0x8814
+#endif
+#ifndef GL_RGB32F
+    #define GL_RGB32F 0x8815
+#endif
+#ifndef GL_RGB32UI
+    #define GL_RGB32UI 0x8D71
+#endif
+#ifndef GL_RGB_INTEGER
+    #define GL_RGB_INTEGER 0x8D98
+#endif
+
+
+enum ShapeType
+{
+    SHAPE_AABB,
+    SHAPE_OBB,
+    SHAPE_SPHERE,
+    SHAPE_TRI,
+    SHAPE_PLANE,
+    SHAPE_TYPES
+};
+
+// Layout of each shape type's uniforms, must match RaytracerShader.frag
+struct ShapeInfo
+{
+    const char* keyword;     // In scene files
+    const char* uniformName;
+    int vectors;             // Per shape
+    int components;          // Per vector
+    int maxCount;
+    bool bounded;
+};
+
+constexpr ShapeInfo shapeInfo[SHAPE_TYPES] = {
+    { "AABB",   "aabb",   2, 3, 16, true  }, // vec3(min x3), vec3(max x3)
+    { "OBB",    "obb",    5, 3, 16, true  }, // vec3(center x3), vec3(halfLength x3), vec3(x-axis x3), vec3(y-axis x3), vec3(z-axis x3)
+    { "Sphere", "sphere", 1, 4, 16, true  }, // vec4(pos x3, rad x1)
+    { "Tri",    "tri",    3, 3, 32, true  }, // vec3(v1 x3), vec3(v2 x3), vec3(v3 x3)
+    { "Plane",  "plane",  2, 3, 8,  false }  // vec3(center x3), vec3(normal x3)
+};
+
+
+constexpr int MATERIAL_VALUES = 5;
+
+struct Material
+{
+    sf::Glsl::Vec4
+        surface,    // albedo reflectivity, specular reflectivity, reflective index, unused
+        albedo,     // albedo x3, opacity
+        specular,   // specular x3, opacity
+        emission,   // emission x3, opacity
+        absorption; // absorption x3, offset
+};
+
+struct ShapeList
+{
+    std::vector<float> data; // vectors * components floats per shape
+    std::vector<Material> mats;
+
+    std::vector<sf::Glsl::Vec4> bounds; // Bounding spheres, xyz center & w radius
+    std::vector<int32_t> boundCoverage; // Consecutive shapes inside each bounding sphere
+
+    int Count() const
+    {
+        return (int)mats.size();
+    }
+};
+
+// Mesh limits, must match RaytracerShader.frag
+constexpr int
+    MESH_MAX = 8,
+    MESH_TEXTURE_WIDTH = 4096,
+    MESH_TRIANGLES_MAX = 10 * 1048576; // Primitive IDs of mesh triangles span types 6 to 15
+
+static_assert(MESH_TRIANGLES_MAX < BVH_INDEX_LIMIT, "triangle indices are floats in the BVH nodes");
+
+// Where a mesh came from, so reloading a scene can reuse meshes whose file and transform didn't change
+struct MeshSource
+{
+    uint64_t stamp;      // Scene::FileStamp of the mesh file, or a hash of the parameters of a generated one
+    float offset[3], scale;
+    uint32_t firstVertex, hasNormals;
+};
+
+struct MeshView;
+
+// Every mesh of a scene, concatenated in the layout of the shader's data textures
+struct MeshList
+{
+    std::vector<float> vertices;       // xyz per vertex
+    std::vector<float> normals;        // xyz per vertex, empty when no mesh has normals
+    std::vector<uint32_t> triangles;   // Three vertex indices per triangle, in BVH leaf order
+    std::vector<BVHNode> nodes;
+
+    std::vector<Material> mats;         // Per mesh
+    std::vector<sf::Glsl::Vec4> bounds; // Bounding sphere per mesh, checked before its BVH
+    std::vector<int32_t> roots;         // BVH root node per mesh
+    std::vector<int32_t> firstTriangles;
+
+    std::vector<std::string> files;   // Source of each mesh, so caches and reloads can tell when one changes
+    std::vector<MeshSource> sources;
+
+
+    int Count() const
+    {
+        return (int)mats.size();
+    }
+
+    // Node indices past BVH_INDEX_LIMIT would be rounded in the shader's float texels, triangle indices are kept under
+    // it by MESH_TRIANGLES_MAX
+    static bool FitsNodes(size_t nodeCount, std::string& error)
+    {
+        if (nodeCount < BVH_INDEX_LIMIT)
+            return true;
+        error = std::format("too many BVH nodes, the meshes need {} and the shader supports {}", nodeCount, BVH_INDEX_LIMIT - 1);
+        return false;
+    }
+
+    // Builds the mesh's BVH, source only needs its stamp and transform filled in. Fails when the nodes don't fit.
+    bool Add(const Mesh& mesh, const Material& mat, const std::string& file, MeshSource source, std::string& error)
+    {
+        const uint32_t
+            vertexBase = (uint32_t)(vertices.size() / 3),
+            triangleBase = (uint32_t)(triangles.size() / 3),
+            nodeBase = (uint32_t)nodes.size();
+
+        std::vector<BVHNode> meshNodes;
+        std::vector<uint32_t> order;
+        BVHBuilder::Build(mesh.positions.data(), mesh.indices.data(), mesh.TriangleCount(), meshNodes, order);
+        if (!FitsNodes(nodes.size() + meshNodes.size(), error))
+            return false;
+
+        vertices.insert(vertices.end(), mesh.positions.begin(), mesh.positions.end());
+        AppendNormals(mesh.normals.empty() ? nullptr : mesh.normals.data(), mesh.normals.size());
+
+        triangles.reserve(triangles.size() + order.size() * 3);
+        for (uint32_t t : order)
+            for (int v = 0; v < 3; v++)
+                triangles.push_back(mesh.indices[t*3 + v] + vertexBase);
+
+        for (BVHNode& node : meshNodes)
+            node.leftFirst += (float)((node.count > 0.0f) ? triangleBase : nodeBase);
+        nodes.insert(nodes.end(), meshNodes.begin(), meshNodes.end());
+
+        // Sphere around the root's box center that just encloses every vertex
+        const BVHNode& root = meshNodes[0];
+        Vec3 center((root.min[0] + root.max[0]) * 0.5, (root.min[1] + root.max[1]) * 0.5, (root.min[2] + root.max[2]) * 0.5);
+        double radiusSqr = 0.0;
+        for (size_t v = 0; v < mesh.VertexCount(); v++)
+            radiusSqr = std::max(radiusSqr, (Vec3(mesh.positions[v*3 + 0], mesh.positions[v*3 + 1], mesh.positions[v*3 + 2]) - center).MagSqr());
+
+        source.firstVertex = vertexBase;
+        source.hasNormals = mesh.normals.empty() ? 0 : 1;
+
+        mats.push_back(mat);
+        bounds.emplace_back((float)center.x, (float)center.y, (float)center.z, (float)(std::sqrt(radiusSqr) * 1.01 + 0.01));
+        roots.push_back((int32_t)nodeBase);
+        firstTriangles.push_back((int32_t)triangleBase);
+        files.push_back(file);
+        sources.push_back(source);
+        return true;
+    }
+
+    // Copies mesh m of another scene with its finished BVH, only the indices are rebased
+    void AddFrom(const MeshView& from, int m, const Material& mat);
+
+private:
+    // Meshes without normals get zeroes, which the shader replaces with the face normal
+    void AppendNormals(const float* meshNormals, size_t floats)
+    {
+        if (meshNormals != nullptr && normals.empty())
+            normals.resize(vertices.size() - floats, 0.0f);
+        if (meshNormals != nullptr)
+            normals.insert(normals.end(), meshNormals, meshNormals + floats);
+        else if (!normals.empty())
+            normals.resize(vertices.size(), 0.0f);
+    }
+};
+
+struct SkySettings
+{ // Defaults match RaytracerShader.frag
+    Vec3
+        peakCol = Vec3(0.75, 0.9, 1.0) * 0.95 * 0.1,
+        horizonCol = Vec3(0.5, 0.65, 1.0) * 0.85 * 0.1,
+        voidCol = Vec3(0.1, 0.5, 1.0) * 0.1 * 0.1,
+        sunCol = Vec3(1.0, 0.95, 0.6) * 7.5,
+        sunDir = Vec3(40.0, 50.0, 20.0).Normalize();
+    float sunFlare = 256.0f;
+
+    bool operator==(const SkySettings&) const = default;
+};
+
+// Limits of the scene's settings. 16384 is the largest texture most GPUs take, BatchRender's --width and --height go
+// past it in tiles.
+constexpr unsigned int
+    RENDER_SIDE_MAX = 16384,
+    PASS_SAMPLES_MAX = 4096;
+
+struct RenderSettings
+{
+    unsigned int
+        width = 1280,
+        height = 720,
+        samples = 16,
+        maxBounces = 8;
+
+    bool
+        cumulativeLighting = true,
+        realRender = false,
+        randomizeSampleDir = true,
+        disableLighting = false,
+        viewBounds = false,
+        dynamicResolution = true,
+        temporalReprojection = true,
+        denoise = false;
+
+    bool operator==(const RenderSettings&) const = default;
+};
+
+
+// Read-only view of a scene's final GPU layout, either over a parsed Scene or a mapped scene cache
+struct ShapeView
+{
+    const float* data;
+    const Material* mats;
+    const sf::Glsl::Vec4* bounds;
+    const int32_t* boundCoverage;
+
+    int count, boundCount;
+};
+
+struct MeshView
+{
+    const float* vertices;
+    const float* normals;
+    const uint32_t* triangles;
+    const BVHNode* nodes;
+
+    const Material* mats;
+    const sf::Glsl::Vec4* bounds;
+    const int32_t* roots;
+    const int32_t* firstTriangles;
+    const MeshSource* sources;
+
+    int count;
+    size_t vertexCount, normalCount, triangleCount, nodeCount;
+
+    std::vector<std::string_view> files;
+
+
+    // Vertex, triangle and node ranges of mesh m, meshes are stored back to back
+    size_t VertexEnd(int m) const
+    {
+        return (m + 1 < count) ? sources[m + 1].firstVertex : vertexCount;
+    }
+    size_t TriangleEnd(int m) const
+    {
+        return (m + 1 < count) ? (size_t)firstTriangles[m + 1] : triangleCount;
+    }
+    size_t NodeEnd(int m) const
+    {
+        return (m + 1 < count) ? (size_t)roots[m + 1] : nodeCount;
+    }
+};
+
+inline void MeshList::AddFrom(const MeshView& from, int m, const Material& mat)
+{
+    const MeshSource& source = from.sources[m];
+    const size_t
+        firstVertex = source.firstVertex, endVertex = from.VertexEnd(m),
+        firstTriangle = (size_t)from.firstTriangles[m], endTriangle = from.TriangleEnd(m),
+        firstNode = (size_t)from.roots[m], endNode = from.NodeEnd(m);
+
+    const uint32_t
+        vertexBase = (uint32_t)(vertices.size() / 3),
+        triangleBase = (uint32_t)(triangles.size() / 3),
+        nodeBase = (uint32_t)nodes.size();
+
+    vertices.insert(vertices.end(), from.vertices + firstVertex * 3, from.vertices + endVertex * 3);
+    AppendNormals(source.hasNormals ? from.normals + firstVertex * 3 : nullptr, (endVertex - firstVertex) * 3);
+
+    triangles.reserve(triangles.size() + (endTriangle - firstTriangle) * 3);
+    for (size_t i = firstTriangle * 3; i < endTriangle * 3; i++)
+        triangles.push_back(from.triangles[i] - (uint32_t)firstVertex + vertexBase);
+
+    nodes.reserve(nodes.size() + (endNode - firstNode));
+    for (size_t n = firstNode; n < endNode; n++)
+    {
+        BVHNode node = from.nodes[n];
+        node.leftFirst = (node.count > 0.0f) ?
+            (float)((double)node.leftFirst - firstTriangle + triangleBase) :
+            (float)((double)node.leftFirst - firstNode + nodeBase);
+        nodes.push_back(node);
+    }
+
+    MeshSource copied = source;
+    copied.firstVertex = vertexBase;
+
+    mats.push_back(mat);
+    bounds.push_back(from.bounds[m]);
+    roots.push_back((int32_t)nodeBase);
+    firstTriangles.push_back((int32_t)triangleBase);
+    files.emplace_back(from.files[m]);
+    sources.push_back(copied);
+}
+
+// Mesh buffers are too large for uniforms, so they live in data textures the shader reads with texelFetch
+struct SceneTextures
+{
+    sf::Texture vertices, normals, triangles, nodes;
+    MemoryCharge memory{ MEMORY_TEXTURES };
+
+
+    // Rows of MESH_TEXTURE_WIDTH texels, there's always at least one texel so the samplers stay valid
+    static bool Upload(sf::Texture& texture, const void* data, size_t texels, size_t texelBytes, GLint internalFormat, GLenum format, GLenum type)
+    {
+        const unsigned int
+            w = MESH_TEXTURE_WIDTH,
+            h = (unsigned int)std::max<size_t>(1, (texels + w - 1) / w);
+
+        if (!texture.create(w, h))
+            return false;
+
+        // SFML only creates 8 bit textures, so the storage is replaced
+        sf::Texture::bind(&texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, w, h, 0, format, type, nullptr);
+        UploadRows(data, texels, texelBytes, format, type, 0, h);
+
+        sf::Texture::bind(nullptr);
+        return glGetError() == GL_NO_ERROR;
+    }
+
+    // Re-uploads the rows between the first and last texel that differ from old, which the texture must hold
+    static bool Update(sf::Texture& texture, const void* data, const void* old, size_t texels, size_t texelBytes, GLenum format, GLenum type)
+    {
+        const uint8_t *now = (const uint8_t*)data, *was = (const uint8_t*)old;
+        const size_t bytes = texels * texelBytes;
+
+        size_t first = std::mismatch(now, now + bytes, was).first - now;
+        if (first == bytes)
+            return true;
+        size_t last = bytes - 1 - (std::mismatch(std::make_reverse_iterator(now + bytes), std::make_reverse_iterator(now), std::make_reverse_iterator(was + bytes)).first - std::make_reverse_iterator(now + bytes));
+
+        const size_t rowBytes = MESH_TEXTURE_WIDTH * texelBytes;
+        sf::Texture::bind(&texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        UploadRows(data, texels, texelBytes, format, type, first / rowBytes, last / rowBytes + 1);
+
+        sf::Texture::bind(nullptr);
+        return glGetError() == GL_NO_ERROR;
+    }
+
+    // Of a texture holding texels, in whole rows
+    static size_t Bytes(size_t texels, size_t texelBytes)
+    {
+        return std::max<size_t>(1, (texels + MESH_TEXTURE_WIDTH - 1) / MESH_TEXTURE_WIDTH) * MESH_TEXTURE_WIDTH * texelBytes;
+    }
+
+    bool UploadMeshes(const MeshView& m)
+    {
+        static_assert(sizeof(BVHNode) == 2 * 4 * sizeof(float));
+        memory.Set(Bytes(m.vertexCount, 3 * sizeof(float)) + Bytes(m.normalCount, 3 * sizeof(float)) +
+            Bytes(m.triangleCount, 3 * sizeof(uint32_t)) + Bytes(m.nodeCount * 2, 4 * sizeof(float)));
+        return
+            Upload(vertices, m.vertices, m.vertexCount, 3 * sizeof(float), GL_RGB32F, GL_RGB, GL_FLOAT) &&
+            Upload(normals, m.normals, m.normalCount, 3 * sizeof(float), GL_RGB32F, GL_RGB, GL_FLOAT) &&
+            Upload(triangles, m.triangles, m.triangleCount, 3 * sizeof(uint32_t), GL_RGB32UI, GL_RGB_INTEGER, GL_UNSIGNED_INT) &&
+            Upload(nodes, m.nodes, m.nodeCount * 2, 4 * sizeof(float), GL_RGBA32F, GL_RGBA, GL_FLOAT);
+    }
+
+    // Both views must have the same buffer sizes
+    bool UpdateMeshes(const MeshView& m, const MeshView& old)
+    {
+        return
+            Update(vertices, m.vertices, old.vertices, m.vertexCount, 3 * sizeof(float), GL_RGB, GL_FLOAT) &&
+            Update(normals, m.normals, old.normals, m.normalCount, 3 * sizeof(float), GL_RGB, GL_FLOAT) &&
+            Update(triangles, m.triangles, old.triangles, m.triangleCount, 3 * sizeof(uint32_t), GL_RGB_INTEGER, GL_UNSIGNED_INT) &&
+            Update(nodes, m.nodes, old.nodes, m.nodeCount * 2, 4 * sizeof(float), GL_RGBA, GL_FLOAT);
+    }
+
+private:
+    // Rows [firstRow, endRow) of the bound texture, the data's last row may be partial
+    static void UploadRows(const void* data, size_t texels, size_t texelBytes, GLenum format, GLenum type, size_t firstRow, size_t endRow)
+    {
+        const size_t w = MESH_TEXTURE_WIDTH, fullRows = texels / w, rest = texels % w;
+        const uint8_t* bytes = (const uint8_t*)data;
+
+        size_t end = std::min(endRow, fullRows);
+        if (end > firstRow)
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, (GLint)firstRow, (GLsizei)w, (GLsizei)(end - firstRow), format, type, bytes + firstRow * w * texelBytes);
+        if (rest > 0 && endRow > fullRows)
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, (GLint)fullRows, (GLsizei)rest, 1, format, type, bytes + fullRows * w * texelBytes);
+    }
+};
+
+// What differs between two versions of a scene, returned by SceneView::Update
+constexpr int
+    SCENE_CAM = 1 << 0,
+    SCENE_SETTINGS = 1 << 1,
+    SCENE_SKY = 1 << 2,
+    SCENE_MATERIALS = 1 << 3,
+    SCENE_GEOMETRY = 1 << 4,
+    SCENE_VISIBLE = SCENE_SKY | SCENE_MATERIALS | SCENE_GEOMETRY; // Changes that invalidate accumulated samples
+
+struct SceneView
+{
+    Cam cam;
+    SkySettings sky = {};
+    RenderSettings settings = {};
+
+    ShapeView shapes[SHAPE_TYPES] = {};
+    MeshView meshes = {};
+
+
+    void Upload(sf::Shader& shader, SceneTextures& textures) const
+    {
+        static_assert(sizeof(sf::Glsl::Vec3) == 3 * sizeof(float) && sizeof(sf::Glsl::Vec4) == 4 * sizeof(float));
+        static_assert(sizeof(Material) == MATERIAL_VALUES * sizeof(sf::Glsl::Vec4));
+
+        for (int t = 0; t < SHAPE_TYPES; t++)
+            UploadShapes(shader, t);
+
+        UploadMeshes(shader, textures);
+        UploadSky(shader);
+    }
+
+    // Uploads only what differs from old, which must be what the shader currently holds, and returns SCENE_ flags for it.
+    // Camera and settings are only compared, they belong to whoever owns the live copies.
+    int Update(sf::Shader& shader, SceneTextures& textures, const SceneView& old) const
+    {
+        int changes = 0;
+
+        if (cam.fov != old.cam.fov || cam.perspective != old.cam.perspective || cam.speed != old.cam.speed || cam.origin != old.cam.origin || cam.fwd != old.cam.fwd)
+            changes |= SCENE_CAM;
+        if (settings != old.settings)
+            changes |= SCENE_SETTINGS;
+        if (sky != old.sky)
+        {
+            UploadSky(shader);
+            changes |= SCENE_SKY;
+        }
+
+        for (int t = 0; t < SHAPE_TYPES; t++)
+            changes |= UpdateShapes(shader, t, old.shapes[t]);
+
+        return changes | UpdateMeshes(shader, textures, old.meshes);
+    }
+
+    // Hash of everything the shader renders from besides the camera and settings, the same whether the scene was
+    // parsed or mapped from a cache. File stamps are left out, touching a file doesn't change the scene.
+    uint64_t Hash() const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto Add = [&hash](const void* data, size_t bytes) {
+            const uint8_t* p = (const uint8_t*)data;
+            for (size_t i = 0; i < bytes; i++)
+                hash = (hash ^ p[i]) * 1099511628211ull;
+        };
+
+        for (const Vec3& v : { sky.peakCol, sky.horizonCol, sky.voidCol, sky.sunCol, sky.sunDir })
+        {
+            double xyz[3] = { v.x, v.y, v.z };
+            Add(xyz, sizeof(xyz));
+        }
+        Add(&sky.sunFlare, sizeof(float));
+
+        for (int t = 0; t < SHAPE_TYPES; t++)
+        {
+            const ShapeInfo& info = shapeInfo[t];
+            const ShapeView& list = shapes[t];
+
+            Add(&list.count, sizeof(int));
+            Add(list.data, (size_t)list.count * info.vectors * info.components * sizeof(float));
+            Add(list.mats, (size_t)list.count * sizeof(Material));
+            Add(&list.boundCount, sizeof(int));
+            Add(list.bounds, (size_t)list.boundCount * sizeof(sf::Glsl::Vec4));
+            Add(list.boundCoverage, (size_t)list.boundCount * sizeof(int32_t));
+        }
+
+        const size_t counts[5] = { (size_t)meshes.count, meshes.vertexCount, meshes.normalCount, meshes.triangleCount, meshes.nodeCount };
+        Add(counts, sizeof(counts));
+        Add(meshes.vertices, meshes.vertexCount * 3 * sizeof(float));
+        Add(meshes.normals, meshes.normalCount * 3 * sizeof(float));
+        Add(meshes.triangles, meshes.triangleCount * 3 * sizeof(uint32_t));
+        Add(meshes.nodes, meshes.nodeCount * sizeof(BVHNode));
+        Add(meshes.mats, meshes.count * sizeof(Material));
+        Add(meshes.bounds, meshes.count * sizeof(sf::Glsl::Vec4));
+        Add(meshes.roots, meshes.count * sizeof(int32_t));
+        Add(meshes.firstTriangles, meshes.count * sizeof(int32_t));
+
+        return hash;
+    }
+
+
+private:
+    template <typename T>
+    static bool Same(const T* a, const T* b, size_t count)
+    {
+        return count == 0 || std::memcmp(a, b, count * sizeof(T)) == 0;
+    }
+
+    // The stored layout is exactly what the shader takes, so it's uploaded in place
+    static void SetShapes(sf::Shader& shader, const std::string& uniform, const ShapeInfo& info, const float* data, int count)
+    {
+        if (info.components == 4)
+            shader.setUniformArray(uniform, (const sf::Glsl::Vec4*)data, count * info.vectors);
+        else
+            shader.setUniformArray(uniform, (const sf::Glsl::Vec3*)data, count * info.vectors);
+    }
+
+    void UploadShapes(sf::Shader& shader, int t) const
+    {
+        const ShapeInfo& info = shapeInfo[t];
+        const ShapeView& list = shapes[t];
+        const std::string shapeName = info.uniformName;
+
+        if (list.count > 0)
+        {
+            SetShapes(shader, shapeName + "Shapes", info, list.data, list.count);
+            shader.setUniformArray(shapeName + "Mats", (const sf::Glsl::Vec4*)list.mats, list.count * MATERIAL_VALUES);
+        }
+
+        if (info.bounded && list.boundCount > 0)
+        {
+            shader.setUniformArray(shapeName + "Bounds", list.bounds, list.boundCount);
+            for (int i = 0; i < list.boundCount; i++)
+                shader.setUniform(std::format("{}BoundCoverage[{}]", shapeName, i), (int)list.boundCoverage[i]);
+        }
+
+        shader.setUniform(shapeName + "Count", list.count);
+    }
+
+    // Same sized lists are patched element by element, a uniform array can be set starting at any element
+    int UpdateShapes(sf::Shader& shader, int t, const ShapeView& old) const
+    {
+        const ShapeInfo& info = shapeInfo[t];
+        const ShapeView& list = shapes[t];
+
+        if (list.count != old.count || list.boundCount != old.boundCount)
+        {
+            UploadShapes(shader, t);
+            return SCENE_GEOMETRY | SCENE_MATERIALS;
+        }
+
+        int changes = 0;
+        const int floats = info.vectors * info.components;
+        for (int i = 0; i < list.count; i++)
+        {
+            if (!Same(list.data + i * floats, old.data + i * floats, floats))
+            {
+                SetShapes(shader, std::format("{}Shapes[{}]", info.uniformName, i * info.vectors), info, list.data + i * floats, 1);
+                changes |= SCENE_GEOMETRY;
+            }
+            if (!Same(list.mats + i, old.mats + i, 1))
+            {
+                shader.setUniformArray(std::format("{}Mats[{}]", info.uniformName, i * MATERIAL_VALUES), (const sf::Glsl::Vec4*)(list.mats + i), MATERIAL_VALUES);
+                changes |= SCENE_MATERIALS;
+            }
+        }
+
+        for (int i = 0; info.bounded && i < list.boundCount; i++)
+            if (!Same(list.bounds + i, old.bounds + i, 1) || list.boundCoverage[i] != old.boundCoverage[i])
+            {
+                shader.setUniform(std::format("{}Bounds[{}]", info.uniformName, i), list.bounds[i]);
+                shader.setUniform(std::format("{}BoundCoverage[{}]", info.uniformName, i), (int)list.boundCoverage[i]);
+                changes |= SCENE_GEOMETRY;
+            }
+
+        return changes;
+    }
+
+    void UploadMeshes(sf::Shader& shader, SceneTextures& textures) const
+    {
+        int meshCount = meshes.count;
+        if (!textures.UploadMeshes(meshes) && meshCount > 0)
+        {
+            std::cerr << "Failed to upload mesh data, meshes are hidden\n";
+            meshCount = 0;
+        }
+
+        shader.setUniform("meshVertices", textures.vertices);
+        shader.setUniform("meshNormals", textures.normals);
+        shader.setUniform("meshTriangles", textures.triangles);
+        shader.setUniform("meshNodes", textures.nodes);
+
+        if (meshCount > 0)
+        {
+            shader.setUniformArray("meshBounds", meshes.bounds, meshCount);
+            shader.setUniformArray("meshMats", (const sf::Glsl::Vec4*)meshes.mats, meshCount * MATERIAL_VALUES);
+            for (int i = 0; i < meshCount; i++)
+            {
+                shader.setUniform(std::format("meshRoots[{}]", i), (int)meshes.roots[i]);
+                shader.setUniform(std::format("meshFirstTriangle[{}]", i), (int)meshes.firstTriangles[i]);
+            }
+        }
+        shader.setUniform("meshSmooth", meshes.normalCount > 0);
+        shader.setUniform("meshCount", meshCount);
+    }
+
+    // Reused meshes keep their data in place, so usually nothing or only one mesh's rows get uploaded
+    int UpdateMeshes(sf::Shader& shader, SceneTextures& textures, const MeshView& old) const
+    {
+        if (meshes.count != old.count || meshes.vertexCount != old.vertexCount || meshes.normalCount != old.normalCount ||
+            meshes.triangleCount != old.triangleCount || meshes.nodeCount != old.nodeCount)
+        {
+            UploadMeshes(shader, textures);
+            return SCENE_GEOMETRY | SCENE_MATERIALS;
+        }
+
+        int changes = 0;
+        if (!Same(meshes.vertices, old.vertices, meshes.vertexCount * 3) || !Same(meshes.normals, old.normals, meshes.normalCount * 3) ||
+            !Same(meshes.triangles, old.triangles, meshes.triangleCount * 3) || !Same(meshes.nodes, old.nodes, meshes.nodeCount))
+        {
+            changes |= SCENE_GEOMETRY;
+            if (!textures.UpdateMeshes(meshes, old))
+            {
+                std::cerr << "Failed to upload mesh data, meshes are hidden\n";
+                shader.setUniform("meshCount", 0);
+                return changes;
+            }
+        }
+
+        for (int i = 0; i < meshes.count; i++)
+        {
+            if (!Same(meshes.mats + i, old.mats + i, 1))
+            {
+                shader.setUniformArray(std::format("meshMats[{}]", i * MATERIAL_VALUES), (const sf::Glsl::Vec4*)(meshes.mats + i), MATERIAL_VALUES);
+                changes |= SCENE_MATERIALS;
+            }
+            if (!Same(meshes.bounds + i, old.bounds + i, 1) || meshes.roots[i] != old.roots[i] || meshes.firstTriangles[i] != old.firstTriangles[i])
+            {
+                shader.setUniform(std::format("meshBounds[{}]", i), meshes.bounds[i]);
+                shader.setUniform(std::format("meshRoots[{}]", i), (int)meshes.roots[i]);
+                shader.setUniform(std::format("meshFirstTriangle[{}]", i), (int)meshes.firstTriangles[i]);
+                changes |= SCENE_GEOMETRY;
+            }
+        }
+        return changes;
+    }
+
+    void UploadSky(sf::Shader& shader) const
+    {
+        shader.setUniform("peakCol", Vec3(sky.peakCol).ToShader());
+        shader.setUniform("horizonCol", Vec3(sky.horizonCol).ToShader());
+        shader.setUniform("voidCol", Vec3(sky.voidCol).ToShader());
+        shader.setUniform("sunCol", Vec3(sky.sunCol).ToShader());
+        shader.setUniform("sunDir", Vec3(sky.sunDir).Normalize().ToShader());
+        shader.setUniform("sunFlare", sky.sunFlare);
+    }
+};
+
+
+struct Scene
+{
+    std::string name;
+
+    Cam cam;
+    SkySettings sky;
+    RenderSettings settings;
+
+    std::vector<std::string> materialNames;
+    std::vector<Material> materials;
+
+    ShapeList shapes[SHAPE_TYPES];
+    MeshList meshes;
+
+
+    Scene() :
+        cam(65.0f, true, 5.0f, Vec3(0.0, 5.0, -10.0), Vec3(0.0, 0.0, 1.0))
+    {}
+
+
+    // Parses a scene file, on failure returns false and describes the first problem as "file:line:column: message".
+    // Meshes that are unchanged in previous are copied from it instead of being loaded and built again.
+    bool Load(const std::string& filename, std::string& error, const SceneView* previous = nullptr);
+
+    SceneView View() const
+    {
+        SceneView view{ cam, sky, settings };
+
+        for (int t = 0; t < SHAPE_TYPES; t++)
+        {
+            const ShapeList& list = shapes[t];
+            view.shapes[t] = {
+                list.data.data(), list.mats.data(), list.bounds.data(), list.boundCoverage.data(),
+                list.Count(), (int)list.bounds.size()
+            };
+        }
+
+        view.meshes = {
+            meshes.vertices.data(), meshes.normals.data(), meshes.triangles.data(), meshes.nodes.data(),
+            meshes.mats.data(), meshes.bounds.data(), meshes.roots.data(), meshes.firstTriangles.data(), meshes.sources.data(),
+            meshes.Count(), meshes.vertices.size() / 3, meshes.normals.size() / 3, meshes.triangles.size() / 3, meshes.nodes.size(),
+            std::vector<std::string_view>(meshes.files.begin(), meshes.files.end())
+        };
+        return view;
+    }
+
+    // Generated meshes are named after their statement in angle brackets, which no file name can hold on Windows
+    static bool IsGenerated(std::string_view file)
+    {
+        return !file.empty() && file[0] == '<';
+    }
+
+    // Hash of a file's size and write time, 0 if it can't be read
+    static uint64_t FileStamp(const std::string& file)
+    {
+        std::error_code ec;
+        uint64_t size = (uint64_t)std::filesystem::file_size(file, ec);
+        if (ec)
+            return 0;
+
+        int64_t time = (int64_t)std::filesystem::last_write_time(file, ec).time_since_epoch().count();
+        if (ec)
+            return 0;
+
+        uint64_t hash = 14695981039346656037ull;
+        for (uint64_t v : { size, (uint64_t)time })
+            hash = (hash ^ v) * 1099511628211ull;
+        return hash;
+    }
+
+
+    // Spheres enclosing a single shape, points have a radius of 0
+    static void ShapeExtents(ShapeType type, const float* d, std::vector<sf::Glsl::Vec4>& out)
+    {
+        switch (type)
+        {
+        case SHAPE_AABB:
+            for (int corner = 0; corner < 8; corner++)
+                out.emplace_back(d[(corner & 1) ? 3 : 0], d[(corner & 2) ? 4 : 1], d[(corner & 4) ? 5 : 2], 0.0f);
+            break;
+        case SHAPE_OBB:
+            out.emplace_back(d[0], d[1], d[2], (float)Vec3(d[3], d[4], d[5]).Mag());
+            break;
+        case SHAPE_SPHERE:
+            out.emplace_back(d[0], d[1], d[2], d[3]);
+            break;
+        case SHAPE_TRI:
+            for (int v = 0; v < 3; v++)
+                out.emplace_back(d[v*3 + 0], d[v*3 + 1], d[v*3 + 2], 0.0f);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Closes a bounding group over shapes [first, Count()) of one type
+    void CloseGroup(ShapeType type, int first)
+    {
+        ShapeList& list = shapes[type];
+        const ShapeInfo& info = shapeInfo[type];
+
+        if (!info.bounded || first >= list.Count())
+            return;
+
+        int floats = info.vectors * info.components;
+        std::vector<sf::Glsl::Vec4> spheres;
+        for (int i = first; i < list.Count(); i++)
+            ShapeExtents(type, &list.data[i * floats], spheres);
+
+        Vec3 lo(utils::MAXVAL, utils::MAXVAL, utils::MAXVAL), hi = lo * -1.0;
+        for (const sf::Glsl::Vec4& s : spheres)
+        {
+            lo = Vec3(std::min(lo.x, (double)s.x - s.w), std::min(lo.y, (double)s.y - s.w), std::min(lo.z, (double)s.z - s.w));
+            hi = Vec3(std::max(hi.x, (double)s.x + s.w), std::max(hi.y, (double)s.y + s.w), std::max(hi.z, (double)s.z + s.w));
+        }
+
+        Vec3 center = (lo + hi) * 0.5;
+        double radius = 0.0;
+        for (const sf::Glsl::Vec4& s : spheres)
+            radius = std::max(radius, (Vec3(s.x, s.y, s.z) - center).Mag() + s.w);
+
+        list.bounds.emplace_back((float)center.x, (float)center.y, (float)center.z, (float)(radius * 1.01 + 0.01));
+        list.boundCoverage.push_back(list.Count() - first);
+    }
+};
+
+
+// Single pass, line based parser. Every statement is a keyword followed by its values on one line,
+// block headers (Cam, Sky, Settings, Material <name>) apply to the statements below them.
+struct SceneParser
+{
+    Scene& scene;
+    const SceneView* previous; // Meshes are reused from it when possible
+    std::string filename, error;
+
+    const char *cur, *end;
+    int line = 1;
+    const char* lineStart;
+
+    enum Block { BLOCK_NONE, BLOCK_CAM, BLOCK_SKY, BLOCK_SETTINGS, BLOCK_MATERIAL } block = BLOCK_NONE;
+
+    bool inGroup = false;
+    int groupStart[SHAPE_TYPES] = {};
+
+
+    SceneParser(Scene& scene, const SceneView* previous, const std::string& filename, const std::string& text) :
+        scene(scene), previous(previous), filename(filename), cur(text.data()), end(text.data() + text.size()), lineStart(text.data())
+    {}
+
+
+    bool Fail(const std::string& message, const char* at)
+    {
+        if (error.empty())
+            error = std::format("{}:{}:{}: {}", filename, line, (int)(at - lineStart) + 1, message);
+        return false;
+    }
+
+    // Next token on the current line, empty at the end of the line
+    std::string_view Token()
+    {
+        while (cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\r'))
+            cur++;
+
+        if (cur < end && *cur == '#')
+            while (cur < end && *cur != '\n')
+                cur++;
+
+        const char* start = cur;
+        while (cur < end && *cur != ' ' && *cur != '\t' && *cur != '\r' && *cur != '\n' && *cur != '#')
+            cur++;
+
+        return std::string_view(start, cur - start);
+    }
+
+    bool EndLine()
+    {
+        std::string_view extra = Token();
+        if (!extra.empty())
+            return Fail(std::format("unexpected '{}' at the end of the line", extra), extra.data());
+
+        if (cur < end)
+        { // Skip the newline
+            cur++;
+            line++;
+            lineStart = cur;
+        }
+        return true;
+    }
+
+    bool Number(float& value, std::string_view what)
+    {
+        std::string_view tok = Token();
+        if (tok.empty())
+            return Fail(std::format("expected a number for '{}'", what), cur);
+
+        // Refractive indices can be named
+        static const std::pair<std::string_view, double> constants[] = {
+            { "riVacuum", riVacuum }, { "riAir", riAir }, { "riWater", riWater }, { "riGlass", riGlass }, { "riDiamond", riDiamond }
+        };
+        for (const auto& [name, v] : constants)
+            if (tok == name)
+            {
+                value = (float)v;
+                return true;
+            }
+
+        const char* first = tok.data();
+        if (*first == '+')
+            first++;
+
+        auto [ptr, ec] = std::from_chars(first, tok.data() + tok.size(), value);
+        if (ec != std::errc() || ptr != tok.data() + tok.size())
+            return Fail(std::format("expected a number for '{}' but found '{}'", what, tok), tok.data());
+        return true;
+    }
+
+    bool Numbers(float* values, int count, std::string_view what)
+    {
+        for (int i = 0; i < count; i++)
+            if (!Number(values[i], what))
+                return false;
+        return true;
+    }
+
+    bool Vector(Vec3& v, std::string_view what)
+    {
+        float f[3];
+        if (!Numbers(f, 3, what))
+            return false;
+        v = Vec3(f[0], f[1], f[2]);
+        return true;
+    }
+
+    bool Vector(sf::Glsl::Vec4& v, std::string_view what)
+    {
+        float f[4];
+        if (!Numbers(f, 4, what))
+            return false;
+        v = sf::Glsl::Vec4(f[0], f[1], f[2], f[3]);
+        return true;
+    }
+
+    // Digits only, parsed exactly so large counts and seeds don't round to the same float, from lo to hi
+    bool Unsigned(unsigned int& value, std::string_view what, unsigned int lo = 0, unsigned int hi = UINT32_MAX)
+    {
+        std::string_view tok = Token();
+        if (tok.empty())
+            return Fail(std::format("expected a whole number for '{}'", what), cur);
+
+        const char* first = tok.data();
+        if (*first == '+')
+            first++;
+
+        uint32_t v;
+        auto [ptr, ec] = std::from_chars(first, tok.data() + tok.size(), v);
+        if (ec == std::errc::result_out_of_range)
+            return Fail(std::format("'{}' can be at most {} but is {}", what, UINT32_MAX, tok), tok.data());
+        if (ec != std::errc() || ptr != tok.data() + tok.size())
+            return Fail(std::format("expected a whole number for '{}' but found '{}'", what, tok), tok.data());
+        if (v < lo || v > hi)
+            return Fail(std::format("'{}' has to be from {} to {} but is {}", what, lo, hi, tok), tok.data());
+
+        value = v;
+        return true;
+    }
+
+    bool Bool(bool& value, std::string_view what)
+    {
+        std::string_view tok = Token();
+        if (tok == "1" || tok == "true" || tok == "on")
+            value = true;
+        else if (tok == "0" || tok == "false" || tok == "off")
+            value = false;
+        else
+            return Fail(std::format("expected true or false for '{}' but found '{}'", what, tok), tok.empty() ? cur : tok.data());
+        return true;
+    }
+
+
+    bool CamProperty(std::string_view key)
+    {
+        Cam& cam = scene.cam;
+
+        if (key == "fov")
+            return Number(cam.fov, key);
+        if (key == "speed")
+            return Number(cam.speed, key);
+        if (key == "perspective")
+            return Bool(cam.perspective, key);
+        if (key == "origin")
+            return Vector(cam.origin, key);
+        if (key == "fwd")
+        {
+            if (!Vector(cam.fwd, key))
+                return false;
+            if (cam.fwd.MagSqr() < utils::MINVAL)
+                return Fail("'fwd' can't be zero", cur);
+            cam.UpdateRotation();
+            return true;
+        }
+        return Fail(std::format("unknown camera property '{}'", key), key.data());
+    }
+
+    bool SkyProperty(std::string_view key)
+    {
+        SkySettings& sky = scene.sky;
+
+        if (key == "peak")
+            return Vector(sky.peakCol, key);
+        if (key == "horizon")
+            return Vector(sky.horizonCol, key);
+        if (key == "void")
+            return Vector(sky.voidCol, key);
+        if (key == "sun")
+            return Vector(sky.sunCol, key);
+        if (key == "sunDir")
+            return Vector(sky.sunDir, key);
+        if (key == "sunFlare")
+            return Number(sky.sunFlare, key);
+        return Fail(std::format("unknown sky property '{}'", key), key.data());
+    }
+
+    bool SettingsProperty(std::string_view key)
+    {
+        RenderSettings& s = scene.settings;
+
+        if (key == "width")
+            return Unsigned(s.width, key, 1, RENDER_SIDE_MAX);
+        if (key == "height")
+            return Unsigned(s.height, key, 1, RENDER_SIDE_MAX);
+        if (key == "samples")
+            return Unsigned(s.samples, key, 1, PASS_SAMPLES_MAX);
+        if (key == "maxBounces")
+            return Unsigned(s.maxBounces, key);
+        if (key == "cumulativeLighting")
+            return Bool(s.cumulativeLighting, key);
+        if (key == "realRender")
+            return Bool(s.realRender, key);
+        if (key == "randomizeSampleDir")
+            return Bool(s.randomizeSampleDir, key);
+        if (key == "disableLighting")
+            return Bool(s.disableLighting, key);
+        if (key == "viewBounds")
+            return Bool(s.viewBounds, key);
+        if (key == "dynamicResolution")
+            return Bool(s.dynamicResolution, key);
+        if (key == "temporalReprojection")
+            return Bool(s.temporalReprojection, key);
+        if (key == "denoise")
+            return Bool(s.denoise, key);
+        return Fail(std::format("unknown setting '{}'", key), key.data());
+    }
+
+    bool MaterialProperty(std::string_view key)
+    {
+        Material& m = scene.materials.back();
+
+        if (key == "surface")
+            return Vector(m.surface, key);
+        if (key == "albedo")
+            return Vector(m.albedo, key);
+        if (key == "specular")
+            return Vector(m.specular, key);
+        if (key == "emission")
+            return Vector(m.emission, key);
+        if (key == "absorption")
+            return Vector(m.absorption, key);
+        return Fail(std::format("unknown material property '{}', expected surface, albedo, specular, emission or absorption", key), key.data());
+    }
+
+
+    bool MaterialName(const Material*& mat, std::string_view what)
+    {
+        std::string_view matName = Token();
+        if (matName.empty())
+            return Fail(std::format("expected a material name after the {} values", what), cur);
+
+        auto it = std::find(scene.materialNames.begin(), scene.materialNames.end(), matName);
+        if (it == scene.materialNames.end())
+            return Fail(std::format("unknown material '{}', materials must be defined before use", matName), matName.data());
+
+        mat = &scene.materials[it - scene.materialNames.begin()];
+        return true;
+    }
+
+    bool CheckMeshTriangles(size_t count, const char* at)
+    {
+        if (scene.meshes.triangles.size() / 3 + count > (size_t)MESH_TRIANGLES_MAX)
+            return Fail(std::format("too many mesh triangles, the shader supports {}", MESH_TRIANGLES_MAX), at);
+        return true;
+    }
+
+    // Adds the same mesh from the previous load if it has one, so its BVH isn't built again
+    bool ReuseMesh(const std::string& path, const MeshSource& source, const Material& mat, const char* at, bool& reused)
+    {
+        reused = false;
+
+        const MeshView* old = previous ? &previous->meshes : nullptr;
+        for (int m = 0; old && m < old->count && source.stamp != 0; m++)
+        {
+            const MeshSource& s = old->sources[m];
+            if (old->files[m] != path || s.stamp != source.stamp || s.scale != source.scale || std::memcmp(s.offset, source.offset, sizeof(s.offset)) != 0)
+                continue;
+
+            if (!CheckMeshTriangles(old->TriangleEnd(m) - old->firstTriangles[m], at))
+                return false;
+
+            std::string nodeError;
+            if (!MeshList::FitsNodes(scene.meshes.nodes.size() + (old->NodeEnd(m) - old->roots[m]), nodeError))
+                return Fail(nodeError, at);
+
+            scene.meshes.AddFrom(*old, m, mat);
+            reused = true;
+            break;
+        }
+        return true;
+    }
+
+    // Mesh <file> <offset x3> <scale> <material>, the file is relative to the scene file
+    bool MeshStatement()
+    {
+        MeshList& meshes = scene.meshes;
+
+        std::string_view file = Token();
+        if (file.empty())
+            return Fail("expected a mesh file", cur);
+        if (meshes.Count() >= MESH_MAX)
+            return Fail(std::format("too many meshes, the shader supports {}", MESH_MAX), file.data());
+
+        float values[4];
+        if (!Numbers(values, 4, "Mesh"))
+            return false;
+        if (values[3] == 0.0f)
+            return Fail("mesh scale can't be zero", cur);
+
+        const Material* mat;
+        if (!MaterialName(mat, "Mesh"))
+            return false;
+
+        std::string path = (std::filesystem::path(filename).parent_path() / std::filesystem::path(file)).string();
+        MeshSource source = { Scene::FileStamp(path), { values[0], values[1], values[2] }, values[3], 0, 0 };
+
+        bool reused;
+        if (!ReuseMesh(path, source, *mat, file.data(), reused))
+            return false;
+        if (reused)
+            return true;
+
+        std::string meshError;
+        Mesh mesh;
+        if (!mesh.Load(path, meshError))
+            return Fail(meshError, file.data());
+
+        if (!CheckMeshTriangles(mesh.TriangleCount(), file.data()))
+            return false;
+
+        for (size_t i = 0; i < mesh.positions.size(); i++)
+            mesh.positions[i] = mesh.positions[i] * values[3] + values[i % 3];
+
+        if (!meshes.Add(mesh, *mat, path, source, meshError))
+            return Fail(meshError, file.data());
+        return true;
+    }
+
+    bool Shape(ShapeType type)
+    {
+        const ShapeInfo& info = shapeInfo[type];
+        ShapeList& list = scene.shapes[type];
+        const char* at = cur;
+
+        if (list.Count() >= info.maxCount)
+            return Fail(std::format("too many {} shapes, the shader supports {}", info.keyword, info.maxCount), at);
+
+        float values[5 * 4];
+        if (!Numbers(values, info.vectors * info.components, info.keyword))
+            return false;
+
+        if (type == SHAPE_OBB)
+        { // Axes must be unit length
+            for (int a = 2; a < 5; a++)
+            {
+                Vec3 axis = Vec3(values[a*3 + 0], values[a*3 + 1], values[a*3 + 2]).Normalize();
+                values[a*3 + 0] = (float)axis.x;
+                values[a*3 + 1] = (float)axis.y;
+                values[a*3 + 2] = (float)axis.z;
+            }
+        }
+        else if (type == SHAPE_PLANE)
+        {
+            Vec3 normal = Vec3(values[3], values[4], values[5]).Normalize();
+            values[3] = (float)normal.x;
+            values[4] = (float)normal.y;
+            values[5] = (float)normal.z;
+        }
+
+        const Material* mat;
+        if (!MaterialName(mat, info.keyword))
+            return false;
+
+        list.data.insert(list.data.end(), values, values + info.vectors * info.components);
+        list.mats.push_back(*mat);
+
+        if (!inGroup)
+            scene.CloseGroup(type, list.Count() - 1);
+        return true;
+    }
+
+    // Generate <kind> <values> <material>, scenes too big to write by hand, made from a seed by SceneGenerator
+    bool GenerateStatement()
+    {
+        struct Kind
+        {
+            std::string_view name;
+            int counts, values; // Whole numbers first, the seed last of them
+        };
+        static const Kind kinds[] = {
+            { "Spheres", 2, 8 }, // count, seed, min x3, max x3, min radius, max radius
+            { "Surface", 2, 5 }, // triangles, seed, center x3, size, height
+            { "Boxes",   3, 5 }, // columns, rows, seed, center x3, spacing, size
+            { "Lights",  2, 7 }  // count, seed, min x3, max x3, radius
+        };
+
+        std::string_view name = Token();
+        const char* at = name.data();
+        auto kind = std::find_if(std::begin(kinds), std::end(kinds), [&](const Kind& k) { return k.name == name; });
+        if (name.empty() || kind == std::end(kinds))
+            return Fail(std::format("expected Spheres, Surface, Boxes or Lights after 'Generate' but found '{}'", name), name.empty() ? cur : at);
+
+        const std::string what = std::format("Generate {}", name);
+        unsigned int counts[3];
+        float v[8];
+        for (int i = 0; i < kind->counts; i++)
+            if (!Unsigned(counts[i], what))
+                return false;
+        if (!Numbers(v, kind->values, what))
+            return false;
+
+        for (int i = 0; i < kind->counts - 1; i++)
+            if (counts[i] == 0)
+                return Fail(std::format("'{}' can't generate nothing", what), at);
+
+        const Material* mat;
+        if (!MaterialName(mat, what))
+            return false;
+
+        SceneGenerator generator(counts[kind->counts - 1]);
+
+        if (name == "Spheres" || name == "Surface")
+        {
+            if (scene.meshes.Count() >= MESH_MAX)
+                return Fail(std::format("too many meshes, the shader supports {}", MESH_MAX), at);
+
+            const unsigned int cells = SceneGenerator::SurfaceCells(counts[0]);
+            if (!CheckMeshTriangles(name == "Spheres" ? counts[0] * SceneGenerator::SphereTriangles() : (size_t)cells * cells * 2, at))
+                return false;
+
+            // Same statement, same mesh
+            uint64_t stamp = 14695981039346656037ull;
+            for (const uint8_t* b = (const uint8_t*)counts; b < (const uint8_t*)(counts + kind->counts); b++)
+                stamp = (stamp ^ *b) * 1099511628211ull;
+            for (const uint8_t* b = (const uint8_t*)v; b < (const uint8_t*)(v + kind->values); b++)
+                stamp = (stamp ^ *b) * 1099511628211ull;
+
+            const std::string path = std::format("<{}>", what);
+            MeshSource source = { stamp, { 0.0f, 0.0f, 0.0f }, 1.0f, 0, 0 };
+
+            bool reused;
+            if (!ReuseMesh(path, source, *mat, at, reused))
+                return false;
+            if (reused)
+                return true;
+
+            Mesh mesh;
+            if (name == "Spheres")
+                generator.Spheres(counts[0], Vec3(v[0], v[1], v[2]), Vec3(v[3], v[4], v[5]), v[6], v[7], mesh);
+            else
+                generator.Surface(counts[0], Vec3(v[0], v[1], v[2]), v[3], v[4], mesh);
+
+            std::string meshError;
+            if (!scene.meshes.Add(mesh, *mat, path, source, meshError))
+                return Fail(meshError, at);
+            return true;
+        }
+
+        // Analytic shapes, ungrouped ones get a bounding sphere each
+        const ShapeType type = name == "Boxes" ? SHAPE_OBB : SHAPE_SPHERE;
+        const ShapeInfo& info = shapeInfo[type];
+        ShapeList& list = scene.shapes[type];
+
+        const size_t count = name == "Boxes" ? (size_t)counts[0] * counts[1] : counts[0];
+        if (list.Count() + count > (size_t)info.maxCount)
+            return Fail(std::format("too many {} shapes, the shader supports {}", info.keyword, info.maxCount), at);
+
+        std::vector<float> values;
+        if (name == "Boxes")
+            generator.Boxes(counts[0], counts[1], Vec3(v[0], v[1], v[2]), v[3], v[4], values);
+        else
+            generator.Lights(counts[0], Vec3(v[0], v[1], v[2]), Vec3(v[3], v[4], v[5]), v[6], values);
+
+        const int floats = info.vectors * info.components;
+        for (size_t i = 0; i < count; i++)
+        {
+            list.data.insert(list.data.end(), values.begin() + i * floats, values.begin() + (i + 1) * floats);
+            list.mats.push_back(*mat);
+
+            if (!inGroup)
+                scene.CloseGroup(type, list.Count() - 1);
+        }
+        return true;
+    }
+
+    bool Statement(std::string_view key)
+    {
+        if (key == "Cam")
+            block = BLOCK_CAM;
+        else if (key == "Sky")
+            block = BLOCK_SKY;
+        else if (key == "Settings")
+            block = BLOCK_SETTINGS;
+        else if (key == "Material")
+        {
+            std::string_view name = Token();
+            if (name.empty())
+                return Fail("expected a material name", cur);
+            if (std::find(scene.materialNames.begin(), scene.materialNames.end(), name) != scene.materialNames.end())
+                return Fail(std::format("material '{}' is already defined", name), name.data());
+
+            scene.materialNames.emplace_back(name);
+            scene.materials.push_back({ {0, 0, 1, 0}, {1, 1, 1, 1}, {0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0} });
+            block = BLOCK_MATERIAL;
+        }
+        else if (key == "Mesh")
+        {
+            block = BLOCK_NONE;
+            return MeshStatement();
+        }
+        else if (key == "Generate")
+        {
+            block = BLOCK_NONE;
+            return GenerateStatement();
+        }
+        else if (key == "Group")
+        { // Shapes until End share bounding spheres, one per shape type
+            if (inGroup)
+                return Fail("groups can't be nested", key.data());
+            inGroup = true;
+            for (int t = 0; t < SHAPE_TYPES; t++)
+                groupStart[t] = scene.shapes[t].Count();
+            block = BLOCK_NONE;
+        }
+        else if (key == "End")
+        {
+            if (!inGroup)
+                return Fail("'End' without a matching 'Group'", key.data());
+            inGroup = false;
+            for (int t = 0; t < SHAPE_TYPES; t++)
+                scene.CloseGroup((ShapeType)t, groupStart[t]);
+        }
+        else
+        {
+            for (int t = 0; t < SHAPE_TYPES; t++)
+                if (key == shapeInfo[t].keyword)
+                {
+                    block = BLOCK_NONE;
+                    return Shape((ShapeType)t);
+                }
+
+            switch (block)
+            {
+            case BLOCK_CAM:      return CamProperty(key);
+            case BLOCK_SKY:      return SkyProperty(key);
+            case BLOCK_SETTINGS: return SettingsProperty(key);
+            case BLOCK_MATERIAL: return MaterialProperty(key);
+            default:
+                return Fail(std::format("unknown statement '{}'", key), key.data());
+            }
+        }
+        return true;
+    }
+
+    bool Parse()
+    {
+        while (cur < end)
+        {
+            std::string_view key = Token();
+            if (!key.empty() && !Statement(key))
+                return false;
+            if (!EndLine())
+                return false;
+        }
+
+        if (inGroup)
+            return Fail("missing 'End' for the last 'Group'", cur);
+        return true;
+    }
+};
+
+
+inline bool Scene::Load(const std::string& filename, std::string& error, const SceneView* previous)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+    {
+        error = filename + ": can't open file";
+        return false;
+    }
+
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string text = buffer.str();
+
+    *this = Scene();
+    name = filename;
+
+    SceneParser parser(*this, previous, filename, text);
+    if (!parser.Parse())
+    {
+        error = parser.error;
+        return false;
+    }
+    return true;
+}
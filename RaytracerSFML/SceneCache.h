@@ -0,0 +1,401 @@
+#pragma once
+
+#include "Scene.h"
+#include "MappedFile.h"
+#include "Memory.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <type_traits>
+
+
+// Binary scene cache, "<scene file>.scenecache". Holds the scene in the exact layout uploaded to the shader
+// so loading it is a mapping with no parsing or copying. Bump the version whenever the layout changes.
+constexpr uint32_t
+    SCENECACHE_MAGIC = 0x43535452, // "RTSC"
+    SCENECACHE_VERSION = 3,
+    SCENECACHE_ALIGN = 16;
+
+struct SceneCacheHeader
+{
+    uint32_t magic, version, headerSize, reserved;
+
+    // Identifies the source file the cache was built from
+    uint64_t sourceSize;
+    int64_t sourceTime;
+
+    // Vec3 isn't trivially copyable so the camera and sky are stored as plain values
+    double camOrigin[3], camFwd[3];
+    float camFov, camSpeed;
+    uint32_t camPerspective;
+    float sunFlare;
+    double sky[5][3]; // peak, horizon, void, sun, sunDir
+
+    RenderSettings settings;
+
+    struct Shapes
+    {
+        uint64_t dataOffset, matsOffset, boundsOffset, coverageOffset;
+        uint32_t count, boundCount;
+    } shapes[SHAPE_TYPES];
+
+    struct Meshes
+    {
+        uint64_t verticesOffset, normalsOffset, trianglesOffset, nodesOffset;
+        uint64_t matsOffset, boundsOffset, rootsOffset, firstTrianglesOffset, sourcesOffset;
+        uint64_t vertexCount, normalCount, triangleCount, nodeCount;
+        uint32_t count, filesBytes;
+
+        // Mesh files as consecutive null terminated paths, their stamps are in the sources
+        uint64_t filesOffset;
+    } meshes;
+};
+
+static_assert(std::is_trivially_copyable_v<SceneCacheHeader>);
+static_assert(std::is_trivially_copyable_v<Material>);
+static_assert(std::is_trivially_copyable_v<MeshSource>);
+
+
+struct CachedScene
+{
+    SceneView view;
+
+
+    CachedScene() :
+        view{ Scene().cam }
+    {}
+
+
+    static std::string CacheFilename(const std::string& sceneFile)
+    {
+        return sceneFile + ".scenecache";
+    }
+
+    // Maps the scene's cache, rebuilding it first if it's missing or older than the scene file.
+    // When rebuilding, unchanged meshes are taken from previous, which must stay alive until this returns.
+    bool Load(const std::string& sceneFile, std::string& error, const SceneView* previous = nullptr)
+    {
+        filename = sceneFile;
+
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        if (!SourceStamp(sceneFile, sourceSize, sourceTime))
+        {
+            error = sceneFile + ": can't open file";
+            return false;
+        }
+
+        const std::string cacheFile = CacheFilename(sceneFile);
+        if (Map(cacheFile, sourceSize, sourceTime))
+            return true;
+
+        Scene parsed;
+        if (!parsed.Load(sceneFile, error, previous))
+            return false;
+
+        if (Write(parsed, cacheFile, sourceSize, sourceTime) && Map(cacheFile, sourceSize, sourceTime))
+            return true;
+
+        // The cache couldn't be written, render straight from the parsed scene
+        owned = std::make_unique<Scene>(std::move(parsed));
+        view = owned->View();
+        Charge();
+        return true;
+    }
+
+
+    static bool SourceStamp(const std::string& sceneFile, uint64_t& size, int64_t& time)
+    {
+        std::error_code ec;
+        size = (uint64_t)std::filesystem::file_size(sceneFile, ec);
+        if (ec)
+            return false;
+
+        time = (int64_t)std::filesystem::last_write_time(sceneFile, ec).time_since_epoch().count();
+        return !ec;
+    }
+
+    // Current stamp of the scene file and every mesh it uses, cheap enough to poll for changes every frame
+    uint64_t Stamp() const
+    {
+        uint64_t hash = Scene::FileStamp(filename);
+        for (std::string_view f : view.meshes.files)
+            hash = (hash ^ Scene::FileStamp(std::string(f))) * 1099511628211ull;
+        return hash;
+    }
+
+    static bool Write(const Scene& scene, const std::string& cacheFile, uint64_t sourceSize, int64_t sourceTime)
+    {
+        SceneCacheHeader header;
+        std::memset((void*)&header, 0, sizeof(header)); // Padding included, so caches are reproducible
+
+        header.magic = SCENECACHE_MAGIC;
+        header.version = SCENECACHE_VERSION;
+        header.headerSize = sizeof(SceneCacheHeader);
+        header.sourceSize = sourceSize;
+        header.sourceTime = sourceTime;
+
+        Cam cam = scene.cam;
+        for (int i = 0; i < 3; i++)
+        {
+            header.camOrigin[i] = cam.origin[i];
+            header.camFwd[i] = cam.fwd[i];
+        }
+        header.camFov = cam.fov;
+        header.camSpeed = cam.speed;
+        header.camPerspective = cam.perspective ? 1 : 0;
+
+        Vec3 sky[5] = { scene.sky.peakCol, scene.sky.horizonCol, scene.sky.voidCol, scene.sky.sunCol, scene.sky.sunDir };
+        for (int i = 0; i < 5; i++)
+            for (int c = 0; c < 3; c++)
+                header.sky[i][c] = sky[i][c];
+        header.sunFlare = scene.sky.sunFlare;
+
+        header.settings = scene.settings;
+
+        // Lay out every array after the header
+        std::vector<std::pair<const void*, uint64_t>> blocks;
+        uint64_t offset = Align(sizeof(SceneCacheHeader));
+
+        auto Place = [&](const void* ptr, uint64_t bytes) {
+            uint64_t at = offset;
+            blocks.emplace_back(ptr, bytes);
+            offset = Align(offset + bytes);
+            return at;
+        };
+
+        for (int t = 0; t < SHAPE_TYPES; t++)
+        {
+            const ShapeList& list = scene.shapes[t];
+            SceneCacheHeader::Shapes& s = header.shapes[t];
+
+            s.count = (uint32_t)list.Count();
+            s.boundCount = (uint32_t)list.bounds.size();
+            s.dataOffset = Place(list.data.data(), list.data.size() * sizeof(float));
+            s.matsOffset = Place(list.mats.data(), list.mats.size() * sizeof(Material));
+            s.boundsOffset = Place(list.bounds.data(), list.bounds.size() * sizeof(sf::Glsl::Vec4));
+            s.coverageOffset = Place(list.boundCoverage.data(), list.boundCoverage.size() * sizeof(int32_t));
+        }
+
+        const MeshList& meshes = scene.meshes;
+        SceneCacheHeader::Meshes& m = header.meshes;
+
+        std::string files;
+        for (const std::string& f : meshes.files)
+            files.append(f.c_str(), f.size() + 1);
+
+        m.count = (uint32_t)meshes.Count();
+        m.vertexCount = meshes.vertices.size() / 3;
+        m.normalCount = meshes.normals.size() / 3;
+        m.triangleCount = meshes.triangles.size() / 3;
+        m.nodeCount = meshes.nodes.size();
+        m.filesBytes = (uint32_t)files.size();
+        m.verticesOffset = Place(meshes.vertices.data(), meshes.vertices.size() * sizeof(float));
+        m.normalsOffset = Place(meshes.normals.data(), meshes.normals.size() * sizeof(float));
+        m.trianglesOffset = Place(meshes.triangles.data(), meshes.triangles.size() * sizeof(uint32_t));
+        m.nodesOffset = Place(meshes.nodes.data(), meshes.nodes.size() * sizeof(BVHNode));
+        m.matsOffset = Place(meshes.mats.data(), meshes.mats.size() * sizeof(Material));
+        m.boundsOffset = Place(meshes.bounds.data(), meshes.bounds.size() * sizeof(sf::Glsl::Vec4));
+        m.rootsOffset = Place(meshes.roots.data(), meshes.roots.size() * sizeof(int32_t));
+        m.firstTrianglesOffset = Place(meshes.firstTriangles.data(), meshes.firstTriangles.size() * sizeof(int32_t));
+        m.sourcesOffset = Place(meshes.sources.data(), meshes.sources.size() * sizeof(MeshSource));
+        m.filesOffset = Place(files.data(), files.size());
+
+        // Written next to the cache and renamed over it so a half written cache is never mapped
+        const std::string tempFile = cacheFile + ".tmp";
+
+        FILE* file;
+        if (fopen_s(&file, tempFile.c_str(), "wb") != 0)
+            return false;
+
+        static const uint8_t padding[SCENECACHE_ALIGN] = {};
+        uint64_t written = sizeof(header);
+        bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+
+        for (const auto& [ptr, bytes] : blocks)
+        {
+            uint64_t pad = Align(written) - written;
+            success &= fwrite(padding, 1, (size_t)pad, file) == pad;
+            if (bytes > 0)
+                success &= fwrite(ptr, 1, (size_t)bytes, file) == bytes;
+            written += pad + bytes;
+        }
+
+        success &= fclose(file) == 0;
+
+        std::error_code ec;
+        if (success)
+            std::filesystem::rename(tempFile, cacheFile, ec);
+        if (!success || ec)
+        {
+            std::filesystem::remove(tempFile, ec);
+            return false;
+        }
+        return true;
+    }
+
+
+private:
+    std::string filename;
+    MappedFile file;
+    std::unique_ptr<Scene> owned; // Only used when the cache can't be written
+
+    MemoryCharge geometryMemory{ MEMORY_GEOMETRY }, bvhMemory{ MEMORY_BVH }, materialMemory{ MEMORY_MATERIALS };
+
+
+    static uint64_t Align(uint64_t offset)
+    {
+        return (offset + SCENECACHE_ALIGN - 1) & ~(uint64_t)(SCENECACHE_ALIGN - 1);
+    }
+
+    bool InRange(uint64_t offset, uint64_t bytes) const
+    {
+        return offset <= file.size && bytes <= file.size - offset && offset % SCENECACHE_ALIGN == 0;
+    }
+
+    // Points the view straight into the mapping, fails on stale or damaged caches
+    bool Map(const std::string& cacheFile, uint64_t sourceSize, int64_t sourceTime)
+    {
+        if (!file.Open(cacheFile))
+            return false;
+
+        const SceneCacheHeader* header = (const SceneCacheHeader*)file.data;
+
+        bool valid =
+            file.size >= sizeof(SceneCacheHeader) &&
+            header->magic == SCENECACHE_MAGIC &&
+            header->version == SCENECACHE_VERSION &&
+            header->headerSize == sizeof(SceneCacheHeader) &&
+            header->sourceSize == sourceSize &&
+            header->sourceTime == sourceTime;
+
+        for (int t = 0; valid && t < SHAPE_TYPES; t++)
+        {
+            const SceneCacheHeader::Shapes& s = header->shapes[t];
+            const ShapeInfo& info = shapeInfo[t];
+
+            valid =
+                s.count <= (uint32_t)info.maxCount &&
+                s.boundCount <= s.count &&
+                InRange(s.dataOffset, (uint64_t)s.count * info.vectors * info.components * sizeof(float)) &&
+                InRange(s.matsOffset, (uint64_t)s.count * sizeof(Material)) &&
+                InRange(s.boundsOffset, (uint64_t)s.boundCount * sizeof(sf::Glsl::Vec4)) &&
+                InRange(s.coverageOffset, (uint64_t)s.boundCount * sizeof(int32_t));
+        }
+
+        const SceneCacheHeader::Meshes& m = header->meshes;
+        valid = valid &&
+            m.count <= (uint32_t)MESH_MAX &&
+            m.triangleCount <= (uint64_t)MESH_TRIANGLES_MAX && m.nodeCount < BVH_INDEX_LIMIT &&
+            m.vertexCount <= file.size && m.nodeCount <= file.size &&
+            (m.normalCount == 0 || m.normalCount == m.vertexCount) &&
+            InRange(m.verticesOffset, m.vertexCount * 3 * sizeof(float)) &&
+            InRange(m.normalsOffset, m.normalCount * 3 * sizeof(float)) &&
+            InRange(m.trianglesOffset, m.triangleCount * 3 * sizeof(uint32_t)) &&
+            InRange(m.nodesOffset, m.nodeCount * sizeof(BVHNode)) &&
+            InRange(m.matsOffset, (uint64_t)m.count * sizeof(Material)) &&
+            InRange(m.boundsOffset, (uint64_t)m.count * sizeof(sf::Glsl::Vec4)) &&
+            InRange(m.rootsOffset, (uint64_t)m.count * sizeof(int32_t)) &&
+            InRange(m.firstTrianglesOffset, (uint64_t)m.count * sizeof(int32_t)) &&
+            InRange(m.sourcesOffset, (uint64_t)m.count * sizeof(MeshSource)) &&
+            InRange(m.filesOffset, m.filesBytes);
+
+        // Meshes can change without the scene file changing, generated ones are made from it
+        std::vector<std::string_view> files;
+        if (valid && m.count > 0)
+        {
+            const MeshSource* sources = (const MeshSource*)(file.data + m.sourcesOffset);
+            const int32_t* roots = (const int32_t*)(file.data + m.rootsOffset);
+            const int32_t* firstTriangles = (const int32_t*)(file.data + m.firstTrianglesOffset);
+            const char* names = (const char*)(file.data + m.filesOffset);
+            for (uint32_t at = 0; at < m.filesBytes; at += (uint32_t)files.back().size() + 1)
+                files.emplace_back(names + at, strnlen(names + at, m.filesBytes - at));
+
+            // Reloads copy meshes out of the mapping by these ranges, so they have to be ordered and in bounds
+            valid = files.size() == m.count;
+            for (uint32_t i = 0; valid && i < m.count; i++)
+                valid =
+                    sources[i].firstVertex <= m.vertexCount && (uint64_t)roots[i] < m.nodeCount && (uint64_t)firstTriangles[i] <= m.triangleCount &&
+                    (i == 0 || (sources[i].firstVertex >= sources[i - 1].firstVertex && roots[i] > roots[i - 1] && firstTriangles[i] >= firstTriangles[i - 1])) &&
+                    sources[i].stamp != 0 && (Scene::IsGenerated(files[i]) || Scene::FileStamp(std::string(files[i])) == sources[i].stamp);
+        }
+
+        if (!valid)
+        {
+            file.Close();
+            return false;
+        }
+
+        view.cam = Cam(
+            header->camFov, header->camPerspective != 0, header->camSpeed,
+            Vec3(header->camOrigin[0], header->camOrigin[1], header->camOrigin[2]),
+            Vec3(header->camFwd[0], header->camFwd[1], header->camFwd[2])
+        );
+
+        Vec3* sky[5] = { &view.sky.peakCol, &view.sky.horizonCol, &view.sky.voidCol, &view.sky.sunCol, &view.sky.sunDir };
+        for (int i = 0; i < 5; i++)
+            *sky[i] = Vec3(header->sky[i][0], header->sky[i][1], header->sky[i][2]);
+        view.sky.sunFlare = header->sunFlare;
+
+        view.settings = header->settings;
+
+        for (int t = 0; t < SHAPE_TYPES; t++)
+        {
+            const SceneCacheHeader::Shapes& s = header->shapes[t];
+            view.shapes[t] = {
+                (const float*)(file.data + s.dataOffset),
+                (const Material*)(file.data + s.matsOffset),
+                (const sf::Glsl::Vec4*)(file.data + s.boundsOffset),
+                (const int32_t*)(file.data + s.coverageOffset),
+                (int)s.count, (int)s.boundCount
+            };
+        }
+
+        view.meshes = {
+            (const float*)(file.data + m.verticesOffset),
+            (const float*)(file.data + m.normalsOffset),
+            (const uint32_t*)(file.data + m.trianglesOffset),
+            (const BVHNode*)(file.data + m.nodesOffset),
+            (const Material*)(file.data + m.matsOffset),
+            (const sf::Glsl::Vec4*)(file.data + m.boundsOffset),
+            (const int32_t*)(file.data + m.rootsOffset),
+            (const int32_t*)(file.data + m.firstTrianglesOffset),
+            (const MeshSource*)(file.data + m.sourcesOffset),
+            (int)m.count, (size_t)m.vertexCount, (size_t)m.normalCount, (size_t)m.triangleCount, (size_t)m.nodeCount,
+            std::move(files)
+        };
+
+        owned.reset();
+        Charge();
+        return true;
+    }
+
+    // The view's buffers, whether they're owned or mapped from the cache
+    void Charge()
+    {
+        size_t geometry = 0, bvh = 0, materials = 0;
+        for (int t = 0; t < SHAPE_TYPES; t++)
+        {
+            const ShapeView& s = view.shapes[t];
+            geometry += (size_t)s.count * shapeInfo[t].vectors * shapeInfo[t].components * sizeof(float);
+            materials += (size_t)s.count * sizeof(Material);
+            bvh += (size_t)s.boundCount * (sizeof(sf::Glsl::Vec4) + sizeof(int32_t));
+        }
+
+        const MeshView& m = view.meshes;
+        geometry += (m.vertexCount + m.normalCount) * 3 * sizeof(float) + m.triangleCount * 3 * sizeof(uint32_t) +
+            (size_t)m.count * (2 * sizeof(int32_t) + sizeof(MeshSource));
+        materials += (size_t)m.count * sizeof(Material);
+        bvh += m.nodeCount * sizeof(BVHNode) + (size_t)m.count * sizeof(sf::Glsl::Vec4);
+
+        geometryMemory.Set(geometry);
+        bvhMemory.Set(bvh);
+        materialMemory.Set(materials);
+    }
+};
@@ -0,0 +1,253 @@
+#pragma once
+
+#include "Vec3.h"
+#include "MeshLoader.h"
+
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+
+// Builds parametric scenes far bigger than anyone writes by hand, for the Generate statements of scene files.
+// Everything comes from a seed through mt19937, whose output the standard fixes, and floats are made from its bits
+// rather than with the library's distributions. Past that only arithmetic and square roots are used, which IEEE 754
+// rounds exactly, and no sin or cos, which differ between C runtimes. So a scene generates the same everywhere floats
+// are computed as written, as with MSVC's default /fp:precise. Builds that fuse multiply-adds can differ in the last
+// bits, which changes SceneView::Hash and keeps render nodes of such a build from taking each other's jobs.
+// Spheres and surfaces are meshes, so their counts are only limited by the mesh triangle limit. Boxes and lights are
+// the shader's own shapes and limited to its counts of them.
+struct SceneGenerator
+{
+    static constexpr int SPHERE_SUBDIVISIONS = 1; // Of an icosahedron, 80 triangles per sphere
+
+    std::mt19937 rng;
+
+
+    explicit SceneGenerator(uint32_t seed) :
+        rng(seed)
+    {}
+
+    static size_t SphereTriangles()
+    {
+        return (size_t)20 << (2 * SPHERE_SUBDIVISIONS);
+    }
+
+    // Cells along each side of a surface of about triangles triangles, two to a cell
+    static unsigned int SurfaceCells(size_t triangles)
+    {
+        return std::max(1u, (unsigned int)std::ceil(std::sqrt(triangles / 2.0)));
+    }
+
+    // 0 to 1 from the top 24 bits
+    float Random()
+    {
+        return (float)(rng() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    float Random(float lo, float hi)
+    {
+        return lo + (hi - lo) * Random();
+    }
+
+    // Uniform over the sphere, from points in the ball scaled out to it
+    Vec3 RandomAxis()
+    {
+        while (true)
+        {
+            Vec3 p(Random(-1.0f, 1.0f), Random(-1.0f, 1.0f), Random(-1.0f, 1.0f));
+            const double magSqr = p.MagSqr();
+            if (magSqr > 1e-6 && magSqr <= 1.0)
+                return p.Normalize();
+        }
+    }
+
+    // Periodic wave in place of a sine, its period is 2 rather than 2 pi. Two parabolas meeting at 0 and +-1, as
+    // smooth as the normals need, within 6% of sin(pi x).
+    static float Wave(float x, float& slope)
+    {
+        x -= 2.0f * std::floor((x + 1.0f) / 2.0f); // Into [-1, 1)
+        const float a = std::abs(x);
+        slope = 4.0f - 8.0f * a;
+        return 4.0f * x * (1.0f - a);
+    }
+
+
+    // count spheres with centers between lo and hi and radii between minRadius and maxRadius, as one mesh with
+    // normals. They can overlap.
+    void Spheres(unsigned int count, const Vec3& lo, const Vec3& hi, float minRadius, float maxRadius, Mesh& mesh)
+    {
+        Mesh unit;
+        UnitSphere(unit);
+
+        const size_t vertices = unit.VertexCount();
+        mesh.positions.reserve(mesh.positions.size() + count * vertices * 3);
+        mesh.normals.reserve(mesh.normals.size() + count * vertices * 3);
+        mesh.indices.reserve(mesh.indices.size() + count * unit.indices.size());
+
+        for (unsigned int s = 0; s < count; s++)
+        {
+            const float
+                x = Random((float)lo.x, (float)hi.x),
+                y = Random((float)lo.y, (float)hi.y),
+                z = Random((float)lo.z, (float)hi.z),
+                radius = Random(minRadius, maxRadius);
+
+            const uint32_t base = (uint32_t)mesh.VertexCount();
+            for (size_t v = 0; v < vertices; v++)
+            {
+                const float* n = &unit.positions[v*3];
+                mesh.positions.insert(mesh.positions.end(), { x + n[0] * radius, y + n[1] * radius, z + n[2] * radius });
+                mesh.normals.insert(mesh.normals.end(), { n[0], n[1], n[2] });
+            }
+            for (uint32_t i : unit.indices)
+                mesh.indices.push_back(base + i);
+        }
+    }
+
+    // Height field of about triangles triangles over a size by size square centered on center, facing up. Its height
+    // is a sum of a few waves with random directions and phases, at most height above or below the center.
+    void Surface(size_t triangles, const Vec3& center, float size, float height, Mesh& mesh)
+    {
+        constexpr int WAVES = 6;
+
+        const unsigned int cells = SurfaceCells(triangles);
+        const float step = size / cells;
+
+        // Directions from points in the unit disc, frequencies are in periods of Wave over the size
+        struct Component { float dx, dz, frequency, phase, amplitude; };
+        Component waves[WAVES];
+        for (int w = 0; w < WAVES; w++)
+        {
+            float dx, dz, length;
+            do
+            {
+                dx = Random(-1.0f, 1.0f);
+                dz = Random(-1.0f, 1.0f);
+                length = std::sqrt(dx * dx + dz * dz);
+            } while (length <= 1e-3f || length > 1.0f);
+
+            waves[w] = { dx / length, dz / length, Random(1.0f, 6.0f) * 2.0f / size, Random(-1.0f, 1.0f), height / WAVES * Random(0.5f, 1.0f) };
+        }
+
+        const uint32_t base = (uint32_t)mesh.VertexCount();
+        for (unsigned int j = 0; j <= cells; j++)
+            for (unsigned int i = 0; i <= cells; i++)
+            {
+                const float
+                    u = i * step - size / 2.0f,
+                    v = j * step - size / 2.0f;
+
+                // Height and its slopes along x and z
+                float y = 0.0f, dydx = 0.0f, dydz = 0.0f;
+                for (const Component& w : waves)
+                {
+                    float slope;
+                    y += w.amplitude * Wave((u * w.dx + v * w.dz) * w.frequency + w.phase, slope);
+                    dydx += w.amplitude * w.frequency * w.dx * slope;
+                    dydz += w.amplitude * w.frequency * w.dz * slope;
+                }
+
+                const Vec3 n = Vec3(-(double)dydx, 1.0, -(double)dydz).Normalize();
+                mesh.positions.insert(mesh.positions.end(), { (float)center.x + u, (float)center.y + y, (float)center.z + v });
+                mesh.normals.insert(mesh.normals.end(), { (float)n.x, (float)n.y, (float)n.z });
+            }
+
+        const uint32_t row = cells + 1;
+        for (unsigned int j = 0; j < cells; j++)
+            for (unsigned int i = 0; i < cells; i++)
+            {
+                const uint32_t a = base + j * row + i, b = a + 1, c = a + row, d = c + 1;
+                mesh.indices.insert(mesh.indices.end(), { a, c, b, b, c, d });
+            }
+    }
+
+    // columns by rows boxes on a grid spacing apart around center, each size across at most and turned at random.
+    // OBB values of the scene format per box.
+    void Boxes(unsigned int columns, unsigned int rows, const Vec3& center, float spacing, float size, std::vector<float>& obbs)
+    {
+        for (unsigned int r = 0; r < rows; r++)
+            for (unsigned int c = 0; c < columns; c++)
+            {
+                const Vec3
+                    p = center + Vec3((c - (columns - 1) / 2.0) * spacing, 0.0, (r - (rows - 1) / 2.0) * spacing),
+                    x = RandomAxis(),
+                    y = x.Cross(RandomAxis()).Normalize(),
+                    z = x.Cross(y);
+
+                const float half[3] = { Random(0.25f, 0.5f) * size, Random(0.25f, 0.5f) * size, Random(0.25f, 0.5f) * size };
+                for (const Vec3& v : { p, Vec3(half[0], half[1], half[2]), x, y, z })
+                    obbs.insert(obbs.end(), { (float)v.x, (float)v.y, (float)v.z });
+            }
+    }
+
+    // count spheres of the same radius with centers between lo and hi, Sphere values of the scene format per light
+    void Lights(unsigned int count, const Vec3& lo, const Vec3& hi, float radius, std::vector<float>& spheres)
+    {
+        for (unsigned int l = 0; l < count; l++)
+        {
+            const float
+                x = Random((float)lo.x, (float)hi.x),
+                y = Random((float)lo.y, (float)hi.y),
+                z = Random((float)lo.z, (float)hi.z);
+            spheres.insert(spheres.end(), { x, y, z, radius });
+        }
+    }
+
+
+private:
+    // Subdivided icosahedron of radius 1, so positions double as normals
+    static void UnitSphere(Mesh& mesh)
+    {
+        const float t = (1.0f + std::sqrt(5.0f)) / 2.0f;
+        const float corners[12][3] = {
+            { -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+            { 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+            { t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 }
+        };
+        for (const auto& c : corners)
+            AddUnit(mesh, Vec3(c[0], c[1], c[2]));
+
+        mesh.indices = {
+            0, 11, 5,   0, 5, 1,    0, 1, 7,    0, 7, 10,   0, 10, 11,
+            1, 5, 9,    5, 11, 4,   11, 10, 2,  10, 7, 6,   7, 1, 8,
+            3, 9, 4,    3, 4, 2,    3, 2, 6,    3, 6, 8,    3, 8, 9,
+            4, 9, 5,    2, 4, 11,   6, 2, 10,   8, 6, 7,    9, 8, 1
+        };
+
+        // Every triangle into four, through the midpoints of its edges
+        for (int s = 0; s < SPHERE_SUBDIVISIONS; s++)
+        {
+            std::vector<uint32_t> split;
+            std::vector<std::pair<uint64_t, uint32_t>> midpoints;
+
+            auto Midpoint = [&](uint32_t a, uint32_t b) {
+                const uint64_t key = ((uint64_t)std::min(a, b) << 32) | std::max(a, b);
+                for (const auto& [k, v] : midpoints)
+                    if (k == key)
+                        return v;
+
+                const float* pa = &mesh.positions[a*3];
+                const float* pb = &mesh.positions[b*3];
+                midpoints.emplace_back(key, (uint32_t)mesh.VertexCount());
+                AddUnit(mesh, Vec3(pa[0] + pb[0], pa[1] + pb[1], pa[2] + pb[2]));
+                return midpoints.back().second;
+            };
+
+            for (size_t i = 0; i < mesh.indices.size(); i += 3)
+            {
+                const uint32_t a = mesh.indices[i], b = mesh.indices[i + 1], c = mesh.indices[i + 2];
+                const uint32_t ab = Midpoint(a, b), bc = Midpoint(b, c), ca = Midpoint(c, a);
+                split.insert(split.end(), { a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca });
+            }
+            mesh.indices = std::move(split);
+        }
+    }
+
+    static void AddUnit(Mesh& mesh, Vec3 p)
+    {
+        const Vec3 n = p.Normalize();
+        mesh.positions.insert(mesh.positions.end(), { (float)n.x, (float)n.y, (float)n.z });
+    }
+};
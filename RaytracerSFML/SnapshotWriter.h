@@ -0,0 +1,214 @@
+#pragma once
+
+#include "AOV.h"
+#include "HDRImage.h"
+#include "Trace.h"
+
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <string>
+#include <format>
+#include <charconv>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <cstdint>
+
+#include <SFML/Graphics/Image.hpp>
+
+
+// Fixed capacity queue for exactly one producer and one consumer thread, neither ever takes a lock
+template <typename T, size_t Capacity>
+struct SPSCQueue
+{
+    // Fails when full
+    bool Push(T&& item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        slots[t % Capacity] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Fails when empty
+    bool Pop(T& item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+
+        item = std::move(slots[h % Capacity]);
+        head.store(h + 1, std::memory_order_release);
+        head.notify_one();
+        return true;
+    }
+
+    // Blocks the producer until the consumer has taken something
+    void WaitForSpace()
+    {
+        size_t h = head.load(std::memory_order_acquire);
+        if (tail.load(std::memory_order_relaxed) - h == Capacity)
+            head.wait(h);
+    }
+
+private:
+    std::atomic<size_t> head = 0, tail = 0; // Ever increasing, wrapped on access
+    T slots[Capacity];
+};
+
+
+struct Snapshot
+{
+    sf::Image image;
+    bool opaque = false; // Alpha is replaced with 255 before saving
+
+    std::vector<float> linear;          // Unclamped rgb per pixel, saved in floatFormat when set
+    std::string floatFormat = ".pfm";   // Also used for the AOVs
+
+    int aovOutputs = 0;
+    std::unique_ptr<AOVBuffers> aov; // Only set with aovOutputs
+
+    std::string baseName; // Assigned by SnapshotWriter
+};
+
+// Saves snapshots as "<directory>/Snapshot <n>.png" on a background thread, so encoding doesn't stall rendering.
+// The next free index is looked up once and counted from there.
+struct SnapshotWriter
+{
+    static constexpr size_t QUEUE_SIZE = 8;
+
+
+    explicit SnapshotWriter(const std::string& directory = "Snapshots") :
+        directory(directory), thread([this] { Run(); })
+    {}
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    // Writes everything still queued before returning
+    ~SnapshotWriter()
+    {
+        stopping.store(true);
+        Wake();
+        thread.join();
+    }
+
+
+    // Returns the snapshot's file name without extension, only waits if the queue is full
+    std::string Push(Snapshot&& snapshot)
+    {
+        if (nextIndex < 0)
+            nextIndex = FirstFreeIndex(directory);
+
+        snapshot.baseName = std::format("{}/Snapshot {}", directory, nextIndex++);
+        std::string baseName = snapshot.baseName;
+
+        while (!queue.Push(std::move(snapshot)))
+            queue.WaitForSpace();
+
+        Wake();
+        return baseName;
+    }
+
+    // One past the highest snapshot index in the directory, which only has to be listed once
+    static int FirstFreeIndex(const std::string& directory)
+    {
+        const std::string_view prefix = "Snapshot ";
+        int next = 0;
+
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, ec))
+        {
+            std::string name = entry.path().stem().string();
+            if (!name.starts_with(prefix))
+                continue;
+
+            int index;
+            auto [ptr, err] = std::from_chars(name.data() + prefix.size(), name.data() + name.size(), index);
+            if (err == std::errc() && ptr == name.data() + name.size())
+                next = std::max(next, index + 1);
+        }
+        return next;
+    }
+
+
+private:
+    std::string directory;
+    int nextIndex = -1;
+
+    SPSCQueue<Snapshot, QUEUE_SIZE> queue;
+    std::atomic<uint32_t> signal = 0; // Bumped to wake the writer
+    std::atomic<bool> stopping = false;
+    std::thread thread;
+
+
+    void Wake()
+    {
+        signal.fetch_add(1, std::memory_order_release);
+        signal.notify_one();
+    }
+
+    void Run()
+    {
+        trace.NameThread("Snapshot writer");
+
+        Snapshot snapshot;
+        while (true)
+        {
+            // Read before checking the queue, so a push in between still wakes the wait
+            uint32_t seen = signal.load(std::memory_order_acquire);
+
+            if (queue.Pop(snapshot))
+            {
+                TraceScope scope("Save snapshot");
+                Write(snapshot);
+                snapshot = Snapshot();
+                continue;
+            }
+
+            if (stopping.load())
+                break;
+
+            signal.wait(seen);
+        }
+    }
+
+    static void Write(Snapshot& snapshot)
+    {
+        if (snapshot.opaque)
+        {
+            sf::Vector2u size = snapshot.image.getSize();
+            for (unsigned int y = 0; y < size.y; y++)
+                for (unsigned int x = 0; x < size.x; x++)
+                {
+                    sf::Color c = snapshot.image.getPixel(x, y);
+                    c.a = 255;
+                    snapshot.image.setPixel(x, y, c);
+                }
+        }
+
+        if (!snapshot.image.saveToFile(snapshot.baseName + ".png"))
+            std::cout << "Saving Failed!";
+
+        if (!snapshot.linear.empty())
+        {
+            sf::Vector2u size = snapshot.image.getSize();
+
+            HDRWriter writer;
+            bool saved = writer.Open(snapshot.baseName + snapshot.floatFormat, size.x, size.y, 3);
+            for (unsigned int y = 0; saved && y < size.y; y++)
+                saved &= writer.WriteRow(y, &snapshot.linear[(size_t)y * size.x * 3]);
+
+            if (!writer.Close() || !saved)
+                std::cout << "Saving " << snapshot.floatFormat << " Failed!";
+        }
+
+        if (snapshot.aov && !snapshot.aov->Save(snapshot.baseName, snapshot.aovOutputs, snapshot.floatFormat))
+            std::cout << "Saving AOVs Failed!";
+    }
+};
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <ostream>
+#include <format>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+
+
+// Timings of named phases on any thread, written as Chrome trace_event JSON to open in chrome://tracing or
+// ui.perfetto.dev. Events go into a fixed ring, so tracing can stay on for any length of time and keeps the latest ones.
+// Recording takes a lock, which is fine for phases of a frame but too much for anything done per pixel or ray.
+struct TraceEvent
+{
+    const char* name;          // Never copied, has to outlive the trace, like a string literal
+    int64_t start, duration;   // Nanoseconds, start from when the buffer was made
+    uint32_t thread, frame;
+};
+
+struct TraceBuffer
+{
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t CAPACITY = 65536; // Events kept, a frame of the render loop takes about a dozen
+
+    std::atomic<bool> enabled = false;
+    std::atomic<uint32_t> frame = 0; // Tagged onto every event, counted by whoever owns the frames
+
+
+    // Clears the buffer and starts recording
+    void Start()
+    {
+        std::lock_guard lock(mutex);
+        events.resize(CAPACITY);
+        next = 0;
+        enabled.store(true);
+    }
+
+    void Stop()
+    {
+        enabled.store(false);
+    }
+
+    void Record(const char* name, Clock::time_point start, Clock::time_point end)
+    {
+        TraceEvent e = { name, Nanoseconds(start), Nanoseconds(end) - Nanoseconds(start), ThreadIndex(), frame.load(std::memory_order_relaxed) };
+
+        std::lock_guard lock(mutex);
+        if (events.empty())
+            return;
+        events[next % CAPACITY] = e;
+        next++;
+    }
+
+    // Shown as the thread's name in the viewer, names the calling thread
+    void NameThread(const std::string& name)
+    {
+        std::lock_guard lock(mutex);
+        const uint32_t thread = ThreadIndex();
+        if (threadNames.size() <= thread)
+            threadNames.resize(thread + 1);
+        threadNames[thread] = name;
+    }
+
+    size_t Count()
+    {
+        std::lock_guard lock(mutex);
+        return std::min(next, CAPACITY);
+    }
+
+    // Writes the recorded events oldest first, complete events with times in microseconds
+    bool Save(const std::string& filename)
+    {
+        std::vector<TraceEvent> saved;
+        std::vector<std::string> names;
+        {
+            std::lock_guard lock(mutex);
+            const size_t count = std::min(next, CAPACITY);
+            saved.reserve(count);
+            for (size_t i = next - count; i < next; i++)
+                saved.push_back(events[i % CAPACITY]);
+            names = threadNames;
+        }
+
+        std::ofstream file(filename, std::ios::binary);
+        if (!file)
+            return false;
+
+        std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        for (uint32_t t = 0; t < names.size(); t++)
+            if (!names[t].empty())
+                out += std::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}},\n", t, names[t]);
+
+        for (size_t i = 0; i < saved.size(); i++)
+        {
+            const TraceEvent& e = saved[i];
+            out += std::format("{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f},\"args\":{{\"frame\":{}}}}}{}\n",
+                e.name, e.thread, e.start / 1000.0, e.duration / 1000.0, e.frame, i + 1 < saved.size() ? "," : "");
+
+            if (out.size() > (1 << 20))
+            {
+                file << out;
+                out.clear();
+            }
+        }
+        out += "]}\n";
+
+        file << out;
+        return (bool)file.flush();
+    }
+
+    // Small per thread numbers in the order threads first record something
+    static uint32_t ThreadIndex()
+    {
+        static std::atomic<uint32_t> threads = 0;
+        thread_local const uint32_t index = threads.fetch_add(1);
+        return index;
+    }
+
+
+private:
+    const Clock::time_point origin = Clock::now();
+
+    std::mutex mutex;
+    std::vector<TraceEvent> events; // Ring of CAPACITY once started
+    size_t next = 0;                // Events ever recorded since Start
+    std::vector<std::string> threadNames;
+
+    int64_t Nanoseconds(Clock::time_point t) const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t - origin).count();
+    }
+};
+
+// The process-wide trace, so anything can be timed without having the buffer passed to it
+inline TraceBuffer trace;
+
+
+// Times from construction to destruction, does nothing while tracing is off
+struct TraceScope
+{
+    explicit TraceScope(const char* name) :
+        name(trace.enabled.load(std::memory_order_relaxed) ? name : nullptr)
+    {
+        if (this->name != nullptr)
+            start = TraceBuffer::Clock::now();
+    }
+
+    ~TraceScope()
+    {
+        if (name != nullptr)
+            trace.Record(name, start, TraceBuffer::Clock::now());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    TraceBuffer::Clock::time_point start;
+};
+
+// Back to back phases, each ends where the next begins and the last one when this goes out of scope
+struct TracePhases
+{
+    TracePhases() = default;
+    TracePhases(const TracePhases&) = delete;
+    TracePhases& operator=(const TracePhases&) = delete;
+
+    ~TracePhases()
+    {
+        End();
+    }
+
+    void Next(const char* phase)
+    {
+        const bool enabled = trace.enabled.load(std::memory_order_relaxed);
+        if (name == nullptr && !enabled)
+            return;
+
+        const TraceBuffer::Clock::time_point now = TraceBuffer::Clock::now();
+        if (name != nullptr)
+            trace.Record(name, start, now);
+
+        name = enabled ? phase : nullptr;
+        start = now;
+    }
+
+    void End()
+    {
+        if (name != nullptr)
+            trace.Record(name, start, TraceBuffer::Clock::now());
+        name = nullptr;
+    }
+
+private:
+    const char* name = nullptr;
+    TraceBuffer::Clock::time_point start;
+};
+
+
+// Traces a command line tool from construction to exit and saves the trace when destroyed, however the tool returns.
+// Does nothing without a file name. Reports the save to out, where the tool prints its progress.
+struct TraceSession
+{
+    TraceSession(const std::string& file, const std::string& threadName, std::ostream& out) :
+        file(file), out(out)
+    {
+        if (file.empty())
+            return;
+        trace.NameThread(threadName);
+        trace.Start();
+    }
+
+    ~TraceSession()
+    {
+        if (file.empty())
+            return;
+        trace.Stop();
+
+        const size_t events = trace.Count();
+        if (trace.Save(file))
+            out << std::format("Saved {} trace events to {}\n", events, file);
+        else
+            out << "Saving trace " << file << " failed\n";
+    }
+
+    TraceSession(const TraceSession&) = delete;
+    TraceSession& operator=(const TraceSession&) = delete;
+
+private:
+    const std::string file;
+    std::ostream& out;
+};
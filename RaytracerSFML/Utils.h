@@ -42,14 +42,6 @@ namespace utils
         return (double)VeryRand(0, UINT_MAX) / ((double)(UINT_MAX));
     }
 
-    unsigned int FirstUnusedSnapshot(unsigned int i)
-    {
-        FILE* file;
-        while (fopen_s(&file, ("Snapshots/Snapshot " + std::to_string(i) + ".png").c_str(), "r") == 0)
-        { fclose(file); i++; }
-        return i;
-    }
-
 
     /*
     struct Vec4
@@ -2,6 +2,14 @@
 #include "Utils.h"
 #include "Vec3.h"
 #include "Graphics.h"
+#include "Cam.h"
+#include "SceneCache.h"
+#include "Renderer.h"
+#include "AOV.h"
+#include "Denoiser.h"
+#include "SnapshotWriter.h"
+#include "Trace.h"
+#include "Memory.h"
 
 #include <SFML/Graphics/Shader.hpp>
 #include <SFML/Graphics.hpp>
@@ -9,58 +17,61 @@
 #include <string>
 #include <format>
 #include <cmath>
+#include <vector>
+#include <filesystem>
 
 
-struct Cam
+int main(int argc, char* argv[])
 {
-    float fov;
-    bool perspective;
-    float speed;
+    if (!sf::Shader::isAvailable())
+        return 1;
 
-    Vec3
-        origin,
-        fwd, right, up;
+    // Snapshots are encoded and saved on a background thread
+    SnapshotWriter snapshots;
 
+    // P starts tracing the phases of every frame and saves the trace when pressed again or on exit
+    trace.NameThread("Render loop");
 
-    Cam(float fov, bool perspective, float speed, const Vec3& origin, const Vec3& fwd) :
-        fov(fov), perspective(perspective), speed(speed), origin(origin), fwd(fwd)
-    {
-        UpdateRotation();
-    }
+    auto SaveTrace = [&]() {
+        trace.Stop();
 
-    void UpdateRotation()
-    {
-        fwd.Normalize();
+        std::error_code ec;
+        std::filesystem::create_directories("Snapshots", ec);
 
-        right = fwd.Cross({ 0, -1, 0 });
-        right.Normalize();
+        std::string traceFile;
+        for (int i = 0; traceFile.empty() || std::filesystem::exists(traceFile, ec); i++)
+            traceFile = std::format("Snapshots/Trace {}.json", i);
 
-        up = fwd.Cross(right);
-        up.Normalize();
-    }
-};
+        size_t events = trace.Count();
+        if (trace.Save(traceFile))
+            std::cout << std::format("Saved {} events to {}\n", events, traceFile);
+        else
+            std::cout << "Saving " << traceFile << " Failed!\n";
+    };
 
+    
+    // Build Scene, every scene file given on the command line can be switched to with PageUp / PageDown
+    std::vector<std::string> sceneFiles(argv + 1, argv + argc);
+    if (sceneFiles.empty())
+        sceneFiles.push_back("Scenes/Default.scene");
 
-int main()
-{
-    if (!sf::Shader::isAvailable())
-        return 1;
+    size_t sceneIndex = 0;
+    CachedScene scene;
+    std::string sceneError;
 
-    unsigned int nextSnapshot = 0;
+    if (!scene.Load(sceneFiles[sceneIndex], sceneError))
+    {
+        std::cout << sceneError << "\n";
+        return 1;
+    }
 
-    
-    // Build Scene
-    Cam cam(
-        75.0f, true, 5.0f,
-        Vec3(0.0, 5.0, -10.0),
-        Vec3(0.0, -0.531709431, 1.0).Normalize()
-    );
+    Cam cam = scene.view.cam;
 
 
-    // Render Scene
+    // Render Scene, the resolution comes from the first scene
     const unsigned int 
-        w = /*80,*/ /*160,*/ /*320,*/ /*640,*/ /*960,*/ 1280, /*1920,*/
-        h = /*45,*/ /*90, */ /*180,*/ /*360,*/ /*540,*/ 720,  /*1080,*/
+        w = scene.view.settings.width,
+        h = scene.view.settings.height,
         dim = w * h;
 
     sf::RenderWindow window(
@@ -78,7 +89,7 @@ int main()
         scaleH = (double)sH / (double)h;
 
     Color* render = new Color[dim];
-    for (int i = 0; i < dim; i++)
+    for (unsigned int i = 0; i < dim; i++)
         render[i] = Color();
 
 
@@ -96,6 +107,92 @@ int main()
     displaySprite.setScale((float)scaleW, (float)scaleH);
     shader.loadFromFile("RaytracerShader.frag", sf::Shader::Type::Fragment);
 
+    // Every image, texture and render target charges what its size takes, the textures loaded from images once they are
+    MemoryCharge
+        renderImgMemory(MEMORY_FRAMEBUFFERS, MemoryCharge::OfTexels(renderImg)),
+        displayImgMemory(MEMORY_FRAMEBUFFERS, MemoryCharge::OfTexels(displayImg)),
+        renderTexMemory(MEMORY_FRAMEBUFFERS, MemoryCharge::OfTexels(renderTex)),
+        texMemory(MEMORY_FRAMEBUFFERS),
+        displayTexMemory(MEMORY_FRAMEBUFFERS);
+
+
+    // Reduced resolution used while the camera is moving, upscaled bilinearly for display
+    const unsigned int
+        motionDownscale = 3,
+        motionW = w / motionDownscale,
+        motionH = h / motionDownscale;
+
+    const double motionSettleTime = 0.1;
+
+    sf::RenderTexture motionTex;
+    sf::Sprite motionSprite;
+
+    motionTex.create(motionW, motionH);
+    motionTex.setView(sf::View(sf::FloatRect(0.0f, 0.0f, (float)w, (float)h)));
+    motionTex.setSmooth(true);
+    motionSprite.setTexture(motionTex.getTexture(), true);
+    motionSprite.setScale((float)sW / (float)motionW, (float)sH / (float)motionH);
+
+    const MemoryCharge motionMemory(MEMORY_FRAMEBUFFERS, MemoryCharge::OfTexels(motionTex));
+
+
+    // Previous accumulation and its first-hit depth & normals, used to reproject samples when the camera moves
+    const int maxHistory = 32;
+
+    sf::RenderTexture historyTex, hitTex;
+    bool hitBufferValid = false;
+
+    historyTex.create(w, h);
+    historyTex.setSmooth(true);
+    hitTex.create(w, h);
+
+    const MemoryCharge
+        historyMemory(MEMORY_FRAMEBUFFERS, MemoryCharge::OfTexels(historyTex)),
+        hitMemory(MEMORY_FRAMEBUFFERS, MemoryCharge::OfTexels(hitTex));
+
+
+    // Primitive hit by each pixel's primary ray, reused by every frame while the view is static and unjittered
+    sf::RenderTexture primaryTex;
+    bool primaryCacheValid = false;
+
+    primaryTex.create(w, h);
+    const MemoryCharge primaryMemory(MEMORY_FRAMEBUFFERS, MemoryCharge::OfTexels(primaryTex));
+
+
+    // Auxiliary outputs, refreshed from their own shader passes whenever the view changes
+    sf::RenderTexture aovTex;
+    sf::Image debugImg;
+    int decodedAOVs = 0, visualizedView = 0;
+
+    AOVBuffers aov(w, h);
+
+    aovTex.create(w, h);
+    debugImg.create(w, h, sf::Color::Black);
+
+    const MemoryCharge
+        aovTexMemory(MEMORY_FRAMEBUFFERS, MemoryCharge::OfTexels(aovTex)),
+        debugImgMemory(MEMORY_FRAMEBUFFERS, MemoryCharge::OfTexels(debugImg));
+
+
+    // Edge-aware denoising of the accumulated image, guided by first-hit albedo, normal and depth
+    sf::Image denoisedImg;
+
+    Denoiser denoiser(w, h);
+    std::vector<float> denoiseBuffer(dim * 3);
+
+    denoisedImg.create(w, h, sf::Color::Black);
+
+    const MemoryCharge
+        denoisedImgMemory(MEMORY_FRAMEBUFFERS, MemoryCharge::OfTexels(denoisedImg)),
+        renderMemory(MEMORY_ACCUMULATION, (size_t)dim * sizeof(Color)),
+        denoiseMemory(MEMORY_SCRATCH, MemoryCharge::Of(denoiseBuffer));
+
+
+    // The scene and its meshes are polled for edits and reloaded in place, only visible changes restart accumulation
+    const double reloadInterval = 0.5;
+    double lastReloadCheck = 0.0;
+    uint64_t sceneStamp = scene.Stamp();
+
 
     sf::Clock clock;
     double lT = 0.0, tT = 0.0, dT = 0.0;
@@ -106,430 +203,61 @@ int main()
     fixed.y /= 2;
 
 
-    bool cumulativeLighting, realRender, randomizeSampleDir, keepConstant, giveControl, disableLighting, viewBounds;
+    bool cumulativeLighting, realRender, randomizeSampleDir, keepConstant, giveControl, disableLighting, viewBounds, dynamicResolution, temporalReprojection, denoise;
     unsigned int perPixelSamples, maxBounces;
-
-    {
-        keepConstant = false;
-        giveControl = true;
-        cam.fov = 65.0f;
-
-        cumulativeLighting = true;
-        realRender = false;
-        randomizeSampleDir = true;
-        disableLighting = false;
-        viewBounds = false;
-        perPixelSamples = 16;
-        maxBounces = 8;
-	}
+    int aovOutputs, debugView;
+    std::string floatFormat; // ".pfm" or ".exr" to save the linear render alongside snapshots, empty for none
+
+    keepConstant = false;
+    giveControl = true;
+    aovOutputs = 0;        // AOVs saved alongside snapshots
+    debugView = 0;         // AOV shown instead of the beauty render, 0 for none
+
+    auto ApplySettings = [&](const RenderSettings& settings) {
+        cumulativeLighting = settings.cumulativeLighting;
+        realRender = settings.realRender;
+        randomizeSampleDir = settings.randomizeSampleDir;
+        disableLighting = settings.disableLighting;
+        viewBounds = settings.viewBounds;
+        dynamicResolution = settings.dynamicResolution;
+        temporalReprojection = settings.temporalReprojection;
+        denoise = settings.denoise;
+        perPixelSamples = settings.samples;
+        maxBounces = settings.maxBounces;
+    };
+    ApplySettings(scene.view.settings);
 
     shader.setUniform("imgW", (int)w);
     shader.setUniform("imgH", (int)h);
     shader.setUniform("samples", (int)perPixelSamples);
     shader.setUniform("maxBounces", (int)maxBounces);
+    shader.setUniform("maxHistory", maxHistory);
+    shader.setUniform("outputMode", OUTPUT_BEAUTY);
 
-	// Send shape data to GPU 
-    {
-        const int matLen = 5;
-
-        // AABBs (MAX 16)
-        { 
-            // Shape:   
-            //      vec3(min x3), vec3(max x3)
-            // Mat:     
-            //      vec4(albedo reflectivity x1, specular reflectivity x1, reflective index x1, unused x1), 
-            //      vec4(albedo x3, opacity x1), 
-            //      vec4(specular x3, opacity x1), 
-            //      vec4(emission x3, opacity x1), 
-            //      vec4(absorption x3, offset x1)
-
-            const std::string shapeName = "aabb";
-
-            int iShape = 0, iMat = 0, iBounds = 0;
-            /*shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-1.0, 2.0, -1.0));
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(1.0, 4.0, 1.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 0.0, 0.0, 0.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 1.0)); // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Absorption
-
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(1.1, 3.2, -2.3));
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(2.4, 3.6, -2.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));   // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 0.0, 0.0, 1.0));   // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));   // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 0.0, 0.0, 0.666)); // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));   // Absorption
-
-
-            shader.setUniform(std::format("{}Bounds[{}]", shapeName, iBounds), sf::Glsl::Vec4(0.7, 3.0, -0.65, 2.75));
-            shader.setUniform(std::format("{}BoundCoverage[{}]", shapeName, iBounds++), iMat / matLen);*/
-
-            /*
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(5.0, 0.0, -7.0));
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(7.0, 2.5, -6.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.75, 0.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.75, 0.75, 1.0, 0.15));  // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(3.0, 3.0, 2.0, 0.0));  // Absorption
-            
-            shader.setUniform(std::format("{}Bounds[{}]", shapeName, iBounds), sf::Glsl::Vec4(6.0, 1.25, -6.5, 2.5));
-            shader.setUniform(std::format("{}BoundCoverage[{}]", shapeName, iBounds++), iMat / matLen);
-            */
-
-
-            // Blender Comparison
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(0.7, 0.2, -0.8));
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(2.3, 1.8, 0.8));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.5, 0.0, riWater, 1.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 0.0));  // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(3.5, 3.5, 0.2, 0.0));  // Absorption
-
-            shader.setUniform(std::format("{}Bounds[{}]", shapeName, iBounds), sf::Glsl::Vec4(1.5, 1.0, 0.0, 1.5));
-            shader.setUniform(std::format("{}BoundCoverage[{}]", shapeName, iBounds++), 1);
-            // Blender Comparison
-
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-25.0, 0.0, -20.0));
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(25.0, 15.0, -18.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.5, 0.2, riGlass, 1.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 0.0, 1.0));  // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 0.1));  // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Absorption
-
-            shader.setUniform(std::format("{}Bounds[{}]", shapeName, iBounds), sf::Glsl::Vec4(0.0, 7.5, -19.0, 28.0));
-            shader.setUniform(std::format("{}BoundCoverage[{}]", shapeName, iBounds++), 1);
-
-
-            shader.setUniform(std::format("{}Count", shapeName), iMat / matLen);
-        }
-        
-        // OBBs (MAX 16)
-        { 
-            // Shape:   
-            //      vec3(center x3), vec3(halfLength x3), vec3(x-axis x3), vec3(y-axis x3), vec3(z-axis x3)
-            // Mat:     
-            //      vec4(albedo reflectivity x1, specular reflectivity x1, reflective index x1, unused x1), 
-            //      vec4(albedo x3, opacity x1), 
-            //      vec4(specular x3, opacity x1), 
-            //      vec4(emission x3, opacity x1), 
-            //      vec4(absorption x3, offset x1)
-
-            const std::string shapeName = "obb";
-
-            int iShape = 0, iMat = 0, iBounds = 0;
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(0.0, 3.0, -6.0));
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(2.0, 1.33, 1.75));
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), Vec3(6.0, 4.0, -2.0).Normalize().ToShader());
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), Vec3(-0.01965655, -0.384051845, -0.92310227).Normalize().ToShader());
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), Vec3(-0.5970381, 0.73607948, -0.3189553).Normalize().ToShader());
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 1.5, 0.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 0.0)); // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 0.0, 1.0, 0.0)); // Absorption
-
-
-            shader.setUniform(std::format("{}Bounds[{}]", shapeName, iBounds), sf::Glsl::Vec4(0.0, 3.0, -6.0, 3.5));
-            shader.setUniform(std::format("{}BoundCoverage[{}]", shapeName, iBounds++), iMat / matLen);
-
-            shader.setUniform(std::format("{}Count", shapeName), iMat / matLen);
-        }
-
-        // Spheres (MAX 16)
-        {
-            // Shape:   
-            //      vec4(pos x3, rad x1)
-            // Mat:     
-            //      vec4(albedo reflectivity x1, specular reflectivity x1, reflective index x1, unused x1), 
-            //      vec4(albedo x3, opacity x1), 
-            //      vec4(specular x3, opacity x1), 
-            //      vec4(emission x3, opacity x1), 
-            //      vec4(absorption x3, offset x1)
-
-            const std::string shapeName = "sphere";
-
-            int iShape = 0, iMat = 0, iBounds = 0;
-            /*shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec4(1.0, 3.0, 0.0, 3.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, riGlass, 0.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 0.0));     // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 1.0));     // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));     // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));     // Absorption
-
-            shader.setUniform(std::format("{}Bounds[{}]", shapeName, iBounds), sf::Glsl::Vec4(1.0, 3.0, 0.0, 3.0));
-            shader.setUniform(std::format("{}BoundCoverage[{}]", shapeName, iBounds++), 1);
-
-
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec4(7.25, 1.0, 6.0, 1.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.25, 0.9, 1.0, 0.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 0.0, 0.0, 1.0));  // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 0.25)); // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Absorption
-
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec4(5.25, 1.0, 6.5, 1.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.25, 0.9, 1.0, 0.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 1.0, 0.0, 1.0));  // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 0.25)); // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Absorption
-
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec4(5.75, 1.0, 4.5, 1.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.25, 0.9, 1.0, 0.0));  // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 1.0, 1.0));  // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 0.25)); // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Absorption
-
-            shader.setUniform(std::format("{}Bounds[{}]", shapeName, iBounds), sf::Glsl::Vec4(6.1007, 1.0095, 5.6512, 2.21));
-            shader.setUniform(std::format("{}BoundCoverage[{}]", shapeName, iBounds++), 3);
-
-
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec4(12.0, 1.1, 0.0, 1.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 1.2, 0.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 0.0, 0.0)); // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 1.0, 1.0)); // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Absorption
-
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec4(14.0, 1.1, 0.0, 1.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 1.2, 0.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 1.0, 1.0, 0.0)); // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 0.0, 0.0, 1.0)); // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Absorption
-
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec4(13.0, 1.5, 1.73205, 1.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 1.2, 0.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 0.0, 1.0, 0.0)); // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 1.0, 0.0, 1.0)); // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Absorption
-
-            shader.setUniform(std::format("{}Bounds[{}]", shapeName, iBounds), sf::Glsl::Vec4(13.00456, 1.2383, 0.59414, 2.185));
-            shader.setUniform(std::format("{}BoundCoverage[{}]", shapeName, iBounds++), 3);*/
-
-            /*shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec4(12.0, 12.5, 7.0, 6.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 1.0, 0.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 1.0)); // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 6.0)); // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Absorption
-
-            shader.setUniform(std::format("{}Bounds[{}]", shapeName, iBounds), sf::Glsl::Vec4(12.0, 12.5, 7.0, 6.0));
-            shader.setUniform(std::format("{}BoundCoverage[{}]", shapeName, iBounds++), 1);*/
-
-            /*shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec4(2.5, 1.5, -7.0, 1.5));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, riAir, 0.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 0.25));  // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 0.5));   // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));   // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 0.333, 0.0)); // Absorption
-            */
-
-            // Blender Comparison
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec4(-1.5, 1.0, 0.0, 1.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.8, riWater, 1.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 0.05, 0.05, 0.2));  // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 0.2));  // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.1, 1.0, 1.0, 0.0));  // Absorption
-
-            shader.setUniform(std::format("{}Bounds[{}]", shapeName, iBounds), sf::Glsl::Vec4(-1.5, 1.0, 0.0, 1.1));
-            shader.setUniform(std::format("{}BoundCoverage[{}]", shapeName, iBounds++), 1);
-
-
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec4(0.0, 4.0, 5.0, 1.75));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 1.0, 1.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 1.0));  // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 100.0));  // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Absorption
-
-            shader.setUniform(std::format("{}Bounds[{}]", shapeName, iBounds), sf::Glsl::Vec4(0.0, 4.0, 5.0, 1.8));
-            shader.setUniform(std::format("{}BoundCoverage[{}]", shapeName, iBounds++), 1);
-            // Blender Comparison
-
-
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec4(-15.0, 5.0, 3.0, 5.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, riGlass, 1.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 0.0));  // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 0.0));  // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Absorption
-
-            shader.setUniform(std::format("{}Bounds[{}]", shapeName, iBounds), sf::Glsl::Vec4(-15.0, 5.0, 3.0, 5.1));
-            shader.setUniform(std::format("{}BoundCoverage[{}]", shapeName, iBounds++), 1);
-
-
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec4(-7.0, 3.5, 3.0, 2.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 0.0, riGlass, 1.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 1.0));  // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 0.0));  // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Absorption
-
-            shader.setUniform(std::format("{}Bounds[{}]", shapeName, iBounds), sf::Glsl::Vec4(-7.0, 3.5, 3.0, 2.1));
-            shader.setUniform(std::format("{}BoundCoverage[{}]", shapeName, iBounds++), 1);
-            
-
-            shader.setUniform(std::format("{}Count", shapeName), iMat / matLen);
-        }
-        
-        // Tris (MAX 32)
-        {
-            // Shape:   
-            //      vec3(v1 x3), vec3(v2 x3), vec3(v3 x3)
-            // Mat:     
-            //      vec4(albedo reflectivity x1, specular reflectivity x1, reflective index x1, unused x1), 
-            //      vec4(albedo x3, opacity x1), 
-            //      vec4(specular x3, opacity x1), 
-            //      vec4(emission x3, opacity x1), 
-            //      vec4(absorption x3, offset x1)
-
-            const std::string shapeName = "tri";
-
-            int iShape = 0, iMat = 0, iBounds = 0;
-            /*{
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-3.5, 0.0, -4.5));
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-3.5, 10.0, -4.5));
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-3.5, 0.0, 4.5));
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Surface
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.85, 0.2, 0.1, 1.0)); // Albedo
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Specular
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Emission
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Absorption
-
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-3.5, 0.0, 4.5));
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-3.5, 10.0, -4.5));
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-3.5, 10.0, 4.5));
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Surface
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.85, 0.2, 0.1, 1.0)); // Albedo
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Specular
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Emission
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Absorption
-            }
-
-            {
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-3.5, 0.0, -4.5));
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-3.5, 0.0, 4.5));
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(3.5, 0.0, -4.5));
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Surface
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 1.0)); // Albedo
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Specular
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Emission
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Absorption
-
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(3.5, 0.0, -4.5));
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-3.5, 0.0, 4.5));
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(3.5, 0.0, 4.5));
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Surface
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(1.0, 1.0, 1.0, 1.0)); // Albedo
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Specular
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Emission
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Absorption
-            }
-
-            {
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-3.5, 10.0, 4.5));
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-3.5, 10.0, -4.5));
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(3.5, 10.0, 4.5));
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Surface
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.2, 0.2, 0.9, 1.0)); // Albedo
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Specular
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Emission
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Absorption
-
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(3.5, 10.0, 4.5));
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-3.5, 10.0, -4.5));
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(3.5, 10.0, -4.5));
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Surface
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.2, 0.2, 0.9, 1.0)); // Albedo
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Specular
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Emission
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Absorption
-            }
-
-            {
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(3.5, 0.0, -4.5));
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(3.5, 10.0, -4.5));
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-3.5, 0.0, -4.5));
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Surface
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.2, 0.85, 0.1, 1.0)); // Albedo
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Specular
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Emission
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Absorption
-
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-3.5, 0.0, -4.5));
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(3.5, 10.0, -4.5));
-                shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(-3.5, 10.0, -4.5));
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Surface
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.2, 0.85, 0.1, 1.0)); // Albedo
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Specular
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Emission
-                shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Absorption
-            }
-
-
-            shader.setUniform(std::format("{}Bounds[{}]", shapeName, iBounds), sf::Glsl::Vec4(0.0, 5.0, 0.0, 7.7));
-            shader.setUniform(std::format("{}BoundCoverage[{}]", shapeName, iBounds++), iMat / matLen);*/
-
-            shader.setUniform(std::format("{}Count", shapeName), iMat / matLen);
-        }
-
-        // Planes (MAX 8)
-        {
-            // Shape:   
-            //      vec3(center x3), vec3(normal x3)
-            // Mat:     
-            //      vec4(albedo reflectivity x1, specular reflectivity x1, reflective index x1, unused x1), 
-            //      vec4(albedo x3, opacity x1), 
-            //      vec4(specular x3, opacity x1), 
-            //      vec4(emission x3, opacity x1), 
-            //      vec4(absorption x3, offset x1)
-
-            const std::string shapeName = "plane";
-
-            int iShape = 0, iMat = 0;
-            /*shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(0.0, -0.05, 0.0));
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(0.0, 1.0, 0.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.7, 0.8, 0.65, 1.0)); // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0));  // Absorption*/
-
-
-            // Blender Comparison
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(0.0, 0.0, 0.0));
-            shader.setUniform(std::format("{}Shapes[{}]", shapeName, iShape++), sf::Glsl::Vec3(0.0, 1.0, 0.0));
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 1.0, 1.0)); // Surface
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.9, 1.0, 0.9, 1.0)); // Albedo
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Specular
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Emission
-            shader.setUniform(std::format("{}Mats[{}]", shapeName, iMat++), sf::Glsl::Vec4(0.0, 0.0, 0.0, 0.0)); // Absorption
-            // Blender Comparison
-
-            shader.setUniform(std::format("{}Count", shapeName), iMat / matLen);
-        }
-    }
+    SceneTextures sceneTextures;
+    scene.view.Upload(shader, sceneTextures);
 
     unsigned int 
         cumulativeFrameCount = 0,
         totFrames = 0;
 
+    double lastMoveTime = -motionSettleTime;
+
+    Cam historyCam = cam;
+
     while (window.isOpen())
     {
+        trace.frame.store(totFrames, std::memory_order_relaxed);
+        TraceScope frameScope("Frame");
+        TracePhases phases;
+
         lT = tT;
         tT = clock.getElapsedTime().asSeconds();
         dT = tT - lT;
 
-        bool hasMoved = false;
+        bool hasMoved = false, camMoved = false;
+
+        phases.Next("Events");
 
         sf::Event event;
         while (window.pollEvent(event))
@@ -550,7 +278,7 @@ int main()
                     cam.fov = std::clamp(cam.fov - event.mouseWheelScroll.delta, 0.01f, 179.99f);
                     
                     if (abs(cam.fov - lFov) > 0.000001)
-                        hasMoved = true;
+                        camMoved = true;
                 }
             }
 
@@ -558,18 +286,48 @@ int main()
             {
                 if (event.key.code == sf::Keyboard::Enter)
                 {
-                    sf::Image snapshotImage;
-
-                    if (realRender)
-                        snapshotImage = displayImg;
+                    Snapshot snapshot;
+
+                    if (debugView != 0)
+                        snapshot.image = debugImg;
+                    else if (denoise)
+                        snapshot.image = denoisedImg;
+                    else if (realRender)
+                        snapshot.image = displayImg;
                     else
-                        snapshotImage = renderTex.getTexture().copyToImage();
-
-                    nextSnapshot = utils::FirstUnusedSnapshot(nextSnapshot);
-                    std::string filename = "Snapshots/Snapshot " + std::to_string(nextSnapshot) + ".png";
-
-                    if (!snapshotImage.saveToFile(filename))
-                        std::cout << "Saving Failed!";
+                    {
+                        snapshot.image = renderTex.getTexture().copyToImage();
+                        snapshot.opaque = true; // Alpha holds the per-pixel history length
+                    }
+
+                    if (!floatFormat.empty())
+                    { // Only the CPU accumulation is linear, the shader's is tonemapped to 8 bits
+                        if (realRender && cumulativeFrameCount > 1)
+                        { // The last rendered frame is only added at the start of the next one
+                            double colorsCaptured = cumulativeLighting ? cumulativeFrameCount - 1 : 1.0;
+
+                            snapshot.linear.resize(dim * 3);
+                            for (unsigned int i = 0; i < dim; i++)
+                            {
+                                Color c = render[i] / colorsCaptured;
+                                snapshot.linear[i*3 + 0] = (float)c.r;
+                                snapshot.linear[i*3 + 1] = (float)c.g;
+                                snapshot.linear[i*3 + 2] = (float)c.b;
+                            }
+                        }
+                        else
+                            std::cout << "Float snapshots need real render mode (E)\n";
+
+                        snapshot.floatFormat = floatFormat;
+                    }
+
+                    if (aovOutputs != 0)
+                    {
+                        snapshot.aovOutputs = aovOutputs;
+                        snapshot.aov = std::make_unique<AOVBuffers>(aov);
+                    }
+
+                    snapshots.Push(std::move(snapshot));
                 }
                 else if (event.key.code == sf::Keyboard::L)
                 {
@@ -599,9 +357,117 @@ int main()
                 }
                 else if (event.key.code == sf::Keyboard::V)
                     hasMoved = true;
+                else if (event.key.code == sf::Keyboard::M)
+                {
+                    dynamicResolution = !dynamicResolution;
+                    hasMoved = true;
+                }
+                else if (event.key.code == sf::Keyboard::H)
+                {
+                    temporalReprojection = !temporalReprojection;
+                    hasMoved = true;
+                }
+                else if (event.key.code == sf::Keyboard::N)
+                    denoise = !denoise;
+                else if (event.key.code == sf::Keyboard::P)
+                {
+                    if (trace.enabled)
+                        SaveTrace();
+                    else
+                    {
+                        trace.Start();
+                        std::cout << "Tracing\n";
+                    }
+                }
+                else if (event.key.code == sf::Keyboard::I)
+                    std::cout << "Memory: " << memoryUsage.Summary() << "\n";
+                else if ((event.key.code == sf::Keyboard::PageUp || event.key.code == sf::Keyboard::PageDown) && sceneFiles.size() > 1)
+                {
+                    size_t next = (sceneIndex + (event.key.code == sf::Keyboard::PageUp ? 1 : sceneFiles.size() - 1)) % sceneFiles.size();
+
+                    CachedScene nextScene;
+                    if (nextScene.Load(sceneFiles[next], sceneError))
+                    {
+                        sceneIndex = next;
+                        scene = std::move(nextScene);
+                        scene.view.Upload(shader, sceneTextures);
+                        sceneStamp = scene.Stamp();
+
+                        cam = scene.view.cam;
+                        ApplySettings(scene.view.settings);
+                        shader.setUniform("samples", (int)perPixelSamples);
+                        shader.setUniform("maxBounces", (int)maxBounces);
+
+                        cumulativeFrameCount = 0;
+                        hasMoved = true;
+                    }
+                    else
+                        std::cout << sceneError << "\n";
+                }
+                else if (event.key.code == sf::Keyboard::Tab)
+                { // Cycle through the debug views
+                    debugView = (debugView == 0) ? 1 : (debugView << 1) & AOV_ALL;
+                    std::cout << "View: " << AOVBuffers::Name(debugView) << "\n";
+                }
+                else if (event.key.code == sf::Keyboard::F)
+                { // Cycle the float snapshot format, which AOVs are also saved in
+                    floatFormat = floatFormat.empty() ? ".pfm" : (floatFormat == ".pfm") ? ".exr" : "";
+                    std::cout << "Float snapshots: " << (floatFormat.empty() ? "off" : floatFormat) << "\n";
+                }
+                else if (event.key.code >= sf::Keyboard::F1 && event.key.code < sf::Keyboard::F1 + AOV_COUNT)
+                {
+                    int toggled = 1 << (event.key.code - sf::Keyboard::F1);
+                    aovOutputs ^= toggled;
+                    std::cout << "Save " << AOVBuffers::Name(toggled) << ": " << ((aovOutputs & toggled) ? "on" : "off") << "\n";
+                }
             }
         }
 
+        phases.Next("Scene reload");
+
+        if (tT - lastReloadCheck >= reloadInterval)
+        {
+            lastReloadCheck = tT;
+
+            uint64_t stamp = scene.Stamp();
+            if (stamp != sceneStamp)
+            {
+                sceneStamp = stamp; // Broken edits aren't retried until the files change again
+
+                CachedScene reloaded;
+                if (reloaded.Load(sceneFiles[sceneIndex], sceneError, &scene.view))
+                {
+                    int changes = reloaded.view.Update(shader, sceneTextures, scene.view);
+                    scene = std::move(reloaded);
+                    sceneStamp = scene.Stamp();
+
+                    // The live camera and settings are only replaced when the file's own values changed
+                    if (changes & SCENE_CAM)
+                        cam = scene.view.cam;
+                    if (changes & SCENE_SETTINGS)
+                    { // The resolution stays that of the first scene
+                        ApplySettings(scene.view.settings);
+                        shader.setUniform("samples", (int)perPixelSamples);
+                        shader.setUniform("maxBounces", (int)maxBounces);
+                    }
+                    if (changes & SCENE_VISIBLE)
+                        cumulativeFrameCount = 0;
+                    if (changes)
+                        hasMoved = true;
+
+                    std::string changed;
+                    for (auto [flag, what] : { std::pair(SCENE_CAM, "camera"), { SCENE_SETTINGS, "settings" }, { SCENE_SKY, "sky" }, { SCENE_MATERIALS, "materials" }, { SCENE_GEOMETRY, "geometry" } })
+                        if (changes & flag)
+                            changed += (changed.empty() ? "" : ", ") + std::string(what);
+                    std::cout << "Reloaded " << sceneFiles[sceneIndex] << ": " << (changed.empty() ? "no changes" : changed) << "\n";
+                }
+                else
+                    std::cout << sceneError << "\n";
+            }
+        }
+
+        phases.Next("Camera");
+
         if (sf::Keyboard::isKeyPressed(sf::Keyboard::Escape))
             window.close();
 
@@ -662,16 +528,46 @@ int main()
             cam.UpdateRotation();
 
             if ((camLOrigin - cam.origin).MagSqr() > 0.000001 || (camLFwd - cam.fwd).MagSqr() > 0.000001)
-                hasMoved = true;
+                camMoved = true;
         }
 
+        // Camera movement keeps the accumulated samples by reprojecting them when possible, otherwise it resets
+        bool canReproject = temporalReprojection && cumulativeLighting && !realRender;
+        bool reprojectFrame = canReproject && camMoved && !hasMoved;
+
+        if (camMoved && !reprojectFrame)
+            hasMoved = true;
+
+        if (reprojectFrame)
+            cumulativeFrameCount = 0;
+
+        int requiredAOVs = aovOutputs | debugView | (denoise ? (AOV_DEPTH | AOV_NORMAL | AOV_ALBEDO) : 0);
+        bool needHitBuffer = canReproject || (requiredAOVs & (AOV_DEPTH | AOV_NORMAL));
+
+        if (!needHitBuffer)
+            hitBufferValid = false;
+
+        // Stay at reduced resolution until the camera has settled, then restart full resolution accumulation
+        if (hasMoved)
+            lastMoveTime = tT;
+
+        bool motionRender = dynamicResolution && !canReproject && (tT - lastMoveTime) < motionSettleTime;
+        if (motionRender)
+            hasMoved = true;
+
+        bool usePrimaryCache = !randomizeSampleDir && !motionRender;
+        if (!usePrimaryCache || camMoved || hasMoved)
+            primaryCacheValid = false;
+
+        phases.Next("Accumulation");
+
         if (cumulativeLighting && hasMoved)
         {
             cumulativeFrameCount = 0;
-            renderTex.clear();
+            renderTex.clear(sf::Color::Transparent);
 
             if (realRender)
-                for (int i = 0; i < dim; i++)
+                for (unsigned int i = 0; i < dim; i++)
                 {
                     render[i] = Color();
                     renderImg.setPixel(i%w, i/w, {0, 0, 0, 0});
@@ -680,7 +576,7 @@ int main()
 
         if (realRender && cumulativeFrameCount > 0)
         {
-            for (int i = 0; i < dim; i++)
+            for (unsigned int i = 0; i < dim; i++)
             {
                 unsigned int
                     x = i % w,
@@ -688,8 +584,7 @@ int main()
 
                 double colorsCaptured = cumulativeFrameCount;
 
-                sf::Color sfPix = renderImg.getPixel(x, y);
-                Color pix = sfPix;
+                Color pix = Color::FromRGBE(renderImg.getPixel(x, y));
 
                 if (cumulativeLighting)
                     render[i] = render[i] + pix;
@@ -699,7 +594,7 @@ int main()
                     colorsCaptured = 1.0;
                 }
 
-                Color displayCol = render[i] / colorsCaptured;
+                Color displayCol = (render[i] / colorsCaptured).ACESFilm();
 
                 displayImg.setPixel(x, y, {
                     (uint8_t)(displayCol.r * 255.0),
@@ -710,41 +605,214 @@ int main()
         }
 
 
+        phases.Next("Uniforms");
+
         {
+            shader.setUniform("imgW", (int)(motionRender ? motionW : w));
+            shader.setUniform("imgH", (int)(motionRender ? motionH : h));
             shader.setUniform("rndSeed", keepConstant ? 0 : (int)((long)utils::VeryRand(h * w, 4294967295u) - 2147483647));
 
-            float
-                viewHeight = tanf((cam.fov / 2.0f) * (float)utils::PI / 180.0f) * 2.0f,
-                viewWidth = viewHeight / ((float)h / (float)w);
-
-            shader.setUniform("viewHeight", viewHeight);
-            shader.setUniform("viewWidth", viewWidth);
-
-            shader.setUniform("camPos", cam.origin.ToShader());
-            shader.setUniform("camFwd", cam.fwd.ToShader());
-            shader.setUniform("camUp", cam.up.ToShader());
-            shader.setUniform("camRight", cam.right.ToShader());
+            SetCamUniforms(shader, cam, w, h);
 
             shader.setUniform("viewBounds", viewBounds);
-            shader.setUniform("realRender", realRender);
+            shader.setUniform("realRender", realRender && !motionRender); // Motion frames are shown straight from the shader
             shader.setUniform("disableLighting", disableLighting);
             shader.setUniform("randomizeDir", randomizeSampleDir);
 
-            shader.setUniform("frameCount", cumulativeLighting ? (int)cumulativeFrameCount : 0);
+            shader.setUniform("frameCount", (cumulativeLighting && !motionRender) ? (int)cumulativeFrameCount : 0);
+
+            shader.setUniform("primaryCache", false);
+            shader.setUniform("trackHistory", canReproject);
+            shader.setUniform("reproject", reprojectFrame);
+
+            if (reprojectFrame)
+            {
+                float prevViewHeight = tanf((historyCam.fov / 2.0f) * (float)utils::PI / 180.0f) * 2.0f;
+
+                shader.setUniform("prevViewHeight", prevViewHeight);
+                shader.setUniform("prevViewWidth", prevViewHeight / ((float)h / (float)w));
+
+                shader.setUniform("prevCamPos", historyCam.origin.ToShader());
+                shader.setUniform("prevCamFwd", historyCam.fwd.ToShader());
+                shader.setUniform("prevCamUp", historyCam.up.ToShader());
+                shader.setUniform("prevCamRight", historyCam.right.ToShader());
+            }
         }
 
+        phases.Next("Texture upload");
+
         tex.loadFromImage(renderImg);
         sprite.setTexture(tex);
+        texMemory.Set(MemoryCharge::OfTexels(tex));
+
+        if (motionRender)
+        {
+            phases.Next("Draw");
+
+            shader.setUniform("lastFrame", motionTex.getTexture());
+
+            motionTex.draw(sprite, &shader);
+            motionTex.display();
+
+            phases.Next("Present");
+
+            window.clear();
+            window.draw(motionSprite);
+            window.display();
+
+            hitBufferValid = false;
+            decodedAOVs = 0;
+
+            totFrames++;
+            continue;
+        }
+
+        phases.Next("Draw");
 
-        shader.setUniform("lastFrame", renderTex.getTexture());
+        if (reprojectFrame)
+        { // Reprojection reads other pixels of the previous accumulation, so it can't be sampled while being written to
+            historyTex.clear(sf::Color::Transparent);
+            historyTex.draw(sf::Sprite(renderTex.getTexture()), sf::BlendNone);
+            historyTex.display();
+
+            shader.setUniform("lastFrame", historyTex.getTexture());
+        }
+        else
+            shader.setUniform("lastFrame", renderTex.getTexture());
+
+        shader.setUniform("lastHit", hitTex.getTexture());
+
+        if (usePrimaryCache)
+        {
+            if (!primaryCacheValid)
+            {
+                shader.setUniform("outputMode", OUTPUT_PRIMITIVEID);
+
+                primaryTex.draw(sprite, sf::RenderStates(sf::BlendNone, sf::Transform::Identity, nullptr, &shader));
+                primaryTex.display();
+
+                shader.setUniform("outputMode", OUTPUT_BEAUTY);
+                primaryCacheValid = true;
+            }
+
+            shader.setUniform("primaryCache", true);
+            shader.setUniform("lastPrimary", primaryTex.getTexture());
+        }
 
-        renderTex.draw(sprite, &shader);
+        renderTex.draw(sprite, sf::RenderStates(sf::BlendNone, sf::Transform::Identity, nullptr, &shader));
         renderTex.display();
 
+        bool refreshAOV = camMoved || hasMoved;
+
+        if (needHitBuffer && (refreshAOV || !hitBufferValid))
+        {
+            shader.setUniform("outputMode", OUTPUT_FIRSTHIT);
+
+            hitTex.draw(sprite, sf::RenderStates(sf::BlendNone, sf::Transform::Identity, nullptr, &shader));
+            hitTex.display();
+
+            shader.setUniform("outputMode", OUTPUT_BEAUTY);
+            hitBufferValid = true;
+        }
+
+        if (refreshAOV)
+            decodedAOVs = 0;
+
+        if ((requiredAOVs & ~decodedAOVs) != 0)
+        {
+            phases.Next("AOVs");
+
+            if (requiredAOVs & ~decodedAOVs & (AOV_DEPTH | AOV_NORMAL))
+            {
+                TraceScope readback("Readback");
+                aov.DecodeFirstHit(hitTex.getTexture().copyToImage());
+            }
+
+            for (int i = 0; i < AOV_COUNT; i++)
+            {
+                int output = 1 << i;
+                if (!(requiredAOVs & ~decodedAOVs & output) || AOVBuffers::OutputMode(output) == OUTPUT_FIRSTHIT)
+                    continue;
+
+                shader.setUniform("outputMode", AOVBuffers::OutputMode(output));
+
+                aovTex.draw(sprite, sf::RenderStates(sf::BlendNone, sf::Transform::Identity, nullptr, &shader));
+                aovTex.display();
+
+                TraceScope readback("Readback");
+                aov.Decode(output, aovTex.getTexture().copyToImage());
+            }
+
+            shader.setUniform("outputMode", OUTPUT_BEAUTY);
+
+            decodedAOVs |= requiredAOVs;
+            visualizedView = 0;
+        }
+
+        historyCam = cam;
+
         if (realRender)
         {
+            phases.Next("Readback");
             renderImg = renderTex.getTexture().copyToImage();
+        }
+
+        if (debugView != 0)
+        {
+            if (visualizedView != debugView)
+            {
+                phases.Next("Visualize");
+                aov.Visualize(debugView, debugImg);
+                visualizedView = debugView;
+            }
 
+            phases.Next("Texture upload");
+            displayTex.loadFromImage(debugImg);
+            displaySprite.setTexture(displayTex);
+        }
+        else if (denoise)
+        {
+            phases.Next("Denoise");
+
+            if (realRender)
+            {
+                double colorsCaptured = std::max(1u, cumulativeFrameCount);
+
+                for (unsigned int i = 0; i < dim; i++)
+                {
+                    Color c = (render[i] / colorsCaptured).ACESFilm();
+                    denoiseBuffer[i*3 + 0] = (float)c.r;
+                    denoiseBuffer[i*3 + 1] = (float)c.g;
+                    denoiseBuffer[i*3 + 2] = (float)c.b;
+                }
+            }
+            else
+            {
+                TraceScope readback("Readback");
+                sf::Image accumulated = renderTex.getTexture().copyToImage();
+                const uint8_t* px = accumulated.getPixelsPtr();
+
+                for (unsigned int i = 0; i < dim; i++)
+                    for (int c = 0; c < 3; c++)
+                        denoiseBuffer[i*3 + c] = (float)px[i*4 + c] / 255.0f;
+            }
+
+            denoiser.Denoise(denoiseBuffer.data(), aov, denoiseBuffer.data());
+
+            for (unsigned int i = 0; i < dim; i++)
+                denoisedImg.setPixel(i%w, i/w, {
+                    (uint8_t)(std::clamp(denoiseBuffer[i*3 + 0], 0.0f, 1.0f) * 255.0f),
+                    (uint8_t)(std::clamp(denoiseBuffer[i*3 + 1], 0.0f, 1.0f) * 255.0f),
+                    (uint8_t)(std::clamp(denoiseBuffer[i*3 + 2], 0.0f, 1.0f) * 255.0f)
+                });
+
+            phases.Next("Texture upload");
+            displayTex.loadFromImage(denoisedImg);
+            displaySprite.setTexture(displayTex);
+        }
+        else if (realRender)
+        {
+            phases.Next("Texture upload");
             displayTex.loadFromImage(displayImg);
             displaySprite.setTexture(displayTex);
         }
@@ -752,15 +820,21 @@ int main()
         {
             displaySprite.setTexture(renderTex.getTexture());
         }
-        
+        displayTexMemory.Set(MemoryCharge::OfTexels(displayTex));
+
+        phases.Next("Present");
+
         window.clear();
-        window.draw(displaySprite);
+        window.draw(displaySprite, sf::BlendNone);
         window.display();
 
         cumulativeFrameCount++;
         totFrames++;
     }
 
+    if (trace.enabled)
+        SaveTrace();
+
     delete[] render;
     return 0;
 }